@@ -22,6 +22,11 @@ static BooleanValueConstraint relocate_is_boolean(relocate_owned);
 //set default to true
 static ConfigVariable<bool> send_hash_to_client("send_hash", true, ca_client_config);
 static ConfigVariable<bool> send_version_to_client("send_version", true, ca_client_config);
+static ConfigVariable<unsigned int> write_batch_size("write_batch", 0, ca_client_config);
+
+static ConfigGroup compression_config("compression", ca_client_config);
+static ConfigVariable<string> compression_type("type", "none", compression_config);
+static ConfigVariable<unsigned int> compression_threshold("threshold", 128, compression_config);
 
 static bool is_permission_level(const string& str)
 {
@@ -30,6 +35,13 @@ static bool is_permission_level(const string& str)
 static ConfigConstraint<string> valid_permission_level(is_permission_level, interest_permissions,
         "Permissions for add_interest must be one of 'visible', 'enabled', 'disabled'.");
 
+static bool is_compression_type(const string& str)
+{
+    return (str == "none" || str == "zlib");
+}
+static ConfigConstraint<string> valid_compression_type(is_compression_type, compression_type,
+        "Compression type must be one of 'none', 'zlib'.");
+
 enum InterestPermission {
     INTERESTS_ENABLED,
     INTERESTS_VISIBLE,
@@ -45,6 +57,8 @@ class AstronClient : public Client, public NetworkClient
     bool m_send_hash;
     bool m_send_version;
     InterestPermission m_interests_allowed;
+    bool m_allow_zlib;
+    size_t m_compression_threshold;
 
   public:
     AstronClient(ConfigNode config, ClientAgent* client_agent, tcp::socket *socket) :
@@ -84,6 +98,12 @@ class AstronClient : public Client, public NetworkClient
         m_log->set_name(ss.str());
         set_con_name(ss.str());
 
+        set_write_batching(write_batch_size.get_rval(m_config));
+
+        ConfigNode compression = ca_client_config.get_child_node(compression_config, m_config);
+        m_allow_zlib = compression_type.get_rval(compression) == "zlib";
+        m_compression_threshold = compression_threshold.get_rval(compression);
+
         // Create event for EventLogger
         LoggedEvent event("client-connected");
 
@@ -122,9 +142,18 @@ class AstronClient : public Client, public NetworkClient
         }
     }
 
+    // handle_datagram writes everything sent to the client in response to a server datagram
+    // at once, rather than one message at a time.
+    virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
+    {
+        WriteBatch batch(this);
+        Client::handle_datagram(in_dg, dgi);
+    }
+
     // receive_datagram is the handler for datagrams received over the network from a Client.
     virtual void receive_datagram(DatagramHandle dg)
     {
+        WriteBatch batch(this);
         lock_guard<recursive_mutex> lock(m_client_lock);
         DatagramIterator dgi(dg);
         try {
@@ -176,6 +205,17 @@ class AstronClient : public Client, public NetworkClient
             log_event(event);
         }
 
+        if(is_compressed()) {
+            CompressionStats sent, received;
+            get_compression_stats(sent, received);
+            m_log->info() << "Compression saved " << bytes_saved(sent) << " of "
+                          << sent.datagram_bytes << " bytes sent, and "
+                          << bytes_saved(received) << " of " << received.datagram_bytes
+                          << " bytes received, in "
+                          << chrono::duration_cast<chrono::microseconds>(
+                              sent.time + received.time).count() << "us.\n";
+        }
+
         annihilate();
     }
 
@@ -256,25 +296,30 @@ class AstronClient : public Client, public NetworkClient
     }
 
     // handle_set_field should inform the client that the field has been updated.
+    // The update is the same for every client, so it is only built once per broadcast.
     virtual void handle_set_field(doid_t do_id, uint16_t field_id, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
-        resp->add_uint16(CLIENT_OBJECT_SET_FIELD);
-        resp->add_doid(do_id);
-        resp->add_uint16(field_id);
-        resp->add_data(dgi.read_remainder());
-        send_datagram(resp);
+        send_datagram(translate(dgi, CLIENT_OBJECT_SET_FIELD, [&]() {
+            DatagramPtr resp = Datagram::create();
+            resp->add_uint16(CLIENT_OBJECT_SET_FIELD);
+            resp->add_doid(do_id);
+            resp->add_uint16(field_id);
+            resp->add_data(dgi.read_remainder());
+            return resp;
+        }));
     }
 
     // handle_set_fields should inform the client that a group of fields has been updated.
     virtual void handle_set_fields(doid_t do_id, uint16_t num_fields, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
-        resp->add_uint16(CLIENT_OBJECT_SET_FIELDS);
-        resp->add_doid(do_id);
-        resp->add_uint16(num_fields);
-        resp->add_data(dgi.read_remainder());
-        send_datagram(resp);
+        send_datagram(translate(dgi, CLIENT_OBJECT_SET_FIELDS, [&]() {
+            DatagramPtr resp = Datagram::create();
+            resp->add_uint16(CLIENT_OBJECT_SET_FIELDS);
+            resp->add_doid(do_id);
+            resp->add_uint16(num_fields);
+            resp->add_data(dgi.read_remainder());
+            return resp;
+        }));
     }
 
     // handle_change_location should inform the client that the objects location has changed.
@@ -360,13 +405,38 @@ class AstronClient : public Client, public NetworkClient
             return;
         }
 
+        // Clients which support compression list the algorithms they accept after the version.
+        bool offered_compression = dgi.get_remaining() > 0;
+        uint8_t compression = CLIENT_COMPRESSION_NONE;
+        if(offered_compression) {
+            uint8_t accepted = dgi.read_uint8();
+            if(m_allow_zlib && (accepted & (1 << CLIENT_COMPRESSION_ZLIB))) {
+                compression = CLIENT_COMPRESSION_ZLIB;
+            }
+        }
+
         DatagramPtr resp = Datagram::create();
         resp->add_uint16(CLIENT_HELLO_RESP);
+        if(offered_compression) {
+            resp->add_uint8(compression);
+        }
         send_datagram(resp);
 
+        // Everything after the CLIENT_HELLO_RESP is compressed, in both directions.
+        if(compression == CLIENT_COMPRESSION_ZLIB) {
+            set_compression(m_compression_threshold);
+        }
+
         m_state = CLIENT_STATE_ANONYMOUS;
     }
 
+    // bytes_saved returns how many fewer bytes compression put on the network, which is
+    // negative if the flag preceding each datagram cost more than compression saved.
+    static int64_t bytes_saved(const CompressionStats &stats)
+    {
+        return int64_t(stats.datagram_bytes) - int64_t(stats.network_bytes);
+    }
+
     // Client has sent "CLIENT_HELLO" and can now access anonymous uberdogs.
     virtual void handle_pre_auth(DatagramIterator &dgi)
     {
@@ -458,7 +528,8 @@ class AstronClient : public Client, public NetworkClient
         // If the client is not in the ESTABLISHED state, it may only send updates
         // to anonymous UberDOGs.
         if(m_state != CLIENT_STATE_ESTABLISHED) {
-            if(g_uberdogs.find(do_id) == g_uberdogs.end() || !g_uberdogs[do_id].anonymous) {
+            auto uberdog = g_uberdogs.find(do_id);
+            if(uberdog == g_uberdogs.end() || !uberdog->second.anonymous) {
                 stringstream ss;
                 ss << "Client tried to send update to non-anonymous object "
                    << dcc->get_name() << "(" << do_id << ")";
@@ -478,7 +549,7 @@ class AstronClient : public Client, public NetworkClient
         }
 
         // Check that the client is actually allowed to send updates to this field
-        bool is_owned = m_owned_objects.find(do_id) != m_owned_objects.end();
+        bool is_owned = has_object(do_id, ObjectRecord::OWNED);
         if(!field->has_keyword("clsend") && !(is_owned && field->has_keyword("ownsend"))) {
             auto send_it = m_fields_sendable.find(do_id);
             if(send_it == m_fields_sendable.end() ||
@@ -518,7 +589,7 @@ class AstronClient : public Client, public NetworkClient
         }
         // Check that the object the client is trying manipulate actually exists
         doid_t do_id = dgi.read_doid();
-        if(m_visible_objects.find(do_id) == m_visible_objects.end()) {
+        if(!has_object(do_id, ObjectRecord::VISIBLE)) {
             if(is_historical_object(do_id)) {
                 // The client isn't disconnected in this case because it could be a delayed
                 // message, we also have to skip to the end so a disconnect overside_datagram
@@ -535,7 +606,7 @@ class AstronClient : public Client, public NetworkClient
         }
 
         // Check that the client is actually allowed to change the object's location
-        bool is_owned = m_owned_objects.find(do_id) != m_owned_objects.end();
+        bool is_owned = has_object(do_id, ObjectRecord::OWNED);
         if(!is_owned) {
             send_disconnect(CLIENT_DISCONNECT_FORBIDDEN_RELOCATE,
                             "Can't relocate an object the client doesn't own", true);
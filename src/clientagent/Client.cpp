@@ -3,8 +3,10 @@
 #include "core/msgtypes.h"
 #include "clientagent/ClientMessages.h"
 #include "clientagent/ClientAgent.h"
+#include "dclass/dc/Field.h"
 using namespace std;
 using dclass::Class;
+using dclass::Field;
 
 Client::Client(ClientAgent* client_agent) : m_client_agent(client_agent)
 {
@@ -37,12 +39,20 @@ void Client::annihilate()
 
     // Unsubscribe from all channels first so the DELETE messages aren't sent back to us.
     unsubscribe_all();
+    for(auto it = m_locations.begin(); it != m_locations.end(); ++it) {
+        m_client_agent->unsubscribe_location(this, *it);
+    }
+    m_locations.clear();
     m_client_agent->m_ct.free_channel(m_allocated_channel);
 
     // Delete all session objects
-    while(m_session_objects.size() > 0) {
-        doid_t do_id = *m_session_objects.begin();
-        m_session_objects.erase(do_id);
+    for(auto it = m_objects.begin(); it != m_objects.end(); ++it) {
+        if(!(it->second.flags & ObjectRecord::SESSION)) {
+            continue;
+        }
+
+        doid_t do_id = it->first;
+        it->second.flags &= ~ObjectRecord::SESSION;
         m_log->debug() << "Client exited, deleting session object with id " << do_id << ".\n";
         DatagramPtr dg = Datagram::create(do_id, m_channel, STATESERVER_OBJECT_DELETE_RAM);
         dg->add_doid(do_id);
@@ -68,38 +78,125 @@ void Client::log_event(LoggedEvent &event)
 const Class *Client::lookup_object(doid_t do_id)
 {
     // First see if it's an UberDOG:
-    if(g_uberdogs.find(do_id) != g_uberdogs.end()) {
-        return g_uberdogs[do_id].dcc;
+    auto uberdog = g_uberdogs.find(do_id);
+    if(uberdog != g_uberdogs.end()) {
+        return uberdog->second.dcc;
     }
 
-    // Next, check the object cache, but this client only knows about it
-    // if it occurs in m_seen_objects or m_owned_objects:
-    if(m_owned_objects.find(do_id) != m_owned_objects.end() ||
-       m_seen_objects.find(do_id) != m_seen_objects.end()) {
-        if(m_visible_objects.find(do_id) != m_visible_objects.end()) {
-            return m_visible_objects[do_id].dcc;
-        }
+    auto it = m_objects.find(do_id);
+    if(it == m_objects.end()) {
+        return NULL;
     }
 
+    // Next, check if the object is visible, either owned or seen:
+    const ObjectRecord &obj = it->second;
+    if(obj.flags & (ObjectRecord::OWNED | ObjectRecord::SEEN)) {
+        if(obj.flags & ObjectRecord::VISIBLE) {
+            return obj.dcc;
+        }
+    }
     // Hey we also know about it if its a declared object!
-    else if(m_declared_objects.find(do_id) != m_declared_objects.end()) {
-        return m_declared_objects[do_id].dcc;
+    else if(obj.flags & ObjectRecord::DECLARED) {
+        return obj.declared_dcc;
     }
 
     // We're at the end of our rope; we have no clue what this object is.
     return NULL;
 }
 
-// lookup_interests returns a list of all the interests that a parent-zone pair is visible to.
-list<Interest> Client::lookup_interests(doid_t parent_id, zone_t zone_id)
+// has_object returns true if the record of do_id has any of the flags.
+bool Client::has_object(doid_t do_id, uint8_t flags) const
+{
+    auto it = m_objects.find(do_id);
+    return it != m_objects.end() && (it->second.flags & flags);
+}
+
+// set_object_flags adds flags to the record of do_id, creating it if necessary.
+ObjectRecord& Client::set_object_flags(doid_t do_id, uint8_t flags)
+{
+    ObjectRecord &obj = m_objects[do_id];
+    obj.flags |= flags;
+    return obj;
+}
+
+// clear_object_flags removes flags from the record of do_id, and forgets the object
+// once no flags remain.
+void Client::clear_object_flags(doid_t do_id, uint8_t flags)
+{
+    auto it = m_objects.find(do_id);
+    if(it == m_objects.end()) {
+        return;
+    }
+
+    it->second.flags &= ~flags;
+    if(!it->second.flags) {
+        m_objects.erase(it);
+    }
+}
+
+// show_object marks an object visible, caching its class and location if it wasn't already.
+void Client::show_object(doid_t do_id, uint8_t flags, doid_t parent, zone_t zone, uint16_t dc_id)
+{
+    ObjectRecord &obj = set_object_flags(do_id, flags);
+    if(!(obj.flags & ObjectRecord::VISIBLE)) {
+        obj.flags |= ObjectRecord::VISIBLE;
+        obj.dcc = g_dcf->get_class_by_id(dc_id);
+        obj.parent = parent;
+        obj.zone = zone;
+    }
+}
+
+// hide_object removes an object from the client's visibility, leaving it historical.
+void Client::hide_object(doid_t do_id)
 {
-    list<Interest> interests;
-    for(auto it = m_interests.begin(); it != m_interests.end(); ++it) {
-        if(parent_id == it->second.parent && (it->second.zones.find(zone_id) != it->second.zones.end())) {
-            interests.push_back(it->second);
+    m_historical_objects.insert(do_id);
+    clear_object_flags(do_id, ObjectRecord::OWNED | ObjectRecord::SEEN | ObjectRecord::VISIBLE);
+}
+
+// set_pending_object queues messages about do_id under the interest operation with
+// request_context, unless they're already queued under another.
+void Client::set_pending_object(doid_t do_id, uint32_t request_context)
+{
+    ObjectRecord &obj = m_objects[do_id];
+    if(!(obj.flags & ObjectRecord::PENDING)) {
+        obj.flags |= ObjectRecord::PENDING;
+        obj.pending_context = request_context;
+    }
+}
+
+// count_interests returns the number of interests that a parent-zone pair is visible to.
+unsigned int Client::count_interests(doid_t parent_id, zone_t zone_id) const
+{
+    auto it = m_interest_zones.find(location_as_channel(parent_id, zone_id));
+    return it != m_interest_zones.end() ? it->second : 0;
+}
+
+// set_interest opens or replaces an interest, and erase_interest closes one; they keep
+// m_interest_zones up to date, and don't change what the client can see.
+void Client::set_interest(const Interest &i)
+{
+    erase_interest(i.id);
+    m_interests[i.id] = i;
+    for(auto it = i.zones.begin(); it != i.zones.end(); ++it) {
+        ++m_interest_zones[location_as_channel(i.parent, *it)];
+    }
+}
+
+void Client::erase_interest(uint16_t interest_id)
+{
+    auto found = m_interests.find(interest_id);
+    if(found == m_interests.end()) {
+        return;
+    }
+
+    const Interest &i = found->second;
+    for(auto it = i.zones.begin(); it != i.zones.end(); ++it) {
+        auto zone = m_interest_zones.find(location_as_channel(i.parent, *it));
+        if(--zone->second == 0) {
+            m_interest_zones.erase(zone);
         }
     }
-    return interests;
+    m_interests.erase(found);
 }
 
 // build_interest will build an interest from a datagram. It is expected that the datagram
@@ -133,21 +230,22 @@ void Client::add_interest(Interest &i, uint32_t context, channel_t caller)
     unordered_set<zone_t> new_zones;
 
     for(auto it = i.zones.begin(); it != i.zones.end(); ++it) {
-        if(lookup_interests(i.parent, *it).empty()) {
+        if(count_interests(i.parent, *it) == 0) {
             new_zones.insert(*it);
         }
     }
 
-    if(m_interests.find(i.id) != m_interests.end()) {
+    auto previous = m_interests.find(i.id);
+    if(previous != m_interests.end()) {
         // This is an already-open interest that is actually being altered.
         // Therefore, we need to delete the objects that the client can see
         // through this interest only.
 
-        Interest previous_interest = m_interests[i.id];
+        const Interest &previous_interest = previous->second;
         unordered_set<zone_t> killed_zones;
 
         for(auto it = previous_interest.zones.begin(); it != previous_interest.zones.end(); ++it) {
-            if(lookup_interests(previous_interest.parent, *it).size() > 1) {
+            if(count_interests(previous_interest.parent, *it) > 1) {
                 // An interest other than the altered one can see this parent/zone,
                 // so we don't care about it.
                 continue;
@@ -163,7 +261,7 @@ void Client::add_interest(Interest &i, uint32_t context, channel_t caller)
         // Now that we know what zones to kill, let's get to it:
         close_zones(previous_interest.parent, killed_zones);
     }
-    m_interests[i.id] = i;
+    set_interest(i);
 
     if(new_zones.empty()) {
         // We aren't requesting any new zones with this operation, so don't
@@ -187,7 +285,7 @@ void Client::add_interest(Interest &i, uint32_t context, channel_t caller)
     resp->add_uint16(new_zones.size());
     for(auto it = new_zones.begin(); it != new_zones.end(); ++it) {
         resp->add_zone(*it);
-        subscribe_channel(location_as_channel(i.parent, *it));
+        subscribe_location(location_as_channel(i.parent, *it));
     }
     route_datagram(resp);
 }
@@ -199,7 +297,7 @@ void Client::remove_interest(Interest &i, uint32_t context, channel_t caller)
     unordered_set<zone_t> killed_zones;
 
     for(auto it = i.zones.begin(); it != i.zones.end(); ++it) {
-        if(lookup_interests(i.parent, *it).size() == 1) {
+        if(count_interests(i.parent, *it) == 1) {
             // We're the only interest who can see this zone, so let's kill it.
             killed_zones.insert(*it);
         }
@@ -211,7 +309,21 @@ void Client::remove_interest(Interest &i, uint32_t context, channel_t caller)
     notify_interest_done(i.id, caller);
     handle_interest_done(i.id, context);
 
-    m_interests.erase(i.id);
+    erase_interest(i.id);
+}
+
+void Client::subscribe_location(channel_t location)
+{
+    if(m_locations.insert(location).second) {
+        m_client_agent->subscribe_location(this, location);
+    }
+}
+
+void Client::unsubscribe_location(channel_t location)
+{
+    if(m_locations.erase(location)) {
+        m_client_agent->unsubscribe_location(this, location);
+    }
 }
 
 // cloze_zones removes objects visible through the zones from the client and unsubscribes
@@ -219,42 +331,40 @@ void Client::remove_interest(Interest &i, uint32_t context, channel_t caller)
 void Client::close_zones(doid_t parent, const unordered_set<zone_t> &killed_zones)
 {
     // Kill off all objects that are in the matched parent/zones:
-
-    list<doid_t> to_remove;
-    for(auto it = m_visible_objects.begin(); it != m_visible_objects.end(); ++it) {
-        if(it->second.parent != parent) {
+    vector<doid_t> killed_objects;
+    for(auto it = m_objects.begin(); it != m_objects.end(); ++it) {
+        const ObjectRecord &obj = it->second;
+        if(!(obj.flags & ObjectRecord::VISIBLE) || obj.parent != parent) {
             // Object does not belong to the parent in question; ignore.
             continue;
         }
 
-        if(killed_zones.find(it->second.zone) != killed_zones.end()) {
-            if(m_owned_objects.find(it->second.id) != m_owned_objects.end()) {
+        if(killed_zones.find(obj.zone) != killed_zones.end()) {
+            if(obj.flags & ObjectRecord::OWNED) {
                 // Owned objects are always visible, ignore this object
                 continue;
             }
 
-            if(m_session_objects.find(it->second.id) != m_session_objects.end()) {
+            if(obj.flags & ObjectRecord::SESSION) {
                 // This object is a session object. The client should be disconnected.
                 send_disconnect(CLIENT_DISCONNECT_SESSION_OBJECT_DELETED,
                                 "A session object has unexpectedly left interest.");
                 return;
             }
 
-            handle_remove_object(it->second.id);
-
-            m_seen_objects.erase(it->second.id);
-            m_historical_objects.insert(it->second.id);
-            to_remove.push_back(it->second.id);
+            handle_remove_object(it->first);
+            killed_objects.push_back(it->first);
         }
     }
 
-    for(auto it = to_remove.begin(); it != to_remove.end(); ++it) {
-        m_visible_objects.erase(*it);
+    // Hiding an object may forget its record, so it can't be done while iterating
+    for(auto it = killed_objects.begin(); it != killed_objects.end(); ++it) {
+        hide_object(*it);
     }
 
     // Close all of the channels:
     for(auto it = killed_zones.begin(); it != killed_zones.end(); ++it) {
-        unsubscribe_channel(location_as_channel(parent, *it));
+        unsubscribe_location(location_as_channel(parent, *it));
     }
 }
 
@@ -369,28 +479,26 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
         doid_t do_id = dgi.read_doid();
         uint16_t dc_id = dgi.read_uint16();
 
-        if(m_declared_objects.find(do_id) != m_declared_objects.end()) {
+        if(has_object(do_id, ObjectRecord::DECLARED)) {
             m_log->warning() << "Received object declaration for previously declared object "
                              << do_id << ".\n";
             return;
         }
 
-        DeclaredObject obj;
-        obj.id = do_id;
-        obj.dcc = g_dcf->get_class_by_id(dc_id);
-        m_declared_objects[do_id] = obj;
+        ObjectRecord &obj = set_object_flags(do_id, ObjectRecord::DECLARED);
+        obj.declared_dcc = g_dcf->get_class_by_id(dc_id);
     }
     break;
     case CLIENTAGENT_UNDECLARE_OBJECT: {
         doid_t do_id = dgi.read_doid();
 
-        if(m_declared_objects.find(do_id) == m_declared_objects.end()) {
+        if(!has_object(do_id, ObjectRecord::DECLARED)) {
             m_log->warning() << "Received undeclare object for unknown object "
                              << do_id << ".\n";
             return;
         }
 
-        m_declared_objects.erase(do_id);
+        clear_object_flags(do_id, ObjectRecord::DECLARED);
     }
     break;
     case CLIENTAGENT_SET_FIELDS_SENDABLE: {
@@ -406,7 +514,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
     break;
     case CLIENTAGENT_ADD_SESSION_OBJECT: {
         doid_t do_id = dgi.read_doid();
-        if(m_session_objects.find(do_id) != m_session_objects.end()) {
+        if(has_object(do_id, ObjectRecord::SESSION)) {
             m_log->warning() << "Received add session object for existing session object "
                              << do_id << ".\n";
             return;
@@ -414,13 +522,13 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 
         m_log->debug() << "Added session object with id " << do_id << ".\n";
 
-        m_session_objects.insert(do_id);
+        set_object_flags(do_id, ObjectRecord::SESSION);
     }
     break;
     case CLIENTAGENT_REMOVE_SESSION_OBJECT: {
         doid_t do_id = dgi.read_doid();
 
-        if(m_session_objects.find(do_id) == m_session_objects.end()) {
+        if(!has_object(do_id, ObjectRecord::SESSION)) {
             m_log->warning() << "Received remove session object for non-session object "
                              << do_id << ".\n";
             return;
@@ -428,7 +536,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 
         m_log->debug() << "Removed session object with id " << do_id << ".\n";
 
-        m_session_objects.erase(do_id);
+        clear_object_flags(do_id, ObjectRecord::SESSION);
     }
     break;
     case STATESERVER_OBJECT_SET_FIELD: {
@@ -471,11 +579,13 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             return;
         }
 
-        if(m_session_objects.find(do_id) != m_session_objects.end()) {
-            // We have to erase the object from our session_objects here, because
-            // the object has already been deleted and we don't want it to be deleted
-            // again in the client's destructor.
-            m_session_objects.erase(do_id);
+        auto found = m_objects.find(do_id);
+        uint8_t flags = found != m_objects.end() ? found->second.flags : 0;
+        if(flags & ObjectRecord::SESSION) {
+            // We have to clear the object's session flag here, because the object has
+            // already been deleted and we don't want it to be deleted again in the
+            // client's destructor.
+            found->second.flags &= ~ObjectRecord::SESSION;
 
             stringstream ss;
             ss << "The session object with id " << do_id << " has been unexpectedly deleted.";
@@ -483,18 +593,15 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             return;
         }
 
-        if(m_seen_objects.find(do_id) != m_seen_objects.end()) {
+        if(flags & ObjectRecord::SEEN) {
             handle_remove_object(do_id);
-            m_seen_objects.erase(do_id);
         }
 
-        if(m_owned_objects.find(do_id) != m_owned_objects.end()) {
+        if(flags & ObjectRecord::OWNED) {
             handle_remove_ownership(do_id);
-            m_owned_objects.erase(do_id);
         }
 
-        m_historical_objects.insert(do_id);
-        m_visible_objects.erase(do_id);
+        hide_object(do_id);
     }
     break;
     case STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER:
@@ -503,16 +610,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
         doid_t parent = dgi.read_doid();
         zone_t zone = dgi.read_zone();
         uint16_t dc_id = dgi.read_uint16();
-        m_owned_objects.insert(do_id);
-
-        if(m_visible_objects.find(do_id) == m_visible_objects.end()) {
-            VisibleObject obj;
-            obj.id = do_id;
-            obj.parent = parent;
-            obj.zone = zone;
-            obj.dcc = g_dcf->get_class_by_id(dc_id);
-            m_visible_objects[do_id] = obj;
-        }
+        show_object(do_id, ObjectRecord::OWNED, parent, zone, dc_id);
 
         bool with_other = (msgtype == STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER);
         handle_add_ownership(do_id, parent, zone, dc_id, dgi, with_other);
@@ -529,9 +627,9 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 
                 it->second.queue_datagram(in_dg);
 
-                // Add the DoId to m_pending_objects, because while it's not an object
+                // Mark the object pending, because while it's not an object
                 // from opening the interest, we should begin queueing messages for it
-                m_pending_objects.emplace(do_id, it->first);
+                set_pending_object(do_id, it->first);
 
                 return;
             }
@@ -556,12 +654,36 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             return;
         }
 
-        m_pending_objects.emplace(dgi.read_doid(), request_context);
+        set_pending_object(dgi.read_doid(), request_context);
         it->second.queue_expected(in_dg);
         if(it->second.is_ready()) { it->second.finish(this); }
         return;
     }
     break;
+    case STATESERVER_OBJECT_ENTER_INTEREST_BULK: {
+        uint32_t request_context = dgi.read_uint32();
+        auto it = m_pending_interests.find(request_context);
+        if(it == m_pending_interests.end()) {
+            m_log->warning() << "Received bulk object entrance into interest with unknown context "
+                             << request_context << ".\n";
+            return;
+        }
+
+        // Mark every object as pending, the entries themselves are unpacked by finish().
+        uint16_t entry_count = dgi.read_uint16();
+        for(uint16_t i = 0; i < entry_count; ++i) {
+            dgsize_t entry_size = dgi.read_size();
+            dgsize_t entry_end = dgi.tell() + entry_size;
+            dgi.skip(sizeof(bool)); // skip has_other
+            set_pending_object(dgi.read_doid(), request_context);
+            dgi.seek(entry_end);
+        }
+
+        it->second.queue_expected(in_dg, entry_count);
+        if(it->second.is_ready()) { it->second.finish(this); }
+        return;
+    }
+    break;
     case STATESERVER_OBJECT_GET_ZONES_COUNT_RESP: {
         uint32_t context = dgi.read_uint32();
         // using doid_t because <max_objects_in_zones> == <max_total_objects>
@@ -598,24 +720,17 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
                 return;
             }
         }
-        bool disable = true;
-        for(auto it = m_interests.begin(); it != m_interests.end(); ++it) {
-            Interest &i = it->second;
-            for(auto it2 = i.zones.begin(); it2 != i.zones.end(); ++it2) {
-                if(*it2 == n_zone) {
-                    disable = false;
-                    break;
-                }
-            }
-        }
+        bool disable = count_interests(n_parent, n_zone) == 0;
 
-        if(m_visible_objects.find(do_id) != m_visible_objects.end()) {
-            m_visible_objects[do_id].parent = n_parent;
-            m_visible_objects[do_id].zone = n_zone;
+        auto found = m_objects.find(do_id);
+        uint8_t flags = found != m_objects.end() ? found->second.flags : 0;
+        if(flags & ObjectRecord::VISIBLE) {
+            found->second.parent = n_parent;
+            found->second.zone = n_zone;
         }
 
-        if(disable && m_owned_objects.find(do_id) == m_owned_objects.end()) {
-            if(m_session_objects.find(do_id) != m_session_objects.end()) {
+        if(disable && !(flags & ObjectRecord::OWNED)) {
+            if(flags & ObjectRecord::SESSION) {
                 stringstream ss;
                 ss << "The session object with id " << do_id
                    << " has unexpectedly left interest.";
@@ -624,9 +739,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             }
 
             handle_remove_object(do_id);
-            m_seen_objects.erase(do_id);
-            m_historical_objects.insert(do_id);
-            m_visible_objects.erase(do_id);
+            hide_object(do_id);
         } else {
             handle_change_location(do_id, n_parent, n_zone);
         }
@@ -643,14 +756,16 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             return;
         }
 
-        if(m_owned_objects.find(do_id) == m_owned_objects.end()) {
+        auto found = m_objects.find(do_id);
+        uint8_t flags = found != m_objects.end() ? found->second.flags : 0;
+        if(!(flags & ObjectRecord::OWNED)) {
             m_log->error() << "Received ChangingOwner for unowned object with id "
                            << do_id << ".\n";
             return;
         }
 
-        if(m_seen_objects.find(do_id) == m_seen_objects.end()) {
-            if(m_session_objects.find(do_id) != m_session_objects.end()) {
+        if(!(flags & ObjectRecord::SEEN)) {
+            if(flags & ObjectRecord::SESSION) {
                 stringstream ss;
                 ss << "The session object with id " << do_id
                    << " has unexpectedly left ownership.";
@@ -659,9 +774,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
             }
 
             handle_remove_ownership(do_id);
-            m_owned_objects.erase(do_id);
-            m_historical_objects.insert(do_id);
-            m_visible_objects.erase(do_id);
+            hide_object(do_id);
         }
     }
     break;
@@ -672,16 +785,22 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 
 bool Client::try_queue_pending(doid_t do_id, DatagramHandle dg)
 {
-    auto it = m_pending_objects.find(do_id);
-    if(it != m_pending_objects.end()) {
+    auto it = m_objects.find(do_id);
+    if(it != m_objects.end() && (it->second.flags & ObjectRecord::PENDING)) {
         // the dg should be queued under the appropriate iop
-        m_pending_interests.find(it->second)->second.queue_datagram(dg);
+        m_pending_interests.find(it->second.pending_context)->second.queue_datagram(dg);
         return true;
     }
     // still no idea what do_id was being talked about
     return false;
 }
 
+DatagramHandle Client::translate(const DatagramIterator &dgi, uint16_t encoding,
+                                 const function<DatagramHandle()> &encode)
+{
+    return m_client_agent->m_translations.translate(dgi, encoding, encode);
+}
+
 void Client::handle_object_entrance(DatagramIterator &dgi, bool other)
 {
     doid_t do_id = dgi.read_doid();
@@ -690,22 +809,13 @@ void Client::handle_object_entrance(DatagramIterator &dgi, bool other)
     uint16_t dc_id = dgi.read_uint16();
 
     // this object is no longer pending
-    m_pending_objects.erase(do_id);
+    clear_object_flags(do_id, ObjectRecord::PENDING);
 
-    if(m_owned_objects.find(do_id) != m_owned_objects.end() ||
-       m_seen_objects.find(do_id) != m_seen_objects.end()) {
+    if(has_object(do_id, ObjectRecord::OWNED | ObjectRecord::SEEN)) {
         return;
     }
 
-    if(m_visible_objects.find(do_id) == m_visible_objects.end()) {
-        VisibleObject obj;
-        obj.id = do_id;
-        obj.dcc = g_dcf->get_class_by_id(dc_id);
-        obj.parent = parent;
-        obj.zone = zone;
-        m_visible_objects[do_id] = obj;
-    }
-    m_seen_objects.insert(do_id);
+    show_object(do_id, ObjectRecord::SEEN, parent, zone, dc_id);
 
     handle_add_object(do_id, parent, zone, dc_id, dgi, other);
 }
@@ -757,9 +867,19 @@ void InterestOperation::finish(Client *client)
         dgi.skip(sizeof(channel_t)); // skip sender
 
         uint16_t msgtype = dgi.read_uint16();
-        bool with_other = (msgtype == STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER);
-
         dgi.skip(sizeof(uint32_t)); // skip request_context
+
+        if(msgtype == STATESERVER_OBJECT_ENTER_INTEREST_BULK) {
+            uint16_t entry_count = dgi.read_uint16();
+            for(uint16_t i = 0; i < entry_count; ++i) {
+                DatagramIterator entry(Datagram::create(dgi.read_blob()));
+                bool with_other = entry.read_bool();
+                client->handle_object_entrance(entry, with_other);
+            }
+            continue;
+        }
+
+        bool with_other = (msgtype == STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER);
         client->handle_object_entrance(dgi, with_other);
     }
 
@@ -771,6 +891,7 @@ void InterestOperation::finish(Client *client)
     //       datagrams, so that they aren't just re-added to the queue.
     //       Move the queued datagrams to the stack so it is safe to delete the Operation.
     list<DatagramHandle> dispatch = move(m_pending_datagrams);
+    m_conflated_updates.clear();
 
     // Delete the Interest Operation
     client->m_pending_interests.erase(m_request_context);
@@ -785,7 +906,7 @@ void InterestOperation::finish(Client *client)
 
 bool InterestOperation::is_ready()
 {
-    return m_has_total && m_pending_generates.size() >= m_total;
+    return m_has_total && m_received >= m_total;
 }
 
 void InterestOperation::set_expected(doid_t total)
@@ -801,12 +922,36 @@ void InterestOperation::decrement_expected()
     if(m_has_total) { --m_total; }
 }
 
-void InterestOperation::queue_expected(DatagramHandle dg)
+void InterestOperation::queue_expected(DatagramHandle dg, uint16_t object_count)
 {
     m_pending_generates.push_back(dg);
+    m_received += object_count;
 }
 
 void InterestOperation::queue_datagram(DatagramHandle dg)
 {
-    m_pending_datagrams.push_back(dg);
+    DatagramIterator dgi(dg);
+    dgi.seek_payload();
+    dgi.skip(sizeof(channel_t)); // skip sender
+    if(dgi.read_uint16() != STATESERVER_OBJECT_SET_FIELD) {
+        m_pending_datagrams.push_back(dg);
+        return;
+    }
+
+    doid_t do_id = dgi.read_doid();
+    uint16_t field_id = dgi.read_uint16();
+    const Field *field = g_dcf->get_field_by_id(field_id);
+    if(!field || !field->has_keyword("conflate")) {
+        m_pending_datagrams.push_back(dg);
+        return;
+    }
+
+    // The client only needs the latest value of a conflated field, so replace
+    // the update that is still waiting in the queue rather than sending both.
+    auto key = make_pair(do_id, field_id);
+    auto queued = m_conflated_updates.find(key);
+    if(queued != m_conflated_updates.end()) {
+        m_pending_datagrams.erase(queued->second);
+    }
+    m_conflated_updates[key] = m_pending_datagrams.insert(m_pending_datagrams.end(), dg);
 }
@@ -4,6 +4,7 @@
 #include "util/EventSender.h"
 
 #include <queue>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 
@@ -22,16 +23,24 @@ enum ClientState {
     CLIENT_STATE_ESTABLISHED
 };
 
-struct DeclaredObject {
-    doid_t id;
-    const dclass::Class *dcc;
-};
-
-// A VisibleObject is used to cache metadata associated with
-// a particular object when it becomes visible to a Client.
-struct VisibleObject : DeclaredObject {
-    doid_t parent;
-    zone_t zone;
+// An ObjectRecord holds everything a Client knows about one object: how the object relates
+// to the client, and the metadata cached while it is visible or declared.
+struct ObjectRecord {
+    enum Flags : uint8_t {
+        OWNED = 1 << 0,      // visible through ownership
+        SEEN = 1 << 1,       // visible through an interest
+        VISIBLE = 1 << 2,    // dcc, parent and zone describe the visible object
+        DECLARED = 1 << 3,   // declared_dcc was declared by the server
+        SESSION = 1 << 4,    // deleted when the client disconnects, and required by it
+        PENDING = 1 << 5,    // messages are queued under the interest op pending_context
+    };
+
+    const dclass::Class *dcc = nullptr;
+    const dclass::Class *declared_dcc = nullptr;
+    doid_t parent = 0;
+    zone_t zone = 0;
+    uint32_t pending_context = 0;
+    uint8_t flags = 0;
 };
 
 // An Interest represents a Client's interest opened with a
@@ -59,9 +68,13 @@ class InterestOperation
 
     bool m_has_total = false;
     doid_t m_total = 0; // as doid_t because <max_objs_in_zones> == <max_total_objs>
+    doid_t m_received = 0; // objects received, counting each entry of a bulk entry
 
     std::list<DatagramHandle> m_pending_generates;
     std::list<DatagramHandle> m_pending_datagrams;
+    // m_conflated_updates tracks the queued SET_FIELD for each (doid, field) of a "conflate"
+    // field, so that a newer update replaces the stale one instead of queueing behind it.
+    std::map<std::pair<doid_t, uint16_t>, std::list<DatagramHandle>::iterator> m_conflated_updates;
 
     InterestOperation(uint16_t interest_id, uint32_t client_context, uint32_t request_context,
                       doid_t parent, std::unordered_set<zone_t> zones, channel_t caller);
@@ -69,7 +82,7 @@ class InterestOperation
     bool is_ready();
     void set_expected(doid_t total);
     void decrement_expected();
-    void queue_expected(DatagramHandle dg);
+    void queue_expected(DatagramHandle dg, uint16_t object_count = 1);
     void queue_datagram(DatagramHandle dg);
     void finish(Client *client);
 };
@@ -91,26 +104,18 @@ class Client : public MDParticipantInterface
     channel_t m_allocated_channel = 0;      // Channel assigned to client at creation time
     uint32_t m_next_context = 1;
 
-    // m_owned_objects is a list of all objects visible through ownership
-    std::unordered_set<doid_t> m_owned_objects;
-    // m_seen_objects is a list of all objects visible through interests
-    std::unordered_set<doid_t> m_seen_objects;
-    // m_session_objects is a list of objects that are automatically cleaned up when the
-    // client disconnects.  Additionally, these objects are presumed to be required for the
-    // client, so if one is delete, the client is dropped.
-    std::unordered_set<doid_t> m_session_objects;
-    // m_historical_objects is a list of all objects which where previously visible, but have
-    // had their visibility removed; a historical object may have become visible again
+    // m_objects is a map of every object the client knows about to its ObjectRecord.
+    std::unordered_map<doid_t, ObjectRecord> m_objects;
+    // m_historical_objects is the set of objects which were visible once, and may be again.
+    // It is kept apart from m_objects, so that an object out of sight costs only its doid.
     std::unordered_set<doid_t> m_historical_objects;
-    // m_visible_objects is a map which relates all visible objects to VisibleObject metadata.
-    std::unordered_map<doid_t, VisibleObject> m_visible_objects;
-    // m_declared_objects is a map of declared objects to their metadata.
-    std::unordered_map<doid_t, DeclaredObject> m_declared_objects;
-    // m_pending_objects is a map of doids for objects that we need to buffer dg's for
-    std::unordered_map<doid_t, uint32_t> m_pending_objects;
 
     // m_interests is a map of interest ids to interests.
     std::unordered_map<uint16_t, Interest> m_interests;
+    // m_interest_zones counts the interests open in each location, keyed by location channel.
+    std::unordered_map<channel_t, unsigned int> m_interest_zones;
+    // m_locations is the set of location channels the ClientAgent receives for this client.
+    std::unordered_set<channel_t> m_locations;
     // m_pending_interests is a map of contexts to in-progress interests.
     std::unordered_map<uint32_t, InterestOperation> m_pending_interests;
     // m_fields_sendable is a map of DoIds to sendable field sets.
@@ -129,8 +134,13 @@ class Client : public MDParticipantInterface
     // If that object is not visible to the client, NULL will be returned instead.
     const dclass::Class* lookup_object(doid_t do_id);
 
-    // lookup_interests returns a list of all the interests that a parent-zone pair is visible to.
-    std::list<Interest> lookup_interests(doid_t parent_id, zone_t zone_id);
+    // count_interests returns the number of interests that a parent-zone pair is visible to.
+    unsigned int count_interests(doid_t parent_id, zone_t zone_id) const;
+
+    // set_interest opens or replaces an interest, and erase_interest closes one; they keep
+    // m_interest_zones up to date, and don't change what the client can see.
+    void set_interest(const Interest &i);
+    void erase_interest(uint16_t interest_id);
 
     // build_interest will build an interest from a datagram. It is expected that the datagram
     // iterator is positioned such that next item to be read is the interest_id.
@@ -147,20 +157,45 @@ class Client : public MDParticipantInterface
     // passes it to close_zones() to be removed from the client's visibility.
     void remove_interest(Interest &i, uint32_t context, channel_t caller = 0);
 
+    // subscribe_location and unsubscribe_location start and stop the ClientAgent passing on
+    // the datagrams sent to a location.
+    void subscribe_location(channel_t location);
+    void unsubscribe_location(channel_t location);
+
     // cloze_zones removes objects visible through the zones from the client and unsubscribes
     // from the associated location channels for those objects.
     void close_zones(doid_t parent, const std::unordered_set<zone_t> &killed_zones);
 
+    // has_object returns true if the record of do_id has any of the flags.
+    bool has_object(doid_t do_id, uint8_t flags) const;
+    // set_object_flags adds flags to the record of do_id, creating it if necessary.
+    ObjectRecord& set_object_flags(doid_t do_id, uint8_t flags);
+    // clear_object_flags removes flags from the record of do_id, and forgets the object
+    // once no flags remain.
+    void clear_object_flags(doid_t do_id, uint8_t flags);
+    // show_object marks an object visible, caching its class and location if it wasn't already.
+    void show_object(doid_t do_id, uint8_t flags, doid_t parent, zone_t zone, uint16_t dc_id);
+    // hide_object removes an object from the client's visibility, leaving it historical.
+    void hide_object(doid_t do_id);
+    // set_pending_object queues messages about do_id under the interest operation with
+    // request_context, unless they're already queued under another.
+    void set_pending_object(doid_t do_id, uint32_t request_context);
+
     // is_historical_object returns true if the object was once visible to the client, but has
     // since been deleted.  The return is still true even if the object has become visible again.
     bool is_historical_object(doid_t do_id);
 
 
+    // translate returns the client datagram which encode makes from the rest of dgi, reusing
+    // the one made by any other client of the agent which received the same server datagram.
+    DatagramHandle translate(const DatagramIterator &dgi, uint16_t encoding,
+                             const std::function<DatagramHandle()> &encode);
+
     // handle_object_entrance is a common handler for object entrance. the DGI should be positioned
     // at the start of the do_id parameter
     void handle_object_entrance(DatagramIterator &dgi, bool other);
 
-    // try_queue_pending checks the object against m_pending_objects, and if the objects is
+    // try_queue_pending checks whether the object is pending, and if the object is
     // involved in a pending iop, queues the datagram for later sending, and returns true
     inline bool try_queue_pending(doid_t do_id, DatagramHandle dg);
 
@@ -238,9 +238,81 @@ void ClientAgent::handle_ssl(ssl::stream<tcp::socket> *stream)
 
 
 // handle_datagram handles Datagrams received from the message director.
-void ClientAgent::handle_datagram(DatagramHandle, DatagramIterator&)
+void ClientAgent::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 {
-    // At the moment, the client agent doesn't actually handle any datagrams
+    list<channel_t> channels;
+    DatagramIterator header(in_dg);
+    uint8_t channel_count = header.read_uint8();
+    for(uint8_t i = 0; i < channel_count; ++i) {
+        channels.push_back(header.read_channel());
+    }
+
+    // Copy the recipients, so that clients may change their interests as they handle it
+    vector<Client*> clients;
+    {
+        lock_guard<mutex> lock(m_locations_lock);
+        unordered_set<Client*> found;
+        for(auto it = channels.begin(); it != channels.end(); ++it) {
+            auto location = m_locations.find(*it);
+            if(location == m_locations.end()) {
+                continue;
+            }
+
+            for(auto client = location->second.begin(); client != location->second.end(); ++client) {
+                if(found.insert(*client).second) {
+                    clients.push_back(*client);
+                }
+            }
+        }
+    }
+
+    MDParticipantInterface *origin = MessageDirector::singleton.get_origin();
+    for(auto it = clients.begin(); it != clients.end(); ++it) {
+        // A client doesn't receive the datagrams it sent itself
+        if(*it == origin) {
+            continue;
+        }
+
+        // A client subscribed to any of the recipients itself has had the datagram already
+        bool subscribed = false;
+        for(auto channel = channels.begin(); channel != channels.end() && !subscribed; ++channel) {
+            subscribed = MessageDirector::singleton.is_subscribed(*it, *channel);
+        }
+        if(subscribed) {
+            continue;
+        }
+
+        DatagramIterator client_dgi(in_dg, dgi.tell());
+        try {
+            (*it)->handle_datagram(in_dg, client_dgi);
+        } catch(DatagramIteratorEOF &) {
+            m_log->error() << "Detected truncated datagram in handle_datagram for a client.\n";
+        }
+    }
+}
+
+void ClientAgent::subscribe_location(Client *client, channel_t location)
+{
+    lock_guard<mutex> lock(m_locations_lock);
+    auto &clients = m_locations[location];
+    if(clients.empty()) {
+        subscribe_channel(location);
+    }
+    clients.insert(client);
+}
+
+void ClientAgent::unsubscribe_location(Client *client, channel_t location)
+{
+    lock_guard<mutex> lock(m_locations_lock);
+    auto it = m_locations.find(location);
+    if(it == m_locations.end() || !it->second.erase(client)) {
+        return;
+    }
+
+    if(it->second.empty()) {
+        m_locations.erase(it);
+        unsubscribe_channel(location);
+    }
 }
 
 string ClientAgent::ssl_password_callback()
@@ -280,3 +352,31 @@ void ChannelTracker::free_channel(channel_t channel)
 {
     m_unused_channels.push(channel);
 }
+
+// The entries are only needed while one datagram is delivered to each of its recipients,
+// so a handful covers datagrams translated with several encodings.
+static const size_t MAX_TRANSLATIONS = 8;
+
+DatagramHandle TranslationCache::translate(const DatagramIterator &dgi, uint16_t encoding,
+                                           const function<DatagramHandle()> &encode)
+{
+    DatagramHandle in = dgi.get_datagram();
+    dgsize_t offset = dgi.tell();
+    {
+        lock_guard<mutex> lock(m_lock);
+        for(auto it = m_entries.rbegin(); it != m_entries.rend(); ++it) {
+            if(it->in == in && it->offset == offset && it->encoding == encoding) {
+                return it->out;
+            }
+        }
+    }
+
+    DatagramHandle out = encode();
+
+    lock_guard<mutex> lock(m_lock);
+    if(m_entries.size() >= MAX_TRANSLATIONS) {
+        m_entries.pop_front();
+    }
+    m_entries.push_back(Entry {in, offset, encoding, out});
+    return out;
+}
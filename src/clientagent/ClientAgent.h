@@ -2,6 +2,11 @@
 #include "core/Role.h"
 #include "Client.h"
 
+#include <deque>
+#include <list>
+#include <vector>
+#include <functional>
+#include <mutex>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 
@@ -26,6 +31,30 @@ class ChannelTracker
     std::queue<channel_t> m_unused_channels;
 };
 
+// A TranslationCache remembers the client datagrams most recently made from server datagrams.
+// A broadcast reaches every Client subscribed to its channel with the same DatagramHandle,
+// so the first Client to translate it does so for all of them.  Entries hold a reference to
+// their server datagram, so its address can't be reused while it is cached.
+class TranslationCache
+{
+  public:
+    // translate returns the datagram which encode makes from the rest of dgi.  Clients whose
+    // translations differ must use distinct encodings.
+    DatagramHandle translate(const DatagramIterator &dgi, uint16_t encoding,
+                             const std::function<DatagramHandle()> &encode);
+
+  private:
+    struct Entry {
+        DatagramHandle in;
+        dgsize_t offset;
+        uint16_t encoding;
+        DatagramHandle out;
+    };
+
+    std::mutex m_lock;
+    std::deque<Entry> m_entries; // most recent at the back
+};
+
 class ClientAgent : public Role
 {
     friend class Client;
@@ -41,10 +70,17 @@ class ClientAgent : public Role
     void handle_ssl(boost::asio::ssl::stream<boost::asio::ip::tcp::socket> *stream);
 
     // handle_datagram handles Datagrams received from the message director.
-    // Currently the ClientAgent does not handle any datagrams,
-    // and delegates everything to the Client objects.
+    // The ClientAgent only receives datagrams sent to locations, which it passes on to
+    // each of its Clients with interest in them.
     void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
 
+    // subscribe_location adds a client to those receiving a location channel's datagrams; the
+    // ClientAgent subscribes to the channel once, for all of its clients.
+    void subscribe_location(Client *client, channel_t location);
+    // unsubscribe_location removes a client from a location, unsubscribing from the channel
+    // once no client remains.
+    void unsubscribe_location(Client *client, channel_t location);
+
     // ssl_password_callback prompts for password on stdin if the cert/key has a password
     std::string ssl_password_callback();
 
@@ -68,6 +104,11 @@ class ClientAgent : public Role
     std::string m_client_type;
     std::string m_server_version;
     ChannelTracker m_ct;
+    TranslationCache m_translations;
+
+    // m_locations maps each subscribed location channel to the clients with interest in it.
+    std::mutex m_locations_lock;
+    std::unordered_map<channel_t, std::unordered_set<Client*> > m_locations;
     ConfigNode m_clientconfig;
     LogCategory *m_log;
     uint32_t m_hash;
@@ -19,6 +19,9 @@
 #define CLIENT_ADD_INTEREST_MULTIPLE 201
 #define CLIENT_REMOVE_INTEREST 203
 
+#define CLIENT_COMPRESSION_NONE 0
+#define CLIENT_COMPRESSION_ZLIB 1
+
 #define CLIENT_DISCONNECT_GENERIC 1
 #define CLIENT_DISCONNECT_OVERSIZED_DATAGRAM 106
 #define CLIENT_DISCONNECT_NO_HELLO 107
@@ -7,6 +7,7 @@
 using dclass::Class;
 
 #include <boost/filesystem.hpp>
+#include <cstdlib>
 #include <cstring>
 #include <string>  // std::string
 #include <vector>  // std::vector
@@ -165,6 +166,7 @@ int main(int argc, char *argv[])
     dcf->add_keyword("ownsend");
     dcf->add_keyword("ownrecv");
     dcf->add_keyword("airecv");
+    dcf->add_keyword("conflate");
     vector<string> dc_file_names = dc_files.get_val();
     for(auto it = dc_file_names.begin(); it != dc_file_names.end(); ++it) {
         bool ok = dclass::append(dcf, *it);
@@ -216,7 +218,9 @@ int main(int argc, char *argv[])
     }
     // This exception is propogated if astron_shutdown is called
     catch(const ShutdownException& e) {
-        return e.exit_code();
+        // A role which failed part way through its constructor is still registered with the
+        // MessageDirector, so skip the static destructors, which would delete it again.
+        _Exit(e.exit_code());
     }
 
     // Run the main event loop
@@ -237,6 +241,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // Give the roles a chance to save their state before exiting
+    astron_run_shutdown_hooks();
+
     return exit_code;
 }
 
@@ -315,6 +322,10 @@ void printCompiledOptions(ostream &s)
       "(With YAML Support) "
 #endif //End DB_YAML
 
+#ifdef BUILD_DB_BINLOG
+      "(With Binlog Support) "
+#endif //End DB_BINLOG
+
 #ifdef BUILD_DB_SQL
       "(With SQL DB Support) "
 #endif //End DB_SQL
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <mutex>
+#include <vector>
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #  include <windows.h>
@@ -21,6 +22,7 @@ static int exit_code = 0;
 static int interrupts = 0;
 static mutex exit_mtx;
 static mutex ctrlc_mtx;
+static vector<function<void()>> shutdown_hooks;
 
 
 #ifdef WIN32 /* Handle Windows signals */
@@ -59,6 +61,12 @@ static void handle_interrupt(int)
     cerr << "Received interrupt (Ctrl + C)\n";
     astron_shutdown(0, false);
 }
+static void handle_terminate(int)
+{
+    /*log->info()*/
+    cerr << "Received terminate signal\n";
+    astron_shutdown(0, false);
+}
 void astron_handle_signals()
 {
     struct sigaction interruptHandler;
@@ -66,6 +74,12 @@ void astron_handle_signals()
     sigemptyset(&interruptHandler.sa_mask);
     interruptHandler.sa_flags = 0;
     sigaction(SIGINT, &interruptHandler, NULL);
+
+    struct sigaction terminateHandler;
+    terminateHandler.sa_handler = handle_terminate;
+    sigemptyset(&terminateHandler.sa_mask);
+    terminateHandler.sa_flags = 0;
+    sigaction(SIGTERM, &terminateHandler, NULL);
 }
 
 #endif
@@ -84,6 +98,21 @@ void astron_shutdown(int code, bool throw_exception)
     }
 }
 
+// astron_add_shutdown_hook registers a function to be called, from the main thread,
+// once the main event loop has stopped during a graceful shutdown.
+void astron_add_shutdown_hook(function<void()> hook)
+{
+    shutdown_hooks.push_back(hook);
+}
+
+// astron_run_shutdown_hooks calls each registered shutdown hook in the order added.
+void astron_run_shutdown_hooks()
+{
+    for(auto it = shutdown_hooks.begin(); it != shutdown_hooks.end(); ++it) {
+        (*it)();
+    }
+}
+
 // astron_exit_code returns the exit code astron should exit with
 int astron_exit_code()
 {
@@ -1,5 +1,6 @@
 #pragma once
 #include <exception>
+#include <functional>
 
 // astron_handle_signals sets up signal handlers for the native OS
 void astron_handle_signals();
@@ -7,6 +8,13 @@ void astron_handle_signals();
 // astron_shutdown tells astron to exit gracefully with a given error code
 void astron_shutdown(int exit_code, bool throw_exception = true);
 
+// astron_add_shutdown_hook registers a function to be called, from the main thread,
+// once the main event loop has stopped during a graceful shutdown.
+void astron_add_shutdown_hook(std::function<void()> hook);
+
+// astron_run_shutdown_hooks calls each registered shutdown hook in the order added.
+void astron_run_shutdown_hooks();
+
 // ShutdownException is thrown by astron_shutdown to prevent
 // the current thread from continuing execution.
 class ShutdownException : public std::exception
@@ -0,0 +1,850 @@
+#include "DatabaseBackend.h"
+#include "DBBackendFactory.h"
+#include "DatabaseServer.h"
+
+#include "core/global.h"
+#include "core/shutdown.h"
+#include "util/Datagram.h"
+#include "util/DatagramIterator.h"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/icl/interval_set.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using dclass::Class;
+using dclass::Field;
+using namespace std;
+
+typedef boost::icl::discrete_interval<doid_t> interval_t;
+typedef boost::icl::interval_set<doid_t> set_t;
+
+static ConfigVariable<string> binlog_filename("filename", "objects.binlog", db_backend_config);
+
+static ConfigGroup compaction_config("compaction", db_backend_config);
+static ConfigVariable<unsigned int> compact_garbage("garbage", 50, compaction_config);
+static ConfigVariable<uint64_t> compact_min_size("min_size", 16 * 1024 * 1024, compaction_config);
+
+// The file starts with the magic, followed by the format version and the size of a doid_t.
+static const char BINLOG_MAGIC[8] = { 'A', 'S', 'T', 'R', 'O', 'N', 'D', 'B' };
+static const uint16_t BINLOG_VERSION = 1;
+static const uint64_t BINLOG_HEADER_SIZE = sizeof(BINLOG_MAGIC) + 2 + 2;
+
+// Each record is its length and a crc32 of its body, followed by the body.
+static const uint64_t RECORD_HEADER_SIZE = 4 + 4;
+
+// An object's records are merged back into one once it has this many field updates.
+static const size_t MAX_FIELD_RECORDS = 8;
+
+// After a compaction fails, the next is attempted no sooner than this, doubling up to the maximum.
+static const unsigned int COMPACT_RETRY_SECONDS = 10;
+static const unsigned int COMPACT_RETRY_MAX_SECONDS = 600;
+
+// sync_file writes a file's data from the OS's cache to disk.
+static bool sync_file(const string &path)
+{
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+    if(fd < 0) {
+        return false;
+    }
+    bool ok = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+#endif
+    return ok;
+}
+
+// sync_directory writes a directory's entries to disk, so that a file renamed into it stays
+// renamed.  Windows doesn't allow this, and doesn't need it.
+static bool sync_directory(const string &path)
+{
+#ifdef _WIN32
+    return true;
+#else
+    return sync_file(path.empty() ? "." : path);
+#endif
+}
+
+// The body of a record starts with its type and the object's id.
+enum RecordType {
+    // uint16 dc_id, uint16 field_count, [uint16 field_id, blob value]*field_count
+    RECORD_OBJECT = 1,
+    // uint16 field_count, [uint16 field_id, blob value]*field_count; an empty value clears the field
+    RECORD_FIELDS = 2,
+    // no further data
+    RECORD_DELETE = 3
+};
+
+// BinlogDatabase stores objects in a single append-only file of binary records.  Creating an
+// object writes a record with its class and fields, every update appends a record of just the
+// changed fields, and a delete appends a tombstone.  An index in memory maps each object to the
+// offsets of its records, so reading an object never has to search the file.
+//
+// Records which have been superseded are garbage; once enough of the file is garbage, it is
+// rewritten in the background with one record per object, and atomically renamed over the old
+// file.  Every record is checksummed, so if astrond dies part way through writing one, the file
+// is truncated to the last intact record when it is next opened.  A bad record anywhere before
+// the end can't have been left by a crash, so astrond refuses to start rather than drop it.
+//
+// Records are flushed to the OS as they are written, but not synced to disk, so they survive
+// astrond crashing but not the machine losing power.  A compacted file is synced before it
+// replaces the old one, so compaction never loses more than the records not yet synced.
+class BinlogDatabase : public DatabaseBackend
+{
+  public:
+    BinlogDatabase(ConfigNode dbeconfig, doid_t min_id, doid_t max_id) :
+        DatabaseBackend(dbeconfig, min_id, max_id),
+        m_filename(binlog_filename.get_rval(dbeconfig))
+    {
+        stringstream log_name;
+        log_name << "Database-Binlog" << "(Range: [" << min_id << ", " << max_id << "])";
+        m_log = new LogCategory("binlogdb", log_name.str());
+
+        ConfigNode compaction = db_backend_config.get_child_node(compaction_config, dbeconfig);
+        m_garbage_percent = compact_garbage.get_rval(compaction);
+        m_min_size = compact_min_size.get_rval(compaction);
+
+        recover();
+
+        m_free_ids += interval_t::closed(m_min_id, m_max_id);
+        for(auto it = m_index.begin(); it != m_index.end(); ++it) {
+            m_free_ids -= interval_t::closed(it->first, it->first);
+        }
+
+        open_file();
+        if(m_garbage_percent > 0) {
+            m_compact_thread = new thread(&BinlogDatabase::run_compaction, this);
+            astron_add_shutdown_hook([this]() {
+                stop_compaction();
+            });
+        }
+    }
+
+    virtual void submit(DBOperation *operation)
+    {
+        switch(operation->type()) {
+        case DBOperation::CREATE_OBJECT:
+            create_object(operation);
+            break;
+        case DBOperation::DELETE_OBJECT:
+            delete_object(operation);
+            break;
+        case DBOperation::GET_OBJECT:
+        case DBOperation::GET_FIELDS:
+            get_object(operation);
+            break;
+        case DBOperation::SET_FIELDS:
+        case DBOperation::UPDATE_FIELDS:
+            set_fields(operation);
+            break;
+        }
+    }
+
+    virtual void submit_batch(const vector<DBOperation*> &operations)
+    {
+        vector<DBOperation*> reads;
+        for(auto it = operations.begin(); it != operations.end(); ++it) {
+            if((*it)->type() == DBOperation::GET_OBJECT ||
+               (*it)->type() == DBOperation::GET_FIELDS) {
+                reads.push_back(*it);
+            } else {
+                submit(*it);
+            }
+        }
+
+        if(!reads.empty()) {
+            get_objects(reads);
+        }
+    }
+
+  private:
+    // An ObjectEntry is the index's record of where an object is stored.
+    struct ObjectEntry {
+        uint16_t dc_id;
+        std::vector<uint64_t> records; // the object's RECORD_OBJECT, then any RECORD_FIELDS
+        uint64_t size; // the total size of the records above
+    };
+    typedef unordered_map<doid_t, ObjectEntry> ObjectIndex;
+
+    string m_filename;
+    LogCategory *m_log;
+
+    mutex m_lock; // protects everything below
+    ObjectIndex m_index;
+    set_t m_free_ids;
+    ofstream m_out; // appends records to the binlog
+    ifstream m_in; // reads records from the binlog
+    uint64_t m_file_size = 0;
+    uint64_t m_garbage = 0; // bytes of records which have been superseded
+
+    // Compaction state, m_compact_thread is null if compaction is disabled.
+    unsigned int m_garbage_percent = 0;
+    uint64_t m_min_size = 0;
+    thread *m_compact_thread = nullptr;
+    condition_variable m_compact_cv;
+    bool m_compact_wanted = false;
+    bool m_stopping = false;
+
+    void create_object(DBOperation *operation)
+    {
+        doid_t do_id = INVALID_DO_ID;
+        bool out_of_ids = false;
+        {
+            lock_guard<mutex> lock(m_lock);
+            if(m_free_ids.size()) {
+                do_id = m_free_ids.begin()->lower();
+                if(!(m_free_ids.begin()->bounds().bits() & BOOST_BINARY(10))) {
+                    do_id += 1;
+                }
+            }
+
+            if(do_id != INVALID_DO_ID && do_id <= m_max_id) {
+                ObjectEntry entry;
+                entry.dc_id = operation->dclass()->get_id();
+                if(write_object(do_id, entry, operation->set_fields())) {
+                    m_free_ids -= interval_t::closed(do_id, do_id);
+                    m_index[do_id] = entry;
+                } else {
+                    do_id = INVALID_DO_ID;
+                }
+            } else {
+                do_id = INVALID_DO_ID;
+                out_of_ids = true;
+            }
+        }
+
+        if(out_of_ids) {
+            operation->on_out_of_ids();
+        } else if(do_id == INVALID_DO_ID) {
+            operation->on_failure();
+        } else {
+            operation->on_complete(do_id);
+        }
+    }
+
+    void delete_object(DBOperation *operation)
+    {
+        bool deleted = true;
+        {
+            lock_guard<mutex> lock(m_lock);
+            auto it = m_index.find(operation->doid());
+            if(it != m_index.end()) {
+                DatagramPtr body = Datagram::create();
+                body->add_uint8(RECORD_DELETE);
+                body->add_doid(it->first);
+
+                uint64_t offset;
+                deleted = append(body, offset);
+                if(deleted) {
+                    // Both the object's records and the tombstone are garbage once compacted
+                    m_garbage += it->second.size + RECORD_HEADER_SIZE + body->size();
+                    m_free_ids += interval_t::closed(it->first, it->first);
+                    m_index.erase(it);
+                    check_garbage();
+                }
+            }
+        }
+
+        if(deleted) {
+            operation->on_complete();
+        } else {
+            operation->on_failure();
+        }
+    }
+
+    void get_object(DBOperation *operation)
+    {
+        DBObjectSnapshot *snapshot = nullptr;
+        {
+            lock_guard<mutex> lock(m_lock);
+            auto it = m_index.find(operation->doid());
+            if(it != m_index.end()) {
+                const Class *dcc = g_dcf->get_class_by_id(it->second.dc_id);
+                if(dcc && operation->verify_class(dcc)) {
+                    snapshot = new DBObjectSnapshot();
+                    snapshot->m_dclass = dcc;
+                    if(!read_object(m_in, it->first, it->second, snapshot->m_fields)) {
+                        delete snapshot;
+                        snapshot = nullptr;
+                    }
+                }
+            }
+        }
+
+        if(snapshot) {
+            operation->on_complete(snapshot);
+        } else {
+            operation->on_failure();
+        }
+    }
+
+    // get_objects reads several objects while taking the lock once, in the order they're
+    // stored in the binlog rather than the order they were asked for.
+    void get_objects(const vector<DBOperation*> &operations)
+    {
+        vector<pair<uint64_t, size_t> > order;
+        vector<DBObjectSnapshot*> snapshots(operations.size(), nullptr);
+        {
+            lock_guard<mutex> lock(m_lock);
+            for(size_t i = 0; i < operations.size(); ++i) {
+                auto it = m_index.find(operations[i]->doid());
+                if(it != m_index.end()) {
+                    order.push_back(make_pair(it->second.records.front(), i));
+                }
+            }
+            sort(order.begin(), order.end());
+
+            for(auto o_it = order.begin(); o_it != order.end(); ++o_it) {
+                DBOperation *operation = operations[o_it->second];
+                const ObjectEntry &entry = m_index[operation->doid()];
+                const Class *dcc = g_dcf->get_class_by_id(entry.dc_id);
+                if(!dcc || !operation->verify_class(dcc)) {
+                    continue;
+                }
+
+                DBObjectSnapshot *snapshot = new DBObjectSnapshot();
+                snapshot->m_dclass = dcc;
+                if(read_object(m_in, operation->doid(), entry, snapshot->m_fields)) {
+                    snapshots[o_it->second] = snapshot;
+                } else {
+                    delete snapshot;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < operations.size(); ++i) {
+            if(snapshots[i]) {
+                operations[i]->on_complete(snapshots[i]);
+            } else {
+                operations[i]->on_failure();
+            }
+        }
+    }
+
+    // set_fields carries out a SET_FIELDS, or an UPDATE_FIELDS if its criteria are met.
+    void set_fields(DBOperation *operation)
+    {
+        bool written = false;
+        DBObjectSnapshot *mismatch = nullptr;
+        {
+            lock_guard<mutex> lock(m_lock);
+            auto it = m_index.find(operation->doid());
+            const Class *dcc = nullptr;
+            if(it != m_index.end()) {
+                dcc = g_dcf->get_class_by_id(it->second.dc_id);
+            }
+
+            FieldValues current;
+            bool valid = dcc && operation->verify_class(dcc);
+            if(valid && operation->type() == DBOperation::UPDATE_FIELDS) {
+                valid = read_object(m_in, it->first, it->second, current);
+
+                // An empty criterion means that the field must have no value
+                const FieldValues &criteria = operation->criteria_fields();
+                for(auto c_it = criteria.begin(); valid && c_it != criteria.end(); ++c_it) {
+                    auto current_it = current.find(c_it->first);
+                    if(current_it == current.end() ? !c_it->second.empty()
+                       : current_it->second != c_it->second) {
+                        mismatch = new DBObjectSnapshot();
+                        mismatch->m_dclass = dcc;
+                        mismatch->m_fields = current;
+                        valid = false;
+                    }
+                }
+            }
+
+            if(valid) {
+                written = write_fields(it->first, it->second, operation->set_fields());
+            }
+        }
+
+        if(written) {
+            operation->on_complete();
+        } else if(mismatch) {
+            operation->on_criteria_mismatch(mismatch);
+        } else {
+            operation->on_failure();
+        }
+    }
+
+    // write_object appends a record of all of an object's fields, and points its entry at it.
+    bool write_object(doid_t do_id, ObjectEntry &entry, const FieldValues &fields)
+    {
+        DatagramPtr body = object_record(do_id, entry.dc_id, fields);
+        uint64_t offset;
+        if(!append(body, offset)) {
+            return false;
+        }
+
+        entry.records.assign(1, offset);
+        entry.size = RECORD_HEADER_SIZE + body->size();
+        return true;
+    }
+
+    // write_fields appends a record of changes to an object's fields.
+    bool write_fields(doid_t do_id, ObjectEntry &entry, const FieldValues &fields)
+    {
+        DatagramPtr body = Datagram::create();
+        body->add_uint8(RECORD_FIELDS);
+        body->add_doid(do_id);
+        add_fields(body, fields, true);
+
+        uint64_t offset;
+        if(!append(body, offset)) {
+            return false;
+        }
+        entry.records.push_back(offset);
+        entry.size += RECORD_HEADER_SIZE + body->size();
+
+        // Keep reads quick by merging the object's records once there are many of them
+        if(entry.records.size() > MAX_FIELD_RECORDS) {
+            FieldValues merged;
+            uint64_t old_size = entry.size;
+            if(read_object(m_in, do_id, entry, merged) && write_object(do_id, entry, merged)) {
+                m_garbage += old_size;
+            }
+        }
+
+        check_garbage();
+        return true;
+    }
+
+    // append writes a record to the end of the binlog, and sets offset to where it was written.
+    bool append(DatagramHandle body, uint64_t &offset)
+    {
+        if(!write_record(m_out, body)) {
+            m_log->error() << "Failed to write to " << m_filename << endl;
+
+            // Drop whatever was partially written, so the next record follows the last good one
+            m_out.close();
+            boost::system::error_code ec;
+            boost::filesystem::resize_file(m_filename, m_file_size, ec);
+            open_file();
+            return false;
+        }
+
+        offset = m_file_size;
+        m_file_size += RECORD_HEADER_SIZE + body->size();
+        return true;
+    }
+
+    // check_garbage wakes the compaction thread if enough of the binlog is garbage.
+    void check_garbage()
+    {
+        if(m_compact_thread && !m_compact_wanted && m_file_size >= m_min_size &&
+           m_garbage * 100 >= m_file_size * m_garbage_percent) {
+            m_compact_wanted = true;
+            m_compact_cv.notify_one();
+        }
+    }
+
+    // open_file opens the binlog to read and append records.
+    void open_file()
+    {
+        m_out.open(m_filename, ios::binary | ios::app);
+        m_in.open(m_filename, ios::binary);
+        if(!m_out.is_open() || !m_in.is_open()) {
+            m_log->fatal() << "Could not open " << m_filename << endl;
+            astron_shutdown(1);
+        }
+    }
+
+    // recover builds the index from the binlog, creating it if it doesn't exist.  If astrond
+    // died while writing a record, the file is truncated to the end of the last intact record;
+    // a bad record anywhere else is fatal.
+    void recover()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(m_filename + ".tmp", ec); // left over from a compaction
+
+        if(!boost::filesystem::exists(m_filename)) {
+            ofstream out(m_filename, ios::binary);
+            if(!write_header(out)) {
+                m_log->fatal() << "Could not create " << m_filename << endl;
+                astron_shutdown(1);
+            }
+            m_file_size = BINLOG_HEADER_SIZE;
+            return;
+        }
+
+        ifstream in(m_filename, ios::binary);
+        if(!read_header(in)) {
+            m_log->fatal() << m_filename << " is not a binlog database for this build of astrond."
+                           << endl;
+            astron_shutdown(1);
+        }
+
+        uint64_t offset = BINLOG_HEADER_SIZE;
+        vector<uint8_t> body;
+        bool applied = true;
+        while(read_record(in, offset, body)) {
+            if(!apply_record(m_index, m_garbage, offset, body)) {
+                applied = false;
+                break;
+            }
+            offset += RECORD_HEADER_SIZE + body.size();
+        }
+
+        uint64_t size = boost::filesystem::file_size(m_filename);
+        if(offset < size) {
+            // Only the last record can have been cut short by a crash; anything else is
+            // corruption, which truncating would silently turn into lost objects.
+            if(!applied || !is_torn_tail(in, offset, size)) {
+                m_log->fatal() << "Corrupt record at offset " << offset << " of " << m_filename
+                               << ", which is not the end of the file." << endl;
+                astron_shutdown(1);
+            }
+            m_log->warning() << "Discarding " << size - offset << " bytes of incomplete records"
+                             " from the end of " << m_filename << endl;
+            in.close();
+            boost::filesystem::resize_file(m_filename, offset);
+        }
+        m_file_size = offset;
+
+        m_log->info() << "Loaded " << m_index.size() << " objects from " << m_filename << endl;
+    }
+
+    // run_compaction compacts the binlog whenever enough of it becomes garbage.
+    void run_compaction()
+    {
+        unsigned int retry_seconds = COMPACT_RETRY_SECONDS;
+        unique_lock<mutex> lock(m_lock);
+        while(true) {
+            m_compact_cv.wait(lock, [this]() {
+                return m_stopping || m_compact_wanted;
+            });
+            if(m_stopping) {
+                return;
+            }
+
+            if(compact(lock)) {
+                retry_seconds = COMPACT_RETRY_SECONDS;
+            } else {
+                // Whatever went wrong (e.g. a full disk) won't have cleared up by the next write,
+                // so wait before trying again.  Writes can't wake us while m_compact_wanted is set.
+                m_log->warning() << "Retrying compaction in " << retry_seconds << " seconds."
+                                 << endl;
+                m_compact_cv.wait_for(lock, chrono::seconds(retry_seconds), [this]() {
+                    return m_stopping;
+                });
+                retry_seconds = min(retry_seconds * 2, COMPACT_RETRY_MAX_SECONDS);
+            }
+            m_compact_wanted = false;
+        }
+    }
+
+    void stop_compaction()
+    {
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_stopping = true;
+            m_compact_cv.notify_all();
+        }
+        m_compact_thread->join();
+        delete m_compact_thread;
+        m_compact_thread = nullptr;
+    }
+
+    // compact rewrites the binlog with one record for each object.  The objects are copied
+    // without holding the lock; the records written in the meantime are then copied across
+    // with it held, before the new file replaces the old one.  Returns false if it failed.
+    bool compact(unique_lock<mutex> &lock)
+    {
+        ObjectIndex objects = m_index;
+        uint64_t copied_end = m_file_size;
+        uint64_t old_size = m_file_size;
+        lock.unlock();
+
+        string temp_file = m_filename + ".tmp";
+        ofstream out(temp_file, ios::binary | ios::trunc);
+        ifstream in(m_filename, ios::binary);
+        bool ok = write_header(out);
+
+        ObjectIndex index;
+        uint64_t size = BINLOG_HEADER_SIZE, garbage = 0;
+        for(auto it = objects.begin(); ok && it != objects.end(); ++it) {
+            FieldValues fields;
+            ok = read_object(in, it->first, it->second, fields);
+            if(!ok) {
+                break;
+            }
+
+            DatagramPtr body = object_record(it->first, it->second.dc_id, fields);
+            ok = write_record(out, body);
+
+            ObjectEntry &entry = index[it->first];
+            entry.dc_id = it->second.dc_id;
+            entry.records.assign(1, size);
+            entry.size = RECORD_HEADER_SIZE + body->size();
+            size += entry.size;
+        }
+
+        lock.lock();
+        vector<uint8_t> body;
+        for(uint64_t offset = copied_end; ok && offset < m_file_size;
+            offset += RECORD_HEADER_SIZE + body.size()) {
+            ok = read_record(m_in, offset, body) && apply_record(index, garbage, size, body);
+            if(ok) {
+                ok = write_record(out, Datagram::create(body));
+                size += RECORD_HEADER_SIZE + body.size();
+            }
+        }
+        out.close();
+
+        // The new file has to be on disk before it replaces the old one, and the rename has to
+        // be on disk before anything is appended to it, or a power loss could lose both.
+        boost::system::error_code ec;
+        if(ok && !out.fail() && sync_file(temp_file)) {
+            m_out.close();
+            m_in.close();
+            boost::filesystem::rename(temp_file, m_filename, ec);
+            if(!ec && !sync_directory(boost::filesystem::path(m_filename).parent_path().string())) {
+                m_log->warning() << "Could not sync the directory of " << m_filename << endl;
+            }
+            open_file();
+        } else {
+            ok = false;
+        }
+        if(!ok || out.fail() || ec) {
+            m_log->error() << "Failed to compact " << m_filename << endl;
+            boost::filesystem::remove(temp_file, ec);
+            return false;
+        }
+
+        m_index.swap(index);
+        m_file_size = size;
+        m_garbage = garbage;
+        m_log->info() << "Compacted " << m_filename << " from " << old_size << " to "
+                      << m_file_size << " bytes." << endl;
+        return true;
+    }
+
+    // apply_record updates an index with a record read from the binlog at offset.
+    // Returns false if the record is malformed.
+    bool apply_record(ObjectIndex &index, uint64_t &garbage, uint64_t offset,
+                      const vector<uint8_t> &body)
+    {
+        uint64_t size = RECORD_HEADER_SIZE + body.size();
+        try {
+            DatagramIterator dgi(Datagram::create(body));
+            uint8_t type = dgi.read_uint8();
+            doid_t do_id = dgi.read_doid();
+            auto it = index.find(do_id);
+            switch(type) {
+            case RECORD_OBJECT:
+                if(it != index.end()) {
+                    garbage += it->second.size;
+                }
+                index[do_id].dc_id = dgi.read_uint16();
+                index[do_id].records.assign(1, offset);
+                index[do_id].size = size;
+                break;
+            case RECORD_FIELDS:
+                if(it == index.end()) {
+                    garbage += size;
+                } else {
+                    it->second.records.push_back(offset);
+                    it->second.size += size;
+                }
+                break;
+            case RECORD_DELETE:
+                garbage += size;
+                if(it != index.end()) {
+                    garbage += it->second.size;
+                    index.erase(it);
+                }
+                break;
+            default:
+                return false;
+            }
+        } catch(DatagramIteratorEOF&) {
+            return false;
+        }
+
+        return true;
+    }
+
+    // read_object merges an object's records into its current field values.
+    bool read_object(ifstream &in, doid_t do_id, const ObjectEntry &entry, FieldValues &fields)
+    {
+        vector<uint8_t> body;
+        for(auto it = entry.records.begin(); it != entry.records.end(); ++it) {
+            if(!read_record(in, *it, body)) {
+                m_log->error() << "Could not read a record of object " << do_id << " at offset "
+                               << *it << " of " << m_filename << endl;
+                return false;
+            }
+
+            try {
+                DatagramIterator dgi(Datagram::create(body));
+                if(dgi.read_uint8() == RECORD_OBJECT) {
+                    dgi.read_doid();
+                    dgi.read_uint16(); // dc_id
+                } else {
+                    dgi.read_doid();
+                }
+
+                uint16_t field_count = dgi.read_uint16();
+                for(uint16_t i = 0; i < field_count; ++i) {
+                    const Field *field = g_dcf->get_field_by_id(dgi.read_uint16());
+                    vector<uint8_t> value = dgi.read_blob();
+                    if(!field) {
+                        continue; // the field has been removed from the dc file
+                    } else if(value.empty()) {
+                        fields.erase(field);
+                    } else {
+                        fields[field] = value;
+                    }
+                }
+            } catch(DatagramIteratorEOF&) {
+                m_log->error() << "Malformed record of object " << do_id << " at offset "
+                               << *it << " of " << m_filename << endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // object_record returns the body of a record holding all of an object's fields.
+    static DatagramPtr object_record(doid_t do_id, uint16_t dc_id, const FieldValues &fields)
+    {
+        DatagramPtr body = Datagram::create();
+        body->add_uint8(RECORD_OBJECT);
+        body->add_doid(do_id);
+        body->add_uint16(dc_id);
+        add_fields(body, fields, false);
+        return body;
+    }
+
+    // add_fields adds a field count followed by the fields; empty values are only kept if
+    // keep_empty is set, in which case they clear the field.
+    static void add_fields(DatagramPtr body, const FieldValues &fields, bool keep_empty)
+    {
+        uint16_t field_count = 0;
+        for(auto it = fields.begin(); it != fields.end(); ++it) {
+            if(keep_empty || !it->second.empty()) {
+                ++field_count;
+            }
+        }
+
+        body->add_uint16(field_count);
+        for(auto it = fields.begin(); it != fields.end(); ++it) {
+            if(keep_empty || !it->second.empty()) {
+                body->add_uint16(it->first->get_id());
+                body->add_blob(it->second);
+            }
+        }
+    }
+
+    static uint32_t checksum(const uint8_t *data, size_t length)
+    {
+        boost::crc_32_type crc;
+        crc.process_bytes(data, length);
+        return crc.checksum();
+    }
+
+    static bool write_header(ostream &out)
+    {
+        DatagramPtr header = Datagram::create();
+        header->add_data((const uint8_t*)BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+        header->add_uint16(BINLOG_VERSION);
+        header->add_uint16(sizeof(doid_t));
+        out.write((const char*)header->get_data(), header->size());
+        out.flush();
+        return !out.fail();
+    }
+
+    static bool read_header(istream &in)
+    {
+        vector<uint8_t> header(BINLOG_HEADER_SIZE);
+        if(!in.read((char*)&header[0], header.size())) {
+            return false;
+        }
+
+        DatagramIterator dgi(Datagram::create(header));
+        vector<uint8_t> magic = dgi.read_data(sizeof(BINLOG_MAGIC));
+        return equal(magic.begin(), magic.end(), BINLOG_MAGIC) &&
+               dgi.read_uint16() == BINLOG_VERSION && dgi.read_uint16() == sizeof(doid_t);
+    }
+
+    // write_record writes a record with the given body, and flushes it to the file.
+    static bool write_record(ostream &out, DatagramHandle body)
+    {
+        DatagramPtr header = Datagram::create();
+        header->add_uint32(body->size());
+        header->add_uint32(checksum(body->get_data(), body->size()));
+        out.write((const char*)header->get_data(), header->size());
+        out.write((const char*)body->get_data(), body->size());
+        out.flush();
+        return !out.fail();
+    }
+
+    // read_record reads the body of the record at offset, checking its length and checksum.
+    // Returns false if there isn't an intact record there.
+    static bool read_record(istream &in, uint64_t offset, vector<uint8_t> &body)
+    {
+        vector<uint8_t> header(RECORD_HEADER_SIZE);
+        in.clear();
+        in.seekg(offset);
+        if(!in.read((char*)&header[0], header.size())) {
+            return false;
+        }
+
+        DatagramIterator dgi(Datagram::create(header));
+        uint32_t length = dgi.read_uint32();
+        uint32_t crc = dgi.read_uint32();
+        if(length < 1 + sizeof(doid_t) || length > DGSIZE_MAX) {
+            return false;
+        }
+
+        body.resize(length);
+        if(!in.read((char*)&body[0], length)) {
+            return false;
+        }
+        return checksum(&body[0], length) == crc;
+    }
+
+    // is_torn_tail returns true if the record at offset runs to or past the end of a file of
+    // the given size, as the last record does if astrond died while writing it.
+    static bool is_torn_tail(istream &in, uint64_t offset, uint64_t size)
+    {
+        vector<uint8_t> header(RECORD_HEADER_SIZE);
+        in.clear();
+        in.seekg(offset);
+        if(!in.read((char*)&header[0], header.size())) {
+            return true;
+        }
+
+        DatagramIterator dgi(Datagram::create(header));
+        uint32_t length = dgi.read_uint32();
+        return offset + RECORD_HEADER_SIZE + length >= size;
+    }
+};
+
+static string binlog_storage(ConfigNode config)
+{
+    return binlog_filename.get_rval(config);
+}
+
+DBBackendFactoryItem<BinlogDatabase> binlogdb_factory("binlog", binlog_storage);
@@ -1,10 +1,16 @@
 #include "DBBackendFactory.h"
 
-BaseDBBackendFactoryItem::BaseDBBackendFactoryItem(const std::string &name)
+BaseDBBackendFactoryItem::BaseDBBackendFactoryItem(const std::string &name,
+        StorageFunction storage) : m_storage(storage)
 {
     DBBackendFactory::singleton().add_backend(name, this);
 }
 
+std::string BaseDBBackendFactoryItem::get_storage(ConfigNode config)
+{
+    return m_storage ? m_storage(config) : "";
+}
+
 DBBackendFactory& DBBackendFactory::singleton()
 {
     static DBBackendFactory* fact = new DBBackendFactory();
@@ -33,3 +39,13 @@ bool DBBackendFactory::has_backend(const std::string &name)
 {
     return m_factories.find(name) != m_factories.end();
 }
+
+// get_storage returns where a backend of type 'backend_name' keeps its objects.
+std::string DBBackendFactory::get_storage(const std::string &backend_name, ConfigNode config)
+{
+    auto it = m_factories.find(backend_name);
+    if(it == m_factories.end()) {
+        return "";
+    }
+    return it->second->get_storage(config);
+}
@@ -5,23 +5,35 @@
 #include <string>
 #include <cstdint>
 
+// A StorageFunction returns where a backend with the given config keeps its objects,
+//     such as a file or directory name.
+typedef std::string (*StorageFunction)(ConfigNode config);
+
 // A BaseDBBackendFactoryItem is a common ancestor that all
 //     DatabaseBackend factory templates inherit from.
 class BaseDBBackendFactoryItem
 {
   public:
     virtual DatabaseBackend* instantiate(ConfigNode config, doid_t min_id, doid_t max_id) = 0;
+
+    // get_storage returns where a backend with the given config keeps its objects,
+    //     or an empty string if that isn't known.
+    std::string get_storage(ConfigNode config);
   protected:
-    BaseDBBackendFactoryItem(const std::string &name);
+    BaseDBBackendFactoryItem(const std::string &name, StorageFunction storage);
+  private:
+    StorageFunction m_storage;
 };
 
 // A DBBackendFactoryItem is the factory for a particular database backend.
 // Each new role should declare a DBBackendFactoryItem<BackendClass>("BackendName");
+// a backend which keeps its objects in a file or directory should also give a StorageFunction.
 template<class T>
 class DBBackendFactoryItem : public BaseDBBackendFactoryItem
 {
   public:
-    DBBackendFactoryItem(const std::string& name) : BaseDBBackendFactoryItem(name)
+    DBBackendFactoryItem(const std::string& name, StorageFunction storage = nullptr) :
+        BaseDBBackendFactoryItem(name, storage)
     {
     }
 
@@ -49,6 +61,10 @@ class DBBackendFactory
     // has_backend returns true if a backend exists for 'name'.
     bool has_backend(const std::string &name);
 
+    // get_storage returns where a backend of type 'backend_name' keeps its objects,
+    //     or an empty string if that isn't known.
+    std::string get_storage(const std::string &backend_name, ConfigNode config);
+
   private:
     std::map<std::string, BaseDBBackendFactoryItem*> m_factories;
 };
@@ -236,11 +236,14 @@ bool DBOperationDelete::initialize(channel_t sender, uint16_t, DatagramIterator
 
 void DBOperationDelete::on_failure()
 {
+    m_dbserver->finish_write(this, false);
     cleanup();
 }
 
 void DBOperationDelete::on_complete()
 {
+    m_dbserver->finish_write(this, true);
+
     // Broadcast update to object's channel
     if(m_dbserver->m_broadcast) {
         DatagramPtr update = Datagram::create();
@@ -307,6 +310,8 @@ void DBOperationGet::on_failure()
 
 void DBOperationGet::on_complete(DBObjectSnapshot *snapshot)
 {
+    m_dbserver->cache_result(this, snapshot);
+
     DatagramPtr resp = Datagram::create();
     resp->add_server_header(m_sender, m_dbserver->m_control_channel,
                             m_resp_msgtype);
@@ -362,6 +367,132 @@ void DBOperationGet::on_complete(DBObjectSnapshot *snapshot)
     cleanup();
 }
 
+// Leave room in each response for the server header, context, and count
+static const dgsize_t GET_MULTI_CHUNK_SIZE = DGSIZE_MAX - 64;
+
+bool DBOperationGetMulti::initialize(channel_t sender, uint16_t, DatagramIterator &dgi)
+{
+    m_sender = sender;
+    m_context = dgi.read_uint32();
+
+    uint16_t count = dgi.read_uint16();
+    m_doids.reserve(count);
+    for(uint16_t i = 0; i < count; ++i) {
+        m_doids.push_back(dgi.read_doid());
+    }
+
+    m_snapshots.resize(count, nullptr);
+    m_remaining = count + 1;
+    return true;
+}
+
+void DBOperationGetMulti::submit()
+{
+    vector<DBOperation*> parts;
+    parts.reserve(m_doids.size());
+    for(size_t i = 0; i < m_doids.size(); ++i) {
+        parts.push_back(new Part(this, i));
+    }
+    m_dbserver->submit_batch(parts);
+
+    // Every part has been handed to the backend, release our own reference
+    complete_part(m_doids.size(), nullptr);
+}
+
+void DBOperationGetMulti::complete_part(size_t index, DBObjectSnapshot *snapshot)
+{
+    if(index < m_snapshots.size()) {
+        m_snapshots[index] = snapshot;
+    }
+
+    if(--m_remaining == 0) {
+        send_response();
+        delete this;
+    }
+}
+
+void DBOperationGetMulti::send_response()
+{
+    // The response is split into as many datagrams as are needed to stay within
+    // the maximum datagram size; each carries the count of the objects it contains.
+    vector<DatagramPtr> records;
+    dgsize_t chunk_size = 0;
+    auto flush = [&]() {
+        DatagramPtr resp = Datagram::create();
+        resp->add_server_header(m_sender, m_dbserver->m_control_channel,
+                                DBSERVER_OBJECT_GET_ALL_MULTI_RESP);
+        resp->add_uint32(m_context);
+        resp->add_uint16(records.size());
+        for(auto it = records.begin(); it != records.end(); ++it) {
+            resp->add_data(*it);
+        }
+        m_dbserver->route_datagram(resp);
+        records.clear();
+        chunk_size = 0;
+    };
+
+    for(size_t i = 0; i < m_doids.size(); ++i) {
+        DBObjectSnapshot *snapshot = m_snapshots[i];
+
+        DatagramPtr record = Datagram::create();
+        record->add_doid(m_doids[i]);
+        if(snapshot) {
+            size_t size = sizeof(doid_t) + 5;
+            for(auto it = snapshot->m_fields.begin(); it != snapshot->m_fields.end(); ++it) {
+                size += 2 + it->second.size();
+            }
+
+            if(size <= GET_MULTI_CHUNK_SIZE) {
+                record->add_uint8(SUCCESS);
+                record->add_uint16(snapshot->m_dclass->get_id());
+                record->add_uint16(snapshot->m_fields.size());
+                for(auto it = snapshot->m_fields.begin(); it != snapshot->m_fields.end(); ++it) {
+                    record->add_uint16(it->first->get_id());
+                    record->add_data(it->second);
+                }
+            } else {
+                m_dbserver->m_log->warning() << "Object " << m_doids[i] << " is too large"
+                                             << " to be included in a GET_ALL_MULTI response.\n";
+                record->add_uint8(FAILURE);
+            }
+            delete snapshot;
+        } else {
+            record->add_uint8(FAILURE);
+        }
+
+        if(chunk_size + record->size() > GET_MULTI_CHUNK_SIZE) {
+            flush();
+        }
+        chunk_size += record->size();
+        records.push_back(record);
+    }
+
+    if(!records.empty() || m_doids.empty()) {
+        flush();
+    }
+}
+
+DBOperationGetMulti::Part::Part(DBOperationGetMulti *multi, size_t index) :
+    DBOperation(multi->m_dbserver), m_multi(multi), m_index(index)
+{
+    m_sender = multi->m_sender;
+    m_type = GET_OBJECT;
+    m_doid = multi->m_doids[index];
+}
+
+void DBOperationGetMulti::Part::on_complete(DBObjectSnapshot *snapshot)
+{
+    m_dbserver->cache_result(this, snapshot);
+    m_multi->complete_part(m_index, snapshot);
+    cleanup();
+}
+
+void DBOperationGetMulti::Part::on_failure()
+{
+    m_multi->complete_part(m_index, nullptr);
+    cleanup();
+}
+
 bool DBOperationSet::initialize(channel_t sender, uint16_t msg_type, DatagramIterator &dgi)
 {
     m_sender = sender;
@@ -402,6 +533,8 @@ bool DBOperationSet::verify_class(const dclass::Class *dclass)
 
 void DBOperationSet::on_complete()
 {
+    m_dbserver->finish_write(this, true);
+
     // Broadcast update to object's channel
     if(m_dbserver->m_broadcast) {
         announce_fields(m_set_fields);
@@ -412,6 +545,7 @@ void DBOperationSet::on_complete()
 
 void DBOperationSet::on_failure()
 {
+    m_dbserver->finish_write(this, false);
     cleanup();
 }
 
@@ -471,6 +605,8 @@ bool DBOperationUpdate::verify_class(const dclass::Class *dclass)
 
 void DBOperationUpdate::on_complete()
 {
+    m_dbserver->finish_write(this, true);
+
     // Broadcast update to object's channel
     if(m_dbserver->m_broadcast) {
         announce_fields(m_set_fields);
@@ -489,6 +625,8 @@ void DBOperationUpdate::on_complete()
 
 void DBOperationUpdate::on_failure()
 {
+    m_dbserver->finish_write(this, false);
+
     DatagramPtr resp = Datagram::create();
     resp->add_server_header(m_sender, m_dbserver->m_control_channel,
                             m_resp_msgtype);
@@ -501,6 +639,9 @@ void DBOperationUpdate::on_failure()
 
 void DBOperationUpdate::on_criteria_mismatch(DBObjectSnapshot *snapshot)
 {
+    // The cache would have answered this itself if it held the object's current values
+    m_dbserver->finish_write(this, false);
+
     DatagramPtr resp = Datagram::create();
     resp->add_server_header(m_sender, m_dbserver->m_control_channel,
                             m_resp_msgtype);
@@ -1,6 +1,8 @@
 #pragma once
+#include <atomic>
 #include <set>
 #include <map>
+#include <vector>
 
 #include "core/types.h"
 #include "core/objtypes.h"
@@ -138,6 +140,13 @@ class DBOperation
     //   for the class.
     virtual void on_failure() { }
 
+    // This is used when a CREATE_OBJECT fails because the backend has no ids
+    // left to give the new object.  By default, it is treated as any other failure.
+    virtual void on_out_of_ids()
+    {
+        on_failure();
+    }
+
     // This is used in the case of UPDATE_FIELDS operations where the fields
     // in m_criteria_fields were NOT satisfied. The backend provides a snapshot
     // of the current values to be sent back to the client.
@@ -176,6 +185,11 @@ class DBOperation
     // The fields that must be equal (or absent) for the change to complete atomically.
     FieldValues m_criteria_fields;
 
+    // m_cache_read is set on reads which missed the dbserver's cache, so that their result
+    // is cached; m_cache_write on writes which hold back cached reads of their object.
+    bool m_cache_read = false;
+    bool m_cache_write = false;
+
     void cleanup();
     bool verify_fields(const dclass::Class *dclass, const FieldSet& fields);
     bool verify_fields(const dclass::Class *dclass, const FieldValues& fields);
@@ -183,6 +197,8 @@ class DBOperation
     bool populate_set_fields(DatagramIterator &dgi, uint16_t field_count,
                              bool deletes = false, bool values = false);
     bool populate_get_fields(DatagramIterator &dgi, uint16_t field_count);
+
+    friend class DatabaseServer;
 };
 
 class DBOperationCreate : public DBOperation
@@ -240,3 +256,46 @@ class DBOperationUpdate : public DBOperation
     uint32_t m_context;
     uint16_t m_resp_msgtype;
 };
+
+// DBOperationGetMulti answers a DBSERVER_OBJECT_GET_ALL_MULTI. It is not itself an operation
+// on the backend; instead it submits a GET_OBJECT operation for each requested object, and
+// responds once all of them have completed.
+class DBOperationGetMulti
+{
+  public:
+    DBOperationGetMulti(DatabaseServer *db) : m_dbserver(db) { }
+    bool initialize(channel_t sender, uint16_t msg_type, DatagramIterator &dgi);
+    // submit passes the operation for each object to the dbserver. The DBOperationGetMulti
+    // deletes itself once the response has been sent, which may happen before submit returns.
+    void submit();
+
+  private:
+    // A Part is the GET_OBJECT operation for one of the requested objects.
+    class Part : public DBOperation
+    {
+      public:
+        Part(DBOperationGetMulti *multi, size_t index);
+        virtual bool initialize(channel_t, uint16_t, DatagramIterator &)
+        {
+            return true;
+        }
+        virtual void on_complete(DBObjectSnapshot *snapshot);
+        virtual void on_failure();
+
+      private:
+        DBOperationGetMulti *m_multi;
+        size_t m_index;
+    };
+
+    DatabaseServer *m_dbserver;
+    channel_t m_sender;
+    uint32_t m_context;
+    std::vector<doid_t> m_doids;
+    std::vector<DBObjectSnapshot*> m_snapshots; // nullptr if the object couldn't be loaded
+    // m_remaining counts the parts which haven't completed, plus one while still submitting
+    std::atomic<size_t> m_remaining;
+
+    // complete_part stores the result of a part, and responds if it was the last one.
+    void complete_part(size_t index, DBObjectSnapshot *snapshot);
+    void send_response();
+};
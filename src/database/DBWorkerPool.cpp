@@ -0,0 +1,128 @@
+#include "DBWorkerPool.h"
+
+DBWorkerPool::DBWorkerPool(DatabaseBackend *backend, unsigned int num_workers) :
+    m_backend(backend)
+{
+    for(unsigned int i = 0; i < num_workers; ++i) {
+        m_workers.push_back(std::thread(&DBWorkerPool::run_worker, this));
+    }
+}
+
+DBWorkerPool::~DBWorkerPool()
+{
+    shutdown();
+}
+
+void DBWorkerPool::submit(DBOperation *operation)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if(m_workers.empty() || m_stopping) {
+        lock.unlock();
+        m_backend->submit(operation);
+        return;
+    }
+
+    // Creations have no object yet, so nothing can be ordered after them
+    if(operation->type() != DBOperation::CREATE_OBJECT) {
+        auto blocked_it = m_blocked.find(operation->doid());
+        if(blocked_it != m_blocked.end()) {
+            blocked_it->second.push_back(operation);
+            return;
+        }
+        m_blocked[operation->doid()];
+    }
+
+    m_ready.push_back(std::vector<DBOperation*>(1, operation));
+    m_cv.notify_one();
+}
+
+void DBWorkerPool::submit_batch(const std::vector<DBOperation*> &operations)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if(m_workers.empty() || m_stopping) {
+        lock.unlock();
+        m_backend->submit_split_batch(operations);
+        return;
+    }
+
+    // Operations which have to wait (including for one earlier in the same batch)
+    // are run on their own once released.
+    std::vector<DBOperation*> batch;
+    for(auto it = operations.begin(); it != operations.end(); ++it) {
+        auto blocked_it = m_blocked.find((*it)->doid());
+        if(blocked_it != m_blocked.end()) {
+            blocked_it->second.push_back(*it);
+            continue;
+        }
+        m_blocked[(*it)->doid()];
+        batch.push_back(*it);
+    }
+
+    if(!batch.empty()) {
+        m_ready.push_back(std::move(batch));
+        m_cv.notify_one();
+    }
+}
+
+void DBWorkerPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+        m_cv.notify_all();
+    }
+
+    for(auto it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->join();
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_workers.clear();
+}
+
+void DBWorkerPool::run_worker()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while(true) {
+        m_cv.wait(lock, [this]() {
+            return m_stopping || !m_ready.empty();
+        });
+
+        // Operations which are blocked are released by the worker running the
+        // operation ahead of them, so an empty ready queue means we're done.
+        if(m_ready.empty()) {
+            return;
+        }
+
+        std::vector<DBOperation*> operations = std::move(m_ready.front());
+        m_ready.pop_front();
+
+        // The operations may be deleted by the time submit returns
+        std::vector<doid_t> ordered;
+        for(auto it = operations.begin(); it != operations.end(); ++it) {
+            if((*it)->type() != DBOperation::CREATE_OBJECT) {
+                ordered.push_back((*it)->doid());
+            }
+        }
+
+        lock.unlock();
+        if(operations.size() == 1) {
+            m_backend->submit(operations.front());
+        } else {
+            m_backend->submit_batch(operations);
+        }
+        lock.lock();
+
+        // Release the next operation on each object, if there is one
+        for(auto it = ordered.begin(); it != ordered.end(); ++it) {
+            auto blocked_it = m_blocked.find(*it);
+            if(blocked_it->second.empty()) {
+                m_blocked.erase(blocked_it);
+            } else {
+                m_ready.push_back(std::vector<DBOperation*>(1, blocked_it->second.front()));
+                blocked_it->second.pop_front();
+                m_cv.notify_one();
+            }
+        }
+    }
+}
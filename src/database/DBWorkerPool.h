@@ -0,0 +1,48 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+#include "DatabaseBackend.h"
+
+// A DBWorkerPool runs DBOperations on a database backend from a set of worker threads,
+// so that slow operations don't hold up the thread which receives them.
+// Operations on the same object are run one at a time, in the order they were submitted;
+// operations on different objects, and object creations, may run concurrently.
+// The order is kept only until the backend's submit() returns, so a backend which
+// completes operations asynchronously must keep its own order.
+class DBWorkerPool
+{
+  public:
+    DBWorkerPool(DatabaseBackend *backend, unsigned int num_workers);
+    ~DBWorkerPool();
+
+    // submit queues an operation to be run by one of the workers.
+    void submit(DBOperation *operation);
+    // submit_batch queues several operations on existing objects.  Those which aren't waiting
+    // on an earlier operation are passed to the backend together, in one submit_batch.
+    // After shutdown, the batch is run immediately, split so that no part has two
+    // operations on the same object.
+    void submit_batch(const std::vector<DBOperation*> &operations);
+    // shutdown runs every queued operation, then stops the workers.  Operations submitted
+    // afterwards are run immediately, in the calling thread.
+    void shutdown();
+
+  private:
+    DatabaseBackend *m_backend;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    // m_ready holds the operations which may be run as soon as a worker is free; the
+    // operations of each entry are run together, and are all on different objects.
+    std::deque<std::vector<DBOperation*> > m_ready;
+    // m_blocked has an entry for each object with an operation running or ready,
+    // holding the operations on that object which must wait for it to finish.
+    std::unordered_map<doid_t, std::deque<DBOperation*> > m_blocked;
+
+    void run_worker();
+};
@@ -2,6 +2,7 @@
 #include "DatabaseServer.h"
 #include "DBBackendFactory.h"
 #include <string>
+#include <unordered_set>
 using namespace std;
 
 ConfigGroup db_backend_config("backend", dbserver_config);
@@ -13,3 +14,20 @@ bool have_backend(const string& backend)
 }
 ConfigConstraint<string> db_backend_exists(have_backend, db_backend_type,
         "No database backend exists for the given backend type.");
+
+void DatabaseBackend::submit_split_batch(const vector<DBOperation*> &operations)
+{
+    unordered_set<doid_t> doids;
+    auto start = operations.begin();
+    for(auto it = operations.begin(); it != operations.end(); ++it) {
+        if(!doids.insert((*it)->doid()).second) {
+            submit_batch(vector<DBOperation*>(start, it));
+            doids.clear();
+            doids.insert((*it)->doid());
+            start = it;
+        }
+    }
+    if(start != operations.end()) {
+        submit_batch(vector<DBOperation*>(start, operations.end()));
+    }
+}
@@ -22,6 +22,21 @@ class DatabaseBackend
     // same database object.
     virtual void submit(DBOperation *operation) = 0;
 
+    // submit_batch submits several operations at once, so that a backend which can carry
+    // them out together (with a single query, for example) may do so.  The operations are
+    // all on different objects, and none of them creates one.  By default, each operation
+    // is simply submitted on its own.
+    virtual void submit_batch(const std::vector<DBOperation*> &operations)
+    {
+        for(auto it = operations.begin(); it != operations.end(); ++it) {
+            submit(*it);
+        }
+    }
+
+    // submit_split_batch passes a batch which may have several operations on one object to
+    // submit_batch, split before each operation on an object already in the current part.
+    void submit_split_batch(const std::vector<DBOperation*> &operations);
+
   protected:
     ConfigNode m_config;
     doid_t m_min_id;
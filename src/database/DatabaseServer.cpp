@@ -6,6 +6,7 @@
 #include "config/constraints.h"
 #include "DatabaseBackend.h"
 #include "DBBackendFactory.h"
+#include "ShardedDatabase.h"
 
 using namespace std;
 
@@ -17,6 +18,7 @@ static ConfigVariable<bool> broadcast_updates("broadcast", true, dbserver_config
 static InvalidChannelConstraint control_not_invalid(control_channel);
 static ReservedChannelConstraint control_not_reserved(control_channel);
 static BooleanValueConstraint broadcast_is_boolean(broadcast_updates);
+static ConfigVariable<unsigned int> num_workers("workers", 0, dbserver_config);
 
 static ConfigGroup generate_config("generate", dbserver_config);
 static ConfigVariable<doid_t> min_id("min", INVALID_DO_ID, generate_config);
@@ -26,35 +28,303 @@ static InvalidDoidConstraint max_not_invalid(max_id);
 static ReservedDoidConstraint min_not_reserved(min_id);
 static ReservedDoidConstraint max_not_reserved(max_id);
 
+// ShardListConfig is a list of backend configs, each of which is validated like "backend".
+class ShardListConfig : public ConfigList
+{
+  public:
+    ShardListConfig(const string& name, ConfigGroup& parent) : ConfigList(name, parent) { }
+
+    virtual bool validate(ConfigNode node)
+    {
+        if(!node.IsSequence()) {
+            config_error("Section '" + m_path + "' expects a list of backends.");
+            return false;
+        }
+
+        bool ok = true;
+        map<string, size_t> storage;
+        size_t index = 0;
+        for(auto it = node.begin(); it != node.end(); ++it, ++index) {
+            if(!db_backend_config.validate(*it)) {
+                ok = false;
+                continue;
+            }
+
+            // Shards which kept their objects in the same place would overwrite each other's
+            string where = DBBackendFactory::singleton().get_storage(
+                               db_backend_type.get_rval(*it), *it);
+            if(where.empty()) {
+                continue;
+            }
+            auto found = storage.find(where);
+            if(found != storage.end()) {
+                stringstream ss;
+                ss << "Shards " << found->second << " and " << index << " of '" << m_path
+                   << "' both keep their objects in '" << where << "'.";
+                config_error(ss.str());
+                ok = false;
+            } else {
+                storage[where] = index;
+            }
+        }
+        return ok;
+    }
+};
+static ShardListConfig shards_config("shards", dbserver_config);
+
+static ConfigGroup cache_config("cache", dbserver_config);
+static ConfigVariable<uint64_t> cache_max_size("max_size", 0, cache_config);
+static ConfigVariable<unsigned int> cache_stats_interval("stats_interval", 0, cache_config);
+
 DatabaseServer::DatabaseServer(RoleConfig roleconfig) : Role(roleconfig),
+    m_cache(cache_max_size.get_rval(dbserver_config.get_child_node(cache_config, roleconfig))),
     m_control_channel(control_channel.get_rval(roleconfig)),
     m_min_id(min_id.get_rval(roleconfig)),
     m_max_id(max_id.get_rval(roleconfig)),
     m_broadcast(broadcast_updates.get_rval(roleconfig))
 {
-    ConfigNode generate = dbserver_config.get_child_node(generate_config, roleconfig);
-    ConfigNode backend = dbserver_config.get_child_node(db_backend_config, roleconfig);
-    m_db_backend = DBBackendFactory::singleton().instantiate_backend(
-                       db_backend_type.get_rval(backend), backend,
-                       min_id.get_rval(generate), max_id.get_rval(generate));
-
     // Initialize DatabaseServer log
     stringstream log_title;
     log_title << "Database(" << m_control_channel << ")";
     m_log = new LogCategory("db", log_title.str());
     set_con_name(log_title.str());
 
-    // Check to see the backend was instantiated
-    if(!m_db_backend) {
-        m_log->fatal() << "No database backend of type '"
-                       << db_backend_type.get_rval(backend) << "' exists." << endl;
-        astron_shutdown(1);
+    ConfigNode generate = dbserver_config.get_child_node(generate_config, roleconfig);
+    ConfigNode shards = dbserver_config.get_child_node(shards_config, roleconfig);
+    if(shards) {
+        init_shards(shards, min_id.get_rval(generate), max_id.get_rval(generate));
+    } else {
+        ConfigNode backend = dbserver_config.get_child_node(db_backend_config, roleconfig);
+        m_db_backend = DBBackendFactory::singleton().instantiate_backend(
+                           db_backend_type.get_rval(backend), backend,
+                           min_id.get_rval(generate), max_id.get_rval(generate));
+
+        // Check to see the backend was instantiated
+        if(!m_db_backend) {
+            m_log->fatal() << "No database backend of type '"
+                           << db_backend_type.get_rval(backend) << "' exists." << endl;
+            astron_shutdown(1);
+        }
+    }
+
+    // Run operations off of the MessageDirector's thread if configured to
+    unsigned int workers = num_workers.get_rval(roleconfig);
+    if(workers > 0) {
+        m_log->info() << "Running database operations on " << workers << " worker threads.\n";
+        m_workers = new DBWorkerPool(m_db_backend, workers);
+
+        // Finish any outstanding operations before exiting
+        astron_add_shutdown_hook([this]() {
+            m_workers->shutdown();
+            MessageDirector::singleton.flush();
+        });
+    }
+
+    if(m_cache.enabled()) {
+        ConfigNode cache = dbserver_config.get_child_node(cache_config, roleconfig);
+        m_cache_stats_interval = cache_stats_interval.get_rval(cache);
+        m_cache_stats_timer = new boost::asio::deadline_timer(io_service);
+        schedule_cache_stats();
     }
 
     // Listen on control channel
     subscribe_channel(m_control_channel);
 }
 
+void DatabaseServer::init_shards(ConfigNode shards, doid_t min, doid_t max)
+{
+    if(shards.size() == 0 || shards.size() > uint64_t(max) - min + 1) {
+        m_log->fatal() << "Can't split ids " << min << " to " << max << " between "
+                       << shards.size() << " shards." << endl;
+        astron_shutdown(1);
+    }
+
+    vector<DatabaseBackend*> backends;
+    for(size_t i = 0; i < shards.size(); ++i) {
+        ConfigNode backend = shards[i];
+        doid_t shard_min, shard_max;
+        ShardedDatabase::shard_range(i, shards.size(), min, max, shard_min, shard_max);
+        DatabaseBackend *shard = DBBackendFactory::singleton().instantiate_backend(
+                                     db_backend_type.get_rval(backend), backend,
+                                     shard_min, shard_max);
+        if(!shard) {
+            m_log->fatal() << "No database backend of type '"
+                           << db_backend_type.get_rval(backend) << "' exists." << endl;
+            astron_shutdown(1);
+        }
+
+        m_log->info() << "Shard " << i << " (" << db_backend_type.get_rval(backend)
+                      << ") holds ids " << shard_min << " to " << shard_max << ".\n";
+        backends.push_back(shard);
+    }
+
+    m_db_backend = new ShardedDatabase(backends, min, max);
+}
+
+void DatabaseServer::submit(DBOperation *op)
+{
+    if(m_cache.enabled() && answer_from_cache(op)) {
+        return;
+    }
+
+    if(m_workers) {
+        m_workers->submit(op);
+    } else {
+        m_db_backend->submit(op);
+    }
+}
+
+void DatabaseServer::submit_batch(const vector<DBOperation*> &ops)
+{
+    vector<DBOperation*> batch;
+    batch.reserve(ops.size());
+    for(auto it = ops.begin(); it != ops.end(); ++it) {
+        if(!m_cache.enabled() || !answer_from_cache(*it)) {
+            batch.push_back(*it);
+        }
+    }
+
+    if(m_workers) {
+        m_workers->submit_batch(batch);
+    } else {
+        m_db_backend->submit_split_batch(batch);
+    }
+}
+
+void DatabaseServer::handle_set_fields_multi(channel_t sender, DatagramIterator &dgi)
+{
+    vector<DBOperation*> ops;
+    uint16_t count = dgi.read_uint16();
+    ops.reserve(count);
+    for(uint16_t i = 0; i < count; ++i) {
+        // Each object's update has the same layout as a DBSERVER_OBJECT_SET_FIELDS
+        DBOperation *op = new DBOperationSet(this);
+        if(!op->initialize(sender, DBSERVER_OBJECT_SET_FIELDS, dgi)) {
+            // The rest of the message can't be trusted to line up
+            m_log->error() << "SetFieldsMulti included an invalid update, ignoring the "
+                           << count - i - 1 << " objects after it.\n";
+            break;
+        }
+        ops.push_back(op);
+    }
+
+    submit_batch(ops);
+}
+
+bool DatabaseServer::answer_from_cache(DBOperation *op)
+{
+    switch(op->type()) {
+    case DBOperation::GET_OBJECT:
+    case DBOperation::GET_FIELDS: {
+        bool all = op->type() == DBOperation::GET_OBJECT;
+        DBObjectSnapshot *snapshot = m_cache.get(op->doid(), all ? nullptr : &op->get_fields());
+        if(!snapshot) {
+            op->m_cache_read = true;
+            return false;
+        }
+
+        if(!op->verify_class(snapshot->m_dclass)) {
+            delete snapshot;
+            op->on_failure();
+            return true;
+        }
+        op->on_complete(snapshot);
+        return true;
+    }
+    case DBOperation::UPDATE_FIELDS: {
+        // An update whose criteria don't hold can be refused without the backend,
+        // but one which will change the object must still be written.
+        DBObjectSnapshot *snapshot = m_cache.get(op->doid());
+        if(snapshot) {
+            if(!op->verify_class(snapshot->m_dclass)) {
+                delete snapshot;
+                op->on_failure();
+                return true;
+            }
+
+            for(auto it = op->criteria_fields().begin(); it != op->criteria_fields().end(); ++it) {
+                auto value = snapshot->m_fields.find(it->first);
+                if(value == snapshot->m_fields.end() ? !it->second.empty() :
+                   value->second != it->second) {
+                    op->on_criteria_mismatch(snapshot);
+                    return true;
+                }
+            }
+            delete snapshot;
+        }
+    }
+    // Fallthrough
+    case DBOperation::SET_FIELDS:
+    case DBOperation::DELETE_OBJECT:
+        m_cache.begin_write(op->doid());
+        op->m_cache_write = true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+void DatabaseServer::cache_result(DBOperation *op, const DBObjectSnapshot *snapshot)
+{
+    if(!op->m_cache_read) {
+        return;
+    }
+
+    m_cache.count_miss(snapshot->m_dclass);
+
+    // GET_FIELDS may only have loaded the fields it asked for
+    if(op->type() == DBOperation::GET_OBJECT) {
+        m_cache.store(op->doid(), *snapshot);
+    }
+}
+
+void DatabaseServer::finish_write(DBOperation *op, bool changed)
+{
+    if(!op->m_cache_write) {
+        return;
+    }
+
+    bool deleted = op->type() == DBOperation::DELETE_OBJECT;
+    m_cache.end_write(op->doid(), changed && !deleted ? &op->set_fields() : nullptr);
+}
+
+void DatabaseServer::schedule_cache_stats()
+{
+    if(!m_cache_stats_interval) {
+        return;
+    }
+
+    m_cache_stats_timer->expires_from_now(boost::posix_time::seconds(m_cache_stats_interval));
+    m_cache_stats_timer->async_wait([this](const boost::system::error_code &ec) {
+        if(ec) {
+            return;
+        }
+
+        unordered_map<const dclass::Class*, SnapshotCache::ClassStats> stats;
+        size_t size, count;
+        uint64_t evictions;
+        m_cache.get_stats(stats, size, count, evictions);
+
+        uint64_t hits = 0, misses = 0;
+        for(auto it = stats.begin(); it != stats.end(); ++it) {
+            hits += it->second.hits;
+            misses += it->second.misses;
+        }
+        m_log->info() << "Snapshot cache: " << count << " objects, " << size << " bytes, "
+                      << hits << " hits, " << misses << " misses ("
+                      << (hits + misses ? hits * 100 / (hits + misses) : 0) << "% hit rate), "
+                      << evictions << " evictions.\n";
+
+        for(auto it = stats.begin(); it != stats.end(); ++it) {
+            uint64_t lookups = it->second.hits + it->second.misses;
+            m_log->info() << "    " << it->first->get_name() << ": " << it->second.hits
+                          << " hits, " << it->second.misses << " misses ("
+                          << it->second.hits * 100 / lookups << "% hit rate)\n";
+        }
+        schedule_cache_stats();
+    });
+}
+
 void DatabaseServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
 {
     channel_t sender = dgi.read_channel();
@@ -77,6 +347,16 @@ void DatabaseServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         op = new DBOperationGet(this);
     }
     break;
+    case DBSERVER_OBJECT_GET_ALL_MULTI: {
+        // Answered with one response, but loaded as a GET_OBJECT operation per object
+        DBOperationGetMulti *multi = new DBOperationGetMulti(this);
+        if(multi->initialize(sender, msg_type, dgi)) {
+            multi->submit();
+        } else {
+            delete multi;
+        }
+        return;
+    }
     case DBSERVER_OBJECT_SET_FIELD:
     case DBSERVER_OBJECT_SET_FIELDS:
     case DBSERVER_OBJECT_DELETE_FIELD:
@@ -84,6 +364,10 @@ void DatabaseServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         op = new DBOperationSet(this);
     }
     break;
+    case DBSERVER_OBJECT_SET_FIELDS_MULTI: {
+        handle_set_fields_multi(sender, dgi);
+        return;
+    }
     case DBSERVER_OBJECT_SET_FIELD_IF_EMPTY:
     case DBSERVER_OBJECT_SET_FIELD_IF_EQUALS:
     case DBSERVER_OBJECT_SET_FIELDS_IF_EQUALS: {
@@ -96,6 +380,6 @@ void DatabaseServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
     };
 
     if(op->initialize(sender, msg_type, dgi)) {
-        m_db_backend->submit(op);
+        submit(op);
     }
 }
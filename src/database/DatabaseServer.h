@@ -3,6 +3,8 @@
 #include "core/RoleFactory.h"
 #include "DatabaseBackend.h"
 #include "DBOperation.h"
+#include "DBWorkerPool.h"
+#include "SnapshotCache.h"
 
 extern RoleConfigGroup dbserver_config;
 
@@ -14,11 +16,37 @@ class DatabaseServer : public Role
     virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
 
   private:
+    // init_shards creates a backend for each config in shards, and splits [min, max] between them.
+    void init_shards(ConfigNode shards, doid_t min, doid_t max);
     void handle_operation(DBOperation *op);
+    // submit passes an operation to the worker pool, or straight to the backend if there is none.
+    void submit(DBOperation *op);
+    // submit_batch passes several operations on existing objects on together, so that the
+    // backend may carry them out at once.
+    void submit_batch(const std::vector<DBOperation*> &ops);
+    // handle_set_fields_multi submits a SET_FIELDS operation for each object of a
+    // DBSERVER_OBJECT_SET_FIELDS_MULTI.
+    void handle_set_fields_multi(channel_t sender, DatagramIterator &dgi);
+
+    // answer_from_cache completes a read, or an update whose criteria don't hold, from the
+    // snapshot cache.  It returns false if the operation must be passed to the backend.
+    bool answer_from_cache(DBOperation *op);
+    // cache_result is called by reads with the snapshot the backend returned.
+    void cache_result(DBOperation *op, const DBObjectSnapshot *snapshot);
+    // finish_write is called by writes when they complete; changed is false if they failed.
+    void finish_write(DBOperation *op, bool changed);
+    // schedule_cache_stats starts the timer for the next cache statistics report.
+    void schedule_cache_stats();
 
     DatabaseBackend *m_db_backend;
+    DBWorkerPool *m_workers = nullptr;
     LogCategory *m_log;
 
+    // m_cache holds the snapshots of recently read objects
+    SnapshotCache m_cache;
+    unsigned int m_cache_stats_interval = 0;
+    boost::asio::deadline_timer *m_cache_stats_timer = nullptr;
+
     channel_t m_control_channel;
     doid_t m_min_id, m_max_id;
     bool m_broadcast;
@@ -29,4 +57,5 @@ class DatabaseServer : public Role
     friend class DBOperationGet;
     friend class DBOperationSet;
     friend class DBOperationUpdate;
+    friend class DBOperationGetMulti;
 };
@@ -3,14 +3,20 @@
 
 void OldDatabaseBackend::submit(DBOperation *operation)
 {
-    std::lock_guard<std::mutex> lock(m_submit_lock);
+    std::unique_lock<std::mutex> lock(m_submit_lock, std::defer_lock);
+    if(!m_thread_safe) {
+        lock.lock();
+    }
+
     switch(operation->type()) {
     case DBOperation::OperationType::CREATE_OBJECT: {
         ObjectData dbo(operation->dclass()->get_id());
         dbo.fields = operation->set_fields();
 
         doid_t doid = create_object(dbo);
-        if(doid == INVALID_DO_ID || doid < m_min_id || doid > m_max_id) {
+        if(doid == INVALID_DO_ID && !has_free_ids()) {
+            operation->on_out_of_ids();
+        } else if(doid == INVALID_DO_ID || doid < m_min_id || doid > m_max_id) {
             operation->on_failure();
         } else {
             operation->on_complete(doid);
@@ -34,7 +34,16 @@ class OldDatabaseBackend : public DatabaseBackend
     virtual void submit(DBOperation *operation);
 
   protected:
+    // m_thread_safe may be set by a backend which can run operations on different
+    // objects concurrently.  Otherwise, operations are run one at a time.
+    bool m_thread_safe = false;
+
     virtual doid_t create_object(const ObjectData &dbo) = 0;
+    // has_free_ids returns false once there are no ids left for create_object to use.
+    virtual bool has_free_ids()
+    {
+        return true;
+    }
     virtual void delete_object(doid_t do_id) = 0;
     virtual bool get_object(doid_t do_id, ObjectData &dbo) = 0;
 
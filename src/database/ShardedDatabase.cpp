@@ -0,0 +1,115 @@
+#include "ShardedDatabase.h"
+using namespace std;
+
+// ShardedCreate stands in for a create given to one shard.  If that shard has run out of
+// ids, each of the others is tried in turn before the original operation is failed; any
+// other failure is passed straight on to it.
+class ShardedDatabase::ShardedCreate : public DBOperation
+{
+  public:
+    ShardedCreate(ShardedDatabase *db, DBOperation *op, size_t first) :
+        DBOperation(nullptr), m_db(db), m_op(op), m_shard(first)
+    {
+        m_type = CREATE_OBJECT;
+        m_doid = INVALID_DO_ID;
+        m_dclass = op->dclass();
+        m_set_fields = op->set_fields();
+    }
+
+    virtual bool initialize(channel_t, uint16_t, DatagramIterator&)
+    {
+        return false;
+    }
+
+    void submit()
+    {
+        m_db->m_shards[m_shard]->submit(this);
+    }
+
+    virtual void on_complete(doid_t do_id)
+    {
+        m_op->on_complete(do_id);
+        cleanup();
+    }
+
+    virtual void on_failure()
+    {
+        m_op->on_failure();
+        cleanup();
+    }
+
+    virtual void on_out_of_ids()
+    {
+        if(++m_attempts < m_db->m_shards.size()) {
+            m_shard = (m_shard + 1) % m_db->m_shards.size();
+            submit();
+            return;
+        }
+
+        m_op->on_out_of_ids();
+        cleanup();
+    }
+
+  private:
+    ShardedDatabase *m_db;
+    DBOperation *m_op;
+    size_t m_shard;
+    size_t m_attempts = 0;
+};
+
+ShardedDatabase::ShardedDatabase(const vector<DatabaseBackend*> &shards,
+                                 doid_t min_id, doid_t max_id) :
+    DatabaseBackend(ConfigNode(), min_id, max_id), m_shards(shards),
+    m_shard_size((uint64_t(max_id) - min_id + 1) / shards.size())
+{
+}
+
+void ShardedDatabase::shard_range(size_t index, size_t count, doid_t min_id, doid_t max_id,
+                                  doid_t &shard_min, doid_t &shard_max)
+{
+    // The last shard also takes the ids left over by the division
+    uint64_t size = (uint64_t(max_id) - min_id + 1) / count;
+    shard_min = doid_t(min_id + size * index);
+    shard_max = index + 1 == count ? max_id : doid_t(min_id + size * (index + 1) - 1);
+}
+
+size_t ShardedDatabase::shard_of(doid_t do_id) const
+{
+    if(do_id < m_min_id || do_id > m_max_id) {
+        return 0;
+    }
+
+    uint64_t shard = (uint64_t(do_id) - m_min_id) / m_shard_size;
+    return shard < m_shards.size() ? size_t(shard) : m_shards.size() - 1;
+}
+
+void ShardedDatabase::submit(DBOperation *operation)
+{
+    if(operation->type() != DBOperation::CREATE_OBJECT) {
+        m_shards[shard_of(operation->doid())]->submit(operation);
+        return;
+    }
+
+    if(m_shards.size() == 1) {
+        m_shards[0]->submit(operation);
+        return;
+    }
+
+    // Spread new objects evenly between the shards
+    size_t first = m_next_create++ % m_shards.size();
+    (new ShardedCreate(this, operation, first))->submit();
+}
+
+void ShardedDatabase::submit_batch(const vector<DBOperation*> &operations)
+{
+    vector<vector<DBOperation*> > batches(m_shards.size());
+    for(auto it = operations.begin(); it != operations.end(); ++it) {
+        batches[shard_of((*it)->doid())].push_back(*it);
+    }
+
+    for(size_t i = 0; i < batches.size(); ++i) {
+        if(!batches[i].empty()) {
+            m_shards[i]->submit_batch(batches[i]);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include "DatabaseBackend.h"
+
+// ShardedDatabase splits a DatabaseServer's range of ids between several backends, each of
+// which is given an equal, contiguous part of it.  Operations are passed to the backend
+// owning their object, so operations in different shards can run in parallel on the
+// DatabaseServer's workers.  New objects are created in each shard in turn.
+class ShardedDatabase : public DatabaseBackend
+{
+  public:
+    // shards must hold at least one backend, created with the range returned by shard_range.
+    ShardedDatabase(const std::vector<DatabaseBackend*> &shards, doid_t min_id, doid_t max_id);
+
+    // shard_range returns the range of ids given to shard index of count.
+    static void shard_range(size_t index, size_t count, doid_t min_id, doid_t max_id,
+                            doid_t &shard_min, doid_t &shard_max);
+
+    virtual void submit(DBOperation *operation);
+    virtual void submit_batch(const std::vector<DBOperation*> &operations);
+
+  private:
+    class ShardedCreate;
+
+    std::vector<DatabaseBackend*> m_shards;
+    uint64_t m_shard_size;
+    std::atomic<size_t> m_next_create{0};
+
+    // shard_of returns the index of the shard which owns an object; ids outside of the
+    // range are owned by the first shard.
+    size_t shard_of(doid_t do_id) const;
+};
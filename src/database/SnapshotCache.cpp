@@ -0,0 +1,169 @@
+#include "SnapshotCache.h"
+using namespace std;
+using dclass::Class;
+using dclass::Field;
+
+// Approximate bookkeeping overhead of an entry and of each cached field, in bytes.
+static const size_t ENTRY_OVERHEAD = sizeof(doid_t) * 2 + 128;
+static const size_t FIELD_OVERHEAD = 64;
+
+SnapshotCache::SnapshotCache(size_t max_size) : m_max_size(max_size)
+{
+}
+
+DBObjectSnapshot* SnapshotCache::get(doid_t do_id, const FieldSet *fields)
+{
+    lock_guard<mutex> guard(m_lock);
+    if(m_pending_writes.find(do_id) != m_pending_writes.end()) {
+        return nullptr;
+    }
+
+    auto it = m_entries.find(do_id);
+    if(it == m_entries.end()) {
+        return nullptr;
+    }
+
+    Entry &entry = it->second;
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+    ++m_stats[entry.snapshot.m_dclass].hits;
+
+    DBObjectSnapshot *snapshot = new DBObjectSnapshot();
+    snapshot->m_dclass = entry.snapshot.m_dclass;
+    if(!fields) {
+        snapshot->m_fields = entry.snapshot.m_fields;
+        return snapshot;
+    }
+
+    for(auto field = fields->begin(); field != fields->end(); ++field) {
+        auto value = entry.snapshot.m_fields.find(*field);
+        if(value != entry.snapshot.m_fields.end()) {
+            snapshot->m_fields.insert(*value);
+        }
+    }
+    return snapshot;
+}
+
+void SnapshotCache::store(doid_t do_id, const DBObjectSnapshot &snapshot)
+{
+    lock_guard<mutex> guard(m_lock);
+    if(m_pending_writes.find(do_id) != m_pending_writes.end()) {
+        // The snapshot was read before a write which hasn't completed yet
+        return;
+    }
+
+    auto it = m_entries.find(do_id);
+    if(it != m_entries.end()) {
+        erase(it);
+    }
+
+    Entry &entry = m_entries[do_id];
+    m_lru.push_front(do_id);
+    entry.lru = m_lru.begin();
+    entry.snapshot.m_dclass = snapshot.m_dclass;
+    entry.size = ENTRY_OVERHEAD;
+    m_size += ENTRY_OVERHEAD;
+    for(auto field = snapshot.m_fields.begin(); field != snapshot.m_fields.end(); ++field) {
+        set_field(entry, field->first, field->second);
+    }
+    evict();
+}
+
+void SnapshotCache::count_miss(const Class *dclass)
+{
+    lock_guard<mutex> guard(m_lock);
+    ++m_stats[dclass].misses;
+}
+
+void SnapshotCache::begin_write(doid_t do_id)
+{
+    lock_guard<mutex> guard(m_lock);
+    ++m_pending_writes[do_id];
+}
+
+void SnapshotCache::end_write(doid_t do_id, const FieldValues *changes)
+{
+    lock_guard<mutex> guard(m_lock);
+    auto pending = m_pending_writes.find(do_id);
+    if(pending != m_pending_writes.end() && --pending->second == 0) {
+        m_pending_writes.erase(pending);
+    }
+
+    auto it = m_entries.find(do_id);
+    if(it == m_entries.end()) {
+        return;
+    }
+
+    if(!changes) {
+        erase(it);
+        return;
+    }
+
+    // How a backend stores molecular fields is up to it, so forget the object rather
+    // than guess at what it will read back.
+    for(auto field = changes->begin(); field != changes->end(); ++field) {
+        if(field->first->as_molecular()) {
+            erase(it);
+            return;
+        }
+    }
+
+    Entry &entry = it->second;
+    for(auto field = changes->begin(); field != changes->end(); ++field) {
+        if(!field->second.empty()) {
+            set_field(entry, field->first, field->second);
+            continue;
+        }
+
+        auto value = entry.snapshot.m_fields.find(field->first);
+        if(value != entry.snapshot.m_fields.end()) {
+            size_t field_size = FIELD_OVERHEAD + value->second.size();
+            entry.size -= field_size;
+            m_size -= field_size;
+            entry.snapshot.m_fields.erase(value);
+        }
+    }
+    evict();
+}
+
+void SnapshotCache::get_stats(unordered_map<const Class*, ClassStats> &stats,
+                              size_t &size, size_t &count, uint64_t &evictions)
+{
+    lock_guard<mutex> guard(m_lock);
+    stats = m_stats;
+    size = m_size;
+    count = m_entries.size();
+    evictions = m_evictions;
+}
+
+void SnapshotCache::erase(unordered_map<doid_t, Entry>::iterator it)
+{
+    m_size -= it->second.size;
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+}
+
+void SnapshotCache::set_field(Entry &entry, const Field *field, const vector<uint8_t> &value)
+{
+    auto existing = entry.snapshot.m_fields.find(field);
+    if(existing != entry.snapshot.m_fields.end()) {
+        entry.size -= existing->second.size();
+        m_size -= existing->second.size();
+        existing->second = value;
+    } else {
+        entry.snapshot.m_fields[field] = value;
+        entry.size += FIELD_OVERHEAD;
+        m_size += FIELD_OVERHEAD;
+    }
+    entry.size += value.size();
+    m_size += value.size();
+}
+
+void SnapshotCache::evict()
+{
+    // Evict from the back of the LRU list; this may include the entry just stored,
+    // if it alone is larger than the cache.
+    while(m_size > m_max_size && !m_lru.empty()) {
+        erase(m_entries.find(m_lru.back()));
+        ++m_evictions;
+    }
+}
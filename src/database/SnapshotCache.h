@@ -0,0 +1,68 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "core/types.h"
+#include "core/objtypes.h"
+#include "DBOperation.h"
+
+// A SnapshotCache is a bounded, least-recently-used cache of complete object snapshots,
+// which the DatabaseServer consults before passing reads to its backend.  Operations may
+// complete on the worker threads, so every method takes the cache's lock.
+class SnapshotCache
+{
+  public:
+    // ClassStats counts the lookups of the objects of one class.
+    struct ClassStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    SnapshotCache(size_t max_size = 0);
+
+    inline bool enabled() const
+    {
+        return m_max_size > 0;
+    }
+
+    // get returns a copy of an object's snapshot, or nullptr if it isn't cached or has
+    // writes outstanding.  If fields isn't null, only those fields are copied.
+    DBObjectSnapshot* get(doid_t do_id, const FieldSet *fields = nullptr);
+    // store caches the complete snapshot of an object, as read from the backend.  It is
+    // ignored while a write to the object is outstanding, as the snapshot may predate it.
+    void store(doid_t do_id, const DBObjectSnapshot &snapshot);
+    // count_miss attributes a read which couldn't be answered from the cache to a class.
+    void count_miss(const dclass::Class *dclass);
+
+    // begin_write should be called when a write to an object is passed to the backend,
+    // and end_write once it has completed.  While any write to an object is outstanding,
+    // reads of the object miss, so that they are answered after the write.  end_write
+    // applies the changes to the cached snapshot, or forgets the object if changes is null.
+    void begin_write(doid_t do_id);
+    void end_write(doid_t do_id, const FieldValues *changes);
+
+    // get_stats copies the statistics of every class which has been looked up.
+    void get_stats(std::unordered_map<const dclass::Class*, ClassStats> &stats,
+                   size_t &size, size_t &count, uint64_t &evictions);
+
+  private:
+    struct Entry {
+        DBObjectSnapshot snapshot;
+        size_t size = 0;
+        std::list<doid_t>::iterator lru;
+    };
+
+    size_t m_max_size;
+    std::mutex m_lock;
+    std::unordered_map<doid_t, Entry> m_entries;
+    std::list<doid_t> m_lru; // most recently used at the front
+    std::unordered_map<doid_t, unsigned int> m_pending_writes;
+
+    std::unordered_map<const dclass::Class*, ClassStats> m_stats;
+    uint64_t m_evictions = 0;
+    size_t m_size = 0;
+
+    void erase(std::unordered_map<doid_t, Entry>::iterator it);
+    void set_field(Entry &entry, const dclass::Field *field, const std::vector<uint8_t> &value);
+    void evict();
+};
@@ -1,4 +1,4 @@
-#include "OldDatabaseBackend.h"
+#include "DatabaseBackend.h"
 #include "DBBackendFactory.h"
 #include "DatabaseServer.h"
 
@@ -11,6 +11,14 @@
 
 #include <soci.h>
 #include <boost/icl/interval_set.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 using namespace std;
 using namespace soci;
@@ -18,18 +26,34 @@ using namespace dclass;
 
 typedef boost::icl::discrete_interval<doid_t> interval_t;
 typedef boost::icl::interval_set<doid_t> set_t;
+typedef vector<const Field*> FieldList;
 
 static ConfigVariable<string> database_name("database", "", db_backend_config);
 static ConfigVariable<string> database_host("host", "", db_backend_config);
 static ConfigVariable<uint16_t> database_port("port", 0, db_backend_config);
 static ConfigVariable<string> session_user("username", "", db_backend_config);
 static ConfigVariable<string> session_passwd("password", "", db_backend_config);
-
-class SociSQLDatabase : public OldDatabaseBackend
+static ConfigVariable<unsigned int> sessions("sessions", 1, db_backend_config);
+
+static ConfigGroup group_commit_config("group_commit", db_backend_config);
+static ConfigVariable<unsigned int> group_window("window", 0, group_commit_config);
+static ConfigVariable<unsigned int> group_max_size("max_size", 64, group_commit_config);
+
+// The most objects whose class is remembered, to save looking it up in the objects table.
+static const size_t CLASS_CACHE_SIZE = 1 << 20;
+// The most objects read by one batched query.
+static const size_t MAX_BATCH_READ = 500;
+
+// SociSQLDatabase stores objects in an SQL database through soci. The objects table maps
+// each object to its class, and each class with db fields has a fields_<class> table with a
+// column for each field. Each DBOperation is carried out with as few statements as possible;
+// operations may be submitted from several threads, and run concurrently if there is more
+// than one session.
+class SociSQLDatabase : public DatabaseBackend
 {
   public:
     SociSQLDatabase(ConfigNode dbeconfig, doid_t min_id, doid_t max_id) :
-        OldDatabaseBackend(dbeconfig, min_id, max_id), m_min_id(min_id), m_max_id(max_id),
+        DatabaseBackend(dbeconfig, min_id, max_id),
         m_backend(db_backend_type.get_rval(dbeconfig)),
         m_db_name(database_name.get_rval(dbeconfig)),
         m_db_host(database_host.get_rval(dbeconfig)),
@@ -41,406 +65,104 @@ class SociSQLDatabase : public OldDatabaseBackend
         log_name << "Database-" << m_backend << "(Range: [" << min_id << ", " << max_id << "])";
         m_log = new LogCategory(m_backend, log_name.str());
 
-        connect();
-        check_tables();
-        check_classes();
-        check_ids();
-    }
-
-    virtual doid_t create_object(const ObjectData& dbo)
-    {
-        string field_name;
-        vector<uint8_t> field_value;
-        const Class *dcc = g_dcf->get_class_by_id(dbo.dc_id);
-        bool storable = is_storable(dbo.dc_id);
-
-        doid_t do_id = pop_next_id();
-        if(!do_id) {
-            return 0;
-        }
-
-        try {
-            m_sql.begin(); // Start transaction
-            m_sql << "INSERT INTO objects VALUES (" << do_id << "," << dbo.dc_id << ");";
-
-            if(storable) {
-                // TODO: This would probably be a lot faster if it was all one statement.
-                //       Go ahead and simplify to one statement if you see a good way to do so.
-                m_sql << "INSERT INTO fields_" << dcc->get_name() << "(object_id)"
-                      " VALUES(" << do_id << ");";
-                set_fields_in_table(do_id, dcc, dbo.fields);
-            }
-
-            m_sql.commit(); // End transaction
-        } catch(const soci_error &e) {
-            m_sql.rollback(); // Revert transaction
-            return 0;
-        }
-
-        return do_id;
-    }
-    virtual void delete_object(doid_t do_id)
-    {
-        bool storable = false;
-        const Class* dcc = get_class(do_id);
-        if(dcc) {
-            // Note: needs to be called outside the transaction so it doesn't prevent deletion
-            //       of the object in the `objects` table
-            storable = is_storable(dcc->get_id());
-        }
-
-        m_log->debug() << "Deleting object with id " << do_id << "..." << endl;
-        m_sql << "DELETE FROM objects WHERE id=" << do_id;
-
-        if(dcc && storable) {
-            m_log->trace() << "... object has stored field, also deleted." << endl;
-            m_sql << "DELETE FROM fields_" << dcc->get_name() << " WHERE object_id=:id;", use(do_id);
-        }
-
-        push_id(do_id);
-    }
-    virtual bool get_object(doid_t do_id, ObjectData& dbo)
-    {
-        m_log->trace() << "Getting object with id" << do_id << endl;
-
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            return false; // Object does not exist
+        unsigned int num_sessions = sessions.get_rval(dbeconfig);
+        if(num_sessions < 1) {
+            num_sessions = 1;
         }
-        dbo.dc_id = dcc->get_id();
-
-        bool stored = is_storable(dcc->get_id());
-        if(stored) {
-            get_all_from_table(do_id, dcc, dbo.fields);
-        }
-
-        return true;
-    }
-    virtual const Class* get_class(doid_t do_id)
-    {
-        int dc_id = -1;
-        indicator ind;
-
-        try {
-            m_sql << "SELECT class_id FROM objects WHERE id=" << do_id << ";", into(dc_id, ind);
-        } catch(const soci_error &e) {
-            return NULL;
+        for(unsigned int i = 0; i < num_sessions; ++i) {
+            m_connections.push_back(unique_ptr<Connection>(new Connection));
+            connect(m_connections.back()->sql, num_sessions > 1);
+            m_idle.push_back(m_connections.back().get());
         }
 
-        if(ind != i_ok || dc_id == -1) {
-            return NULL;
+        session &sql = m_connections.front()->sql;
+        check_tables(sql);
+        check_classes(sql);
+        check_ids(sql);
+
+        ConfigNode group_commit = db_backend_config.get_child_node(group_commit_config, dbeconfig);
+        m_group_window = group_window.get_rval(group_commit);
+        m_group_max_size = group_max_size.get_rval(group_commit);
+        if(m_group_window > 0) {
+            m_group_thread = new thread(&SociSQLDatabase::run_group_commit, this);
+            astron_add_shutdown_hook([this]() {
+                stop_group_commit();
+            });
         }
-
-        return g_dcf->get_class_by_id(dc_id);
     }
-    virtual void del_field(doid_t do_id, const Field* field)
-    {
-        const Class *dcc = get_class(do_id);
-        bool storable = is_storable(dcc->get_id());
 
-        if(storable) {
-            FieldList fields;
-            fields.push_back(field);
-            del_fields_in_table(do_id, dcc, fields);
-        }
-    }
-    virtual void del_fields(doid_t do_id, const FieldList &fields)
-    {
-        const Class *dcc = get_class(do_id);
-        bool storable = is_storable(dcc->get_id());
-
-        if(storable) {
-            del_fields_in_table(do_id, dcc, fields);
-        }
-    }
-    virtual void set_field(doid_t do_id, const Field* field, const vector<uint8_t> &value)
+    virtual void submit(DBOperation *operation)
     {
-        const Class *dcc = get_class(do_id);
-        bool storable = is_storable(dcc->get_id());
-
-        if(storable) {
-            FieldValues fields;
-            fields[field] = value;
-            try {
-                m_sql.begin(); // Start transaction
-                set_fields_in_table(do_id, dcc, fields);
-                m_sql.commit(); // End transaction
-            } catch(const soci_error &e) {
-                m_sql.rollback(); // Revert transaction
+        bool is_write = operation->type() == DBOperation::CREATE_OBJECT ||
+                        operation->type() == DBOperation::DELETE_OBJECT ||
+                        operation->type() == DBOperation::SET_FIELDS;
+
+        if(m_group_window) {
+            unique_lock<mutex> lock(m_batch_lock);
+            if(is_write && !m_group_stopped) {
+                queue_write(operation);
+                return;
             }
-        }
-    }
-    virtual void set_fields(doid_t do_id, const FieldValues &fields)
-    {
-        const Class *dcc = get_class(do_id);
-        bool storable = is_storable(dcc->get_id());
 
-        if(storable) {
-            try {
-                m_sql.begin(); // Start transaction
-                set_fields_in_table(do_id, dcc, fields);
-                m_sql.commit(); // End transaction
-            } catch(const soci_error &e) {
-                m_sql.rollback(); // Revert transaction
+            // Anything else must see the object's batched writes, so commit them first
+            bool pending = operation->type() != DBOperation::CREATE_OBJECT &&
+                           m_batch_doids.find(operation->doid()) != m_batch_doids.end();
+            lock.unlock();
+            if(pending) {
+                commit_batch();
             }
         }
-    }
-    virtual bool set_field_if_empty(doid_t do_id, const Field* field, vector<uint8_t> &value)
-    {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            value.clear();
-            return false; // Object does not exist
-        }
-
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            value.clear();
-            return false; // Class has no database fields
-        }
 
-        if(!field->has_keyword("db")) {
-            value.clear();
-            return false;
+        switch(operation->type()) {
+        case DBOperation::CREATE_OBJECT:
+        case DBOperation::DELETE_OBJECT:
+        case DBOperation::SET_FIELDS:
+            run_write(operation);
+            break;
+        case DBOperation::GET_OBJECT:
+        case DBOperation::GET_FIELDS:
+            run_get(operation);
+            break;
+        case DBOperation::UPDATE_FIELDS:
+            run_update(operation);
+            break;
         }
-
-        string val;
-        indicator ind;
-        m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-              << " WHERE object_id=" << do_id << ";", into(val, ind);
-        if(ind != i_null) {
-            bool parse_err;
-            string packed_data = parse_value(field->get_type(), val, parse_err);
-            if(parse_err) {
-                m_log->error() << "Failed parsing value for field '" << field->get_name()
-                               << "' of object " << do_id << "' from database.\n";
-                return false;
-            }
-            value = vector<uint8_t>(packed_data.begin(), packed_data.end());
-            return false;
-        }
-
-        val = format_value(field->get_type(), value);
-        m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
-              << "='" << val << "' WHERE object_id=" << do_id << ";";
-        return true;
     }
-    virtual bool set_fields_if_empty(doid_t do_id, FieldValues &values)
-    {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            values.clear();
-            return false; // Object does not exist
-        }
-
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            values.clear();
-            return false; // Class has no database fields
-        }
-
-        bool failed = false;
-        string value;
-        indicator ind;
-        try {
-            m_sql.begin(); // Start transaction
-            for(auto it = values.begin(); it != values.end(); ++it) {
-                const Field* field = it->first;
-                if(field->has_keyword("db")) {
-                    m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-                          << " WHERE object_id=" << do_id << ";", into(value, ind);
-                    if(ind != i_null) {
-                        bool parse_err;
-                        failed = true;
-                        string packed_data = parse_value(field->get_type(), value, parse_err);
-                        if(parse_err) {
-                            m_log->error() << "Failed parsing value for field '" << field->get_name()
-                                           << "' of object " << do_id << "' from database.\n";
-                            continue;
-                        }
-                        values[field] = vector<uint8_t>(packed_data.begin(), packed_data.end());
-                        continue;
-                    }
-
-                    value = format_value(it->first->get_type(), it->second);
-                    m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
-                          << "='" << value << "' WHERE object_id=" << do_id << ";";
-                }
-            }
 
-            if(failed) {
-                m_sql.rollback(); // Revert transaction
-            } else {
-                m_sql.commit(); // End transaction
-            }
-        } catch(const soci_error &e) {
-            m_sql.rollback(); // Revert transaction
-            values.clear();
-            return false;
-        }
-        return true;
-    }
-    virtual bool set_field_if_equals(doid_t do_id, const Field* field,
-                                     const vector<uint8_t> &equal, vector<uint8_t> &value)
+    virtual void submit_batch(const vector<DBOperation*> &operations)
     {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            return false; // Object does not exist
-        }
-
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            return false; // Class has no database fields
-        }
-
-        if(!field->has_keyword("db")) {
-            return false;
-        }
-
-        string val;
-        indicator ind;
-        m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-              << " WHERE object_id=" << do_id << ";", into(val, ind);
-        if(ind != i_ok) {
-            value.clear();
-            return false;
-        }
-
-        string eql = format_value(field->get_type(), equal);
-        if(val != eql) {
-            bool parse_err;
-            val = parse_value(field->get_type(), val, parse_err);
-            if(parse_err) {
-                m_log->error() << "Failed parsing value for field '" << field->get_name()
-                               << "' of object " << do_id << "' from database.\n";
-                return false;
+        vector<DBOperation*> reads;
+        for(auto it = operations.begin(); it != operations.end(); ++it) {
+            if((*it)->type() == DBOperation::GET_OBJECT ||
+               (*it)->type() == DBOperation::GET_FIELDS) {
+                reads.push_back(*it);
+            } else {
+                submit(*it);
             }
-            value = vector<uint8_t>(val.begin(), val.end());
-            return false;
-        }
-
-        val = format_value(field->get_type(), value);
-        m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
-              << "='" << val << "' WHERE object_id=" << do_id << ";";
-        return true;
-    }
-    virtual bool set_fields_if_equals(doid_t do_id, const FieldValues &equals,
-                                      FieldValues &values)
-    {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            return false; // Object does not exist
-        }
-
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            return false; // Class has no database fields
         }
 
-        bool failed = false;
-        string value;
-        indicator ind;
-        FieldValues stored_values;
-        try {
-            m_sql.begin(); // Start transaction
-            for(auto it = equals.begin(); it != equals.end(); ++it) {
-                const Field* field = it->first;
-                if(field->has_keyword("db")) {
-                    m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-                          << " WHERE object_id=" << do_id << ";", into(value, ind);
-                    if(ind != i_ok) {
-                        failed = true;
-                        continue;
-                    }
-
-                    string equal = format_value(field->get_type(), it->second);
-                    if(value == equal) {
-                        string insert = format_value(field->get_type(), values[field]);
-                        m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
-                              << "='" << insert << "' WHERE object_id=" << do_id << ";";
-                    } else {
-                        failed = true;
-                    }
-
-                    bool parse_err;
-                    value = parse_value(field->get_type(), value, parse_err);
-                    if(parse_err) {
-                        m_log->error() << "Failed parsing value for field '" << field->get_name()
-                                       << "' of object " << do_id << "' from database.\n";
-                        continue;
-                    }
-                    stored_values[field] = vector<uint8_t>(value.begin(), value.end());
+        if(m_group_window && !reads.empty()) {
+            bool pending = false;
+            {
+                lock_guard<mutex> lock(m_batch_lock);
+                for(auto it = reads.begin(); !pending && it != reads.end(); ++it) {
+                    pending = m_batch_doids.find((*it)->doid()) != m_batch_doids.end();
                 }
             }
-
-            if(failed) {
-                values = stored_values;
-                m_sql.rollback(); // Revert transaction
-                return false;
-            } else {
-                m_sql.commit(); // End transaction
-                return true;
+            if(pending) {
+                commit_batch();
             }
-        } catch(const soci_error &e) {
-            m_sql.rollback(); // Revert transaction
-            values.clear();
-            return false;
-        }
-    }
-    virtual bool get_field(doid_t do_id, const Field* field, vector<uint8_t> &value)
-    {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            return false; // Object does not exist
         }
 
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            return false; // Class has no database fields
+        for(size_t i = 0; i < reads.size(); i += MAX_BATCH_READ) {
+            auto end = reads.begin() + min(reads.size(), i + MAX_BATCH_READ);
+            run_get_batch(vector<DBOperation*>(reads.begin() + i, end));
         }
-
-        FieldList fields;
-        fields.push_back(field);
-        FieldValues values;
-
-        get_fields_from_table(do_id, dcc, fields, values);
-
-        auto val_it = values.find(field);
-        if(val_it == values.end()) {
-            return false;
-        }
-
-        value = val_it->second;
-
-        return true;
-    }
-    virtual bool get_fields(doid_t do_id, const FieldList &fields,
-                            FieldValues &values)
-    {
-        // Get class from the objects table
-        const Class* dcc = get_class(do_id);
-        if(!dcc) {
-            return false; // Object does not exist
-        }
-
-        bool stored = is_storable(dcc->get_id());
-        if(!stored) {
-            return false; // Class has no database fields
-        }
-
-        get_fields_from_table(do_id, dcc, fields, values);
-
-        return true;
     }
 
   protected:
-    void connect()
+    // connect opens a session with the database; shared is set if there will be others.
+    void connect(session &sql, bool shared)
     {
         // Prepare database, username, password, etc for connection
         stringstream connstring;
@@ -463,61 +185,69 @@ class SociSQLDatabase : public OldDatabaseBackend
                        << "user=" << m_sess_user << " "
                        << "pass='" << m_sess_passwd << "'";
         } else if(m_backend == "sqlite3") {
-            connstring << m_db_name;
+            if(shared) {
+                // Wait for the other sessions to release the file, instead of failing
+                connstring << "db=" << m_db_name << " timeout=" << 10;
+            } else {
+                connstring << m_db_name;
+            }
         }
 
         // Connect to database
-        m_sql.open(m_backend, connstring.str());
+        sql.open(m_backend, connstring.str());
     }
 
-    void check_tables()
+    void check_tables(session &sql)
     {
         if(sizeof(doid_t) <= sizeof(uint32_t)) {
-            m_sql << "CREATE TABLE IF NOT EXISTS objects ("
-                  "id INT NOT NULL PRIMARY KEY, class_id INT NOT NULL);";
+            sql << "CREATE TABLE IF NOT EXISTS objects ("
+                "id INT NOT NULL PRIMARY KEY, class_id INT NOT NULL);";
             //"CONSTRAINT check_object CHECK (id BETWEEN " << m_min_id << " AND " << m_max_id << "));";
         } else {
-            m_sql << "CREATE TABLE IF NOT EXISTS objects ("
-                  "id BIGINT NOT NULL PRIMARY KEY, class_id INT NOT NULL);";
+            sql << "CREATE TABLE IF NOT EXISTS objects ("
+                "id BIGINT NOT NULL PRIMARY KEY, class_id INT NOT NULL);";
             //"CONSTRAINT check_object CHECK (id BETWEEN " << m_min_id << " AND " << m_max_id << "));";
         }
-        m_sql << "CREATE TABLE IF NOT EXISTS classes ("
-              "id INT NOT NULL PRIMARY KEY, name VARCHAR(32) NOT NULL,"
-              "storable BOOLEAN NOT NULL);";//, CONSTRAINT check_class CHECK (id BETWEEN 0 AND "
+        sql << "CREATE TABLE IF NOT EXISTS classes ("
+            "id INT NOT NULL PRIMARY KEY, name VARCHAR(32) NOT NULL,"
+            "storable BOOLEAN NOT NULL);";//, CONSTRAINT check_class CHECK (id BETWEEN 0 AND "
         //<< g_dcf->get_num_types()-1 << "));";
     }
 
-    void check_classes()
+    void check_classes(session &sql)
     {
         int dc_id;
         uint8_t storable;
         string dc_name;
 
         // Prepare sql statements
-        statement get_row_by_id = (m_sql.prepare << "SELECT name FROM classes WHERE id=:id",
-                                   into(dc_name), use(dc_id));
-        statement insert_class = (m_sql.prepare << "INSERT INTO classes VALUES (:id,:name,:stored)",
+        statement get_row_by_id = (sql.prepare << "SELECT name, storable FROM classes WHERE id=:id",
+                                   into(dc_name), into(storable), use(dc_id));
+        statement insert_class = (sql.prepare << "INSERT INTO classes VALUES (:id,:name,:stored)",
                                   use(dc_id), use(dc_name), use(storable));
 
         // For each class, verify an entry exists and has the correct name and value
         for(unsigned int i = 0; i < g_dcf->get_num_classes(); ++i) {
             dc_id = g_dcf->get_class(i)->get_id();
             get_row_by_id.execute(true);
-            if(m_sql.got_data()) {
+            if(sql.got_data()) {
                 check_class(dc_id, dc_name);
             } else {
                 const Class* dcc = g_dcf->get_class(i);
 
                 // Create fields table for the class
-                storable = create_fields_table(dcc);
+                storable = create_fields_table(sql, dcc);
 
                 // Create class row in classes table
                 dc_name = dcc->get_name();
                 insert_class.execute(true);
             }
+
+            // Classes don't change while we're running, so remember which are stored
+            m_storable[dc_id] = storable;
         }
     }
-    void check_ids()
+    void check_ids(session &sql)
     {
         // Set all ids as free ids
         m_free_ids = set_t();
@@ -526,7 +256,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         doid_t id;
 
         // Get all ids from the database at once
-        statement st = (m_sql.prepare << "SELECT id FROM objects;", into(id));
+        statement st = (sql.prepare << "SELECT id FROM objects;", into(id));
         st.execute();
 
         // Iterate through the result set, removing used ids from the free ids
@@ -537,6 +267,8 @@ class SociSQLDatabase : public OldDatabaseBackend
 
     doid_t pop_next_id()
     {
+        lock_guard<mutex> lock(m_ids_lock);
+
         // Check to make sure any free ids exist
         if(!m_free_ids.size()) {
             return INVALID_DO_ID;
@@ -562,17 +294,520 @@ class SociSQLDatabase : public OldDatabaseBackend
 
     void push_id(doid_t id)
     {
+        lock_guard<mutex> lock(m_ids_lock);
         m_free_ids += interval_t::closed(id, id);
     }
   private:
-    doid_t m_min_id, m_max_id;
+    // The kinds of statement which are prepared, along with the class and fields they're for.
+    enum StatementType {
+        GET_CLASS,     // SELECT class_id FROM objects WHERE id=:id
+        INSERT_OBJECT, // INSERT INTO objects VALUES (:id,:class)
+        DELETE_OBJECT, // DELETE FROM objects WHERE id=:id
+        INSERT_FIELDS, // INSERT INTO fields_<class>(object_id, <fields>) VALUES (:id, :value, ...)
+        DELETE_FIELDS, // DELETE FROM fields_<class> WHERE object_id=:id
+        SELECT_FIELDS, // SELECT <fields> FROM fields_<class> WHERE object_id=:id
+        UPDATE_FIELDS  // UPDATE fields_<class> SET <field>=:value, ... WHERE object_id=:id
+    };
+    typedef tuple<StatementType, const Class*, FieldList> StatementKey;
+
+    // A PreparedStatement is a statement which has been prepared on one of the sessions,
+    // along with the variables it is bound to.  It is run by setting the variables and
+    // calling st.execute(true), so only the values are sent to the server.
+    struct PreparedStatement {
+        PreparedStatement(session &sql) : st(sql) {}
+
+        // finish steps a SELECT past its last row.  SQLite keeps the database locked against
+        // the other sessions' writes until a statement has finished.
+        void finish()
+        {
+            while(st.fetch()) {}
+        }
+
+        statement st;
+        doid_t id = 0;
+        int class_id = -1;
+        indicator class_ind = i_ok;
+        vector<string> values; // one per field, for an INSERT_FIELDS or UPDATE_FIELDS
+        vector<indicator> indicators; // i_null stores no value for the field
+        row result; // the columns returned by a SELECT_FIELDS
+    };
+
+    // A Connection is one session with the database, and the statements prepared on it.
+    struct Connection {
+        session sql;
+        map<StatementKey, unique_ptr<PreparedStatement> > statements;
+    };
+
+    // A Lease holds one of the idle connections for the duration of an operation,
+    // waiting for one to become available if necessary.
+    class Lease
+    {
+      public:
+        Lease(SociSQLDatabase *db) : m_db(db)
+        {
+            unique_lock<mutex> lock(m_db->m_pool_lock);
+            m_db->m_pool_cv.wait(lock, [this]() {
+                return !m_db->m_idle.empty();
+            });
+            m_conn = m_db->m_idle.back();
+            m_db->m_idle.pop_back();
+        }
+        ~Lease()
+        {
+            lock_guard<mutex> lock(m_db->m_pool_lock);
+            m_db->m_idle.push_back(m_conn);
+            m_db->m_pool_cv.notify_one();
+        }
+
+        Connection& operator*()
+        {
+            return *m_conn;
+        }
+        Connection* operator->()
+        {
+            return m_conn;
+        }
+
+      private:
+        SociSQLDatabase *m_db;
+        Connection *m_conn;
+    };
+
+    // A BatchedWrite is an operation waiting to be written in the next group commit.
+    struct BatchedWrite {
+        DBOperation *operation;
+        doid_t do_id; // allocated when queued, for a CREATE_OBJECT
+    };
+
     string m_backend, m_db_name, m_db_host;
     uint16_t m_db_port;
     string m_sess_user, m_sess_passwd;
-    session m_sql;
-    set_t m_free_ids;
     LogCategory* m_log;
 
+    vector<unique_ptr<Connection> > m_connections;
+    vector<Connection*> m_idle;
+    mutex m_pool_lock;
+    condition_variable m_pool_cv;
+
+    set_t m_free_ids;
+    mutex m_ids_lock;
+    unordered_map<uint16_t, bool> m_storable; // filled in at startup, read-only afterwards
+    // m_classes remembers the class of objects which have been created or looked up,
+    // since an object's class never changes.
+    unordered_map<doid_t, const Class*> m_classes;
+    mutex m_classes_lock;
+
+    // Group commit state, m_group_window is zero if each operation commits on its own.
+    unsigned int m_group_window = 0; // milliseconds to wait for more writes to commit together
+    unsigned int m_group_max_size = 0;
+    thread *m_group_thread = nullptr;
+    bool m_group_stopped = false;
+    mutex m_batch_lock; // protects m_batch, m_batch_doids and m_batch_deadline
+    condition_variable m_batch_cv;
+    vector<BatchedWrite> m_batch;
+    chrono::steady_clock::time_point m_batch_deadline;
+    // m_batch_doids counts the uncommitted writes to each object, including a batch being committed
+    unordered_map<doid_t, unsigned int> m_batch_doids;
+    mutex m_commit_lock; // held while a batch is committed, so batches commit in order
+
+    // run_write creates, deletes or sets the fields of an object in its own transaction.
+    void run_write(DBOperation *operation)
+    {
+        doid_t do_id = operation->doid();
+        if(operation->type() == DBOperation::CREATE_OBJECT) {
+            do_id = pop_next_id();
+            if(!do_id) {
+                operation->on_out_of_ids();
+                return;
+            }
+        }
+
+        bool written;
+        {
+            Lease lease(this);
+            session &sql = lease->sql;
+            try {
+                sql.begin(); // Start transaction
+                written = write(*lease, operation, do_id);
+                sql.commit(); // End transaction
+            } catch(const soci_error &e) {
+                sql.rollback(); // Revert transaction
+                m_log->error() << "Write to object " << do_id << " failed: " << e.what() << endl;
+                written = false;
+            }
+        }
+
+        complete_write(operation, do_id, written);
+    }
+
+    // run_get reads the class and fields of an object; with the class known, this is
+    // a single SELECT of all of the wanted columns.
+    void run_get(DBOperation *operation)
+    {
+        doid_t do_id = operation->doid();
+        DBObjectSnapshot *snapshot = nullptr;
+        {
+            Lease lease(this);
+            const Class *dcc = get_class(*lease, do_id);
+            if(dcc && operation->verify_class(dcc)) {
+                FieldList columns;
+                if(operation->type() == DBOperation::GET_OBJECT) {
+                    columns = db_fields(dcc);
+                } else {
+                    for(auto it = operation->get_fields().begin();
+                        it != operation->get_fields().end(); ++it) {
+                        if(is_column(dcc, *it)) {
+                            columns.push_back(*it);
+                        }
+                    }
+                }
+
+                snapshot = new DBObjectSnapshot();
+                snapshot->m_dclass = dcc;
+                try {
+                    if(is_storable(dcc->get_id())) {
+                        get_fields_from_table(*lease, do_id, dcc, columns, snapshot->m_fields);
+                    }
+                } catch(const soci_error &e) {
+                    m_log->error() << "Read of object " << do_id << " failed: " << e.what() << endl;
+                    delete snapshot;
+                    snapshot = nullptr;
+                }
+            }
+        }
+
+        if(snapshot) {
+            operation->on_complete(snapshot);
+        } else {
+            operation->on_failure();
+        }
+    }
+
+    // run_get_batch reads several objects, with one query for their classes and then one
+    // for the fields of each class.  Every field is read, even for a GET_FIELDS.
+    void run_get_batch(const vector<DBOperation*> &operations)
+    {
+        vector<DBObjectSnapshot*> snapshots(operations.size(), nullptr);
+        {
+            Lease lease(this);
+            unordered_map<doid_t, const Class*> classes;
+            get_classes(*lease, operations, classes);
+
+            map<const Class*, vector<size_t> > by_class;
+            for(size_t i = 0; i < operations.size(); ++i) {
+                const Class *dcc = classes[operations[i]->doid()];
+                if(dcc && operations[i]->verify_class(dcc)) {
+                    snapshots[i] = new DBObjectSnapshot();
+                    snapshots[i]->m_dclass = dcc;
+                    if(is_storable(dcc->get_id())) {
+                        by_class[dcc].push_back(i);
+                    }
+                }
+            }
+
+            for(auto it = by_class.begin(); it != by_class.end(); ++it) {
+                FieldList columns = db_fields(it->first);
+                if(columns.empty()) {
+                    continue;
+                }
+
+                unordered_map<doid_t, FieldValues*> objects;
+                for(auto i_it = it->second.begin(); i_it != it->second.end(); ++i_it) {
+                    objects[operations[*i_it]->doid()] = &snapshots[*i_it]->m_fields;
+                }
+
+                try {
+                    get_fields_from_table(*lease, it->first, columns, objects);
+                } catch(const soci_error &e) {
+                    m_log->error() << "Read of " << it->second.size() << " objects of class "
+                                   << it->first->get_name() << " failed: " << e.what() << endl;
+                    for(auto i_it = it->second.begin(); i_it != it->second.end(); ++i_it) {
+                        delete snapshots[*i_it];
+                        snapshots[*i_it] = nullptr;
+                    }
+                }
+            }
+        }
+
+        for(size_t i = 0; i < operations.size(); ++i) {
+            if(snapshots[i]) {
+                operations[i]->on_complete(snapshots[i]);
+            } else {
+                operations[i]->on_failure();
+            }
+        }
+    }
+
+    // run_update checks the criteria fields of an object and, if they all match,
+    // sets the new values; the SELECT and UPDATE happen in one transaction.
+    void run_update(DBOperation *operation)
+    {
+        doid_t do_id = operation->doid();
+        DBObjectSnapshot *mismatch = nullptr;
+        bool updated = false;
+        {
+            Lease lease(this);
+            session &sql = lease->sql;
+            const Class *dcc = get_class(*lease, do_id);
+            if(dcc && operation->verify_class(dcc)) {
+                bool storable = is_storable(dcc->get_id());
+                try {
+                    sql.begin(); // Start transaction
+
+                    FieldList columns;
+                    const FieldValues &criteria = operation->criteria_fields();
+                    for(auto it = criteria.begin(); it != criteria.end(); ++it) {
+                        if(is_column(it->first)) {
+                            columns.push_back(it->first);
+                        }
+                    }
+                    FieldValues current;
+                    if(storable) {
+                        get_fields_from_table(*lease, do_id, dcc, columns, current);
+                    }
+
+                    // An empty criterion means that the field must have no value
+                    bool matches = true;
+                    for(auto it = criteria.begin(); it != criteria.end(); ++it) {
+                        auto current_it = current.find(it->first);
+                        if(current_it == current.end() ? !it->second.empty()
+                           : current_it->second != it->second) {
+                            matches = false;
+                            break;
+                        }
+                    }
+
+                    if(matches) {
+                        if(storable) {
+                            update_fields_in_table(*lease, do_id, dcc, operation->set_fields());
+                        }
+                        sql.commit(); // End transaction
+                        updated = true;
+                    } else {
+                        sql.rollback(); // Revert transaction
+                        mismatch = new DBObjectSnapshot();
+                        mismatch->m_dclass = dcc;
+                        mismatch->m_fields = current;
+                    }
+                } catch(const soci_error &e) {
+                    sql.rollback(); // Revert transaction
+                    m_log->error() << "Update of object " << do_id << " failed: "
+                                   << e.what() << endl;
+                }
+            }
+        }
+
+        if(updated) {
+            operation->on_complete();
+        } else if(mismatch) {
+            operation->on_criteria_mismatch(mismatch);
+        } else {
+            operation->on_failure();
+        }
+    }
+
+    // write performs a create, delete or set operation within the current transaction.
+    // Returns false if the operation isn't valid for the object.
+    bool write(Connection &conn, DBOperation *operation, doid_t do_id)
+    {
+        switch(operation->type()) {
+        case DBOperation::CREATE_OBJECT: {
+            const Class *dcc = operation->dclass();
+            PreparedStatement &insert_object = prepare(conn, INSERT_OBJECT, nullptr);
+            insert_object.id = do_id;
+            insert_object.class_id = dcc->get_id();
+            insert_object.st.execute(true);
+
+            // The object's row in its fields table is inserted along with its initial values
+            if(is_storable(dcc->get_id())) {
+                FieldList columns;
+                const FieldValues &fields = operation->set_fields();
+                for(auto it = fields.begin(); it != fields.end(); ++it) {
+                    if(is_column(it->first)) {
+                        columns.push_back(it->first);
+                    }
+                }
+
+                PreparedStatement &insert_fields = prepare(conn, INSERT_FIELDS, dcc, columns);
+                insert_fields.id = do_id;
+                bind_values(insert_fields, columns, fields);
+                insert_fields.st.execute(true);
+            }
+            return true;
+        }
+        case DBOperation::DELETE_OBJECT: {
+            const Class *dcc = get_class(conn, do_id);
+            PreparedStatement &delete_object = prepare(conn, DELETE_OBJECT, nullptr);
+            delete_object.id = do_id;
+            delete_object.st.execute(true);
+
+            if(dcc && is_storable(dcc->get_id())) {
+                PreparedStatement &delete_fields = prepare(conn, DELETE_FIELDS, dcc);
+                delete_fields.id = do_id;
+                delete_fields.st.execute(true);
+            }
+            return true;
+        }
+        case DBOperation::SET_FIELDS: {
+            const Class *dcc = get_class(conn, do_id);
+            if(!dcc || !operation->verify_class(dcc)) {
+                return false;
+            }
+            if(is_storable(dcc->get_id())) {
+                update_fields_in_table(conn, do_id, dcc, operation->set_fields());
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // complete_write reports the result of a write once it has been committed.
+    void complete_write(DBOperation *operation, doid_t do_id, bool written)
+    {
+        switch(operation->type()) {
+        case DBOperation::CREATE_OBJECT:
+            if(written) {
+                remember_class(do_id, operation->dclass());
+                operation->on_complete(do_id);
+            } else {
+                push_id(do_id);
+                operation->on_failure();
+            }
+            break;
+        case DBOperation::DELETE_OBJECT:
+            if(written) {
+                forget_class(do_id);
+                push_id(do_id);
+                operation->on_complete();
+            } else {
+                operation->on_failure();
+            }
+            break;
+        default:
+            if(written) {
+                operation->on_complete();
+            } else {
+                operation->on_failure();
+            }
+        }
+    }
+
+    // queue_write adds a write to the next group commit; m_batch_lock must be held.
+    void queue_write(DBOperation *operation)
+    {
+        BatchedWrite write;
+        write.operation = operation;
+        if(operation->type() == DBOperation::CREATE_OBJECT) {
+            write.do_id = pop_next_id();
+            if(!write.do_id) {
+                operation->on_out_of_ids();
+                return;
+            }
+        } else {
+            write.do_id = operation->doid();
+        }
+
+        if(m_batch.empty()) {
+            m_batch_deadline = chrono::steady_clock::now() + chrono::milliseconds(m_group_window);
+        }
+        m_batch.push_back(write);
+        ++m_batch_doids[write.do_id];
+        m_batch_cv.notify_one();
+    }
+
+    // run_group_commit commits the batch whenever the window expires or it is full.
+    void run_group_commit()
+    {
+        unique_lock<mutex> lock(m_batch_lock);
+        while(!m_group_stopped) {
+            if(m_batch.empty()) {
+                m_batch_cv.wait(lock);
+                continue;
+            }
+
+            m_batch_cv.wait_until(lock, m_batch_deadline, [this]() {
+                return m_group_stopped || m_batch.size() >= m_group_max_size;
+            });
+
+            lock.unlock();
+            commit_batch();
+            lock.lock();
+        }
+    }
+
+    // stop_group_commit commits the outstanding writes; later writes commit on their own.
+    void stop_group_commit()
+    {
+        {
+            lock_guard<mutex> lock(m_batch_lock);
+            m_group_stopped = true;
+            m_batch_cv.notify_all();
+        }
+        m_group_thread->join();
+        delete m_group_thread;
+        m_group_thread = nullptr;
+        commit_batch();
+    }
+
+    // commit_batch writes every queued operation in a single transaction, then completes them.
+    // If the transaction fails, each operation is retried in its own transaction so that only
+    // the ones which are actually bad fail.
+    void commit_batch()
+    {
+        lock_guard<mutex> commit_lock(m_commit_lock);
+        vector<BatchedWrite> batch;
+        {
+            lock_guard<mutex> lock(m_batch_lock);
+            batch.swap(m_batch);
+        }
+        if(batch.empty()) {
+            return;
+        }
+
+        vector<bool> written(batch.size(), false);
+        {
+            Lease lease(this);
+            session &sql = lease->sql;
+            try {
+                sql.begin(); // Start transaction
+                for(size_t i = 0; i < batch.size(); ++i) {
+                    written[i] = write(*lease, batch[i].operation, batch[i].do_id);
+                }
+                sql.commit(); // End transaction
+            } catch(const soci_error &e) {
+                sql.rollback(); // Revert transaction
+                m_log->warning() << "Group commit of " << batch.size() << " operations failed,"
+                                 " retrying them individually: " << e.what() << endl;
+                for(size_t i = 0; i < batch.size(); ++i) {
+                    try {
+                        sql.begin(); // Start transaction
+                        written[i] = write(*lease, batch[i].operation, batch[i].do_id);
+                        sql.commit(); // End transaction
+                    } catch(const soci_error&) {
+                        sql.rollback(); // Revert transaction
+                        written[i] = false;
+                    }
+                }
+            }
+        }
+
+        {
+            lock_guard<mutex> lock(m_batch_lock);
+            for(auto it = batch.begin(); it != batch.end(); ++it) {
+                auto count_it = m_batch_doids.find(it->do_id);
+                if(--count_it->second == 0) {
+                    m_batch_doids.erase(count_it);
+                }
+            }
+        }
+
+        for(size_t i = 0; i < batch.size(); ++i) {
+            complete_write(batch[i].operation, batch[i].do_id, written[i]);
+        }
+    }
+
     void check_class(uint16_t id, string name)
     {
         const Class* dcc = g_dcf->get_class_by_id(id);
@@ -589,7 +824,7 @@ class SociSQLDatabase : public OldDatabaseBackend
     }
 
     // returns true if class has db fields
-    bool create_fields_table(const Class* dcc)
+    bool create_fields_table(session &sql, const Class* dcc)
     {
         stringstream ss;
         if(sizeof(doid_t) <= sizeof(uint32_t)) {
@@ -603,7 +838,7 @@ class SociSQLDatabase : public OldDatabaseBackend
         int db_field_count = 0;
         for(unsigned int i = 0; i < dcc->get_num_fields(); ++i) {
             const Field* field = dcc->get_field(i);
-            if(field->has_keyword("db") && !field->as_molecular()) {
+            if(is_column(field)) {
                 db_field_count += 1;
                 // TODO: Store SimpleParameters and fields with 1 SimpleParameter
                 //       as a simpler type.
@@ -619,7 +854,7 @@ class SociSQLDatabase : public OldDatabaseBackend
 
         if(db_field_count > 0) {
             ss << ");";
-            m_sql << ss.str();
+            sql << ss.str();
             return true;
         }
 
@@ -628,87 +863,336 @@ class SociSQLDatabase : public OldDatabaseBackend
 
     bool is_storable(uint16_t dc_id)
     {
-        uint8_t storable;
-        m_sql << "SELECT storable FROM classes WHERE id=:id", into(storable), use(dc_id);
-        return storable;
+        auto it = m_storable.find(dc_id);
+        return it != m_storable.end() && it->second;
+    }
+
+    // is_column returns true if a field has a column in its class's fields table.
+    static bool is_column(const Field* field)
+    {
+        return field->has_keyword("db") && !field->as_molecular();
+    }
+    // is_column returns true if a field has a column in the fields table of the given class;
+    // requests may name fields from other classes, which are left out of the reply.
+    static bool is_column(const Class* dcc, const Field* field)
+    {
+        return is_column(field) && dcc->get_field_by_id(field->get_id()) != nullptr;
     }
 
-    void get_all_from_table(doid_t id, const Class* dcc, FieldValues &fields)
+    // db_fields returns the fields of a class which have a column in its fields table.
+    FieldList db_fields(const Class* dcc)
     {
-        string value;
-        indicator ind;
+        FieldList fields;
         for(unsigned int i = 0; i < dcc->get_num_fields(); ++i) {
             const Field* field = dcc->get_field(i);
-            if(field->has_keyword("db")) {
-                m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-                      << " WHERE object_id=" << id << ";", into(value, ind);
-
-                if(ind == i_ok) {
-                    bool parse_err;
-                    string packed_data = parse_value(field->get_type(), value, parse_err);
-                    if(parse_err) {
-                        m_log->error() << "Failed parsing value for field '" << field->get_name()
-                                       << "' of object " << id << "' from database.\n";
-                        continue;
-                    }
-                    fields[field] = vector<uint8_t>(packed_data.begin(), packed_data.end());
-                }
+            if(is_column(field)) {
+                fields.push_back(field);
             }
         }
+        return fields;
     }
 
-    void get_fields_from_table(doid_t id, const Class* dcc, const FieldList &fields,
-                               FieldValues &values)
+    // prepare returns the statement of the given type for a class and fields on a connection,
+    // preparing it the first time it is used.
+    PreparedStatement& prepare(Connection &conn, StatementType type, const Class* dcc,
+                               const FieldList &fields = FieldList())
     {
-        string value;
-        indicator ind;
-        for(auto it = fields.begin(); it != fields.end(); ++it) {
-            const Field* field = *it;
-            if(field->has_keyword("db")) {
-                m_sql << "SELECT " << field->get_name() << " FROM fields_" << dcc->get_name()
-                      << " WHERE object_id=" << id << ";", into(value, ind);
-
-                if(ind == i_ok) {
-                    bool parse_err;
-                    string packed_data = parse_value(field->get_type(), value, parse_err);
-                    if(parse_err) {
-                        m_log->error() << "Failed parsing value for field '" << field->get_name()
-                                       << "' of object " << id << "' from database.\n";
-                        continue;
-                    }
-                    values[field] = vector<uint8_t>(packed_data.begin(), packed_data.end());
+        StatementKey key(type, dcc, fields);
+        auto it = conn.statements.find(key);
+        if(it != conn.statements.end()) {
+            return *it->second;
+        }
+
+        // The bound variables must not move once the statement is prepared
+        PreparedStatement *ps = new PreparedStatement(conn.sql);
+        ps->values.resize(fields.size());
+        ps->indicators.resize(fields.size(), i_ok);
+
+        stringstream query;
+        switch(type) {
+        case GET_CLASS:
+            query << "SELECT class_id FROM objects WHERE id=:id";
+            ps->st.exchange(into(ps->class_id, ps->class_ind));
+            ps->st.exchange(use(ps->id));
+            break;
+        case INSERT_OBJECT:
+            query << "INSERT INTO objects VALUES (:id,:class)";
+            ps->st.exchange(use(ps->id));
+            ps->st.exchange(use(ps->class_id));
+            break;
+        case DELETE_OBJECT:
+            query << "DELETE FROM objects WHERE id=:id";
+            ps->st.exchange(use(ps->id));
+            break;
+        case INSERT_FIELDS:
+            query << "INSERT INTO fields_" << dcc->get_name() << "(object_id";
+            for(size_t i = 0; i < fields.size(); ++i) {
+                query << "," << fields[i]->get_name();
+            }
+            query << ") VALUES (:id";
+            ps->st.exchange(use(ps->id));
+            for(size_t i = 0; i < fields.size(); ++i) {
+                query << ",:v" << i;
+                ps->st.exchange(use(ps->values[i], ps->indicators[i]));
+            }
+            query << ")";
+            break;
+        case DELETE_FIELDS:
+            query << "DELETE FROM fields_" << dcc->get_name() << " WHERE object_id=:id";
+            ps->st.exchange(use(ps->id));
+            break;
+        case SELECT_FIELDS:
+            query << "SELECT ";
+            for(size_t i = 0; i < fields.size(); ++i) {
+                query << (i ? "," : "") << fields[i]->get_name();
+            }
+            query << " FROM fields_" << dcc->get_name() << " WHERE object_id=:id";
+            ps->st.exchange(into(ps->result));
+            ps->st.exchange(use(ps->id));
+            break;
+        case UPDATE_FIELDS:
+            query << "UPDATE fields_" << dcc->get_name() << " SET ";
+            for(size_t i = 0; i < fields.size(); ++i) {
+                query << (i ? "," : "") << fields[i]->get_name() << "=:v" << i;
+                ps->st.exchange(use(ps->values[i], ps->indicators[i]));
+            }
+            query << " WHERE object_id=:id";
+            ps->st.exchange(use(ps->id));
+            break;
+        }
+
+        ps->st.alloc();
+        ps->st.prepare(query.str());
+        ps->st.define_and_bind();
+
+        conn.statements[key].reset(ps);
+        return *ps;
+    }
+
+    // bind_values sets the values of an INSERT_FIELDS or UPDATE_FIELDS statement;
+    // an empty value is stored as NULL.
+    void bind_values(PreparedStatement &ps, const FieldList &columns, const FieldValues &fields)
+    {
+        for(size_t i = 0; i < columns.size(); ++i) {
+            const vector<uint8_t> &value = fields.find(columns[i])->second;
+            if(value.empty()) {
+                ps.values[i].clear();
+                ps.indicators[i] = i_null;
+            } else {
+                ps.values[i] = format_value(columns[i]->get_type(), value);
+                ps.indicators[i] = i_ok;
+            }
+        }
+    }
+
+    // get_class returns the class of an object, or NULL if it doesn't exist.
+    const Class* get_class(Connection &conn, doid_t do_id)
+    {
+        {
+            lock_guard<mutex> lock(m_classes_lock);
+            auto it = m_classes.find(do_id);
+            if(it != m_classes.end()) {
+                return it->second;
+            }
+        }
+
+        try {
+            PreparedStatement &select = prepare(conn, GET_CLASS, nullptr);
+            select.id = do_id;
+            select.class_id = -1;
+            if(!select.st.execute(true)) {
+                return NULL;
+            }
+            int class_id = select.class_ind == i_ok ? select.class_id : -1;
+            select.finish();
+            if(class_id == -1) {
+                return NULL;
+            }
+
+            const Class *dcc = g_dcf->get_class_by_id(class_id);
+            if(dcc) {
+                remember_class(do_id, dcc);
+            }
+            return dcc;
+        } catch(const soci_error&) {
+            return NULL;
+        }
+    }
+    // get_classes finds the class of the object of each operation, asking the database
+    // about all of the objects which aren't in the class cache with one query.
+    void get_classes(Connection &conn, const vector<DBOperation*> &operations,
+                     unordered_map<doid_t, const Class*> &classes)
+    {
+        vector<doid_t> unknown;
+        {
+            lock_guard<mutex> lock(m_classes_lock);
+            for(auto it = operations.begin(); it != operations.end(); ++it) {
+                auto class_it = m_classes.find((*it)->doid());
+                if(class_it != m_classes.end()) {
+                    classes[(*it)->doid()] = class_it->second;
+                } else {
+                    unknown.push_back((*it)->doid());
                 }
             }
         }
+        if(unknown.empty()) {
+            return;
+        }
+
+        stringstream query;
+        query << "SELECT id, class_id FROM objects WHERE id IN (";
+        for(size_t i = 0; i < unknown.size(); ++i) {
+            query << (i ? "," : "") << unknown[i];
+        }
+        query << ")";
+
+        try {
+            doid_t id;
+            int class_id;
+            statement st = (conn.sql.prepare << query.str(), into(id), into(class_id));
+            st.execute();
+            while(st.fetch()) {
+                const Class *dcc = g_dcf->get_class_by_id(class_id);
+                if(dcc) {
+                    classes[id] = dcc;
+                    remember_class(id, dcc);
+                }
+            }
+        } catch(const soci_error&) {
+            // The objects are treated as absent
+        }
+    }
+    void remember_class(doid_t do_id, const Class *dcc)
+    {
+        lock_guard<mutex> lock(m_classes_lock);
+        if(m_classes.size() >= CLASS_CACHE_SIZE) {
+            m_classes.erase(m_classes.begin());
+        }
+        m_classes[do_id] = dcc;
+    }
+    void forget_class(doid_t do_id)
+    {
+        lock_guard<mutex> lock(m_classes_lock);
+        m_classes.erase(do_id);
     }
 
-    void set_fields_in_table(doid_t id, const Class* dcc,
-                             const FieldValues &fields)
+    void get_fields_from_table(Connection &conn, doid_t id, const Class* dcc,
+                               const FieldList &fields, FieldValues &values)
     {
-        string name, value;
-        for(auto it = fields.begin(); it != fields.end(); ++it) {
-            if(it->first->has_keyword("db")) {
-                name = it->first->get_name();
-                value = format_value(it->first->get_type(), it->second);
-                m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << name << "='" << value
-                      << "' WHERE object_id=" << id << ";";
+        if(fields.empty()) {
+            return;
+        }
+
+        // All of the fields are read with a single statement
+        PreparedStatement &select = prepare(conn, SELECT_FIELDS, dcc, fields);
+        select.id = id;
+        if(!select.st.execute(true)) {
+            return;
+        }
+
+        read_fields(select.result, 0, id, fields, values);
+        select.finish();
+    }
+
+    // get_fields_from_table reads the fields of several objects of one class, with a single
+    // statement; objects maps the id of each object to the values to read its fields into.
+    void get_fields_from_table(Connection &conn, const Class* dcc, const FieldList &fields,
+                               const unordered_map<doid_t, FieldValues*> &objects)
+    {
+        stringstream query;
+        query << "SELECT object_id";
+        for(size_t i = 0; i < fields.size(); ++i) {
+            query << "," << fields[i]->get_name();
+        }
+        query << " FROM fields_" << dcc->get_name() << " WHERE object_id IN (";
+        for(auto it = objects.begin(); it != objects.end(); ++it) {
+            query << (it == objects.begin() ? "" : ",") << it->first;
+        }
+        query << ")";
+
+        row result;
+        statement st = (conn.sql.prepare << query.str(), into(result));
+        st.execute();
+        while(st.fetch()) {
+            doid_t id = read_doid(result, 0);
+            auto it = objects.find(id);
+            if(it != objects.end()) {
+                read_fields(result, 1, id, fields, *it->second);
+            }
+        }
+    }
+
+    // read_doid reads an object id from a column of a row.  object_id is an INT, or a BIGINT
+    // if doids are 64-bit, but SOCI backends and versions differ in which integer type they
+    // report for it, and row::get throws std::bad_cast unless asked for exactly that type.
+    static doid_t read_doid(const row &result, size_t pos)
+    {
+        switch(result.get_properties(pos).get_data_type()) {
+        case dt_long_long:
+            return doid_t(result.get<long long>(pos));
+        case dt_unsigned_long_long:
+            return doid_t(result.get<unsigned long long>(pos));
+        default:
+            return doid_t(result.get<int>(pos));
+        }
+    }
+
+    // read_fields parses the values of fields from the columns of a row, starting at first.
+    void read_fields(const row &result, size_t first, doid_t id, const FieldList &fields,
+                     FieldValues &values)
+    {
+        for(size_t i = 0; i < fields.size(); ++i) {
+            const Field* field = fields[i];
+            if(result.get_indicator(first + i) != i_ok) {
+                continue;
             }
+
+            bool parse_err;
+            string packed_data = parse_value(field->get_type(), result.get<string>(first + i),
+                                             parse_err);
+            if(parse_err) {
+                m_log->error() << "Failed parsing value for field '" << field->get_name()
+                               << "' of object " << id << "' from database.\n";
+                continue;
+            }
+            values[field] = vector<uint8_t>(packed_data.begin(), packed_data.end());
         }
     }
 
-    void del_fields_in_table(doid_t id, const Class* dcc, const FieldList &fields)
+    // update_fields_in_table sets and deletes (for empty values) fields with one statement.
+    void update_fields_in_table(Connection &conn, doid_t id, const Class* dcc,
+                                const FieldValues &fields)
     {
-        string name;
+        FieldList columns;
         for(auto it = fields.begin(); it != fields.end(); ++it) {
-            const Field* field = *it;
-            if(field->has_keyword("db")) {
-                m_sql << "UPDATE fields_" << dcc->get_name() << " SET " << field->get_name()
-                      << "=NULL WHERE object_id=" << id << ";";
+            if(is_column(it->first)) {
+                columns.push_back(it->first);
             }
         }
+        if(columns.empty()) {
+            return;
+        }
+
+        PreparedStatement &update = prepare(conn, UPDATE_FIELDS, dcc, columns);
+        update.id = id;
+        bind_values(update, columns, fields);
+        update.st.execute(true);
     }
 };
 
-DBBackendFactoryItem<SociSQLDatabase> mysql_factory("mysql");
-DBBackendFactoryItem<SociSQLDatabase> postgresql_factory("postgresql");
-DBBackendFactoryItem<SociSQLDatabase> sqlite_factory("sqlite3");
+static string server_storage(ConfigNode config)
+{
+    stringstream ss;
+    ss << database_host.get_rval(config) << ":" << database_port.get_rval(config) << "/"
+       << database_name.get_rval(config);
+    return ss.str();
+}
+
+static string sqlite_storage(ConfigNode config)
+{
+    return database_name.get_rval(config);
+}
+
+DBBackendFactoryItem<SociSQLDatabase> mysql_factory("mysql", server_storage);
+DBBackendFactoryItem<SociSQLDatabase> postgresql_factory("postgresql", server_storage);
+DBBackendFactoryItem<SociSQLDatabase> sqlite_factory("sqlite3", sqlite_storage);
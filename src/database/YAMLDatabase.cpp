@@ -3,28 +3,82 @@
 #include "DatabaseServer.h"
 
 #include "core/global.h"
+#include "core/shutdown.h"
 #include "util/DatagramIterator.h"
 #include "dclass/value/format.h"
 #include "dclass/value/parse.h"
 
 #include <yaml-cpp/yaml.h>
-#include <fstream> // std::ifstream
-#include <list>    // std::list
+#include <boost/filesystem.hpp>
+#include <atomic>             // std::atomic
+#include <condition_variable> // std::condition_variable
+#include <fstream>            // std::ifstream
+#include <list>               // std::list
+#include <mutex>              // std::mutex
+#include <thread>             // std::thread
+#include <unordered_map>      // std::unordered_map
+#include <unordered_set>      // std::unordered_set
 
 using dclass::Class;
 using dclass::Field;
 using namespace std;
 
 static ConfigVariable<string> foldername("foldername", "yaml_db", db_backend_config);
-
+static ConfigVariable<unsigned int> flush_interval("flush_interval", 0, db_backend_config);
+static ConfigVariable<unsigned int> lease_size("lease_size", 1024, db_backend_config);
+static ConfigGroup yaml_cache_config("cache", db_backend_config);
+static ConfigVariable<uint64_t> yaml_cache_max_size("max_size", 0, yaml_cache_config);
+
+// Approximate bookkeeping overhead of a cached object and of each of its fields, in bytes.
+static const size_t OBJECT_OVERHEAD = sizeof(doid_t) * 2 + 128;
+static const size_t FIELD_OVERHEAD = 64;
+
+// YAMLDatabase keeps each object in its own YAML file.  Objects are parsed the first time
+// they're used and kept in memory afterwards, so only writes touch the disk; with a
+// flush_interval, changed objects are only written out every so often, in a batch.
+// With a cache max_size, the least recently used objects are forgotten once the cache
+// grows past it, unless they have changes which haven't been written yet.
+// Ids for new objects are reserved in blocks, so "info.yaml" is rarely rewritten by a create.
 class YAMLDatabase : public OldDatabaseBackend
 {
   private:
+    // A CachedObject is the parsed contents of an object's file.
+    struct CachedObject {
+        const Class *dcc;
+        FieldValues fields;
+        size_t size = 0;
+        list<doid_t>::iterator lru;
+    };
+
     doid_t m_next_id;
+    // The ids from m_next_id up to m_lease_end are reserved in info.yaml, and may be handed
+    // out without writing it again.  If astrond dies, they are recovered on the next start.
+    uint64_t m_lease_end;
+    unsigned int m_lease_size;
     list<doid_t> m_free_ids;
+    mutex m_ids_lock; // protects the ids, m_info_dirty and info.yaml
+    bool m_info_dirty = false;
     string m_foldername;
     LogCategory *m_log;
 
+    mutex m_cache_lock; // protects m_objects, m_lru, m_cache_size, m_dirty and m_flushing
+    unordered_map<doid_t, CachedObject> m_objects;
+    list<doid_t> m_lru; // most recently used at the front
+    size_t m_cache_size = 0;
+    size_t m_cache_max_size; // 0 if every object is kept
+    unordered_set<doid_t> m_dirty; // objects changed since they were last written
+    unordered_set<doid_t> m_flushing; // objects whose files are being written by a flush
+
+    // Write-behind state, m_flush_thread is null if every change is written immediately.
+    unsigned int m_flush_interval;
+    atomic<bool> m_write_behind;
+    // m_stopped is set once write-behind has been stopped by a shutdown; after that, objects
+    // are written while holding m_cache_lock, so the final flush can't overwrite a newer copy.
+    bool m_stopped = false;
+    thread *m_flush_thread = nullptr;
+    mutex m_flush_lock; // held while objects are written or deleted in the background
+    condition_variable m_flush_cv;
+
     inline string filename(doid_t do_id)
     {
         stringstream filename;
@@ -59,13 +113,143 @@ class YAMLDatabase : public OldDatabaseBackend
         return true;
     }
 
-    // update_info writes m_next_id and m_free_ids to "info.yaml"
+    // fetch returns the cached copy of an object, loading it from its file if necessary.
+    // Returns NULL if the object doesn't exist.  m_cache_lock must be held.
+    CachedObject* fetch(doid_t do_id)
+    {
+        auto found = m_objects.find(do_id);
+        if(found != m_objects.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, found->second.lru);
+            return &found->second;
+        }
+
+        // Open file for object
+        YAML::Node document;
+        if(!load(do_id, document)) {
+            return NULL;
+        }
+
+        // Read object's DistributedClass
+        CachedObject &object = insert(do_id);
+        object.dcc = g_dcf->get_class_by_name(document["class"].as<string>());
+
+        // Read object's fields
+        YAML::Node fields = document["fields"];
+        for(auto it = fields.begin(); it != fields.end(); ++it) {
+            const Field* field = object.dcc->get_field_by_name(it->first.as<string>());
+            if(!field) {
+                m_log->warning() << "Field '" << it->first.as<string>()
+                                 << "', loaded from '" << filename(do_id)
+                                 << "', does not exist." << endl;
+                continue;
+            }
+
+            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
+            if(value.size() > 0) {
+                object.fields[field] = value;
+            }
+        }
+
+        resize(object);
+        evict(do_id);
+        return &object;
+    }
+
+    // insert adds an empty object to the cache, as the most recently used.
+    // m_cache_lock must be held.
+    CachedObject& insert(doid_t do_id)
+    {
+        erase(do_id);
+        CachedObject &object = m_objects[do_id];
+        m_lru.push_front(do_id);
+        object.lru = m_lru.begin();
+        return object;
+    }
+
+    // erase forgets an object's cached copy, if there is one.  m_cache_lock must be held.
+    bool erase(doid_t do_id)
+    {
+        auto found = m_objects.find(do_id);
+        if(found == m_objects.end()) {
+            return false;
+        }
+
+        m_cache_size -= found->second.size;
+        m_lru.erase(found->second.lru);
+        m_objects.erase(found);
+        m_dirty.erase(do_id);
+        return true;
+    }
+
+    // resize recounts the size of an object after its fields have changed.
+    // m_cache_lock must be held.
+    void resize(CachedObject &object)
+    {
+        size_t size = OBJECT_OVERHEAD;
+        for(auto it = object.fields.begin(); it != object.fields.end(); ++it) {
+            size += FIELD_OVERHEAD + it->second.size();
+        }
+        m_cache_size += size - object.size;
+        object.size = size;
+    }
+
+    // evict forgets the least recently used objects until the cache fits in its max_size,
+    // except for keep and the objects whose files aren't up to date yet.
+    // m_cache_lock must be held.
+    void evict(doid_t keep)
+    {
+        if(m_cache_max_size == 0) {
+            return;
+        }
+
+        auto it = m_lru.end();
+        while(m_cache_size > m_cache_max_size && it != m_lru.begin()) {
+            doid_t do_id = *--it;
+            if(do_id == keep || m_dirty.find(do_id) != m_dirty.end() ||
+               m_flushing.find(do_id) != m_flushing.end()) {
+                continue;
+            }
+
+            // Step past the object before its position in m_lru is erased
+            ++it;
+            erase(do_id);
+        }
+    }
+
+    // store writes out an object after it has been changed, or marks it to be written by the
+    // next flush.  The lock on m_cache_lock may be released.
+    bool store(doid_t do_id, unique_lock<mutex> &lock)
+    {
+        resize(m_objects[do_id]);
+        if(m_write_behind) {
+            m_dirty.insert(do_id);
+            evict(do_id);
+            return true;
+        }
+        evict(do_id);
+
+        ObjectData dbo(m_objects[do_id].dcc->get_id());
+        dbo.fields = m_objects[do_id].fields;
+        const Class *dcc = m_objects[do_id].dcc;
+        if(!m_stopped) {
+            // Operations on the same object are never run at the same time, so the file
+            // can be written without holding up operations on other objects.
+            lock.unlock();
+        }
+        return write_yaml_object(do_id, dcc, dbo);
+    }
+
+    // update_info writes m_next_id, the current lease and m_free_ids to "info.yaml"
     void update_info()
     {
         YAML::Emitter out;
         out << YAML::BeginMap
             << YAML::Key << "next"
             << YAML::Value << m_next_id;
+        if(m_lease_end > m_next_id) {
+            out << YAML::Key << "lease"
+                << YAML::Value << m_lease_end;
+        }
         if(!m_free_ids.empty()) {
             out << YAML::Key << "free"
                 << YAML::Value << YAML::BeginSeq;
@@ -84,11 +268,30 @@ class YAMLDatabase : public OldDatabaseBackend
         }
     }
 
+    // info_changed writes "info.yaml", or marks it to be written by the next flush.
+    // m_ids_lock must be held.
+    void info_changed()
+    {
+        if(m_write_behind) {
+            m_info_dirty = true;
+        } else {
+            update_info();
+        }
+    }
+
     // get_next_id returns the next available id to be used in object creation
     doid_t get_next_id()
     {
+        lock_guard<mutex> lock(m_ids_lock);
         doid_t do_id;
         if(m_next_id <= m_max_id) {
+            if(m_next_id < m_lease_end) {
+                return m_next_id++;
+            }
+
+            // Reserve the next block of ids before handing any of them out
+            m_lease_end = min<uint64_t>(uint64_t(m_next_id) + max(m_lease_size, 1u),
+                                        uint64_t(m_max_id) + 1);
             do_id = m_next_id++;
         } else {
             // Dequeue id from list
@@ -100,10 +303,41 @@ class YAMLDatabase : public OldDatabaseBackend
             }
         }
 
-        update_info();
+        info_changed();
         return do_id;
     }
 
+    // recover_lease finds the ids of a lease which was left outstanding when astrond died,
+    // that weren't used by an object, so that they can be handed out again.
+    void recover_lease(uint64_t lease_end)
+    {
+        doid_t next_id = m_next_id;
+        for(uint64_t do_id = m_next_id; do_id < lease_end; ++do_id) {
+            if(boost::filesystem::exists(filename(do_id))) {
+                next_id = do_id + 1;
+            }
+        }
+
+        // Ids after the last object may have been freed, but won't be used again until
+        // the rest of the range is used up
+        m_free_ids.remove_if([&](doid_t do_id) {
+            return do_id >= next_id && do_id < lease_end;
+        });
+
+        m_log->info() << "Recovered ids " << next_id << " to " << lease_end - 1
+                      << " from an unfinished lease." << endl;
+        m_next_id = next_id;
+    }
+
+    // release_lease returns the unused ids of the current lease to info.yaml.
+    void release_lease()
+    {
+        lock_guard<mutex> lock(m_ids_lock);
+        m_lease_end = m_next_id;
+        update_info();
+        m_info_dirty = false;
+    }
+
     vector<uint8_t> read_yaml_field(const Field* field, YAML::Node node, doid_t id)
     {
         bool error;
@@ -152,13 +386,103 @@ class YAMLDatabase : public OldDatabaseBackend
         }
         return false;
     }
+
+    // run_flush writes out the changed objects every m_flush_interval milliseconds.
+    void run_flush()
+    {
+        unique_lock<mutex> lock(m_flush_lock);
+        bool stopping = false;
+        while(!stopping) {
+            m_flush_cv.wait_for(lock, chrono::milliseconds(m_flush_interval));
+            stopping = !m_write_behind;
+            flush();
+        }
+    }
+
+    // stop_flush writes out all of the changed objects; later changes are written immediately.
+    void stop_flush()
+    {
+        {
+            lock_guard<mutex> lock(m_flush_lock);
+            lock_guard<mutex> cache_lock(m_cache_lock);
+            m_write_behind = false;
+            m_stopped = true;
+            m_flush_cv.notify_all();
+        }
+        m_flush_thread->join();
+        delete m_flush_thread;
+        m_flush_thread = nullptr;
+    }
+
+    // flush writes out the objects which have changed since they were last written.
+    // m_flush_lock must be held.
+    void flush()
+    {
+        // info.yaml goes first, so an id is never reused by a restart after its object is written
+        {
+            lock_guard<mutex> lock(m_ids_lock);
+            if(m_info_dirty) {
+                update_info();
+                m_info_dirty = false;
+            }
+        }
+
+        vector<pair<doid_t, CachedObject> > objects;
+        unique_lock<mutex> lock(m_cache_lock);
+        objects.reserve(m_dirty.size());
+        for(auto it = m_dirty.begin(); it != m_dirty.end(); ++it) {
+            objects.push_back(make_pair(*it, m_objects[*it]));
+        }
+        // The objects stay cached until their files are written, or a fetch on another
+        // thread could read an old copy
+        m_flushing.swap(m_dirty);
+        if(!m_stopped) {
+            lock.unlock();
+        }
+
+        vector<doid_t> failed;
+        for(auto it = objects.begin(); it != objects.end(); ++it) {
+            ObjectData dbo(it->second.dcc->get_id());
+            dbo.fields = it->second.fields;
+            if(!write_yaml_object(it->first, it->second.dcc, dbo)) {
+                m_log->error() << "Failed to write " << filename(it->first) << endl;
+                failed.push_back(it->first);
+            }
+        }
+
+        if(!lock.owns_lock()) {
+            lock.lock();
+        }
+        m_flushing.clear();
+        // An object which couldn't be written is kept, and tried again by the next flush
+        for(auto it = failed.begin(); it != failed.end(); ++it) {
+            if(m_objects.find(*it) != m_objects.end()) {
+                m_dirty.insert(*it);
+            }
+        }
+        // The objects just written may be evicted now, if the cache is over its limit
+        evict(INVALID_DO_ID);
+
+        if(objects.size() > failed.size()) {
+            m_log->trace() << "Wrote " << objects.size() - failed.size()
+                           << " changed objects." << endl;
+        }
+    }
   public:
     YAMLDatabase(ConfigNode dbeconfig, doid_t min_id, doid_t max_id) :
         OldDatabaseBackend(dbeconfig, min_id, max_id),
         m_next_id(min_id),
+        m_lease_size(lease_size.get_rval(m_config)),
         m_free_ids(),
-        m_foldername(foldername.get_rval(m_config))
+        m_foldername(foldername.get_rval(m_config)),
+        m_cache_max_size(yaml_cache_max_size.get_rval(
+                             db_backend_config.get_child_node(yaml_cache_config, m_config))),
+        m_flush_interval(flush_interval.get_rval(m_config)),
+        m_write_behind(m_flush_interval > 0)
     {
+        // Operations on different objects only contend for the cache and id allocation
+        m_thread_safe = true;
+
         stringstream log_name;
         log_name << "Database-YAML" << "(Range: [" << min_id << ", " << max_id << "])";
         m_log = new LogCategory("yamldb", log_name.str());
@@ -181,10 +505,33 @@ class YAMLDatabase : public OldDatabaseBackend
                     m_free_ids.push_back(key_free[i].as<doid_t>());
                 }
             }
+
+            // A lease is only left in the file if astrond wasn't stopped gracefully
+            YAML::Node key_lease = document["lease"];
+            if(key_lease.IsDefined() && !key_lease.IsNull()) {
+                recover_lease(key_lease.as<uint64_t>());
+            }
         }
+        m_lease_end = m_next_id;
 
         // Close database info file
         infostream.close();
+
+        if(m_write_behind) {
+            m_flush_thread = new thread(&YAMLDatabase::run_flush, this);
+            astron_add_shutdown_hook([this]() {
+                stop_flush();
+            });
+        }
+        astron_add_shutdown_hook([this]() {
+            release_lease();
+        });
+    }
+
+    bool has_free_ids()
+    {
+        lock_guard<mutex> lock(m_ids_lock);
+        return m_next_id <= m_max_id || !m_free_ids.empty();
     }
 
     doid_t create_object(const ObjectData &dbo)
@@ -194,9 +541,16 @@ class YAMLDatabase : public OldDatabaseBackend
             return 0;
         }
 
-        const Class *dcc = g_dcf->get_class_by_id(dbo.dc_id);
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject &object = insert(do_id);
+        object.dcc = g_dcf->get_class_by_id(dbo.dc_id);
+        for(auto it = dbo.fields.begin(); it != dbo.fields.end(); ++it) {
+            if(!it->second.empty()) {
+                object.fields[it->first] = it->second;
+            }
+        }
 
-        if(write_yaml_object(do_id, dcc, dbo)) {
+        if(store(do_id, lock)) {
             return do_id;
         }
 
@@ -205,10 +559,24 @@ class YAMLDatabase : public OldDatabaseBackend
 
     void delete_object(doid_t do_id)
     {
+        // Wait for any flush to finish, so that it can't write the object out again
+        unique_lock<mutex> flush_lock(m_flush_lock, defer_lock);
+        if(m_write_behind) {
+            flush_lock.lock();
+        }
+
+        bool cached;
+        {
+            lock_guard<mutex> lock(m_cache_lock);
+            cached = erase(do_id);
+        }
+
+        // With write-behind, an object may be deleted before its file was ever written
         m_log->debug() << "Deleting file: " << filename(do_id) << endl;
-        if(!remove(filename(do_id).c_str())) {
+        if(!remove(filename(do_id).c_str()) || cached) {
+            lock_guard<mutex> lock(m_ids_lock);
             m_free_ids.insert(m_free_ids.end(), do_id);
-            update_info();
+            info_changed();
         }
     }
 
@@ -216,33 +584,14 @@ class YAMLDatabase : public OldDatabaseBackend
     {
         m_log->trace() << "Getting obj-" << do_id << " ..." << endl;
 
-        // Open file for object
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        lock_guard<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return false;
         }
 
-        // Read object's DistributedClass
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        dbo.dc_id = dcc->get_id();
-
-        // Read object's fields
-        YAML::Node fields = document["fields"];
-        for(auto it = fields.begin(); it != fields.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
+        dbo.dc_id = object->dcc->get_id();
+        dbo.fields = object->fields;
         return true;
     }
 
@@ -250,188 +599,94 @@ class YAMLDatabase : public OldDatabaseBackend
     {
         m_log->trace() << "Getting dclass of obj-" << do_id << endl;
 
-        // Open file for object
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        lock_guard<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return NULL;
         }
 
-        return g_dcf->get_class_by_name(document["class"].as<string>());
+        return object->dcc;
     }
 
     void del_field(doid_t do_id, const Field* field)
     {
         m_log->trace() << "Deleting field on obj-" << do_id << endl;
 
-        // Read object from database
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return;
         }
 
-        // Get the fields from the file that are not being updated
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
-        // Remove field to be deleted from ObjectData
-        dbo.fields.erase(field);
-
-        // Write out new object to file
-        write_yaml_object(do_id, dcc, dbo);
+        object->fields.erase(field);
+        store(do_id, lock);
     }
     void del_fields(doid_t do_id, const FieldList &fields)
     {
         m_log->trace() << "Deleting fields on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return;
         }
 
-        // Get the fields from the file that are not being updated
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
         for(auto it = fields.begin(); it != fields.end(); ++it) {
-            dbo.fields.erase(*it);
+            object->fields.erase(*it);
         }
-        write_yaml_object(do_id, dcc, dbo);
+        store(do_id, lock);
     }
 
     void set_field(doid_t do_id, const Field* field, const FieldValue &value)
     {
         m_log->trace() << "Setting field on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return;
         }
 
-        // Get the fields from the file that are not being updated
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
-        dbo.fields[field] = value;
-        write_yaml_object(do_id, dcc, dbo);
+        object->fields[field] = value;
+        store(do_id, lock);
     }
 
     void set_fields(doid_t do_id, const FieldValues &fields)
     {
         m_log->trace() << "Setting fields on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return;
         }
 
-        // Get the fields from the file that are not being updated
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-
-            auto found = fields.find(field);
-            if(found == fields.end()) {
-                vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-                if(value.size() > 0) {
-                    dbo.fields[field] = value;
-                }
-            }
-        }
-
         // Add in the fields that are being updated:
         for(auto it = fields.begin(); it != fields.end(); ++it) {
-            dbo.fields[it->first] = it->second;
+            object->fields[it->first] = it->second;
         }
-
-        write_yaml_object(do_id, dcc, dbo);
+        store(do_id, lock);
     }
 
     bool set_field_if_empty(doid_t do_id, const Field* field, FieldValue &value)
     {
         m_log->trace() << "Setting field if empty on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             value = vector<uint8_t>();
             return false;
         }
 
-        // Get current field values from the file
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
-        auto found = dbo.fields.find(field);
-        if(found != dbo.fields.end()) {
+        auto found = object->fields.find(field);
+        if(found != object->fields.end()) {
             value = found->second;
             return false;
         }
 
-        dbo.fields[field] = value;
-        write_yaml_object(do_id, dcc, dbo);
+        object->fields[field] = value;
+        store(do_id, lock);
         return true;
     }
 
@@ -440,73 +695,39 @@ class YAMLDatabase : public OldDatabaseBackend
     {
         m_log->trace() << "Setting field if equal on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             value = vector<uint8_t>();
             return false;
         }
 
-        // Get current field values from the file
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
-        auto found = dbo.fields.find(field);
-        if(found == dbo.fields.end() || found->second != equal) {
-            value = dbo.fields[field];
+        auto found = object->fields.find(field);
+        if(found == object->fields.end() || found->second != equal) {
+            value = found == object->fields.end() ? vector<uint8_t>() : found->second;
             return false;
         }
 
-        dbo.fields[field] = value;
-        write_yaml_object(do_id, dcc, dbo);
+        object->fields[field] = value;
+        store(do_id, lock);
         return true;
     }
     bool set_fields_if_equals(doid_t do_id, const FieldValues &equals, FieldValues &values)
     {
         m_log->trace() << "Setting fields if equals on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        unique_lock<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             values.clear();
             return false;
         }
 
-        // Get current field values from the file
-        const Class* dcc = g_dcf->get_class_by_name(document["class"].as<string>());
-        ObjectData dbo(dcc->get_id());
-        YAML::Node existing = document["fields"];
-        for(auto it = existing.begin(); it != existing.end(); ++it) {
-            const Field* field = dcc->get_field_by_name(it->first.as<string>());
-            if(!field) {
-                m_log->warning() << "Field '" << it->first.as<string>()
-                                 << "', loaded from '" << filename(do_id)
-                                 << "', does not exist." << endl;
-                continue;
-            }
-            vector<uint8_t> value = read_yaml_field(field, it->second, do_id);
-            if(value.size() > 0) {
-                dbo.fields[field] = value;
-            }
-        }
-
         // Check if equals matches current values
         bool fail = false;
         for(auto it = equals.begin(); it != equals.end(); ++it) {
-            auto found = dbo.fields.find(it->first);
-            if(found == dbo.fields.end()) {
+            auto found = object->fields.find(it->first);
+            if(found == object->fields.end()) {
                 values.erase(it->first);
                 fail = true;
             } else if(it->second != found->second) {
@@ -518,69 +739,63 @@ class YAMLDatabase : public OldDatabaseBackend
         // Return current values on failure
         if(fail) {
             for(auto it = values.begin(); it != values.end(); ++it) {
-                it->second = dbo.fields[it->first];
+                auto found = object->fields.find(it->first);
+                it->second = found == object->fields.end() ? vector<uint8_t>() : found->second;
             }
             return false;
         }
 
         // Update existing values on success
         for(auto it = values.begin(); it != values.end(); ++it) {
-            dbo.fields[it->first] = it->second;
+            object->fields[it->first] = it->second;
         }
-        write_yaml_object(do_id, dcc, dbo);
+        store(do_id, lock);
         return true;
     }
     bool get_field(doid_t do_id, const Field* field, FieldValue &value)
     {
         m_log->trace() << "Getting field on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        lock_guard<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return false;
         }
 
-        // Get the fields from the file that are not being updated
-        YAML::Node node = document["fields"][field->get_name()];
-        if(!node.IsDefined() || node.IsNull()) {
+        auto found = object->fields.find(field);
+        if(found == object->fields.end()) {
             return false;
         }
 
         m_log->trace() << "Found requested field: " + field->get_name() << endl;
 
-        value = read_yaml_field(field, node, do_id);
-        if(value.size() > 0) {
-            return true;
-        }
-
-        return false;
+        value = found->second;
+        return true;
     }
     bool get_fields(doid_t do_id, const FieldList &fields, FieldValues &values)
     {
         m_log->trace() << "Getting fields on obj-" << do_id << endl;
 
-        YAML::Node document;
-        if(!load(do_id, document)) {
+        lock_guard<mutex> lock(m_cache_lock);
+        CachedObject *object = fetch(do_id);
+        if(!object) {
             return false;
         }
 
-        // Get the fields from the file that are not being updated
         for(auto it = fields.begin(); it != fields.end(); ++it) {
-            const Field* field = *it;
-            m_log->trace() << "Searching for field: " << field->get_name() << endl;
-
-            YAML::Node existing = document["fields"];
-            for(auto it2 = existing.begin(); it2 != existing.end(); ++it2) {
-                if(it2->first.as<string>() == field->get_name()) {
-                    vector<uint8_t> value = read_yaml_field(field, it2->second, do_id);
-                    if(value.size() > 0) {
-                        values[*it] = value;
-                        m_log->trace() << "Found requested field: " + field->get_name() << endl;
-                    }
-                }
+            auto found = object->fields.find(*it);
+            if(found != object->fields.end()) {
+                values[*it] = found->second;
+                m_log->trace() << "Found requested field: " + (*it)->get_name() << endl;
             }
         }
         return true;
     }
 };
 
-DBBackendFactoryItem<YAMLDatabase> yamldb_factory("yaml");
+static string yaml_storage(ConfigNode config)
+{
+    return foldername.get_rval(config);
+}
+
+DBBackendFactoryItem<YAMLDatabase> yamldb_factory("yaml", yaml_storage);
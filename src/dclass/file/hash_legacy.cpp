@@ -191,7 +191,7 @@ void hash_keywords(HashGenerator& hashgen, const KeywordList* list)
     for(unsigned int i = 0; i < num_keywords; ++i) {
         bool set_flag = false;
         string keyword = list->get_keyword(i);
-        for(unsigned int j = 0; j < sizeof(legacy_keywords); ++j) {
+        for(unsigned int j = 0; legacy_keywords[j].keyword != NULL; ++j) {
             if(keyword == legacy_keywords[j].keyword) {
                 flags |= legacy_keywords[j].flag;
                 set_flag = true;
@@ -166,10 +166,15 @@ bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
 {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
 
-    std::set<ChannelSubscriber *> pset;
-    lookup_channel(c, pset);
+    // Check the subscriber sets in place, rather than copying them out with lookup_channel;
+    // a popular channel (e.g. a parent's child-broadcast channel) may have many subscribers.
+    auto subs = m_channel_subscriptions.find(c);
+    if(subs != m_channel_subscriptions.end() && subs->second.find(p) != subs->second.end()) {
+        return true;
+    }
 
-    return pset.find(p) != pset.end();
+    auto range = boost::icl::find(m_range_subscriptions, c);
+    return range != m_range_subscriptions.end() && range->second.find(p) != range->second.end();
 }
 
 void ChannelMap::lookup_channel(channel_t c, std::set<ChannelSubscriber *> &ps)
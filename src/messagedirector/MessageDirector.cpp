@@ -151,10 +151,29 @@ void MessageDirector::routing_thread()
         // Get and process the message:
         auto msg = m_messages.front();
         m_messages.pop();
+        m_routing = true;
 
         lock.unlock();
         process_datagram(msg.first, msg.second);
         lock.lock();
+
+        m_routing = false;
+        if(m_messages.empty()) {
+            m_idle_cv.notify_all();
+        }
+    }
+}
+
+void MessageDirector::flush()
+{
+    if(!m_thread) {
+        // Without a routing thread, datagrams are processed as they are routed.
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_messages_lock);
+    while((!m_messages.empty() || m_routing) && !m_shutdown) {
+        m_idle_cv.wait(lock);
     }
 }
 
@@ -192,7 +211,10 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
     lookup_channels(channels, receiving_participants);
     if(p) { receiving_participants.erase(p); }
 
-    // Send the datagram to each participant
+    // Send the datagram to each participant, noting its origin (which may be routing a
+    // datagram itself, when unthreaded) so that multiplexing participants can exclude it
+    MDParticipantInterface *prev_origin = m_origin;
+    m_origin = p;
     for(auto it = receiving_participants.begin(); it != receiving_participants.end(); ++it) {
         auto participant = static_cast<MDParticipantInterface*>(*it);
         DatagramIterator msg_dgi(dg, dgi.tell());
@@ -202,9 +224,11 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
             // Log error with receivers output
             m_log.error() << "Detected truncated datagram in handle_datagram for '"
                           << participant->m_name << "' from participant '" << p->m_name << "'.\n";
+            m_origin = prev_origin;
             return;
         }
     }
+    m_origin = prev_origin;
 
     // Send message upstream, if necessary
     if(p && m_upstream) {
@@ -36,6 +36,17 @@ class MessageDirector : public ChannelMap
     // Message on the CONTROL_MESSAGE channel are processed internally by the MessageDirector.
     void route_datagram(MDParticipantInterface *p, DatagramHandle dg);
 
+    // flush blocks until every datagram routed so far has been processed by the routing
+    //     thread.  It must not be called from the routing thread itself.
+    void flush();
+
+    // get_origin returns the participant which routed the datagram being delivered, or
+    //     nullptr if it came from upstream.  It is only meaningful within handle_datagram.
+    inline MDParticipantInterface* get_origin() const
+    {
+        return m_origin;
+    }
+
     // logger returns the MessageDirector log category.
     inline LogCategory& logger()
     {
@@ -72,7 +83,10 @@ class MessageDirector : public ChannelMap
     std::mutex m_messages_lock;
     std::queue<std::pair<MDParticipantInterface *, DatagramHandle>> m_messages;
     std::condition_variable m_cv;
+    bool m_routing = false; // true while the routing thread is processing a datagram
+    std::condition_variable m_idle_cv;
     std::thread::id m_main_thread;
+    MDParticipantInterface *m_origin = nullptr; // sender of the datagram being delivered
     void process_datagram(MDParticipantInterface *p, DatagramHandle dg);
     void process_terminates();
     void routing_thread();
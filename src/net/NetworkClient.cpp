@@ -3,6 +3,7 @@
 #include <boost/bind.hpp>
 #include <stdexcept>
 
+using std::chrono::steady_clock;
 using boost::asio::ip::tcp;
 namespace ssl = boost::asio::ssl;
 
@@ -32,6 +33,11 @@ NetworkClient::~NetworkClient()
     }
     delete m_socket;
     delete [] m_data_buf;
+
+    if(m_compressed) {
+        deflateEnd(&m_deflate);
+        inflateEnd(&m_inflate);
+    }
 }
 
 void NetworkClient::set_socket(tcp::socket *socket)
@@ -96,14 +102,35 @@ void NetworkClient::async_receive()
 void NetworkClient::send_datagram(DatagramHandle dg)
 {
     std::lock_guard<std::recursive_mutex> lock(m_lock);
+    const uint8_t *data = dg->get_data();
+    size_t size = dg->size();
+    if(m_compressed) {
+        if(!compress(dg, m_frame_buf)) {
+            // The datagram can't be skipped without the client's stream falling out of step.
+            send_disconnect();
+            return;
+        }
+        data = m_frame_buf.data();
+        size = m_frame_buf.size();
+    }
+
     //TODO: make this asynch if necessary
-    dgsize_t len = swap_le(dg->size());
+    dgsize_t len = swap_le(dgsize_t(size));
+    if(m_open_batches > 0) {
+        m_batch_buf.insert(m_batch_buf.end(), (uint8_t*)&len, (uint8_t*)&len + sizeof(dgsize_t));
+        m_batch_buf.insert(m_batch_buf.end(), data, data + size);
+        if(m_batch_buf.size() >= m_batch_size) {
+            flush_writes();
+        }
+        return;
+    }
+
     try {
         m_socket->non_blocking(true);
         m_socket->native_non_blocking(true);
         std::list<boost::asio::const_buffer> gather;
         gather.push_back(boost::asio::buffer((uint8_t*)&len, sizeof(dgsize_t)));
-        gather.push_back(boost::asio::buffer(dg->get_data(), dg->size()));
+        gather.push_back(boost::asio::buffer(data, size));
         socket_write(gather);
     } catch(const boost::system::system_error&) {
         // We assume that the message just got dropped if the remote end died
@@ -115,9 +142,168 @@ void NetworkClient::send_datagram(DatagramHandle dg)
 void NetworkClient::send_disconnect()
 {
     std::lock_guard<std::recursive_mutex> lock(m_lock);
+    flush_writes();
     m_socket->close();
 }
 
+void NetworkClient::set_write_batching(size_t max_size)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_batch_size = max_size;
+}
+
+void NetworkClient::flush_writes()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    if(m_batch_buf.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> data;
+    data.swap(m_batch_buf);
+    try {
+        m_socket->non_blocking(true);
+        m_socket->native_non_blocking(true);
+        std::list<boost::asio::const_buffer> gather;
+        gather.push_back(boost::asio::buffer(data));
+        socket_write(gather);
+    } catch(const boost::system::system_error&) {
+        // As in send_datagram, the remote end has most likely died.
+        m_socket->close();
+    }
+}
+
+void NetworkClient::set_compression(size_t threshold)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    if(m_compressed) {
+        return;
+    }
+
+    m_deflate = z_stream();
+    m_inflate = z_stream();
+    if(deflateInit(&m_deflate, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        throw std::runtime_error("Failed to initialize a zlib stream for compression.");
+    }
+    if(inflateInit(&m_inflate) != Z_OK) {
+        deflateEnd(&m_deflate);
+        throw std::runtime_error("Failed to initialize a zlib stream for decompression.");
+    }
+
+    m_compress_threshold = threshold;
+    m_compressed = true;
+}
+
+bool NetworkClient::is_compressed()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    return m_compressed;
+}
+
+void NetworkClient::get_compression_stats(CompressionStats &sent, CompressionStats &received)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    sent = m_sent_stats;
+    received = m_received_stats;
+}
+
+bool NetworkClient::compress(DatagramHandle dg, std::vector<uint8_t> &out)
+{
+    steady_clock::time_point start = steady_clock::now();
+    out.clear();
+
+    // A datagram which might not fit within DGSIZE_MAX once deflated (and sync-flushed, which
+    // deflateBound doesn't cover) is sent as it is, if it still fits with its flag.
+    size_t size = dg->size();
+    bool fits_raw = size + 1 <= DGSIZE_MAX;
+    bool fits_deflated = 1 + deflateBound(&m_deflate, uLong(size)) + 16 <= DGSIZE_MAX;
+    if(fits_raw && (size < m_compress_threshold || !fits_deflated)) {
+        out.reserve(size + 1);
+        out.push_back(0);
+        out.insert(out.end(), dg->get_data(), dg->get_data() + size);
+    } else {
+        out.push_back(1);
+        m_deflate.next_in = const_cast<Bytef*>(dg->get_data());
+        m_deflate.avail_in = uInt(size);
+        do {
+            size_t offset = out.size();
+            out.resize(offset + size / 2 + 64);
+            m_deflate.next_out = &out[offset];
+            m_deflate.avail_out = uInt(out.size() - offset);
+            int err = deflate(&m_deflate, Z_SYNC_FLUSH);
+            out.resize(out.size() - m_deflate.avail_out);
+            if(err != Z_OK) {
+                return false;
+            }
+        } while(m_deflate.avail_out == 0);
+    }
+
+    m_sent_stats.datagram_bytes += size;
+    m_sent_stats.network_bytes += out.size();
+    m_sent_stats.time += steady_clock::now() - start;
+    return out.size() <= DGSIZE_MAX;
+}
+
+bool NetworkClient::decompress(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    if(length == 0) {
+        return false;
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+    out.clear();
+    if(data[0] == 0) {
+        out.assign(data + 1, data + length);
+    } else if(data[0] == 1) {
+        m_inflate.next_in = const_cast<Bytef*>(data + 1);
+        m_inflate.avail_in = uInt(length - 1);
+        do {
+            size_t offset = out.size();
+            if(offset > DGSIZE_MAX) {
+                return false;
+            }
+            out.resize(offset + length * 2 + 64);
+            m_inflate.next_out = &out[offset];
+            m_inflate.avail_out = uInt(out.size() - offset);
+            int err = inflate(&m_inflate, Z_SYNC_FLUSH);
+            out.resize(out.size() - m_inflate.avail_out);
+            // Z_STREAM_END is an error too: the stream must stay open for the next datagram.
+            if(err != Z_OK && err != Z_BUF_ERROR) {
+                return false;
+            }
+        } while(m_inflate.avail_out == 0);
+
+        if(m_inflate.avail_in > 0 || out.size() > DGSIZE_MAX) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    m_received_stats.datagram_bytes += out.size();
+    m_received_stats.network_bytes += length;
+    m_received_stats.time += steady_clock::now() - start;
+    return true;
+}
+
+NetworkClient::WriteBatch::WriteBatch(NetworkClient *client) : m_client(client)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_client->m_lock);
+    m_counted = m_client->m_batch_size > 0;
+    if(m_counted) {
+        ++m_client->m_open_batches;
+    }
+}
+
+NetworkClient::WriteBatch::~WriteBatch()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_client->m_lock);
+    if(m_counted && --m_client->m_open_batches == 0) {
+        m_client->flush_writes();
+    }
+}
+
 void NetworkClient::receive_size(const boost::system::error_code &ec, size_t /*bytes_transferred*/)
 {
     if(ec.value() != 0) {
@@ -144,7 +330,17 @@ void NetworkClient::receive_data(const boost::system::error_code &ec, size_t /*b
         return;
     }
 
-    DatagramPtr dg = Datagram::create(m_data_buf, m_data_size); // Datagram makes a copy
+    DatagramPtr dg;
+    if(is_compressed()) {
+        if(!decompress(m_data_buf, m_data_size, m_inflate_buf)) {
+            NetworkClient::send_disconnect();
+            receive_disconnect();
+            return;
+        }
+        dg = Datagram::create(m_inflate_buf);
+    } else {
+        dg = Datagram::create(m_data_buf, m_data_size); // Datagram makes a copy
+    }
     m_is_data = false;
     receive_datagram(dg);
     async_receive();
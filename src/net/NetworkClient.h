@@ -1,6 +1,9 @@
 #pragma once
 #include <list>
 #include <mutex>
+#include <chrono>
+#include <vector>
+#include <zlib.h>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include "util/Datagram.h"
@@ -8,13 +11,22 @@
 class NetworkClient
 {
   public:
-    // send_datagram immediately sends the datagram over TCP (blocking).
+    // send_datagram immediately sends the datagram over TCP (blocking),
+    //     unless a WriteBatch is open, in which case it is sent when the batch closes.
     virtual void send_datagram(DatagramHandle dg);
-    // send_disconnect closes the TCP connection
+    // send_disconnect sends any batched datagrams, then closes the TCP connection
     virtual void send_disconnect();
     // is_connected returns true if the TCP connection is active, or false otherwise
     bool is_connected();
 
+    // CompressionStats counts the datagrams passed through a compressed connection in one
+    //     direction, and the time spent compressing or decompressing them.
+    struct CompressionStats {
+        uint64_t datagram_bytes = 0; // bytes of the datagrams themselves
+        uint64_t network_bytes = 0;  // bytes sent over the network in their place
+        std::chrono::nanoseconds time{0};
+    };
+
   protected:
     NetworkClient();
     NetworkClient(boost::asio::ip::tcp::socket *socket);
@@ -23,6 +35,32 @@ class NetworkClient
     void set_socket(boost::asio::ip::tcp::socket *socket);
     void set_socket(boost::asio::ssl::stream<boost::asio::ip::tcp::socket> *stream);
 
+    // set_write_batching enables WriteBatches, which are written early whenever max_size
+    //     bytes have built up.  With a max_size of 0 (the default), WriteBatches have no effect.
+    void set_write_batching(size_t max_size);
+
+    // set_compression deflates each datagram of at least threshold bytes sent from now on, and
+    //     inflates the compressed datagrams received.  Once enabled, every datagram on the
+    //     connection is preceded by a uint8 flag which is 1 if it is compressed, 0 otherwise;
+    //     the compressed datagrams in each direction share one zlib stream.
+    void set_compression(size_t threshold);
+    bool is_compressed();
+    // get_compression_stats returns the stats of a compressed connection.
+    void get_compression_stats(CompressionStats &sent, CompressionStats &received);
+
+    // A WriteBatch holds back the datagrams sent while it is open, and sends them all
+    //     with a single write once the last open batch has closed.
+    class WriteBatch
+    {
+      public:
+        WriteBatch(NetworkClient *client);
+        ~WriteBatch();
+
+      private:
+        NetworkClient *m_client;
+        bool m_counted;
+    };
+
 
     /** Pure virtual methods **/
 
@@ -59,6 +97,13 @@ class NetworkClient
 
     void socket_read(uint8_t* buf, size_t length, receive_handler_t callback);
     void socket_write(std::list<boost::asio::const_buffer>&);
+    // flush_writes sends the batched datagrams.
+    void flush_writes();
+    // compress and decompress convert between a datagram and the payload of a compressed
+    //     connection's frame.  They return false if the result won't fit in a datagram,
+    //     the data received is corrupt, or zlib fails to deflate the datagram.
+    bool compress(DatagramHandle dg, std::vector<uint8_t> &out);
+    bool decompress(const uint8_t *data, size_t length, std::vector<uint8_t> &out);
 
     bool m_ssl_enabled;
     uint8_t m_size_buf[sizeof(dgsize_t)];
@@ -66,5 +111,18 @@ class NetworkClient
     dgsize_t m_data_size;
     bool m_is_data;
 
+    size_t m_batch_size = 0;
+    unsigned int m_open_batches = 0;
+    std::vector<uint8_t> m_batch_buf;
+
+    bool m_compressed = false;
+    size_t m_compress_threshold = 0;
+    z_stream m_deflate;
+    z_stream m_inflate;
+    std::vector<uint8_t> m_frame_buf;
+    std::vector<uint8_t> m_inflate_buf;
+    CompressionStats m_sent_stats;
+    CompressionStats m_received_stats;
+
     std::recursive_mutex m_lock;
 };
@@ -1,8 +1,10 @@
 #include "core/global.h"
 #include "core/msgtypes.h"
+#include "core/shutdown.h"
 #include "config/constraints.h"
 #include "dclass/dc/Class.h"
 #include "dclass/dc/Field.h"
+#include <algorithm>
 #include <unordered_set>
 
 #include "DBStateServer.h"
@@ -26,25 +28,133 @@ static InvalidDoidConstraint max_not_invalid(range_max);
 static ReservedDoidConstraint min_not_reserved(range_min);
 static ReservedDoidConstraint max_not_reserved(range_max);
 
+static ConfigGroup cache_config("cache", dbss_config);
+static ConfigVariable<uint64_t> cache_max_size("max_size", 0, cache_config);
+static ConfigVariable<unsigned int> cache_stats_interval("stats_interval", 0, cache_config);
+
+static ConfigGroup write_behind_config("write_behind", dbss_config);
+static ConfigVariable<unsigned int> write_interval("interval", 0, write_behind_config);
+
 DBStateServer::DBStateServer(RoleConfig roleconfig) : StateServer(roleconfig),
-    m_db_channel(database_channel.get_rval(m_roleconfig)), m_next_context(0)
+    m_db_channel(database_channel.get_rval(m_roleconfig)), m_next_context(0),
+    m_cache(cache_max_size.get_rval(dbss_config.get_child_node(cache_config, roleconfig)))
 {
+    ConfigNode cache = dbss_config.get_child_node(cache_config, roleconfig);
+    m_cache_stats_interval = cache_stats_interval.get_rval(cache);
+
     ConfigNode ranges = dbss_config.get_child_node(ranges_config, roleconfig);
     for(auto it = ranges.begin(); it != ranges.end(); ++it) {
         channel_t min = range_min.get_rval(*it);
         channel_t max = range_max.get_rval(*it);
         MessageDirector::singleton.subscribe_range(this, min, max);
+
+        // Listen for changes made to our objects in the database, so that
+        // we don't keep serving stale fields from the cache.
+        if(m_cache.enabled()) {
+            MessageDirector::singleton.subscribe_range(this, database_to_object(min),
+                    database_to_object(max));
+        }
     }
 
     std::stringstream name;
     name << "DBSS(Database: " << m_db_channel << ")";
     m_log = new LogCategory("dbss", name.str());
     set_con_name(name.str());
+
+    if(m_cache.enabled()) {
+        m_cache_stats_timer = new boost::asio::deadline_timer(io_service);
+        schedule_cache_stats();
+    }
+
+    ConfigNode write_behind = dbss_config.get_child_node(write_behind_config, roleconfig);
+    m_write_interval = write_interval.get_rval(write_behind);
+    if(m_write_interval) {
+        m_write_timer = new boost::asio::deadline_timer(io_service);
+        schedule_write();
+        astron_add_shutdown_hook([this]() {
+            flush_dirty_fields();
+            MessageDirector::singleton.flush();
+        });
+    }
 }
 
 DBStateServer::~DBStateServer()
 {
-    delete m_log;
+    delete m_write_timer;
+    delete m_cache_stats_timer;
+}
+
+void DBStateServer::schedule_write()
+{
+    m_write_timer->expires_from_now(boost::posix_time::seconds(m_write_interval));
+    m_write_timer->async_wait([this](const boost::system::error_code &ec) {
+        if(ec) {
+            return;
+        }
+
+        flush_dirty_fields();
+        schedule_write();
+    });
+}
+
+void DBStateServer::flush_dirty_fields()
+{
+    std::lock_guard<std::mutex> lock(m_dirty_lock);
+    if(m_dirty_fields.empty()) {
+        return;
+    }
+
+    m_log->debug() << "Writing dirty fields of " << m_dirty_fields.size()
+                   << " objects to database.\n";
+    for(auto it = m_dirty_fields.begin(); it != m_dirty_fields.end(); ++it) {
+        write_fields(it->first, it->second);
+    }
+    m_dirty_fields.clear();
+}
+
+void DBStateServer::write_fields(doid_t do_id, const FieldValues &fields)
+{
+    DatagramPtr dg = Datagram::create(m_db_channel, do_id, DBSERVER_OBJECT_SET_FIELDS);
+    dg->add_doid(do_id);
+    dg->add_uint16(fields.size());
+    for(auto it = fields.begin(); it != fields.end(); ++it) {
+        dg->add_uint16(it->first->get_id());
+        dg->add_data(it->second);
+    }
+    route_datagram(dg);
+}
+
+void DBStateServer::object_deleted(DistributedObject *obj)
+{
+    std::lock_guard<std::mutex> lock(m_dirty_lock);
+    auto dirty_it = m_dirty_fields.find(obj->get_id());
+    if(dirty_it != m_dirty_fields.end()) {
+        write_fields(dirty_it->first, dirty_it->second);
+        m_dirty_fields.erase(dirty_it);
+    }
+}
+
+void DBStateServer::schedule_cache_stats()
+{
+    if(!m_cache_stats_interval) {
+        return;
+    }
+
+    m_cache_stats_timer->expires_from_now(boost::posix_time::seconds(m_cache_stats_interval));
+    m_cache_stats_timer->async_wait([this](const boost::system::error_code &ec) {
+        if(ec) {
+            return;
+        }
+
+        uint64_t hits = m_cache.get_hits(), misses = m_cache.get_misses();
+        uint64_t lookups = hits + misses;
+        m_log->info() << "Field cache: " << m_cache.get_count() << " objects, "
+                      << m_cache.get_size() << " bytes, " << hits << " hits, "
+                      << misses << " misses ("
+                      << (lookups ? hits * 100 / lookups : 0) << "% hit rate), "
+                      << m_cache.get_evictions() << " evictions.\n";
+        schedule_cache_stats();
+    });
 }
 
 void DBStateServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
@@ -58,6 +168,9 @@ void DBStateServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
     case DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS_OTHER:
         handle_activate(dgi, true);
         break;
+    case DBSS_OBJECT_ACTIVATE_MANY:
+        handle_activate_many(dgi);
+        break;
     case DBSS_OBJECT_DELETE_DISK:
         handle_delete_disk(sender, dgi);
         break;
@@ -85,9 +198,19 @@ void DBStateServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
     case DBSERVER_OBJECT_GET_ALL_RESP:
         handle_get_all_resp(dgi);
         break;
+    case DBSERVER_OBJECT_GET_ALL_MULTI_RESP:
+        handle_get_all_multi_resp(dgi);
+        break;
     case DBSS_OBJECT_GET_ACTIVATED:
         handle_get_activated(sender, dgi);
         break;
+    case DBSERVER_OBJECT_SET_FIELD:
+    case DBSERVER_OBJECT_SET_FIELDS:
+    case DBSERVER_OBJECT_DELETE_FIELD:
+    case DBSERVER_OBJECT_DELETE_FIELDS:
+    case DBSERVER_OBJECT_DELETE:
+        handle_db_update(msgtype, dgi);
+        break;
     default:
         m_log->trace() << "Ignoring message of type '" << msgtype << "'.\n";
     }
@@ -105,6 +228,9 @@ void DBStateServer::handle_activate(DatagramIterator &dgi, bool has_other)
         return;
     }
 
+    // While the object is active, its fields are owned by the DistributedObject
+    m_cache.invalidate(do_id);
+
     if(!has_other) {
         auto load_it = m_inactive_loads.find(do_id);
         if(load_it == m_inactive_loads.end()) {
@@ -138,6 +264,104 @@ void DBStateServer::handle_activate(DatagramIterator &dgi, bool has_other)
     }
 }
 
+void DBStateServer::handle_activate_many(DatagramIterator &dgi)
+{
+    uint16_t count = dgi.read_uint16();
+    std::vector<doid_t> batch;
+    for(uint16_t i = 0; i < count; ++i) {
+        doid_t do_id = dgi.read_doid();
+        doid_t parent_id = dgi.read_doid();
+        zone_t zone_id = dgi.read_zone();
+
+        if(is_activated_object(do_id)) {
+            m_log->warning() << "Received activate for already-active object with id "
+                             << do_id << "\n";
+            continue;
+        }
+
+        // While the object is active, its fields are owned by the DistributedObject
+        m_cache.invalidate(do_id);
+
+        // If the object is already being read from the db, the loader can use that response
+        auto load_it = m_inactive_loads.find(do_id);
+        if(load_it != m_inactive_loads.end()) {
+            m_loading[do_id] = new LoadingObject(this, do_id, parent_id, zone_id, load_it->second);
+            continue;
+        }
+
+        m_loading[do_id] = new LoadingObject(this, do_id, parent_id, zone_id);
+        batch.push_back(do_id);
+    }
+
+    if(batch.empty()) {
+        return;
+    }
+
+    m_log->trace() << "Loading " << batch.size() << " objects from the database.\n";
+
+    // The response is sent to the last object in the batch, whose loader ignores it;
+    // the db answers in the order requested, so that loader outlives the response.
+    uint32_t db_context = m_next_context++;
+    DatagramPtr dg = Datagram::create(m_db_channel, batch.back(), DBSERVER_OBJECT_GET_ALL_MULTI);
+    dg->add_uint32(db_context);
+    dg->add_uint16(batch.size());
+    for(auto it = batch.begin(); it != batch.end(); ++it) {
+        dg->add_doid(*it);
+    }
+    route_datagram(dg);
+
+    m_multi_loads[db_context] = std::unordered_set<doid_t>(batch.begin(), batch.end());
+}
+
+void DBStateServer::handle_get_all_multi_resp(DatagramIterator &dgi)
+{
+    uint32_t db_context = dgi.read_uint32();
+    auto multi_it = m_multi_loads.find(db_context);
+    if(multi_it == m_multi_loads.end()) {
+        m_log->trace() << "Ignoring GetAllMultiResp with unknown context.\n";
+        return;
+    }
+
+    std::unordered_set<doid_t> &pending = multi_it->second;
+    uint16_t count = dgi.read_uint16();
+    for(uint16_t i = 0; i < count; ++i) {
+        doid_t do_id = dgi.read_doid();
+
+        bool loaded;
+        auto loader_it = m_loading.find(do_id);
+        if(pending.erase(do_id) && loader_it != m_loading.end()) {
+            loaded = loader_it->second->load(dgi);
+        } else {
+            // We're no longer waiting on this object, skip over its fields
+            loaded = true;
+            if(dgi.read_bool()) {
+                const Class *dclass = g_dcf->get_class_by_id(dgi.read_uint16());
+                UnorderedFieldValues required;
+                FieldValues ram;
+                loaded = dclass && unpack_db_fields(dgi, dclass, required, ram);
+            }
+        }
+
+        if(!loaded) {
+            // The rest of the response can't be read, so give up on its objects
+            m_log->error() << "Couldn't read GetAllMultiResp past object " << do_id
+                           << ", aborting " << pending.size() << " remaining loads.\n";
+            for(auto it = pending.begin(); it != pending.end(); ++it) {
+                loader_it = m_loading.find(*it);
+                if(loader_it != m_loading.end()) {
+                    loader_it->second->abort();
+                }
+            }
+            pending.clear();
+            break;
+        }
+    }
+
+    if(pending.empty()) {
+        m_multi_loads.erase(multi_it);
+    }
+}
+
 void DBStateServer::handle_get_activated(channel_t sender, DatagramIterator& dgi)
 {
     uint32_t r_context = dgi.read_uint32();
@@ -201,7 +425,13 @@ void DBStateServer::handle_delete_disk(channel_t sender, DatagramIterator& dgi)
         route_datagram(dg);
     }
 
-    // Send delete to database
+    // Send delete to database, along with any unwritten fields
+    m_cache.invalidate(do_id);
+    detach_reads(do_id);
+    if(m_write_interval) {
+        std::lock_guard<std::mutex> lock(m_dirty_lock);
+        m_dirty_fields.erase(do_id);
+    }
     DatagramPtr dg = Datagram::create(m_db_channel, do_id, DBSERVER_OBJECT_DELETE);
     dg->add_doid(do_id);
     route_datagram(dg);
@@ -220,10 +450,19 @@ void DBStateServer::handle_set_field(DatagramIterator &dgi)
     uint16_t field_id = dgi.read_uint16();
 
     const Field* field = g_dcf->get_field_by_id(field_id);
-    if(field && field->has_keyword("db")) {
+    if(field && field->has_keyword("db") && is_write_behind(do_id)) {
+        // Hold the field until the next flush, replacing any earlier value
+        std::vector<uint8_t> value;
+        dgi.unpack_field(field, value);
+
+        std::lock_guard<std::mutex> lock(m_dirty_lock);
+        m_dirty_fields[do_id][field] = value;
+    } else if(field && field->has_keyword("db")) {
         m_log->trace() << "Forwarding SetField for field \"" << field->get_name()
                        << "\" on object with id " << do_id << " to database.\n";
 
+        m_cache.invalidate_field(do_id, field);
+        detach_reads(do_id);
         DatagramPtr dg = Datagram::create(m_db_channel, do_id, DBSERVER_OBJECT_SET_FIELD);
         dg->add_doid(do_id);
         dg->add_uint16(field_id);
@@ -253,12 +492,21 @@ void DBStateServer::handle_set_fields(DatagramIterator &dgi)
         }
         if(field->has_keyword("db")) {
             dgi.unpack_field(field, db_fields[field]);
+            m_cache.invalidate_field(do_id, field);
         } else {
             dgi.skip_field(field);
         }
     }
 
-    if(db_fields.size() > 0) {
+    if(db_fields.size() > 0 && is_write_behind(do_id)) {
+        // Hold the fields until the next flush, replacing any earlier values
+        std::lock_guard<std::mutex> lock(m_dirty_lock);
+        FieldValues &dirty = m_dirty_fields[do_id];
+        for(auto it = db_fields.begin(); it != db_fields.end(); ++it) {
+            dirty[it->first] = it->second;
+        }
+    } else if(db_fields.size() > 0) {
+        detach_reads(do_id);
         m_log->trace() << "Forwarding SetFields on object with id " << do_id << " to database.\n";
 
         DatagramPtr dg = Datagram::create(m_db_channel, do_id, DBSERVER_OBJECT_SET_FIELDS);
@@ -295,13 +543,27 @@ void DBStateServer::handle_get_field(channel_t sender, DatagramIterator &dgi)
     }
 
     if(field->has_keyword("db")) {
-        // Get context for db query
-        uint32_t db_context = m_next_context++;
-
         // Prepare reponse datagram
         DatagramPtr dg_resp = Datagram::create(sender, r_do_id, STATESERVER_OBJECT_GET_FIELD_RESP);
         dg_resp->add_uint32(r_context);
-        m_context_datagrams[db_context] = dg_resp;
+
+        // Answer from the cache if we can
+        FieldValues cached;
+        if(m_cache.enabled() && m_cache.get_fields(r_do_id, {field}, cached)) {
+            dg_resp->add_bool(true);
+            dg_resp->add_uint16(field_id);
+            dg_resp->add_data(cached[field]);
+            route_datagram(dg_resp);
+            return;
+        }
+
+        // Get context for db query, unless the same field is already being fetched
+        uint32_t db_context;
+        ReadKey key(r_do_id, DBSERVER_OBJECT_GET_FIELD, {field_id});
+        if(!queue_read(key, dg_resp, db_context)) {
+            return;
+        }
+        m_cache.begin_read(r_do_id);
 
         // Send query to database
         DatagramPtr dg = Datagram::create(m_db_channel, r_do_id, DBSERVER_OBJECT_GET_FIELD);
@@ -331,12 +593,11 @@ void DBStateServer::handle_get_field_resp(DatagramIterator& dgi)
         return;
     }
 
-    // Get the datagram from the db_context
-    DatagramPtr dg = m_context_datagrams[db_context];
-    m_context_datagrams.erase(db_context);
+    // Get the datagrams from the db_context
+    std::vector<DatagramPtr> callers = finish_read(db_context);
 
     // Check to make sure the datagram is appropriate
-    DatagramIterator check_dgi = DatagramIterator(dg);
+    DatagramIterator check_dgi = DatagramIterator(callers.front());
     uint16_t resp_type = check_dgi.get_msg_type();
     if(resp_type != STATESERVER_OBJECT_GET_FIELD_RESP) {
         if(resp_type == STATESERVER_OBJECT_GET_FIELDS_RESP) {
@@ -349,9 +610,27 @@ void DBStateServer::handle_get_field_resp(DatagramIterator& dgi)
 
     m_log->trace() << "Received GetFieldResp from database." << std::endl;
 
-    // Add database field payload to response (don't know dclass, so must copy payload) and send
-    dg->add_data(dgi.read_remainder());
-    route_datagram(dg);
+    // Remember the field, unless it was changed while we were waiting on the database
+    check_dgi.seek_payload();
+    doid_t do_id = check_dgi.read_channel(); // the response's sender is the object
+    if(m_cache.end_read(do_id)) {
+        DatagramIterator cache_dgi = dgi;
+        if(cache_dgi.read_bool()) {
+            const Field* field = g_dcf->get_field_by_id(cache_dgi.read_uint16());
+            if(field) {
+                FieldValues values;
+                cache_dgi.unpack_field(field, values[field]);
+                m_cache.store_fields(do_id, values);
+            }
+        }
+    }
+
+    // Add database field payload to responses (don't know dclass, so must copy payload) and send
+    std::vector<uint8_t> payload = dgi.read_remainder();
+    for(auto it = callers.begin(); it != callers.end(); ++it) {
+        (*it)->add_data(payload);
+        route_datagram(*it);
+    }
 }
 
 void DBStateServer::handle_get_fields(channel_t sender, DatagramIterator &dgi)
@@ -385,23 +664,45 @@ void DBStateServer::handle_get_fields(channel_t sender, DatagramIterator &dgi)
         }
     }
 
-    if(db_fields.size()) {
-        // Get context for db query
-        uint32_t db_context = m_next_context++;
-
-        // Prepare reponse datagram
-        if(m_context_datagrams.find(db_context) == m_context_datagrams.end()) {
-            m_context_datagrams[db_context] = Datagram::create(sender, r_do_id,
-                                              STATESERVER_OBJECT_GET_FIELDS_RESP);
+    // Answer from the cache if every database field is in it
+    FieldValues cached;
+    if(db_fields.size() && m_cache.enabled() && m_cache.get_fields(r_do_id, db_fields, cached)) {
+        DatagramPtr dg = Datagram::create(sender, r_do_id, STATESERVER_OBJECT_GET_FIELDS_RESP);
+        dg->add_uint32(r_context);
+        dg->add_bool(true);
+        dg->add_uint16(ram_fields.size() + db_fields.size());
+        for(auto it = ram_fields.begin(); it != ram_fields.end(); ++it) {
+            dg->add_uint16((*it)->get_id());
+            dg->add_data((*it)->get_default_value());
         }
-        m_context_datagrams[db_context]->add_uint32(r_context);
-        m_context_datagrams[db_context]->add_bool(true);
-        m_context_datagrams[db_context]->add_uint16(ram_fields.size() + db_fields.size());
+        for(auto it = db_fields.begin(); it != db_fields.end(); ++it) {
+            dg->add_uint16((*it)->get_id());
+            dg->add_data(cached[*it]);
+        }
+        route_datagram(dg);
+    } else if(db_fields.size()) {
+        // Prepare reponse datagram
+        DatagramPtr dg_resp = Datagram::create(sender, r_do_id, STATESERVER_OBJECT_GET_FIELDS_RESP);
+        dg_resp->add_uint32(r_context);
+        dg_resp->add_bool(true);
+        dg_resp->add_uint16(ram_fields.size() + db_fields.size());
         for(auto it = ram_fields.begin(); it != ram_fields.end(); ++it) {
-            m_context_datagrams[db_context]->add_uint16((*it)->get_id());
-            m_context_datagrams[db_context]->add_data((*it)->get_default_value());
+            dg_resp->add_uint16((*it)->get_id());
+            dg_resp->add_data((*it)->get_default_value());
         }
 
+        // Get context for db query, unless the same fields are already being fetched
+        uint32_t db_context;
+        ReadKey key(r_do_id, DBSERVER_OBJECT_GET_FIELDS, std::vector<uint16_t>());
+        for(auto it = db_fields.begin(); it != db_fields.end(); ++it) {
+            std::get<2>(key).push_back((*it)->get_id());
+        }
+        std::sort(std::get<2>(key).begin(), std::get<2>(key).end());
+        if(!queue_read(key, dg_resp, db_context)) {
+            return;
+        }
+        m_cache.begin_read(r_do_id);
+
         // Send query to database
         DatagramPtr dg = Datagram::create(m_db_channel, r_do_id, DBSERVER_OBJECT_GET_FIELDS);
         dg->add_uint32(db_context);
@@ -431,12 +732,11 @@ void DBStateServer::handle_get_fields_resp(DatagramIterator& dgi)
         return;
     }
 
-    // Get the datagram from the db_context
-    DatagramPtr dg = m_context_datagrams[db_context];
-    m_context_datagrams.erase(db_context);
+    // Get the datagrams from the db_context
+    std::vector<DatagramPtr> callers = finish_read(db_context);
 
     // Check to make sure the datagram is appropriate
-    DatagramIterator check_dgi = DatagramIterator(dg);
+    DatagramIterator check_dgi = DatagramIterator(callers.front());
     uint16_t resp_type = check_dgi.get_msg_type();
     if(resp_type != STATESERVER_OBJECT_GET_FIELDS_RESP) {
         if(resp_type == STATESERVER_OBJECT_GET_FIELD_RESP) {
@@ -449,12 +749,36 @@ void DBStateServer::handle_get_fields_resp(DatagramIterator& dgi)
 
     m_log->trace() << "Received GetFieldResp from database." << std::endl;
 
-    // Add database field payload to response (don't know dclass, so must copy payload).
+    // Remember the fields, unless they were changed while we were waiting on the database
+    check_dgi.seek_payload();
+    doid_t do_id = check_dgi.read_channel(); // the response's sender is the object
+    if(m_cache.end_read(do_id)) {
+        DatagramIterator cache_dgi = dgi;
+        if(cache_dgi.read_bool()) {
+            FieldValues values;
+            uint16_t field_count = cache_dgi.read_uint16();
+            for(uint16_t i = 0; i < field_count; ++i) {
+                const Field* field = g_dcf->get_field_by_id(cache_dgi.read_uint16());
+                if(!field) {
+                    values.clear();
+                    break;
+                }
+                cache_dgi.unpack_field(field, values[field]);
+            }
+            m_cache.store_fields(do_id, values);
+        }
+    }
+
+    // Add database field payload to responses (don't know dclass, so must copy payload).
+    std::vector<uint8_t> payload;
     if(dgi.read_bool() == true) {
         dgi.read_uint16(); // Discard field count
-        dg->add_data(dgi.read_remainder());
+        payload = dgi.read_remainder();
+    }
+    for(auto it = callers.begin(); it != callers.end(); ++it) {
+        (*it)->add_data(payload);
+        route_datagram(*it);
     }
-    route_datagram(dg);
 }
 
 
@@ -468,14 +792,37 @@ void DBStateServer::handle_get_all(channel_t sender, DatagramIterator &dgi)
 
     m_log->trace() << "Received GetAll for inactive object with id " << r_do_id << std::endl;
 
-    // Get context for db query, and remember caller with it
-    uint32_t db_context = m_next_context++;
-
     DatagramPtr resp_dg = Datagram::create(sender, r_do_id, STATESERVER_OBJECT_GET_ALL_RESP);
     resp_dg->add_uint32(r_context);
     resp_dg->add_doid(r_do_id);
     resp_dg->add_channel(INVALID_CHANNEL); // Location
-    m_context_datagrams[db_context] = resp_dg;
+
+    // Answer from the cache if we have the whole object
+    const Class* r_class = nullptr;
+    const FieldValues* cached = m_cache.enabled() ? m_cache.get_all(r_do_id, r_class) : nullptr;
+    if(cached) {
+        UnorderedFieldValues required_fields;
+        FieldValues ram_fields;
+        for(auto it = cached->begin(); it != cached->end(); ++it) {
+            if(it->first->has_keyword("ram")) {
+                ram_fields.insert(*it);
+            } else {
+                required_fields.insert(*it);
+            }
+        }
+
+        add_object_fields(resp_dg, r_class, required_fields, ram_fields);
+        route_datagram(resp_dg);
+        return;
+    }
+
+    // Get context for db query, and remember caller with it.  If the object is already
+    // being fetched, the caller will be answered along with the earlier ones.
+    uint32_t db_context;
+    if(!queue_read(ReadKey(r_do_id, DBSERVER_OBJECT_GET_ALL, {}), resp_dg, db_context)) {
+        return;
+    }
+    m_cache.begin_read(r_do_id);
 
     // Cache the do_id --> context in case we get a dbss_activate
     m_inactive_loads[r_do_id].insert(db_context);
@@ -494,12 +841,11 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
         return;
     }
 
-    // Get the datagram from the db_context
-    DatagramPtr dg = m_context_datagrams[db_context];
-    m_context_datagrams.erase(db_context);
+    // Get the datagrams from the db_context
+    std::vector<DatagramPtr> callers = finish_read(db_context);
 
     // Check to make sure the datagram is appropriate
-    DatagramIterator check_dgi = DatagramIterator(dg);
+    DatagramIterator check_dgi = DatagramIterator(callers.front());
     uint16_t resp_type = check_dgi.get_msg_type();
     if(resp_type != STATESERVER_OBJECT_GET_ALL_RESP) {
         if(resp_type == STATESERVER_OBJECT_GET_FIELD_RESP) {
@@ -512,7 +858,9 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
 
     // Get do_id from datagram
     check_dgi.seek_payload();
-    check_dgi.skip(sizeof(channel_t) + sizeof(doid_t)); // skip over sender and context to do_id;
+    check_dgi.read_channel(); // skip over sender
+    check_dgi.read_uint16(); // skip over msgtype
+    check_dgi.read_uint32(); // skip over context
     doid_t do_id = check_dgi.read_doid();
 
     // Remove cached loading operation
@@ -523,6 +871,7 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
     }
 
     m_log->trace() << "Received GetAllResp from database." << std::endl;
+    bool fresh = m_cache.end_read(do_id);
 
     // If object not found, just cleanup the context map
     if(dgi.read_bool() != true) {
@@ -546,6 +895,24 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
         return;
     }
 
+    // Remember the object, unless it was changed while we were waiting on the database
+    if(fresh) {
+        FieldValues db_fields(ram_fields);
+        db_fields.insert(required_fields.begin(), required_fields.end());
+        m_cache.store_all(do_id, r_class, db_fields);
+    }
+
+    // Send response back to callers
+    for(auto it = callers.begin(); it != callers.end(); ++it) {
+        add_object_fields(*it, r_class, required_fields, ram_fields);
+        route_datagram(*it);
+    }
+}
+
+void DBStateServer::add_object_fields(DatagramPtr dg, const Class *r_class,
+                                      const UnorderedFieldValues &required_fields,
+                                      const FieldValues &ram_fields)
+{
     // Add class to response
     dg->add_uint16(r_class->get_id());
 
@@ -569,9 +936,40 @@ void DBStateServer::handle_get_all_resp(DatagramIterator& dgi)
         dg->add_uint16(it->first->get_id());
         dg->add_data(it->second);
     }
+}
 
-    // Send response back to caller
-    route_datagram(dg);
+void DBStateServer::handle_db_update(uint16_t msgtype, DatagramIterator &dgi)
+{
+    doid_t do_id = dgi.read_doid();
+    detach_reads(do_id);
+
+    switch(msgtype) {
+    case DBSERVER_OBJECT_SET_FIELD:
+    case DBSERVER_OBJECT_DELETE_FIELD: {
+        const Field* field = g_dcf->get_field_by_id(dgi.read_uint16());
+        if(field) {
+            m_cache.invalidate_field(do_id, field);
+        } else {
+            m_cache.invalidate(do_id);
+        }
+    }
+    break;
+    case DBSERVER_OBJECT_DELETE_FIELDS: {
+        uint16_t field_count = dgi.read_uint16();
+        for(uint16_t i = 0; i < field_count; ++i) {
+            const Field* field = g_dcf->get_field_by_id(dgi.read_uint16());
+            if(!field) {
+                m_cache.invalidate(do_id);
+                break;
+            }
+            m_cache.invalidate_field(do_id, field);
+        }
+    }
+    break;
+    default:
+        // Not worth parsing each field, just forget the whole object
+        m_cache.invalidate(do_id);
+    }
 }
 
 void DBStateServer::receive_object(DistributedObject* obj)
@@ -584,11 +982,54 @@ void DBStateServer::discard_loader(doid_t do_id)
     m_loading.erase(do_id);
 }
 
+bool DBStateServer::queue_read(const ReadKey &key, DatagramPtr stub, uint32_t &db_context)
+{
+    auto read_it = m_read_contexts.find(key);
+    if(read_it != m_read_contexts.end()) {
+        m_log->trace() << "Joining outstanding database query for object with id "
+                       << std::get<0>(key) << ".\n";
+        m_context_datagrams[read_it->second].callers.push_back(stub);
+        return false;
+    }
+
+    db_context = m_next_context++;
+    PendingRead &read = m_context_datagrams[db_context];
+    read.key = key;
+    read.callers.push_back(stub);
+    m_read_contexts[key] = db_context;
+    return true;
+}
+
+std::vector<DatagramPtr> DBStateServer::finish_read(uint32_t db_context)
+{
+    auto read_it = m_context_datagrams.find(db_context);
+    std::vector<DatagramPtr> callers = std::move(read_it->second.callers);
+    auto key_it = m_read_contexts.find(read_it->second.key);
+    if(key_it != m_read_contexts.end() && key_it->second == db_context) {
+        m_read_contexts.erase(key_it);
+    }
+    m_context_datagrams.erase(read_it);
+    return callers;
+}
+
+void DBStateServer::detach_reads(doid_t do_id)
+{
+    auto it = m_read_contexts.lower_bound(ReadKey(do_id, 0, {}));
+    while(it != m_read_contexts.end() && std::get<0>(it->first) == do_id) {
+        it = m_read_contexts.erase(it);
+    }
+}
+
 bool DBStateServer::is_expected_context(uint32_t context)
 {
     return m_context_datagrams.find(context) != m_context_datagrams.end();
 }
 
+bool DBStateServer::is_write_behind(doid_t do_id)
+{
+    return m_write_interval && m_objs.find(do_id) != m_objs.end();
+}
+
 bool DBStateServer::is_activated_object(doid_t do_id)
 {
     return m_objs.find(do_id) != m_objs.end() || m_loading.find(do_id) != m_loading.end();
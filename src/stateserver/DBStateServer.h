@@ -1,6 +1,10 @@
 #pragma once
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <unordered_set>
 #include "StateServer.h"
+#include "FieldCache.h"
 #include "core/objtypes.h"
 
 /* Helper Functions */
@@ -29,15 +33,45 @@ class DBStateServer : public StateServer
 
     // m_next_context is the next context to send to the db. Invariant: always post-increment.
     uint32_t m_next_context;
+    // A ReadKey identifies a query to the db by its object, message type and requested fields.
+    typedef std::tuple<doid_t, uint16_t, std::vector<uint16_t> > ReadKey;
+    // A PendingRead is a query which has been sent to the db, along with the response stubs
+    // of every caller waiting on its result.
+    struct PendingRead {
+        ReadKey key;
+        std::vector<DatagramPtr> callers;
+    };
     // m_context_datagrams is a map of "context sent to db" to datagram response stubs to send
     // back to the caller. It stores the data used to correctly route the response while the
     // dbss is waiting on the db.
-    std::unordered_map<uint32_t, DatagramPtr> m_context_datagrams;
+    std::unordered_map<uint32_t, PendingRead> m_context_datagrams;
+    // m_read_contexts maps each outstanding query to its context, so that identical queries
+    // made while it is outstanding can share its result instead of hitting the db again.
+    std::map<ReadKey, uint32_t> m_read_contexts;
 
     std::unordered_map<doid_t, std::unordered_set<uint32_t> > m_inactive_loads;
+    // m_multi_loads maps the context of each outstanding bulk load to the objects
+    // whose part of the response hasn't been received yet.
+    std::unordered_map<uint32_t, std::unordered_set<doid_t> > m_multi_loads;
+
+    // m_cache holds the database fields of recently read inactive objects
+    FieldCache m_cache;
+    unsigned int m_cache_stats_interval = 0;
+    boost::asio::deadline_timer *m_cache_stats_timer = nullptr;
+
+    // Write-behind state, m_write_interval is zero if db fields are written immediately.
+    // m_dirty_fields holds the db fields of active objects which haven't been written yet.
+    unsigned int m_write_interval = 0;
+    boost::asio::deadline_timer *m_write_timer = nullptr;
+    std::mutex m_dirty_lock;
+    std::unordered_map<doid_t, FieldValues> m_dirty_fields;
 
     // handle_activate accepts an activate message and spawns a LoadingObject to handle it.
     void handle_activate(DatagramIterator &dgi, bool has_other);
+    // handle_activate_many spawns a LoadingObject for each object in the message,
+    // and loads them from the db with a single query.
+    void handle_activate_many(DatagramIterator &dgi);
+    void handle_get_all_multi_resp(DatagramIterator &dgi);
     void handle_delete_disk(channel_t sender, DatagramIterator &dgi);
     void handle_set_field(DatagramIterator &dgi);
     void handle_set_fields(DatagramIterator &dgi);
@@ -48,6 +82,34 @@ class DBStateServer : public StateServer
     void handle_get_all(channel_t sender, DatagramIterator &dgi);
     void handle_get_all_resp(DatagramIterator &dgi);
     void handle_get_activated(channel_t sender, DatagramIterator &dgi);
+    // handle_db_update invalidates cached fields when the database broadcasts a change.
+    void handle_db_update(uint16_t msgtype, DatagramIterator &dgi);
+
+    // add_object_fields appends the class, required fields and ram fields of an
+    // inactive object to a GetAllResp.
+    void add_object_fields(DatagramPtr dg, const dclass::Class *dclass,
+                           const UnorderedFieldValues &required, const FieldValues &ram);
+    // queue_read adds a caller's response stub to the query identified by key. It returns
+    // true if a new query must be sent to the db with the context stored in db_context, or
+    // false if the caller has joined an identical query which is already outstanding.
+    bool queue_read(const ReadKey &key, DatagramPtr stub, uint32_t &db_context);
+    // finish_read removes an outstanding query, returning the response stubs of its callers.
+    std::vector<DatagramPtr> finish_read(uint32_t db_context);
+    // detach_reads stops new callers from joining the outstanding queries for an object,
+    // because it has been modified since they were sent.
+    void detach_reads(doid_t do_id);
+
+    // object_deleted writes out the dirty fields of an object which is being deactivated.
+    virtual void object_deleted(DistributedObject *obj);
+    // schedule_write starts the timer for the next write-behind flush.
+    void schedule_write();
+    // flush_dirty_fields writes the dirty fields of every active object to the database.
+    void flush_dirty_fields();
+    // write_fields sends an object's fields to the database in a single SetFields.
+    void write_fields(doid_t do_id, const FieldValues &fields);
+
+    // schedule_cache_stats starts the timer for the next cache statistics report.
+    void schedule_cache_stats();
 
     // receive_object gives responsibility of a DistributedObject to the dbss
     // primarily used by a LoadingObject when the object is finished loading.
@@ -59,4 +121,6 @@ class DBStateServer : public StateServer
     inline bool is_expected_context(uint32_t context);
     // is_activated_object returns true if the doid is an active or loading object.
     inline bool is_activated_object(doid_t);
+    // is_write_behind returns true if db field updates to the doid should be held back.
+    inline bool is_write_behind(doid_t);
 };
@@ -10,6 +10,9 @@ using dclass::Class;
 using dclass::Field;
 using dclass::MolecularField;
 
+// The soft limit for the size of the entries packed into a single ENTER_INTEREST_BULK.
+static const dgsize_t INTEREST_BULK_SIZE = 0x8000;
+
 DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doid_t parent_id,
                                      zone_t zone_id, const Class *dclass, DatagramIterator &dgi,
                                      bool has_other) :
@@ -71,8 +74,33 @@ DistributedObject::DistributedObject(StateServer *stateserver, channel_t sender,
     wake_children();
 }
 
+DistributedObject::DistributedObject(StateServer *stateserver, doid_t do_id, doid_t parent_id,
+                                     zone_t zone_id, const Class *dclass,
+                                     UnorderedFieldValues& required, FieldValues& ram,
+                                     channel_t ai_channel, bool ai_explicitly_set,
+                                     channel_t owner_channel) :
+    m_stateserver(stateserver), m_do_id(do_id), m_parent_id(parent_id), m_zone_id(zone_id),
+    m_dclass(dclass), m_ai_channel(ai_channel), m_owner_channel(owner_channel),
+    m_ai_explicitly_set(ai_explicitly_set), m_next_context(0), m_migration(MIGRATION_INCOMING)
+{
+    stringstream name;
+    name << dclass->get_name() << "(" << do_id << ")";
+    m_log = new LogCategory("object", name.str());
+    set_con_name(name.str());
+
+    m_required_fields = required;
+    m_ram_fields = ram;
+
+    MessageDirector::singleton.subscribe_channel(this, do_id);
+    if(m_parent_id) {
+        MessageDirector::singleton.subscribe_channel(this, parent_to_children(m_parent_id));
+        m_stateserver->m_objs_by_location[location_as_channel(m_parent_id, m_zone_id)].insert(this);
+    }
+}
+
 DistributedObject::~DistributedObject()
 {
+    delete m_migration_timer;
     delete m_log;
 }
 
@@ -117,6 +145,15 @@ void DistributedObject::append_other_data(DatagramPtr dg, bool client_only, bool
     }
 }
 
+void DistributedObject::append_state(DatagramPtr dg)
+{
+    append_required_data(dg);
+    append_other_data(dg);
+    dg->add_channel(m_ai_channel);
+    dg->add_bool(m_ai_explicitly_set);
+    dg->add_channel(m_owner_channel);
+}
+
 
 
 void DistributedObject::send_interest_entry(channel_t location, uint32_t context)
@@ -132,6 +169,53 @@ void DistributedObject::send_interest_entry(channel_t location, uint32_t context
     route_datagram(dg);
 }
 
+// send_interest_bulk sends the interest entries of all children in the given zones
+// which live on this stateserver, packed into as few ENTER_INTEREST_BULK as possible.
+void DistributedObject::send_interest_bulk(channel_t location, uint32_t context,
+                                           const unordered_set<zone_t> &zones)
+{
+    DatagramPtr entries = Datagram::create();
+    uint16_t entry_count = 0;
+    auto send_entries = [&]() {
+        DatagramPtr dg = Datagram::create(location, m_do_id, STATESERVER_OBJECT_ENTER_INTEREST_BULK);
+        dg->add_uint32(context);
+        dg->add_uint16(entry_count);
+        dg->add_data(entries);
+        route_datagram(dg);
+
+        entries = Datagram::create();
+        entry_count = 0;
+    };
+
+    for(auto zone = zones.begin(); zone != zones.end(); ++zone) {
+        auto children = m_stateserver->m_objs_by_location.find(location_as_channel(m_do_id, *zone));
+        if(children == m_stateserver->m_objs_by_location.end()) {
+            continue;
+        }
+
+        for(auto it = children->second.begin(); it != children->second.end(); ++it) {
+            DistributedObject *child = *it;
+            DatagramPtr entry = Datagram::create();
+            entry->add_bool(child->m_ram_fields.size() > 0);
+            child->append_required_data(entry, true);
+            if(child->m_ram_fields.size()) {
+                child->append_other_data(entry, true);
+            }
+
+            if(entry_count > 0 && (entry_count == UINT16_MAX ||
+                                   entries->size() + entry->size() > INTEREST_BULK_SIZE)) {
+                send_entries();
+            }
+            entries->add_blob(entry);
+            ++entry_count;
+        }
+    }
+
+    if(entry_count > 0) {
+        send_entries();
+    }
+}
+
 void DistributedObject::send_location_entry(channel_t location)
 {
     DatagramPtr dg = Datagram::create(location, m_do_id, m_ram_fields.size() ?
@@ -228,6 +312,14 @@ void DistributedObject::handle_location_change(doid_t new_parent, zone_t new_zon
         return; // Not actually changing location, no need to handle.
     }
 
+    // Keep the stateserver's location index up to date
+    if(old_parent) {
+        m_stateserver->remove_from_location(this, location_as_channel(old_parent, old_zone));
+    }
+    if(new_parent) {
+        m_stateserver->m_objs_by_location[location_as_channel(new_parent, new_zone)].insert(this);
+    }
+
     // Send changing location message
     DatagramPtr dg = Datagram::create(targets, sender, STATESERVER_OBJECT_CHANGING_LOCATION);
     dg->add_doid(m_do_id);
@@ -302,6 +394,10 @@ void DistributedObject::annihilate(channel_t sender, bool notify_parent)
 
     delete_children(sender);
 
+    if(m_parent_id) {
+        m_stateserver->remove_from_location(this, location_as_channel(m_parent_id, m_zone_id));
+    }
+    m_stateserver->object_deleted(this);
     m_stateserver->m_objs.erase(m_do_id);
     m_log->debug() << "Deleted.\n";
 
@@ -327,6 +423,247 @@ void DistributedObject::wake_children()
     route_datagram(dg);
 }
 
+void DistributedObject::begin_migration(channel_t target, bool include_children)
+{
+    if(m_migration != MIGRATION_NONE) {
+        m_log->warning() << "Received migrate while already migrating.\n";
+        return;
+    }
+    if(m_stateserver->m_control_channel == INVALID_CHANNEL) {
+        m_log->error() << "Can't migrate an object which isn't owned by a stateserver.\n";
+        return;
+    }
+    if(target == m_stateserver->m_control_channel) {
+        return; // Already there
+    }
+
+    // The state comes from our stateserver, so that the target can tell it if it fails.
+    ++m_migration_id;
+    DatagramPtr dg = Datagram::create(target, m_stateserver->m_control_channel,
+                                      STATESERVER_OBJECT_MIGRATE_STATE);
+    dg->add_uint32(m_migration_id);
+    try {
+        append_state(dg);
+    } catch(const DatagramOverflow&) {
+        m_log->error() << "Object is too large to be migrated.\n";
+        return;
+    }
+
+    // Send our children along too, if they fit; otherwise the target has to ask them.
+    dgsize_t state_size = dg->size();
+    try {
+        uint32_t child_count = 0;
+        for(auto zone = m_zone_objects.begin(); zone != m_zone_objects.end(); ++zone) {
+            child_count += zone->second.size();
+        }
+
+        dg->add_bool(true);
+        dg->add_uint32(child_count);
+        for(auto zone = m_zone_objects.begin(); zone != m_zone_objects.end(); ++zone) {
+            for(auto child = zone->second.begin(); child != zone->second.end(); ++child) {
+                dg->add_doid(*child);
+                dg->add_zone(zone->first);
+            }
+        }
+    } catch(const DatagramOverflow&) {
+        dg = Datagram::create(dg->get_data(), state_size);
+        dg->add_bool(false);
+    }
+
+    if(include_children && !m_zone_objects.empty()) {
+        DatagramPtr migrate = Datagram::create(parent_to_children(m_do_id), m_do_id,
+                                               STATESERVER_OBJECT_MIGRATE);
+        migrate->add_doid(m_do_id);
+        migrate->add_channel(target);
+        migrate->add_bool(true);
+        route_datagram(migrate);
+    }
+
+    // Everything we receive from here on is queued, until the target is ready to take over.
+    m_log->debug() << "Migrating to " << target << "...\n";
+    m_migration = MIGRATION_OUTGOING;
+    route_datagram(dg);
+
+    // If the target never answers, we give up on it by failing the migration ourselves.
+    // The timer is handled outside of the routing thread, so it has to go through our
+    // stateserver rather than touching the object.
+    if(m_stateserver->m_migration_timeout) {
+        if(!m_migration_timer) {
+            m_migration_timer = new boost::asio::deadline_timer(io_service);
+        }
+        m_migration_timer->expires_from_now(
+            boost::posix_time::seconds(m_stateserver->m_migration_timeout));
+
+        channel_t control = m_stateserver->m_control_channel;
+        doid_t do_id = m_do_id;
+        uint32_t migration_id = m_migration_id;
+        m_migration_timer->async_wait([control, do_id, migration_id](
+                                          const boost::system::error_code &ec) {
+            if(ec) {
+                return;
+            }
+
+            DatagramPtr failed = Datagram::create(control, control,
+                                                  STATESERVER_OBJECT_MIGRATE_FAILED);
+            failed->add_doid(do_id);
+            failed->add_uint32(migration_id);
+            MessageDirector::singleton.route_datagram(nullptr, failed);
+        });
+    }
+}
+
+void DistributedObject::finish_migration()
+{
+    // The target received everything after the ready message itself, so we only hand over the
+    // messages we queued up until it arrived.
+    for(auto it = m_migration_queue.begin(); it != m_migration_queue.end(); ++it) {
+        DatagramPtr dg = Datagram::create(m_do_id, m_do_id, STATESERVER_OBJECT_MIGRATE_REPLAY);
+        dg->add_doid(m_do_id);
+        try {
+            dg->add_blob(*it);
+        } catch(const DatagramOverflow&) {
+            m_log->error() << "Dropped a queued message too large to replay on migration.\n";
+            continue;
+        }
+        route_datagram(dg);
+    }
+    m_migration_queue.clear();
+
+    DatagramPtr dg = Datagram::create(m_do_id, m_do_id, STATESERVER_OBJECT_MIGRATE_DONE);
+    dg->add_doid(m_do_id);
+    route_datagram(dg);
+
+    m_log->debug() << "Migrated.\n";
+    remove_migrated();
+}
+
+void DistributedObject::abort_migration(uint32_t migration_id)
+{
+    if(m_migration != MIGRATION_OUTGOING || migration_id != m_migration_id) {
+        return;
+    }
+
+    m_log->warning() << "Migration failed, staying on this stateserver.\n";
+    if(m_migration_timer) {
+        m_migration_timer->cancel();
+    }
+    m_migration = MIGRATION_NONE;
+
+    // Handle everything we held back while we were waiting, as if it had just arrived.
+    std::list<DatagramHandle> queue;
+    queue.swap(m_migration_queue);
+    for(auto it = queue.begin(); it != queue.end(); ++it) {
+        replay_datagram(*it);
+    }
+}
+
+void DistributedObject::discard_late_target(uint32_t migration_id)
+{
+    DatagramPtr dg = Datagram::create(m_do_id, m_do_id, STATESERVER_OBJECT_MIGRATE_FAILED);
+    dg->add_doid(m_do_id);
+    dg->add_uint32(migration_id);
+    route_datagram(dg);
+}
+
+void DistributedObject::remove_migrated()
+{
+    if(m_migration_timer) {
+        m_migration_timer->cancel();
+    }
+    if(m_parent_id) {
+        m_stateserver->remove_from_location(this, location_as_channel(m_parent_id, m_zone_id));
+    }
+    m_stateserver->m_objs.erase(m_do_id);
+
+    terminate();
+}
+
+void DistributedObject::handle_migrating(DatagramHandle in_dg, DatagramIterator &dgi)
+{
+    dgi.read_channel(); // sender
+    uint16_t msgtype = dgi.read_uint16();
+
+    if(m_migration == MIGRATION_OUTGOING) {
+        if(msgtype == STATESERVER_OBJECT_MIGRATE_READY && dgi.read_doid() == m_do_id) {
+            uint32_t migration_id = dgi.read_uint32();
+            if(migration_id == m_migration_id) {
+                finish_migration();
+            } else {
+                discard_late_target(migration_id);
+            }
+        } else {
+            m_migration_queue.push_back(in_dg);
+        }
+        return;
+    }
+
+    switch(msgtype) {
+    case STATESERVER_OBJECT_MIGRATE_READY: {
+        // Anything we received before this, the source received as well, and will replay for us.
+        if(dgi.read_doid() == m_do_id && dgi.read_uint32() == m_migration_id) {
+            m_migration_queue.clear();
+        }
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_REPLAY: {
+        if(dgi.read_doid() == m_do_id) {
+            replay_datagram(Datagram::create(dgi.read_blob()));
+        }
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_FAILED: {
+        // The source gave up on us before we were ready, and has carried on without us.
+        // A failure of one of its earlier migrations is meant for a different copy.
+        if(dgi.read_doid() == m_do_id && dgi.read_uint32() == m_migration_id) {
+            m_log->warning() << "Source abandoned the migration, discarding this copy.\n";
+            remove_migrated();
+        }
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_DONE: {
+        if(dgi.read_doid() != m_do_id) {
+            break;
+        }
+
+        m_log->debug() << "Finished migrating in.\n";
+        m_migration = MIGRATION_NONE;
+
+        // Now handle everything which arrived since the ready message
+        std::list<DatagramHandle> queue;
+        queue.swap(m_migration_queue);
+        for(auto it = queue.begin(); it != queue.end(); ++it) {
+            replay_datagram(*it);
+        }
+        break;
+    }
+    default:
+        m_migration_queue.push_back(in_dg);
+    }
+}
+
+void DistributedObject::replay_datagram(DatagramHandle dg)
+{
+    if(is_terminated()) {
+        return;
+    }
+
+    try {
+        DatagramIterator dgi(dg);
+        uint8_t channel_count = dgi.read_uint8();
+        for(uint8_t i = 0; i < channel_count; ++i) {
+            dgi.read_channel();
+        }
+
+        if(m_migration == MIGRATION_INCOMING) {
+            handle_message(dgi);
+        } else {
+            handle_datagram(dg, dgi);
+        }
+    } catch(const DatagramIteratorEOF&) {
+        m_log->error() << "Received truncated message while replaying migration.\n";
+    }
+}
+
 void DistributedObject::save_field(const Field *field, const vector<uint8_t> &data)
 {
     if(field->has_keyword("required")) {
@@ -432,7 +769,16 @@ bool DistributedObject::handle_one_get(DatagramPtr out, uint16_t field_id,
     return true;
 }
 
-void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
+void DistributedObject::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
+{
+    if(m_migration != MIGRATION_NONE) {
+        handle_migrating(in_dg, dgi);
+    } else {
+        handle_message(dgi);
+    }
+}
+
+void DistributedObject::handle_message(DatagramIterator &dgi)
 {
     channel_t sender = dgi.read_channel();
     uint16_t msgtype = dgi.read_uint16();
@@ -723,6 +1069,24 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         m_log->trace() << "... updated owner.\n";
         break;
     }
+    case STATESERVER_OBJECT_MIGRATE: {
+        doid_t r_do_id = dgi.read_doid();
+        channel_t target = dgi.read_channel();
+        bool include_children = dgi.read_bool();
+        if(r_do_id == m_do_id || (include_children && r_do_id == m_parent_id)) {
+            begin_migration(target, include_children);
+        }
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_READY: {
+        if(dgi.read_doid() == m_do_id) {
+            discard_late_target(dgi.read_uint32());
+        }
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_FAILED: {
+        break; // Only for a copy which is still migrating in
+    }
     case STATESERVER_OBJECT_GET_ZONES_OBJECTS: {
         uint32_t context  = dgi.read_uint32();
         doid_t queried_parent = dgi.read_doid();
@@ -735,6 +1099,12 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         if(queried_parent == m_parent_id) {
             // Query was relayed from parent! See if we match any of the zones
             // and if so, reply:
+            // If our parent is on this stateserver too, we were already
+            // included in its ENTER_INTEREST_BULK.
+            if(m_stateserver->m_objs.find(m_parent_id) != m_stateserver->m_objs.end()) {
+                break;
+            }
+
             uint16_t zone_count = dgi.read_uint16();
             for(uint16_t i = 0; i < zone_count; ++i) {
                 if(dgi.read_zone() == m_zone_id) {
@@ -747,7 +1117,6 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         }
 
         if(queried_parent == m_do_id) {
-            doid_t child_count = 0;
             uint16_t zone_count = dgi.read_uint16();
 
             // Start datagram to relay to children
@@ -758,22 +1127,48 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
             child_dg->add_uint16(zone_count);
 
             // Get all zones requested
+            unordered_set<zone_t> zones;
             for(int i = 0; i < zone_count; ++i) {
                 zone_t zone = dgi.read_zone();
-                child_count += m_zone_objects[zone].size();
                 child_dg->add_zone(zone);
+                zones.insert(zone);
+            }
+
+            // Children on this stateserver are looked up in its location index,
+            // only the children living elsewhere still need to be asked.
+            doid_t local_count = 0, remote_count = 0;
+            for(auto zone = zones.begin(); zone != zones.end(); ++zone) {
+                auto children = m_stateserver->m_objs_by_location.find(
+                                    location_as_channel(m_do_id, *zone));
+                if(children != m_stateserver->m_objs_by_location.end()) {
+                    local_count += children->second.size();
+                }
+
+                auto zone_objects = m_zone_objects.find(*zone);
+                if(zone_objects == m_zone_objects.end()) {
+                    continue;
+                }
+                for(auto it = zone_objects->second.begin(); it != zone_objects->second.end(); ++it) {
+                    if(m_stateserver->m_objs.find(*it) == m_stateserver->m_objs.end()) {
+                        ++remote_count;
+                    }
+                }
             }
 
             // Reply to requestor with count of objects expected
             DatagramPtr count_dg = Datagram::create(sender, m_do_id, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP);
             count_dg->add_uint32(context);
-            count_dg->add_doid(child_count);
+            count_dg->add_doid(local_count + remote_count);
             route_datagram(count_dg);
 
-            // Bounce the message down to all children and have them decide
-            // whether or not to reply.
-            // TODO: Is this really that efficient?
-            if(child_count > 0) {
+            // Reply for all of the children that live on this stateserver at once
+            if(local_count > 0) {
+                send_interest_bulk(sender, context, zones);
+            }
+
+            // Bounce the message down to the children on other stateservers,
+            // and have them decide whether or not to reply.
+            if(remote_count > 0) {
                 route_datagram(child_dg);
             }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <list>
 #include "StateServer.h"
 #include "core/objtypes.h"
 
@@ -12,6 +13,12 @@ class DistributedObject : public MDParticipantInterface
     DistributedObject(StateServer *stateserver, channel_t sender, doid_t do_id,
                       doid_t parent_id, zone_t zone_id, const dclass::Class *dclass,
                       UnorderedFieldValues& req_fields, FieldValues& ram_fields);
+    // This constructor is used for an object migrating in from another stateserver; the object
+    // subscribes to its channels but doesn't announce itself, since it already exists.
+    DistributedObject(StateServer *stateserver, doid_t do_id, doid_t parent_id, zone_t zone_id,
+                      const dclass::Class *dclass, UnorderedFieldValues& req_fields,
+                      FieldValues& ram_fields, channel_t ai_channel, bool ai_explicitly_set,
+                      channel_t owner_channel);
     ~DistributedObject();
 
     virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
@@ -42,6 +49,12 @@ class DistributedObject : public MDParticipantInterface
     }
 
   private:
+    enum MigrationState {
+        MIGRATION_NONE,
+        MIGRATION_OUTGOING, // frozen until the target stateserver has subscribed
+        MIGRATION_INCOMING, // waiting for the source stateserver to replay its queue
+    };
+
     StateServer *m_stateserver;
     doid_t m_do_id;
     doid_t m_parent_id;
@@ -54,12 +67,22 @@ class DistributedObject : public MDParticipantInterface
     bool m_ai_explicitly_set;
     uint32_t m_next_context;
     std::unordered_map<zone_t, std::unordered_set<doid_t>> m_zone_objects;
+    MigrationState m_migration = MIGRATION_NONE;
+    // m_migration_id tells the object's migrations apart, so that messages left over from
+    // an earlier one are ignored.  It is carried across to the target with the object.
+    uint32_t m_migration_id = 0;
+    std::list<DatagramHandle> m_migration_queue;
+    boost::asio::deadline_timer *m_migration_timer = nullptr;
     LogCategory *m_log;
 
+    void append_state(DatagramPtr dg);
+
     void append_required_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
     void append_other_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
 
     void send_interest_entry(channel_t location, uint32_t context);
+    void send_interest_bulk(channel_t location, uint32_t context,
+                            const std::unordered_set<zone_t> &zones);
     void send_location_entry(channel_t location);
     void send_ai_entry(channel_t location);
     void send_owner_entry(channel_t location);
@@ -73,6 +96,19 @@ class DistributedObject : public MDParticipantInterface
     void wake_children(); // ask all children for their locations
 
     void save_field(const dclass::Field *field, const std::vector<uint8_t> &data);
+    void begin_migration(channel_t target, bool include_children);
+    void finish_migration();
+    // abort_migration resumes an outgoing migration's object where it is, handling its queue,
+    // unless migration_id belongs to an earlier migration.
+    void abort_migration(uint32_t migration_id);
+    // discard_late_target tells the target of a migration we gave up on to discard its copy.
+    void discard_late_target(uint32_t migration_id);
+    // remove_migrated removes the object from the stateserver without broadcasting anything.
+    void remove_migrated();
+    void handle_migrating(DatagramHandle in_dg, DatagramIterator &dgi);
+    void replay_datagram(DatagramHandle dg);
+
+    void handle_message(DatagramIterator &dgi);
     bool handle_one_update(DatagramIterator &dgi, channel_t sender);
     bool handle_one_get(DatagramPtr out, uint16_t field_id,
                         bool succeed_if_unset = false, bool is_subfield = false);
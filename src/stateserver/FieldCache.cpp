@@ -0,0 +1,187 @@
+#include "FieldCache.h"
+using dclass::Class;
+using dclass::Field;
+
+// Approximate bookkeeping overhead of an entry and of each cached field, in bytes.
+static const size_t ENTRY_OVERHEAD = sizeof(doid_t) * 2 + 128;
+static const size_t FIELD_OVERHEAD = 64;
+
+FieldCache::FieldCache(size_t max_size) : m_max_size(max_size)
+{
+}
+
+const FieldValues* FieldCache::get_all(doid_t do_id, const Class* &dclass)
+{
+    Entry *entry = find(do_id);
+    if(!entry || !entry->complete) {
+        ++m_misses;
+        return nullptr;
+    }
+
+    ++m_hits;
+    dclass = entry->dclass;
+    return &entry->fields;
+}
+
+bool FieldCache::get_fields(doid_t do_id, const std::list<const Field*> &fields,
+                            FieldValues &values)
+{
+    Entry *entry = find(do_id);
+    if(!entry) {
+        ++m_misses;
+        return false;
+    }
+
+    for(auto it = fields.begin(); it != fields.end(); ++it) {
+        auto value = entry->fields.find(*it);
+        if(value == entry->fields.end()) {
+            values.clear();
+            ++m_misses;
+            return false;
+        }
+        values[*it] = value->second;
+    }
+
+    ++m_hits;
+    return true;
+}
+
+void FieldCache::begin_read(doid_t do_id)
+{
+    if(enabled()) {
+        ++m_pending_reads[do_id];
+    }
+}
+
+bool FieldCache::end_read(doid_t do_id)
+{
+    auto it = m_pending_reads.find(do_id);
+    if(it == m_pending_reads.end()) {
+        return false;
+    }
+
+    bool fresh = m_stale_reads.find(do_id) == m_stale_reads.end();
+    if(--it->second == 0) {
+        m_pending_reads.erase(it);
+        m_stale_reads.erase(do_id);
+    }
+    return fresh;
+}
+
+void FieldCache::store_all(doid_t do_id, const Class *dclass, const FieldValues &fields)
+{
+    Entry &entry = insert(do_id);
+    entry.dclass = dclass;
+    entry.complete = true;
+    for(auto it = fields.begin(); it != fields.end(); ++it) {
+        set_field(entry, it->first, it->second);
+    }
+    evict();
+}
+
+void FieldCache::store_fields(doid_t do_id, const FieldValues &fields)
+{
+    Entry &entry = insert(do_id);
+    for(auto it = fields.begin(); it != fields.end(); ++it) {
+        set_field(entry, it->first, it->second);
+    }
+    evict();
+}
+
+void FieldCache::invalidate(doid_t do_id)
+{
+    if(m_pending_reads.find(do_id) != m_pending_reads.end()) {
+        m_stale_reads.insert(do_id);
+    }
+
+    auto it = m_entries.find(do_id);
+    if(it != m_entries.end()) {
+        erase(it);
+    }
+}
+
+void FieldCache::invalidate_field(doid_t do_id, const Field *field)
+{
+    if(m_pending_reads.find(do_id) != m_pending_reads.end()) {
+        m_stale_reads.insert(do_id);
+    }
+
+    auto it = m_entries.find(do_id);
+    if(it == m_entries.end()) {
+        return;
+    }
+
+    Entry &entry = it->second;
+    auto value = entry.fields.find(field);
+    if(value != entry.fields.end()) {
+        size_t field_size = FIELD_OVERHEAD + value->second.size();
+        entry.size -= field_size;
+        m_size -= field_size;
+        entry.fields.erase(value);
+    }
+
+    // We no longer know whether the database has this field
+    entry.complete = false;
+}
+
+FieldCache::Entry* FieldCache::find(doid_t do_id)
+{
+    auto it = m_entries.find(do_id);
+    if(it == m_entries.end()) {
+        return nullptr;
+    }
+
+    // Move the object to the front of the LRU list
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    return &it->second;
+}
+
+FieldCache::Entry& FieldCache::insert(doid_t do_id)
+{
+    Entry *existing = find(do_id);
+    if(existing) {
+        return *existing;
+    }
+
+    Entry &entry = m_entries[do_id];
+    m_lru.push_front(do_id);
+    entry.lru = m_lru.begin();
+    entry.size = ENTRY_OVERHEAD;
+    m_size += ENTRY_OVERHEAD;
+    ++m_count;
+    return entry;
+}
+
+void FieldCache::erase(std::unordered_map<doid_t, Entry>::iterator it)
+{
+    m_size -= it->second.size;
+    --m_count;
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+}
+
+void FieldCache::set_field(Entry &entry, const Field *field, const std::vector<uint8_t> &value)
+{
+    auto existing = entry.fields.find(field);
+    if(existing != entry.fields.end()) {
+        entry.size -= existing->second.size();
+        m_size -= existing->second.size();
+        existing->second = value;
+    } else {
+        entry.fields[field] = value;
+        entry.size += FIELD_OVERHEAD;
+        m_size += FIELD_OVERHEAD;
+    }
+    entry.size += value.size();
+    m_size += value.size();
+}
+
+void FieldCache::evict()
+{
+    // Evict from the back of the LRU list; this may include the entry just stored,
+    // if it alone is larger than the cache.
+    while(m_size > m_max_size && !m_lru.empty()) {
+        erase(m_entries.find(m_lru.back()));
+        ++m_evictions;
+    }
+}
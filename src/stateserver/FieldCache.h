@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include "core/types.h"
+#include "core/objtypes.h"
+
+// A FieldCache is a bounded, least-recently-used cache of the database fields of objects
+// which aren't active in the DBSS.  It is only accessed from the MessageDirector's routing
+// thread; the statistics may be read from any thread.
+class FieldCache
+{
+  public:
+    FieldCache(size_t max_size = 0);
+
+    inline bool enabled() const
+    {
+        return m_max_size > 0;
+    }
+
+    // get_all returns the cached fields of an object if they are all known.  If the object
+    // is cached, dclass is set to the object's class.
+    const FieldValues* get_all(doid_t do_id, const dclass::Class* &dclass);
+    // get_fields copies the requested fields into values if they are all cached.
+    bool get_fields(doid_t do_id, const std::list<const dclass::Field*> &fields,
+                    FieldValues &values);
+
+    // begin_read should be called when a database read is sent for an object, and end_read
+    // when its response arrives.  end_read returns false if the object was invalidated while
+    // the read was outstanding, in which case the response must not be cached.
+    void begin_read(doid_t do_id);
+    bool end_read(doid_t do_id);
+
+    // store_all caches the complete set of fields of an object, as returned by a GET_ALL.
+    void store_all(doid_t do_id, const dclass::Class *dclass, const FieldValues &fields);
+    // store_fields adds some fields of an object to the cache.
+    void store_fields(doid_t do_id, const FieldValues &fields);
+
+    // invalidate removes an object from the cache.
+    void invalidate(doid_t do_id);
+    // invalidate_field removes a single field of an object from the cache.
+    void invalidate_field(doid_t do_id, const dclass::Field *field);
+
+    inline uint64_t get_hits() const
+    {
+        return m_hits;
+    }
+    inline uint64_t get_misses() const
+    {
+        return m_misses;
+    }
+    inline uint64_t get_evictions() const
+    {
+        return m_evictions;
+    }
+    inline size_t get_size() const
+    {
+        return m_size;
+    }
+    inline size_t get_count() const
+    {
+        return m_count;
+    }
+
+  private:
+    struct Entry {
+        const dclass::Class *dclass = nullptr;
+        bool complete = false; // true if fields holds every field the database has
+        FieldValues fields;
+        size_t size = 0;
+        std::list<doid_t>::iterator lru;
+    };
+
+    size_t m_max_size;
+    std::unordered_map<doid_t, Entry> m_entries;
+    std::list<doid_t> m_lru; // most recently used at the front
+
+    // Reads in flight per object, and the objects which were invalidated during them
+    std::unordered_map<doid_t, unsigned int> m_pending_reads;
+    std::unordered_set<doid_t> m_stale_reads;
+
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_evictions{0};
+    std::atomic<size_t> m_size{0};
+    std::atomic<size_t> m_count{0};
+
+    Entry* find(doid_t do_id);
+    Entry& insert(doid_t do_id);
+    void erase(std::unordered_map<doid_t, Entry>::iterator it);
+    void set_field(Entry &entry, const dclass::Field *field, const std::vector<uint8_t> &value);
+    void evict();
+};
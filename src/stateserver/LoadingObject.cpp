@@ -52,6 +52,25 @@ void LoadingObject::send_get_object(doid_t do_id)
     route_datagram(dg);
 }
 
+void LoadingObject::queue_update(DatagramHandle dg, DatagramIterator &dgi)
+{
+    doid_t do_id = dgi.read_doid();
+    uint16_t field_id = dgi.read_uint16();
+    const Field *field = g_dcf->get_field_by_id(field_id);
+    if(do_id != m_do_id || !field || !field->has_keyword("conflate")) {
+        m_datagram_queue.push_back(dg);
+        return;
+    }
+
+    // Only the most recent value of a conflated field needs to be replayed,
+    // so drop the stale update and queue the new one in its place.
+    auto queued = m_conflated_updates.find(field_id);
+    if(queued != m_conflated_updates.end()) {
+        m_datagram_queue.erase(queued->second);
+    }
+    m_conflated_updates[field_id] = m_datagram_queue.insert(m_datagram_queue.end(), dg);
+}
+
 // replay_datagrams emits datagrams from the loading object queue in the order
 // they were received when the object is successully loaded
 void LoadingObject::replay_datagrams(DistributedObject* obj)
@@ -99,6 +118,79 @@ void LoadingObject::finalize()
     terminate();
 }
 
+bool LoadingObject::load(DatagramIterator &dgi)
+{
+    m_is_loaded = true;
+
+    if(dgi.read_bool() != true) {
+        m_log->debug() << "Object not found in database.\n";
+        finalize();
+        return true;
+    }
+
+    uint16_t dc_id = dgi.read_uint16();
+    const Class *r_dclass = g_dcf->get_class_by_id(dc_id);
+    if(!r_dclass) {
+        m_log->error() << "Received object from database with unknown dclass"
+                       << " - id:" << dc_id << std::endl;
+        finalize();
+        return false;
+    }
+
+    // Get fields from database
+    if(!unpack_db_fields(dgi, r_dclass, m_required_fields, m_ram_fields)) {
+        m_log->error() << "Error while unpacking fields from database.\n";
+        finalize();
+        return false;
+    }
+
+    if(m_dclass && r_dclass != m_dclass) {
+        m_log->error() << "Requested object of class '" << m_dclass->get_id()
+                       << "', but received class " << dc_id << std::endl;
+        finalize();
+        return true;
+    }
+
+    // Add default values and updated values
+    int dcc_field_count = r_dclass->get_num_fields();
+    for(int i = 0; i < dcc_field_count; ++i) {
+        const Field *field = r_dclass->get_field(i);
+        if(!field->as_molecular()) {
+            if(field->has_keyword("required")) {
+                if(m_field_updates.find(field) != m_field_updates.end()) {
+                    m_required_fields[field] = m_field_updates[field];
+                } else if(m_required_fields.find(field) == m_required_fields.end()) {
+                    std::string val = field->get_default_value();
+                    m_required_fields[field] = std::vector<uint8_t>(val.begin(), val.end());
+                }
+            } else if(field->has_keyword("ram")) {
+                if(m_field_updates.find(field) != m_field_updates.end()) {
+                    m_ram_fields[field] = m_field_updates[field];
+                }
+            }
+        }
+    }
+
+    // Create object on stateserver
+    DistributedObject* obj = new DistributedObject(m_dbss, m_dbss->m_db_channel, m_do_id,
+            m_parent_id, m_zone_id, r_dclass,
+            m_required_fields, m_ram_fields);
+
+    // Tell DBSS about object and handle datagram queue
+    m_dbss->receive_object(obj);
+    replay_datagrams(obj);
+
+    // Cleanup this loader
+    finalize();
+    return true;
+}
+
+void LoadingObject::abort()
+{
+    m_is_loaded = true;
+    finalize();
+}
+
 void LoadingObject::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 {
     /*channel_t sender =*/ dgi.read_channel(); // sender not used
@@ -118,77 +210,25 @@ void LoadingObject::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
         }
 
         m_log->trace() << "Received GetAllResp from database.\n";
-        m_is_loaded = true;
-
-        if(dgi.read_bool() != true) {
-            m_log->debug() << "Object not found in database.\n";
-            finalize();
-            break;
-        }
-
-        uint16_t dc_id = dgi.read_uint16();
-        const Class *r_dclass = g_dcf->get_class_by_id(dc_id);
-        if(!r_dclass) {
-            m_log->error() << "Received object from database with unknown dclass"
-                           << " - id:" << dc_id << std::endl;
-            finalize();
-            break;
-        }
-
-        if(m_dclass && r_dclass != m_dclass) {
-            m_log->error() << "Requested object of class '" << m_dclass->get_id()
-                           << "', but received class " << dc_id << std::endl;
-            finalize();
-            break;
-        }
-
-        // Get fields from database
-        if(!unpack_db_fields(dgi, r_dclass, m_required_fields, m_ram_fields)) {
-            m_log->error() << "Error while unpacking fields from database.\n";
-            finalize();
-            break;
-        }
-
-        // Add default values and updated values
-        int dcc_field_count = r_dclass->get_num_fields();
-        for(int i = 0; i < dcc_field_count; ++i) {
-            const Field *field = r_dclass->get_field(i);
-            if(!field->as_molecular()) {
-                if(field->has_keyword("required")) {
-                    if(m_field_updates.find(field) != m_field_updates.end()) {
-                        m_required_fields[field] = m_field_updates[field];
-                    } else if(m_required_fields.find(field) == m_required_fields.end()) {
-                        std::string val = field->get_default_value();
-                        m_required_fields[field] = std::vector<uint8_t>(val.begin(), val.end());
-                    }
-                } else if(field->has_keyword("ram")) {
-                    if(m_field_updates.find(field) != m_field_updates.end()) {
-                        m_ram_fields[field] = m_field_updates[field];
-                    }
-                }
-            }
-        }
-
-        // Create object on stateserver
-        DistributedObject* obj = new DistributedObject(m_dbss, m_dbss->m_db_channel, m_do_id,
-                m_parent_id, m_zone_id, r_dclass,
-                m_required_fields, m_ram_fields);
-
-        // Tell DBSS about object and handle datagram queue
-        m_dbss->receive_object(obj);
-        replay_datagrams(obj);
-
-        // Cleanup this loader
-        finalize();
+        load(dgi);
+        break;
+    }
+    case DBSERVER_OBJECT_GET_ALL_MULTI_RESP: {
+        // Bulk loads are answered to the DBSS, which passes us our part of the response
         break;
     }
     case DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS:
-    case DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS_OTHER: {
+    case DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS_OTHER:
+    case DBSS_OBJECT_ACTIVATE_MANY: {
         // Don't cache these messages in the queue, they are received and
         // handled by the DBSS.  Since the object is already loading they
         // are simply ignored (the DBSS may generate a warning/error).
         break;
     }
+    case STATESERVER_OBJECT_SET_FIELD: {
+        queue_update(in_dg, dgi);
+        break;
+    }
     default: {
         m_datagram_queue.push_back(in_dg);
     }
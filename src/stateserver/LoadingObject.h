@@ -15,6 +15,11 @@ class LoadingObject : public MDParticipantInterface
     ~LoadingObject();
 
     void begin();
+    // load creates the object from the status, class and fields of a database response.
+    // Returns false if the response couldn't be read past the object's fields.
+    bool load(DatagramIterator &dgi);
+    // abort gives up on loading the object, forwarding anything received to the dbss.
+    void abort();
 
     virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
 
@@ -35,8 +40,13 @@ class LoadingObject : public MDParticipantInterface
 
     // Received datagrams while waiting for reply
     std::list<DatagramHandle> m_datagram_queue;
+    // Queued updates of "conflate" fields, by field id; only the latest is replayed
+    std::unordered_map<uint16_t, std::list<DatagramHandle>::iterator> m_conflated_updates;
     bool m_is_loaded;
 
+    // queue_update queues a SET_FIELD received while loading, replacing any
+    // previously queued value if the field is conflated.
+    void inline queue_update(DatagramHandle dg, DatagramIterator &dgi);
     // send_get_object makes the initial request to the database for the object data
     void inline send_get_object(doid_t do_id);
     // replay_datagrams while replay the datagrams for a loaded distributed object
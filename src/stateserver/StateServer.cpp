@@ -1,35 +1,73 @@
 #include "core/global.h"
 #include "core/msgtypes.h"
+#include "core/shutdown.h"
 #include "config/constraints.h"
 #include "dclass/dc/Class.h"
+#include "dclass/dc/Field.h"
+#include <chrono>
 #include <exception>
+#include <fstream>
 #include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "DistributedObject.h"
 #include "StateServer.h"
 
 using dclass::Class;
+using dclass::Field;
 
 static RoleConfigGroup stateserver_config("stateserver");
 static ConfigVariable<channel_t> control_channel("control", INVALID_CHANNEL, stateserver_config);
 static InvalidChannelConstraint control_not_invalid(control_channel);
 static ReservedChannelConstraint control_not_reserved(control_channel);
 
+static ConfigGroup snapshot_config("snapshot", stateserver_config);
+static ConfigVariable<std::string> snapshot_file("file", "", snapshot_config);
+static ConfigVariable<unsigned int> snapshot_interval("interval", 0, snapshot_config);
+
+static ConfigVariable<unsigned int> migration_timeout("migration_timeout", 30, stateserver_config);
+
+// The snapshot file starts with a fixed-size header, followed by one length-prefixed
+// record per object.  All values are little-endian, the same as on the wire.
+static const char SNAPSHOT_MAGIC[4] = { 'A', 'S', 'S', 'N' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const size_t SNAPSHOT_HEADER_SIZE = 4 + 4 + 4 + 8; // magic, version, dc hash, count
+
 StateServer::StateServer(RoleConfig roleconfig) : Role(roleconfig)
 {
     channel_t channel = control_channel.get_rval(m_roleconfig);
     if(channel != INVALID_CHANNEL) {
         MessageDirector::singleton.subscribe_channel(this, channel);
+        m_control_channel = channel;
 
         std::stringstream name;
         name << "StateServer(" << channel << ")";
         m_log = new LogCategory("stateserver", name.str());
         set_con_name(name.str());
+
+        m_migration_timeout = migration_timeout.get_rval(m_roleconfig);
+
+        ConfigNode snapshot = stateserver_config.get_child_node(snapshot_config, m_roleconfig);
+        m_snapshot_file = snapshot_file.get_rval(snapshot);
+        m_snapshot_interval = snapshot_interval.get_rval(snapshot);
+    }
+
+    if(!m_snapshot_file.empty()) {
+        load_snapshot();
+
+        m_snapshot_timer = new boost::asio::deadline_timer(io_service);
+        schedule_snapshot();
+        astron_add_shutdown_hook([this]() {
+            request_snapshot(true);
+        });
     }
 }
 
 StateServer::~StateServer()
 {
+    delete m_snapshot_timer;
     delete m_log;
 }
 
@@ -65,6 +103,19 @@ void StateServer::handle_generate(DatagramIterator &dgi, bool has_other)
     m_objs[do_id] = obj;
 }
 
+void StateServer::remove_from_location(DistributedObject *obj, channel_t location)
+{
+    auto it = m_objs_by_location.find(location);
+    if(it == m_objs_by_location.end()) {
+        return;
+    }
+
+    it->second.erase(obj);
+    if(it->second.empty()) {
+        m_objs_by_location.erase(it);
+    }
+}
+
 void StateServer::handle_delete_ai(DatagramIterator& dgi, channel_t sender)
 {
     channel_t ai_channel = dgi.read_channel();
@@ -82,6 +133,313 @@ void StateServer::handle_delete_ai(DatagramIterator& dgi, channel_t sender)
     }
 }
 
+void StateServer::handle_migrate_state(DatagramIterator &dgi, channel_t sender)
+{
+    uint32_t migration_id = 0;
+    doid_t do_id = INVALID_DO_ID;
+    DistributedObject *obj = nullptr;
+    try {
+        migration_id = dgi.read_uint32();
+        do_id = DatagramIterator(dgi).read_doid();
+        obj = restore_object(dgi, false);
+    } catch(const DatagramIteratorEOF&) {
+        m_log->error() << "Received truncated state for migrating object " << do_id << ".\n";
+    }
+
+    if(!obj) {
+        // Let the source know, so that it can carry on where it is.
+        if(do_id != INVALID_DO_ID) {
+            DatagramPtr dg = Datagram::create(sender, m_control_channel,
+                                              STATESERVER_OBJECT_MIGRATE_FAILED);
+            dg->add_doid(do_id);
+            dg->add_uint32(migration_id);
+            route_datagram(dg);
+        }
+        return;
+    }
+    obj->m_migration_id = migration_id;
+
+    try {
+        if(dgi.read_bool()) {
+            uint32_t child_count = dgi.read_uint32();
+            for(uint32_t i = 0; i < child_count; ++i) {
+                doid_t child = dgi.read_doid();
+                obj->m_zone_objects[dgi.read_zone()].insert(child);
+            }
+        } else {
+            // The source couldn't fit the children into the migration, so ask them directly.
+            obj->wake_children();
+        }
+    } catch(const DatagramIteratorEOF&) {
+        m_log->error() << "Received truncated children for migrating object "
+                       << obj->m_do_id << ".\n";
+        obj->wake_children();
+    }
+
+    m_log->debug() << "Receiving object " << obj->m_do_id << " migrating from " << sender << ".\n";
+
+    // The object is now subscribed to all of its channels, so we let the source know it can
+    // hand over.  This marks the point after which the new object receives its own messages.
+    DatagramPtr dg = Datagram::create(obj->m_do_id, m_control_channel,
+                                      STATESERVER_OBJECT_MIGRATE_READY);
+    dg->add_doid(obj->m_do_id);
+    dg->add_uint32(migration_id);
+    route_datagram(dg);
+}
+
+void StateServer::handle_migrate_failed(DatagramIterator &dgi)
+{
+    doid_t do_id = dgi.read_doid();
+    uint32_t migration_id = dgi.read_uint32();
+    auto it = m_objs.find(do_id);
+    if(it != m_objs.end()) {
+        it->second->abort_migration(migration_id);
+    }
+}
+
+DistributedObject* StateServer::restore_object(DatagramIterator &dgi, bool announce)
+{
+    doid_t do_id = dgi.read_doid();
+    doid_t parent_id = dgi.read_doid();
+    zone_t zone_id = dgi.read_zone();
+    uint16_t dc_id = dgi.read_uint16();
+
+    if(m_objs.find(do_id) != m_objs.end()) {
+        m_log->error() << "Received state for already-existing object ID=" << do_id << ".\n";
+        return nullptr;
+    }
+
+    const Class *dclass = g_dcf->get_class_by_id(dc_id);
+    if(!dclass) {
+        m_log->error() << "Received state for unknown dclass with class id '" << dc_id << "'\n";
+        return nullptr;
+    }
+
+    UnorderedFieldValues required;
+    size_t field_count = dclass->get_num_fields();
+    for(size_t i = 0; i < field_count; ++i) {
+        const Field *field = dclass->get_field(i);
+        if(field->has_keyword("required") && !field->as_molecular()) {
+            dgi.unpack_field(field, required[field]);
+        }
+    }
+
+    FieldValues ram;
+    uint16_t ram_count = dgi.read_uint16();
+    for(uint16_t i = 0; i < ram_count; ++i) {
+        uint16_t field_id = dgi.read_uint16();
+        const Field *field = dclass->get_field_by_id(field_id);
+        if(!field) {
+            m_log->error() << "Received state for " << dclass->get_name() << "(" << do_id
+                           << ") with unknown field " << field_id << ".\n";
+            return nullptr;
+        }
+        dgi.unpack_field(field, ram[field]);
+    }
+
+    channel_t ai_channel = dgi.read_channel();
+    bool ai_explicitly_set = dgi.read_bool();
+    channel_t owner_channel = dgi.read_channel();
+
+    DistributedObject *obj;
+    if(announce) {
+        obj = new DistributedObject(this, m_control_channel, do_id, parent_id, zone_id,
+                                    dclass, required, ram);
+        obj->m_ai_explicitly_set = ai_explicitly_set;
+        if(ai_channel) {
+            obj->m_ai_channel = ai_channel;
+            obj->send_ai_entry(ai_channel);
+        }
+        if(owner_channel) {
+            obj->m_owner_channel = owner_channel;
+            obj->send_owner_entry(owner_channel);
+        }
+    } else {
+        obj = new DistributedObject(this, do_id, parent_id, zone_id, dclass, required, ram,
+                                    ai_channel, ai_explicitly_set, owner_channel);
+    }
+    m_objs[do_id] = obj;
+
+    return obj;
+}
+
+void StateServer::schedule_snapshot()
+{
+    if(!m_snapshot_interval) {
+        return;
+    }
+
+    m_snapshot_timer->expires_from_now(boost::posix_time::seconds(m_snapshot_interval));
+    m_snapshot_timer->async_wait([this](const boost::system::error_code &ec) {
+        if(ec) {
+            return;
+        }
+
+        request_snapshot(false);
+        schedule_snapshot();
+    });
+}
+
+void StateServer::request_snapshot(bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_snapshot_lock);
+    unsigned int expected = m_snapshots_saved + 1;
+    lock.unlock();
+
+    // The objects are only safe to read from the routing thread, so rather than
+    // saving the snapshot here the request is routed back to ourselves.
+    DatagramPtr dg = Datagram::create(m_control_channel, m_control_channel, STATESERVER_SAVE_SNAPSHOT);
+    MessageDirector::singleton.route_datagram(nullptr, dg);
+
+    if(wait) {
+        lock.lock();
+        bool saved = m_snapshot_cv.wait_for(lock, std::chrono::seconds(60), [&]() {
+            return m_snapshots_saved >= expected;
+        });
+        if(!saved) {
+            m_log->error() << "Timed out waiting for snapshot to be saved.\n";
+        }
+    }
+}
+
+void StateServer::save_snapshot()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Write to a temporary file first, so a crash while saving can't clobber the last snapshot
+    std::string temp_file = m_snapshot_file + ".tmp";
+    std::ofstream out(temp_file, std::ios::binary | std::ios::trunc);
+    if(!out) {
+        m_log->error() << "Could not open snapshot file '" << temp_file << "' for writing.\n";
+        return;
+    }
+
+    DatagramPtr header = Datagram::create();
+    header->add_data((const uint8_t*)SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->add_uint32(SNAPSHOT_VERSION);
+    header->add_uint32(g_dcf->get_hash());
+    header->add_uint64(0); // object count, filled in once all objects are written
+    out.write((const char*)header->get_data(), header->size());
+
+    uint64_t count = 0;
+    for(auto it = m_objs.begin(); it != m_objs.end(); ++it) {
+        DistributedObject *obj = it->second;
+        DatagramPtr record = Datagram::create();
+        try {
+            obj->append_state(record);
+        } catch(const DatagramOverflow&) {
+            m_log->error() << "Object " << obj->m_do_id << " is too large to be snapshotted.\n";
+            continue;
+        }
+
+        uint32_t length = record->size();
+        length = swap_le(length);
+        out.write((const char*)&length, sizeof(length));
+        out.write((const char*)record->get_data(), record->size());
+        ++count;
+    }
+
+    uint64_t le_count = swap_le(count);
+    out.seekp(SNAPSHOT_HEADER_SIZE - sizeof(le_count));
+    out.write((const char*)&le_count, sizeof(le_count));
+    out.close();
+    if(!out) {
+        m_log->error() << "Failed writing snapshot file '" << temp_file << "'.\n";
+        return;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(temp_file, m_snapshot_file, ec);
+    if(ec) {
+        m_log->error() << "Could not replace snapshot file '" << m_snapshot_file
+                       << "': " << ec.message() << "\n";
+        return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start);
+    m_log->info() << "Saved snapshot of " << count << " objects in "
+                  << elapsed.count() << "ms.\n";
+}
+
+void StateServer::load_snapshot()
+{
+    using namespace boost::interprocess;
+
+    if(!boost::filesystem::exists(m_snapshot_file)) {
+        m_log->info() << "No snapshot file found, starting empty.\n";
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    file_mapping mapping;
+    mapped_region region;
+    try {
+        mapping = file_mapping(m_snapshot_file.c_str(), read_only);
+        region = mapped_region(mapping, read_only);
+    } catch(const interprocess_exception &e) {
+        m_log->error() << "Could not map snapshot file '" << m_snapshot_file
+                       << "': " << e.what() << "\n";
+        return;
+    }
+
+    const uint8_t *data = (const uint8_t*)region.get_address();
+    size_t size = region.get_size();
+    if(size < SNAPSHOT_HEADER_SIZE || memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))) {
+        m_log->error() << "File '" << m_snapshot_file << "' is not a stateserver snapshot.\n";
+        return;
+    }
+
+    DatagramIterator header(Datagram::create(data, SNAPSHOT_HEADER_SIZE), sizeof(SNAPSHOT_MAGIC));
+    uint32_t version = header.read_uint32();
+    uint32_t dc_hash = header.read_uint32();
+    uint64_t count = header.read_uint64();
+    if(version != SNAPSHOT_VERSION) {
+        m_log->error() << "Snapshot has unsupported version " << version << ".\n";
+        return;
+    }
+    if(dc_hash != g_dcf->get_hash()) {
+        m_log->error() << "Snapshot was saved with a different DC file, not restoring it.\n";
+        return;
+    }
+
+    uint64_t restored = 0;
+    size_t offset = SNAPSHOT_HEADER_SIZE;
+    for(uint64_t n = 0; n < count; ++n) {
+        uint32_t length;
+        if(offset + sizeof(length) > size) {
+            break;
+        }
+        memcpy(&length, data + offset, sizeof(length));
+        length = swap_le(length);
+        offset += sizeof(length);
+        if(offset + length > size || length > DGSIZE_MAX) {
+            break;
+        }
+
+        DatagramIterator dgi(Datagram::create(data + offset, length));
+        offset += length;
+        try {
+            if(restore_object(dgi, true)) {
+                ++restored;
+            }
+        } catch(const DatagramIteratorEOF&) {
+            m_log->error() << "Skipping truncated snapshot record.\n";
+        }
+    }
+
+    if(restored != count) {
+        m_log->warning() << "Restored only " << restored << " of the " << count
+                         << " objects in the snapshot.\n";
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start);
+    m_log->info() << "Restored " << restored << " objects from snapshot in "
+                  << elapsed.count() << "ms.\n";
+}
+
 void StateServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
 {
     channel_t sender = dgi.read_channel();
@@ -99,6 +457,27 @@ void StateServer::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         handle_delete_ai(dgi, sender);
         break;
     }
+    case STATESERVER_OBJECT_MIGRATE_STATE: {
+        handle_migrate_state(dgi, sender);
+        break;
+    }
+    case STATESERVER_OBJECT_MIGRATE_FAILED: {
+        handle_migrate_failed(dgi);
+        break;
+    }
+    case STATESERVER_SAVE_SNAPSHOT: {
+        if(m_snapshot_file.empty()) {
+            m_log->warning() << "Received save snapshot, but snapshots aren't configured.\n";
+            break;
+        }
+
+        save_snapshot();
+
+        std::lock_guard<std::mutex> lock(m_snapshot_lock);
+        ++m_snapshots_saved;
+        m_snapshot_cv.notify_all();
+        break;
+    }
     default:
         m_log->warning() << "Received unknown message: msgtype=" << msgtype << std::endl;
     }
@@ -1,5 +1,8 @@
 #pragma once
 #include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
 #include "core/Role.h"
 #include "core/RoleFactory.h"
 
@@ -16,10 +19,47 @@ class StateServer : public Role
     virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
 
   protected:
-    LogCategory *m_log;
+    LogCategory *m_log = nullptr; // deleted by ~StateServer, including a subclass's
     std::unordered_map<doid_t, DistributedObject*> m_objs;
+    // m_objs_by_location indexes the objects on this stateserver by their location channel,
+    // so a parent can find its local children without relaying through the MessageDirector.
+    std::unordered_map<channel_t, std::unordered_set<DistributedObject*>> m_objs_by_location;
+
+    // remove_from_location removes an object from the location index.
+    void remove_from_location(DistributedObject *obj, channel_t location);
+    // object_deleted is called just before one of the stateserver's objects is removed from ram.
+    virtual void object_deleted(DistributedObject*) {}
 
   private:
+    channel_t m_control_channel = INVALID_CHANNEL;
+    // m_migration_timeout is how many seconds an outgoing migration may wait for the target
+    unsigned int m_migration_timeout = 0;
+
+    // Snapshot state, m_snapshot_file is empty if snapshots are disabled
+    std::string m_snapshot_file;
+    unsigned int m_snapshot_interval = 0;
+    boost::asio::deadline_timer *m_snapshot_timer = nullptr;
+    std::mutex m_snapshot_lock;
+    std::condition_variable m_snapshot_cv;
+    unsigned int m_snapshots_saved = 0;
+
     void handle_generate(DatagramIterator &dgi, bool has_other);
     void handle_delete_ai(DatagramIterator &dgi, channel_t sender);
+    void handle_migrate_state(DatagramIterator &dgi, channel_t sender);
+    void handle_migrate_failed(DatagramIterator &dgi);
+
+    // restore_object recreates an object from the state written by DistributedObject::append_state.
+    // If announce is set, the object announces itself as though it had just been generated.
+    // Returns nullptr if the state doesn't describe a valid object.
+    DistributedObject* restore_object(DatagramIterator &dgi, bool announce);
+
+    // schedule_snapshot starts the timer for the next periodic snapshot.
+    void schedule_snapshot();
+    // request_snapshot asks the routing thread to save a snapshot, optionally
+    // blocking until it has been written.
+    void request_snapshot(bool wait);
+    // save_snapshot writes all of the stateserver's objects to the snapshot file.
+    void save_snapshot();
+    // load_snapshot recreates the objects from the snapshot file, if there is one.
+    void load_snapshot();
 };
@@ -378,6 +378,12 @@ class DatagramIterator
         return msg_type;
     }
 
+    // get_datagram returns the datagram being iterated over.
+    DatagramHandle get_datagram() const
+    {
+        return m_dg;
+    }
+
     // tell returns the current message offset in std::vector<uint8_t>
     dgsize_t tell() const
     {
@@ -0,0 +1,180 @@
+#!/usr/bin/env python2
+# Measures what each client costs a ClientAgent: the memory of a connected client and of its
+# objects, and the CPU time spent delivering an update to it.  Every client owns the same
+# objects, some of which are then deleted so that they stay on as historical objects; each
+# visible object is then updated, with every update sent to all of the clients at once.
+# Like the tests, it expects to be run from the directory containing astrond:
+#     python2 ../test/benchmark_clientagent.py [clients] [objects] [historical] [updates]
+# A process can only have as many clients as it has file descriptors, so check ulimit -n.
+# The memory is astrond's resident set, so it includes the allocator's overhead.
+import sys, os, time, struct, select, socket
+from common.unittests import ProtocolTest
+from common.astron import *
+from common.astron import DATATYPES
+from common.dcfile import *
+
+CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: clientagent
+      bind: 127.0.0.1:57128
+      version: "Sword Art Online v5.1"
+      channels:
+          min: 1000000
+          max: 1999999
+"""
+VERSION = 'Sword Art Online v5.1'
+FIRST_CHANNEL = 1000000
+FIRST_DOID = 50000000
+
+def frame(dg):
+    data = dg.get_data()
+    return struct.pack(DATATYPES['size'], len(data)) + data
+
+def rss_kb(pid):
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmRSS:'):
+                return int(line.split()[1])
+
+def cpu_seconds(pid):
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+class Clients(object):
+    def __init__(self):
+        self.socks = {}
+        self.poll = select.epoll()
+        self.received = 0
+
+    def connect(self, count):
+        hello = Datagram()
+        hello.add_uint16(CLIENT_HELLO)
+        hello.add_uint32(DC_HASH)
+        hello.add_string(VERSION)
+        for i in xrange(count):
+            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            s.connect(('127.0.0.1', 57128))
+            s.sendall(frame(hello))
+            s.setblocking(0)
+            self.socks[s.fileno()] = s
+            self.poll.register(s.fileno(), select.EPOLLIN)
+            if i % 500 == 499:
+                # Let the agent catch up with its accept queue
+                self.drain(0.05)
+
+    def drain(self, quiet):
+        # Reads from every client until nothing has arrived for quiet seconds
+        while True:
+            events = self.poll.poll(quiet)
+            if not events:
+                return
+            for fd, event in events:
+                try:
+                    data = self.socks[fd].recv(65536)
+                except socket.error:
+                    continue
+                if not data:
+                    raise Exception('A client was disconnected.')
+                self.received += len(data)
+
+    def close(self):
+        for s in self.socks.values():
+            s.close()
+
+def send_to_clients(md, clients, make):
+    # A datagram can have at most 255 recipients, so each goes out to the clients in groups
+    data = []
+    for first in xrange(0, clients, 255):
+        channels = range(FIRST_CHANNEL + first, FIRST_CHANNEL + min(first + 255, clients))
+        data.append(frame(make(channels)))
+    md.s.sendall(''.join(data))
+
+def enter_owner(doid):
+    def make(channels):
+        dg = Datagram.create(channels, 5, STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED)
+        dg.add_doid(doid)
+        dg.add_doid(0) # Parent
+        dg.add_zone(0)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(doid) # setRequired1
+        return dg
+    return make
+
+def delete_ram(doid):
+    def make(channels):
+        dg = Datagram.create(channels, 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(doid)
+        return dg
+    return make
+
+def set_field(doid, value):
+    def make(channels):
+        dg = Datagram.create(channels, doid, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setB1)
+        dg.add_uint8(value)
+        return dg
+    return make
+
+def benchmark(clients, objects, historical, updates):
+    daemon = Daemon(CONFIG % test_dc)
+    daemon.start()
+    conns = Clients()
+    try:
+        pid = daemon.daemon.pid
+        md = ProtocolTest.connectToServer()
+        rss_start = rss_kb(pid)
+
+        start = time.time()
+        conns.connect(clients)
+        conns.drain(0.5)
+        connect_time = time.time() - start
+        rss_connected = rss_kb(pid)
+
+        for i in xrange(objects + historical):
+            send_to_clients(md, clients, enter_owner(FIRST_DOID + i))
+            conns.drain(0.01)
+        for i in xrange(objects, objects + historical):
+            send_to_clients(md, clients, delete_ram(FIRST_DOID + i))
+            conns.drain(0.01)
+        conns.drain(0.5)
+        rss_objects = rss_kb(pid)
+
+        cpu_start = cpu_seconds(pid)
+        start = time.time()
+        for u in xrange(updates):
+            for i in xrange(objects):
+                send_to_clients(md, clients, set_field(FIRST_DOID + i, u % 256))
+                conns.drain(0)
+        conns.drain(0.5)
+        update_time = time.time() - start - 0.5
+        cpu = cpu_seconds(pid) - cpu_start
+        deliveries = clients * objects * updates
+
+        md.close()
+        print 'clients:                  %d (connected in %.1f s)' % (clients, connect_time)
+        print 'memory per client:        %.2f KB' % ((rss_connected - rss_start) /
+                                                     float(clients))
+        print 'memory per client object: %.1f bytes (%d visible, %d historical)' % (
+            (rss_objects - rss_connected) * 1024.0 / (clients * (objects + historical)),
+            objects, historical)
+        print 'CPU per update delivered: %.2f us (%d deliveries, %.1f s CPU, %.1f s wall)' % (
+            cpu * 1e6 / deliveries, deliveries, cpu, update_time)
+    finally:
+        conns.close()
+        daemon.stop()
+
+if __name__ == '__main__':
+    clients = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    objects = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+    historical = int(sys.argv[3]) if len(sys.argv) > 3 else 40
+    updates = int(sys.argv[4]) if len(sys.argv) > 4 else 20
+    benchmark(clients, objects, historical, updates)
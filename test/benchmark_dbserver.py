@@ -0,0 +1,139 @@
+#!/usr/bin/env python2
+# Compares the database backends which need no external server, by timing a stream of
+# CreateObjects, a stream of SetField updates to one object, and then a series of GetAll
+# round trips.  Like the tests, it expects to be run from the directory containing astrond:
+#     python2 ../test/benchmark_dbserver.py [writes] [reads] [creates] [backend,...]
+# The SQLite backends are only available when astrond was built with SOCI; they store the
+# database in the temporary directory, at SQLite's default of synchronous=FULL.
+# The times include the trip through the MessageDirector and this script's own overhead,
+# so they are an upper bound on the time spent in the backend itself.
+import sys, time, struct, shutil, tempfile, socket
+from common.unittests import ProtocolTest
+from common.astron import *
+from common.astron import DATATYPES
+from common.dcfile import *
+
+CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: database
+      control: 75757
+      workers: %d
+      generate:
+        min: 1000000
+        max: 9999999
+      backend:
+        %s
+"""
+
+# Each backend is (name, backend config, path within the temporary directory, workers)
+BACKENDS = [
+    ('yaml', 'type: yaml\n        foldername: %r', '', 0),
+    ('yaml-wb', 'type: yaml\n        foldername: %r\n        flush_interval: 100', '', 0),
+    ('binlog', 'type: binlog\n        filename: %r', '/objects.binlog', 0),
+    ('sqlite', 'type: sqlite3\n        database: %r', '/astron.db', 0),
+    ('sqlite-4s', 'type: sqlite3\n        database: %r\n        sessions: 4', '/astron.db', 4),
+    ('sqlite-gc', 'type: sqlite3\n        database: %r\n        sessions: 2\n'
+                  '        group_commit:\n            window: 5', '/astron.db', 4),
+]
+
+def send(conn, dg):
+    # The writes are sent faster than they're handled, so wait for room rather than timing out
+    data = dg.get_data()
+    conn.s.sendall(struct.pack(DATATYPES['size'], len(data)) + data)
+
+def get_all(conn, context, doid):
+    dg = Datagram.create([75757], 40, DBSERVER_OBJECT_GET_ALL)
+    dg.add_uint32(context)
+    dg.add_doid(doid)
+    send(conn, dg)
+    dg = conn.recv()
+    assert DatagramIterator(dg).matches_header([40], 75757, DBSERVER_OBJECT_GET_ALL_RESP)[0]
+
+def create(conn, context):
+    dg = Datagram.create([75757], 40, DBSERVER_CREATE_OBJECT)
+    dg.add_uint32(context)
+    dg.add_uint16(DistributedTestObject3)
+    dg.add_uint16(2) # Field count
+    dg.add_uint16(setRDB3)
+    dg.add_uint32(context)
+    dg.add_uint16(setDb3)
+    dg.add_string('A string stored with the object')
+    send(conn, dg)
+
+def created(conn):
+    dgi = DatagramIterator(conn.recv())
+    dgi.seek(1 + CHANNEL_SIZE_BYTES * 2 + 2 + 4)
+    doid = dgi.read_doid()
+    assert doid, 'An object could not be created.'
+    return doid
+
+def benchmark(name, backend, path, workers, writes, reads, creates):
+    tempdir = tempfile.mkdtemp(prefix = 'astron-', suffix = '.bench')
+    daemon = Daemon(CONFIG % (test_dc, workers, backend % (tempdir + path)))
+    daemon.start()
+    try:
+        try:
+            conn = ProtocolTest.connectToServer()
+        except socket.error:
+            print '%-9s not available in this build' % name
+            return
+        conn.s.settimeout(60.0)
+        send(conn, Datagram.create_add_channel(40))
+
+        # Creates: sent all at once, then every response is awaited
+        start = time.time()
+        for i in xrange(creates):
+            create(conn, i)
+        for i in xrange(creates):
+            created(conn)
+        create_time = time.time() - start
+
+        create(conn, 0)
+        doid = created(conn)
+
+        # Writes: the operations on an object run in order, so once a GetAll of the object
+        # has been answered, all of the updates before it have been written.
+        start = time.time()
+        for i in xrange(writes):
+            dg = Datagram.create([75757], 40, DBSERVER_OBJECT_SET_FIELD)
+            dg.add_doid(doid)
+            dg.add_uint16(setRDB3)
+            dg.add_uint32(i)
+            send(conn, dg)
+        get_all(conn, 1, doid)
+        write_time = time.time() - start
+
+        # Reads: one GetAll at a time
+        latencies = []
+        for i in xrange(reads):
+            start = time.time()
+            get_all(conn, i, doid)
+            latencies.append(time.time() - start)
+        latencies.sort()
+
+        conn.close()
+        print '%-9s %12.0f %12.0f %14.3f %14.3f' % (name, creates / create_time,
+                                                    writes / write_time,
+                                                    latencies[len(latencies) // 2] * 1000,
+                                                    latencies[len(latencies) * 99 // 100] * 1000)
+    finally:
+        daemon.stop()
+        shutil.rmtree(tempdir, ignore_errors = True)
+
+if __name__ == '__main__':
+    writes = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    reads = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+    creates = int(sys.argv[3]) if len(sys.argv) > 3 else 5000
+    names = sys.argv[4].split(',') if len(sys.argv) > 4 else [b[0] for b in BACKENDS]
+    print '%-9s %12s %12s %14s %14s' % ('backend', 'creates/sec', 'writes/sec',
+                                        'GetAll p50 ms', 'GetAll p99 ms')
+    for name, backend, path, workers in BACKENDS:
+        if name in names:
+            benchmark(name, backend, path, workers, writes, reads, creates)
@@ -88,6 +88,7 @@ CONSTANTS = {
     # State Server control message-type constants
     'STATESERVER_CREATE_OBJECT_WITH_REQUIRED':          2000,
     'STATESERVER_CREATE_OBJECT_WITH_REQUIRED_OTHER':    2001,
+    'STATESERVER_SAVE_SNAPSHOT':                        2005,
     'STATESERVER_DELETE_AI_OBJECTS':                    2009,
     # State Server object message-type constants
     'STATESERVER_OBJECT_GET_FIELD':         2010,
@@ -122,6 +123,13 @@ CONSTANTS = {
     'STATESERVER_OBJECT_GET_OWNER_RESP':                        2065,
     'STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED':          2066,
     'STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER':    2067,
+    'STATESERVER_OBJECT_ENTER_INTEREST_BULK':                   2068,
+    'STATESERVER_OBJECT_MIGRATE':                               2070,
+    'STATESERVER_OBJECT_MIGRATE_STATE':                         2071,
+    'STATESERVER_OBJECT_MIGRATE_READY':                         2072,
+    'STATESERVER_OBJECT_MIGRATE_REPLAY':                        2073,
+    'STATESERVER_OBJECT_MIGRATE_DONE':                          2074,
+    'STATESERVER_OBJECT_MIGRATE_FAILED':                        2075,
     # State Server parent methods message-type constants
     'STATESERVER_OBJECT_GET_ZONE_OBJECTS':      2100,
     'STATESERVER_OBJECT_GET_ZONES_OBJECTS':     2102,
@@ -140,6 +148,7 @@ CONSTANTS = {
     # DBSS object message-type constants
     'DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS':        2200,
     'DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS_OTHER':  2201,
+    'DBSS_OBJECT_ACTIVATE_MANY':                 2202,
     'DBSS_OBJECT_GET_ACTIVATED':                 2207,
     'DBSS_OBJECT_GET_ACTIVATED_RESP':            2208,
     'DBSS_OBJECT_DELETE_FIELD_DISK':             2230,
@@ -157,6 +166,9 @@ CONSTANTS = {
     'DBSERVER_OBJECT_GET_FIELDS_RESP':              3013,
     'DBSERVER_OBJECT_GET_ALL':                      3014,
     'DBSERVER_OBJECT_GET_ALL_RESP':                 3015,
+    'DBSERVER_OBJECT_GET_ALL_MULTI':                3016,
+    'DBSERVER_OBJECT_GET_ALL_MULTI_RESP':           3017,
+    'DBSERVER_OBJECT_SET_FIELDS_MULTI':             3018,
     'DBSERVER_OBJECT_SET_FIELD':                    3020,
     'DBSERVER_OBJECT_SET_FIELDS':                   3021,
     'DBSERVER_OBJECT_SET_FIELD_IF_EQUALS':          3022,
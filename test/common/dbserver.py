@@ -166,6 +166,147 @@ class DBServerTestsuite(object):
             self.deleteObject(20, doid)
         self.conn.send(Datagram.create_remove_channel(20))
 
+    def test_get_all_multi(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(22))
+
+        # Create a couple of objects to load
+        doid1 = self.createTypeGetId(22, 1, DistributedTestObject5)
+        dg = Datagram.create([75757], 22, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(2) # Context
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1337)
+        self.conn.send(dg)
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        dgi.seek(CREATE_DOID_OFFSET)
+        doid2 = dgi.read_doid()
+
+        # Load both objects, and one that doesn't exist, in one request
+        dg = Datagram.create([75757], 22, DBSERVER_OBJECT_GET_ALL_MULTI)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(3) # Object count
+        dg.add_doid(doid1)
+        dg.add_doid(78787) # Non-existant ID
+        dg.add_doid(doid2)
+        self.conn.send(dg)
+
+        # All of the objects should be returned in a single response, in order
+        dg = Datagram.create([22], 75757, DBSERVER_OBJECT_GET_ALL_MULTI_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(3) # Object count
+        dg.add_doid(doid1)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDbD5)
+        dg.add_uint8(setRDbD5DefaultValue)
+        dg.add_doid(78787)
+        dg.add_uint8(FAILURE)
+        dg.add_doid(doid2)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1337)
+        self.expect(self.conn, dg)
+
+        # An empty request should still be answered
+        dg = Datagram.create([75757], 22, DBSERVER_OBJECT_GET_ALL_MULTI)
+        dg.add_uint32(4) # Context
+        dg.add_uint16(0) # Object count
+        self.conn.send(dg)
+
+        dg = Datagram.create([22], 75757, DBSERVER_OBJECT_GET_ALL_MULTI_RESP)
+        dg.add_uint32(4) # Context
+        dg.add_uint16(0) # Object count
+        self.expect(self.conn, dg)
+
+        # Cleanup
+        self.deleteObject(22, doid1)
+        self.deleteObject(22, doid2)
+        self.conn.send(Datagram.create_remove_channel(22))
+
+    def test_set_fields_multi(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(23))
+
+        doid1 = self.createTypeGetId(23, 1, DistributedTestObject3)
+        doid2 = self.createTypeGetId(23, 2, DistributedTestObject3)
+
+        # Update both objects in one message, the first of them twice
+        dg = Datagram.create([75757], 23, DBSERVER_OBJECT_SET_FIELDS_MULTI)
+        dg.add_uint16(3) # Object count
+        dg.add_doid(doid1)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(10)
+        dg.add_doid(doid2)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(20)
+        dg.add_doid(doid1)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setDb3)
+        dg.add_string("Set after the first update")
+        self.conn.send(dg)
+
+        # Each update is broadcast separately
+        expected = []
+        dg = Datagram.create([DATABASE_PREFIX|doid1], 23, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(10)
+        expected.append(dg)
+        dg = Datagram.create([DATABASE_PREFIX|doid2], 23, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid2)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(20)
+        expected.append(dg)
+        dg = Datagram.create([DATABASE_PREFIX|doid1], 23, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid1)
+        dg.add_uint16(setDb3)
+        dg.add_string("Set after the first update")
+        expected.append(dg)
+        self.expectMany(self.objects, expected)
+
+        # Both objects should have all of their updates
+        dg = Datagram.create([75757], 23, DBSERVER_OBJECT_GET_ALL_MULTI)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(2) # Object count
+        dg.add_doid(doid1)
+        dg.add_doid(doid2)
+        self.conn.send(dg)
+
+        dg = Datagram.create([23], 75757, DBSERVER_OBJECT_GET_ALL_MULTI_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(2) # Object count
+        dg.add_doid(doid1)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(2) # Field count
+        dg.add_uint16(setDb3)
+        dg.add_string("Set after the first update")
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(10)
+        dg.add_doid(doid2)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(20)
+        self.expect(self.conn, dg)
+
+        # Cleanup
+        self.deleteObject(23, doid1)
+        self.deleteObject(23, doid2)
+        self.conn.send(Datagram.create_remove_channel(23))
+
     def test_delete(self):
         self.objects.flush()
         self.conn.flush()
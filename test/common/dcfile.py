@@ -17,6 +17,7 @@ CLASSES = [
     'DistributedClientTestObject',
     'Block',
     'DistributedChunk',
+    'DistributedConflatedObject',
 ]
 for i,n in enumerate(CLASSES):
     locals()[n] = i
@@ -76,7 +77,12 @@ FIELDS = [
     ### Fields for DistributedChunk ###
     'blockList',
     'lastBlock',
-    'newBlock'
+    'newBlock',
+
+    ### Fields for DistributedConflatedObject ###
+    'setPosition',
+    'setHealth',
+    'setChat'
 ]
 for i,n in enumerate(FIELDS):
     locals()[n] = i
@@ -87,6 +93,6 @@ setRDbD5DefaultValue = 20
 
 # If you edit test.dc *AT ALL*, you will have to recalculate this.
 # If you don't know how, ask CFS.
-DC_HASH = 0x7a9b0e3
+DC_HASH = 0xbbfa09a
 
 setRDbD5DefaultValue = 20
@@ -0,0 +1,12 @@
+import tempfile, shutil
+
+def setup_binlog(unittest):
+    unittest.binlog_path = tempfile.mkdtemp(prefix = 'astron-', suffix = '.binlog')
+    unittest.binlog_file = unittest.binlog_path + '/objects.binlog'
+
+def teardown_binlog(unittest):
+    # Remove temp files
+    try:
+        shutil.rmtree(unittest.binlog_path)
+    except:
+        pass
@@ -0,0 +1,12 @@
+import tempfile, shutil
+
+def setup_sqlite(unittest):
+    unittest.sqlite_path = tempfile.mkdtemp(prefix = 'astron-', suffix = '.sqlite')
+    unittest.sqlite_file = unittest.sqlite_path + '/astron.db'
+
+def teardown_sqlite(unittest):
+    # Remove temp files
+    try:
+        shutil.rmtree(unittest.sqlite_path)
+    except:
+        pass
@@ -1,8 +1,9 @@
 #!/usr/bin/env python2
-import unittest, time, ssl
+import unittest, time, ssl, struct, zlib, os
 from socket import socket, AF_INET, SOCK_STREAM
 from common.unittests import ProtocolTest
 from common.astron import *
+from common.astron import DATATYPES
 from common.dcfile import *
 from common.tls import *
 
@@ -34,6 +35,9 @@ roles:
       client:
           relocate: true
           add_interest: enabled
+          compression:
+              type: zlib
+              threshold: 64
 
     - type: clientagent
       bind: 127.0.0.1:57135
@@ -53,6 +57,15 @@ roles:
           min: 220600
           max: 220699
 
+    - type: clientagent
+      bind: 127.0.0.1:57178
+      version: "Sword Art Online v5.1"
+      channels:
+          min: 440600
+          max: 440699
+      client:
+          write_batch: 1024
+
     - type: clientagent
       bind: 127.0.0.1:57214
       version: "Sword Art Online v5.1"
@@ -65,6 +78,32 @@ roles:
 """ % (USE_THREADING, test_dc, server_crt, server_key)
 VERSION = 'Sword Art Online v5.1'
 
+class CompressedConnection(ClientConnection):
+    # A ClientConnection which has negotiated zlib compression: each datagram is preceded by
+    # a flag which is 1 if it was deflated with the connection's stream, or 0 if it was not.
+    def __init__(self, sock):
+        ClientConnection.__init__(self, sock)
+        self.compressor = zlib.compressobj()
+        self.decompressor = zlib.decompressobj()
+        self.frames = [] # (flag, size) of each frame received
+
+    def send(self, datagram, compress=True):
+        data = datagram.get_data()
+        if compress:
+            data = chr(1) + self.compressor.compress(data) + self.compressor.flush(zlib.Z_SYNC_FLUSH)
+        else:
+            data = chr(0) + data
+        self.s.send(struct.pack(DATATYPES['size'], len(data)) + data)
+
+    def _read(self):
+        frame = ClientConnection._read(self)
+        if frame is None:
+            return None
+        self.frames.append((ord(frame[0]), len(frame)))
+        if frame[0] == chr(1):
+            return self.decompressor.decompress(frame[1:])
+        return frame[1:]
+
 class TestClientAgent(ProtocolTest):
     @classmethod
     def setUpClass(cls):
@@ -322,6 +361,42 @@ class TestClientAgent(ProtocolTest):
         # Client should get booted:
         self.assertDisconnect(client, CLIENT_DISCONNECT_ANONYMOUS_VIOLATION)
 
+    def test_write_batch(self):
+        self.server.flush()
+        # This agent holds back what it writes to a client until it has handled each message,
+        # or 1024 bytes have built up.
+        client = self.connect(port = 57178)
+        id = self.identify(client, min = 440600, max = 440699)
+
+        # Updates sent together, which fill the batch past its size, all arrive in order...
+        updates = ['Update %d: %s' % (i, 'x' * 400) for i in xrange(5)] + ['Short']
+        dgs = []
+        for update in updates:
+            dg = Datagram.create([id], 1, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(1234)
+            dg.add_uint16(response)
+            dg.add_string(update)
+            dgs.append(dg.get_data())
+        self.server.s.send(''.join(struct.pack(DATATYPES['size'], len(d)) + d for d in dgs))
+
+        for update in updates:
+            dg = Datagram()
+            dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+            dg.add_doid(1234)
+            dg.add_uint16(response)
+            dg.add_string(update)
+            self.expect(client, dg, isClient = True)
+        self.expectNone(client)
+
+        # ... and an eject is written out before the client is disconnected.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(response) # Not clsend
+        dg.add_string('Not allowed')
+        client.send(dg)
+        self.assertDisconnect(client, CLIENT_DISCONNECT_FORBIDDEN_FIELD)
+
     def test_receive_update(self):
         self.server.flush()
         client = self.connect()
@@ -363,7 +438,26 @@ class TestClientAgent(ProtocolTest):
         dg.add_uint16(8118)
         self.expect(client, dg, isClient = True)
 
+        # Each client sent the same update should receive it, and the next one, intact
+        client2 = self.connect()
+        id2 = self.identify(client2)
+        for text in ('Once more...', 'And again!'):
+            dg = Datagram.create([id, id2], 1, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(1234)
+            dg.add_uint16(response)
+            dg.add_string(text)
+            self.server.send(dg)
+
+            dg = Datagram()
+            dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+            dg.add_doid(1234)
+            dg.add_uint16(response)
+            dg.add_string(text)
+            self.expect(client, dg, isClient = True)
+            self.expect(client2, dg, isClient = True)
+
         client.close()
+        client2.close()
 
     def test_set_sender(self):
         self.server.flush()
@@ -697,6 +791,95 @@ class TestClientAgent(ProtocolTest):
         self.expect(client, raw_dg, isClient = True)
         client.close()
 
+    def test_compression(self):
+        self.server.flush()
+
+        # A client which doesn't support zlib isn't given it...
+        client = self.connect(False)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(0)
+        client.send(dg)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO_RESP)
+        dg.add_uint8(0) # None
+        self.expect(client, dg, isClient = True)
+        client.close()
+
+        # ...but one which does is answered with an uncompressed CLIENT_HELLO_RESP.
+        client = self.connect(False)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO)
+        dg.add_uint32(DC_HASH)
+        dg.add_string(VERSION)
+        dg.add_uint8(1 << 1)
+        client.send(dg)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_HELLO_RESP)
+        dg.add_uint8(1) # zlib
+        self.expect(client, dg, isClient = True)
+        client = CompressedConnection(client.s)
+
+        # Compressed and uncompressed messages from the client are both understood.
+        id = self.identify(client)
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(request)
+        dg.add_string('Not compressed')
+        client.send(dg, compress=False)
+        dg = Datagram.create([1234], id, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(request)
+        dg.add_string('Not compressed')
+        self.expect(self.server, dg)
+
+        # Datagrams below the threshold aren't compressed...
+        small_dg = Datagram()
+        small_dg.add_uint16(5555)
+        small_dg.add_channel(152379565)
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(small_dg.get_data())
+        self.server.send(dg)
+        self.expect(client, small_dg, isClient = True)
+        self.assertEqual(client.frames[-1], (0, len(small_dg.get_data()) + 1))
+
+        # ...while larger ones are, using what the stream has already seen.
+        large_dg = Datagram()
+        large_dg.add_uint16(5555)
+        large_dg.add_string('Winter is coming. ' * 50)
+        for i in xrange(2):
+            dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+            dg.add_string(large_dg.get_data())
+            self.server.send(dg)
+            self.expect(client, large_dg, isClient = True)
+            self.assertEqual(client.frames[-1][0], 1)
+            self.assertLess(client.frames[-1][1], len(large_dg.get_data()) / 4)
+
+        # A datagram which might not fit once deflated is sent as it is, if it fits with its flag.
+        huge_dg = Datagram()
+        huge_dg.add_uint16(5555)
+        huge_dg.add_string(os.urandom(65500))
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(huge_dg.get_data())
+        self.server.send(dg)
+        self.expect(client, huge_dg, isClient = True)
+        self.assertEqual(client.frames[-1], (0, len(huge_dg.get_data()) + 1))
+
+        # The stream is unaffected by it.
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(large_dg.get_data())
+        self.server.send(dg)
+        self.expect(client, large_dg, isClient = True)
+        self.assertEqual(client.frames[-1][0], 1)
+
+        # A client which sends a corrupt stream is dropped; 0xff starts a block of a reserved type.
+        client.s.send(struct.pack(DATATYPES['size'], 5) + chr(1) + '\xff' * 4)
+        self.assertEqual(client.s.recv(1024), '')
+        client.close()
+
     def test_channel(self):
         self.server.flush()
         client = self.connect()
@@ -1007,6 +1190,201 @@ class TestClientAgent(ProtocolTest):
         # Then we shouldn't expect any more datagrams
         self.expectNone(client)
 
+    def test_interest_bulk(self):
+        # The point of this test is to make sure the ClientAgent accepts the objects
+        # of an interest as entries of a single ENTER_INTEREST_BULK.
+        self.server.flush()
+        client = self.connect()
+        id = self.identify(client)
+
+        # Bring client out of the sandbox
+        self.set_state(client, CLIENT_STATE_ESTABLISHED)
+
+        # Open interest on a zone
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ADD_INTEREST)
+        dg.add_uint32(2200) # Context
+        dg.add_uint16(1200) # Interest id
+        dg.add_doid(1234) # Parent
+        dg.add_zone(4323) # Zone
+        client.send(dg)
+
+        # The CA should've asked for objects in some zones
+        dg = self.server.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1234], id, STATESERVER_OBJECT_GET_ZONES_OBJECTS))
+        ss_context = dgi.read_uint32()
+
+        # There are two objects in the zone
+        dg = Datagram.create([id], 1234, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
+        dg.add_uint32(ss_context)
+        dg.add_doid(2) # Object count
+        self.server.send(dg)
+
+        # Both arrive at once from the parent
+        entry1 = Datagram()
+        entry1.add_uint8(0) # has_other
+        entry1.add_doid(8891) # do_id
+        entry1.add_doid(1234) # parent_id
+        entry1.add_zone(4323) # zone_id
+        entry1.add_uint16(DistributedTestObject1)
+        entry1.add_uint32(999999) # setRequired1
+
+        entry2 = Datagram()
+        entry2.add_uint8(1) # has_other
+        entry2.add_doid(8892) # do_id
+        entry2.add_doid(1234) # parent_id
+        entry2.add_zone(4323) # zone_id
+        entry2.add_uint16(DistributedTestObject1)
+        entry2.add_uint32(888888) # setRequired1
+        entry2.add_uint16(1) # field count
+        entry2.add_uint16(setBR1)
+        entry2.add_string("Wherever you go, there you are.")
+
+        dg = Datagram.create([id], 1234, STATESERVER_OBJECT_ENTER_INTEREST_BULK)
+        dg.add_uint32(ss_context) # request_context
+        dg.add_uint16(2) # entry count
+        dg.add_blob(entry1.get_data())
+        dg.add_blob(entry2.get_data())
+        self.server.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED)
+        dg.add_raw(entry1.get_data()[1:])
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED_OTHER)
+        dg.add_raw(entry2.get_data()[1:])
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(2200) # Context
+        dg.add_uint16(1200) # Interest Id
+        self.expect(client, dg, isClient = True)
+
+        # Then we shouldn't expect any more datagrams
+        self.expectNone(client)
+
+    def test_interest_conflate(self):
+        # The point of this test is to make sure that while an interest is pending,
+        # queued updates of a conflated field are replaced by the latest value.
+        self.server.flush()
+        client = self.connect()
+        id = self.identify(client)
+
+        # Bring client out of the sandbox
+        self.set_state(client, CLIENT_STATE_ESTABLISHED)
+
+        # Open interest on a zone
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ADD_INTEREST)
+        dg.add_uint32(2100) # Context
+        dg.add_uint16(1100) # Interest id
+        dg.add_doid(1234) # Parent
+        dg.add_zone(4322) # Zone
+        client.send(dg)
+
+        # The CA should've asked for objects in some zones
+        dg = self.server.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1234], id, STATESERVER_OBJECT_GET_ZONES_OBJECTS))
+        ss_context = dgi.read_uint32()
+
+        # There are two objects in the zone
+        dg = Datagram.create([id], 1234, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
+        dg.add_uint32(ss_context)
+        dg.add_doid(2) # Object count
+        self.server.send(dg)
+
+        # The first object arrives...
+        dg = Datagram.create([id], 1, STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED)
+        dg.add_uint32(ss_context) # request_context
+        dg.add_doid(8889) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4322) # zone_id
+        dg.add_uint16(DistributedConflatedObject)
+        dg.add_int16(1) # setPosition.x
+        dg.add_int16(2) # setPosition.y
+        self.server.send(dg)
+
+        # ... and gets several updates before the interest has finished.
+        def set_field(field, *values):
+            dg = Datagram.create([id], 1, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(8889)
+            dg.add_uint16(field)
+            for adder, value in values:
+                getattr(dg, adder)(value)
+            self.server.send(dg)
+        set_field(setHealth, ('add_uint16', 100))
+        set_field(setChat, ('add_string', 'Ouch!'))
+        set_field(setHealth, ('add_uint16', 90))
+        set_field(setPosition, ('add_int16', 5), ('add_int16', 6))
+        set_field(setHealth, ('add_uint16', 80))
+
+        # Then the second object arrives, which finishes the interest
+        dg = Datagram.create([id], 1, STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED)
+        dg.add_uint32(ss_context) # request_context
+        dg.add_doid(8890) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4322) # zone_id
+        dg.add_uint16(DistributedTestObject2)
+        self.server.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED)
+        dg.add_doid(8889) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4322) # zone_id
+        dg.add_uint16(DistributedConflatedObject)
+        dg.add_int16(1) # setPosition.x
+        dg.add_int16(2) # setPosition.y
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED)
+        dg.add_doid(8890) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4322) # zone_id
+        dg.add_uint16(DistributedTestObject2)
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(2100) # Context
+        dg.add_uint16(1100) # Interest Id
+        self.expect(client, dg, isClient = True)
+
+        # Only the latest value of each conflated field should be sent,
+        # while the unconflated field is delivered as usual.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(8889)
+        dg.add_uint16(setChat)
+        dg.add_string('Ouch!')
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(8889)
+        dg.add_uint16(setPosition)
+        dg.add_int16(5)
+        dg.add_int16(6)
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(8889)
+        dg.add_uint16(setHealth)
+        dg.add_uint16(80)
+        self.expect(client, dg, isClient = True)
+
+        # Then we shouldn't expect any more datagrams
+        self.expectNone(client)
+
     def test_interest_overcounting(self):
         # The point of this test is to make sure the client agent handles objects
         # entering the zone in which interest is opened upon before the
@@ -1801,6 +2179,265 @@ class TestClientAgent(ProtocolTest):
         client2.close()
         client3.close()
 
+    def test_interest_other_parent(self):
+        self.server.flush()
+        client = self.connect()
+        id = self.identify(client)
+        self.set_state(client, CLIENT_STATE_ESTABLISHED)
+
+        # Open interest on zone 4444 of 1234:
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ADD_INTEREST)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(1) # Interest id
+        dg.add_doid(1234) # Parent
+        dg.add_zone(4444) # Zone
+        client.send(dg)
+
+        dg = self.server.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1234], id, STATESERVER_OBJECT_GET_ZONES_OBJECTS))
+        context = dgi.read_uint32()
+
+        dg = Datagram.create([id], 1234, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
+        dg.add_uint32(context)
+        dg.add_doid(1) # Object count
+        self.server.send(dg)
+
+        dg = Datagram.create([id], 1, STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED)
+        dg.add_uint32(context) # request_context
+        dg.add_doid(8888) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4444) # zone_id
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(999999) # setRequired1
+        self.server.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED)
+        dg.add_doid(8888) # do_id
+        dg.add_doid(1234) # parent_id
+        dg.add_zone(4444) # zone_id
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(999999) # setRequired1
+        self.expect(client, dg, isClient = True)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(1) # Interest Id
+        self.expect(client, dg, isClient = True)
+
+        # Moving the object to the same zone of another parent takes it out of interest...
+        dg = Datagram.create([(1234<<ZONE_SIZE_BITS)|4444], 1, STATESERVER_OBJECT_CHANGING_LOCATION)
+        dg.add_doid(8888) # do_id
+        dg.add_doid(5678) # new_parent
+        dg.add_zone(4444) # new_zone
+        dg.add_doid(1234) # old_parent
+        dg.add_zone(4444) # old_zone
+        self.server.send(dg)
+
+        # ... so the client should have the object disabled.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_LEAVING)
+        dg.add_doid(8888)
+        self.expect(client, dg, isClient = True)
+
+        # Cleanup
+        dg = Datagram()
+        dg.add_uint16(CLIENT_REMOVE_INTEREST)
+        dg.add_uint32(4) # Context
+        dg.add_uint16(1) # Interest id
+        client.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(4) # Context
+        dg.add_uint16(1) # Interest id
+        self.expect(client, dg, isClient = True)
+        self.expectNone(client)
+
+        self.server.flush()
+        client.close()
+
+    def add_empty_interest(self, client, id, context, interest_id, parent, zone):
+        # Opens an interest on a zone which the server reports to be empty.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_ADD_INTEREST)
+        dg.add_uint32(context)
+        dg.add_uint16(interest_id)
+        dg.add_doid(parent)
+        dg.add_zone(zone)
+        client.send(dg)
+
+        dg = self.server.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([parent], id, STATESERVER_OBJECT_GET_ZONES_OBJECTS))
+        request_context = dgi.read_uint32()
+
+        dg = Datagram.create([id], parent, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
+        dg.add_uint32(request_context)
+        dg.add_doid(0) # Object count
+        self.server.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(context)
+        dg.add_uint16(interest_id)
+        self.expect(client, dg, isClient = True)
+
+    def test_interest_shared_location(self):
+        self.server.flush()
+        client1 = self.connect()
+        id1 = self.identify(client1)
+        self.set_state(client1, CLIENT_STATE_ESTABLISHED)
+        client2 = self.connect()
+        id2 = self.identify(client2)
+        self.set_state(client2, CLIENT_STATE_ESTABLISHED)
+
+        # Both clients open interest on zone 6161 of 1235:
+        location = (1235<<ZONE_SIZE_BITS)|6161
+        self.add_empty_interest(client1, id1, 1, 1, 1235, 6161)
+        self.add_empty_interest(client2, id2, 2, 1, 1235, 6161)
+
+        raw_dg = Datagram()
+        raw_dg.add_uint16(5555)
+        raw_dg.add_channel(location)
+
+        # A datagram to the location reaches each client once...
+        dg = Datagram.create([location], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expect(client1, raw_dg, isClient = True)
+        self.expect(client2, raw_dg, isClient = True)
+        self.expectNone(client1)
+        self.expectNone(client2)
+
+        # ... even when it is also sent to one of the clients directly.
+        dg = Datagram.create([location, id1], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expect(client1, raw_dg, isClient = True)
+        self.expect(client2, raw_dg, isClient = True)
+        self.expectNone(client1)
+        self.expectNone(client2)
+
+        # When the first client leaves, the location is still subscribed for the second...
+        client1.close()
+        self.server.flush()
+
+        dg = Datagram.create([location], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expect(client2, raw_dg, isClient = True)
+        self.expectNone(client2)
+
+        # ... until it removes its interest too.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_REMOVE_INTEREST)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(1) # Interest id
+        client2.send(dg)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(1) # Interest id
+        self.expect(client2, dg, isClient = True)
+
+        dg = Datagram.create([location], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expectNone(client2)
+
+        self.server.flush()
+        client2.close()
+
+    def test_interest_location_sender(self):
+        self.server.flush()
+        client1 = self.connect()
+        id1 = self.identify(client1)
+        self.set_state(client1, CLIENT_STATE_ESTABLISHED)
+        client2 = self.connect()
+        id2 = self.identify(client2)
+        self.set_state(client2, CLIENT_STATE_ESTABLISHED)
+
+        # Both clients open interest on zone 1234 of 0, whose location channel is
+        # also the channel of the UberDog1 with id 1234, which is in that zone:
+        for client, id, context in ((client1, id1, 1), (client2, id2, 2)):
+            dg = Datagram()
+            dg.add_uint16(CLIENT_ADD_INTEREST)
+            dg.add_uint32(context)
+            dg.add_uint16(1) # Interest id
+            dg.add_doid(0) # Parent
+            dg.add_zone(1234) # Zone
+            self.server.send(Datagram.create_add_channel(0))
+            client.send(dg)
+
+            dg = self.server.recv_maybe()
+            self.assertTrue(dg is not None)
+            dgi = DatagramIterator(dg)
+            self.assertTrue(*dgi.matches_header([0], id, STATESERVER_OBJECT_GET_ZONES_OBJECTS))
+            request_context = dgi.read_uint32()
+            self.server.send(Datagram.create_remove_channel(0))
+
+            dg = Datagram.create([id], 0, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
+            dg.add_uint32(request_context)
+            dg.add_doid(1) # Object count
+            self.server.send(dg)
+
+            dg = Datagram.create([id], 1, STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED)
+            dg.add_uint32(request_context)
+            dg.add_doid(1234) # do_id
+            dg.add_doid(0) # parent_id
+            dg.add_zone(1234) # zone_id
+            dg.add_uint16(UberDog1)
+            self.server.send(dg)
+
+            dg = Datagram()
+            dg.add_uint16(CLIENT_ENTER_OBJECT_REQUIRED)
+            dg.add_doid(1234) # do_id
+            dg.add_doid(0) # parent_id
+            dg.add_zone(1234) # zone_id
+            dg.add_uint16(UberDog1)
+            self.expect(client, dg, isClient = True)
+
+            dg = Datagram()
+            dg.add_uint16(CLIENT_DONE_INTEREST_RESP)
+            dg.add_uint32(context)
+            dg.add_uint16(1) # Interest id
+            self.expect(client, dg, isClient = True)
+
+        # The first client sends an update to the UberDog, and so to its own location...
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(request)
+        dg.add_string('The sender must not hear this.')
+        client1.send(dg)
+
+        dg = Datagram.create([1234], id1, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(request)
+        dg.add_string('The sender must not hear this.')
+        self.expect(self.server, dg)
+
+        # ... which the other client sees, but which isn't echoed back to the sender.
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(1234)
+        dg.add_uint16(request)
+        dg.add_string('The sender must not hear this.')
+        self.expect(client2, dg, isClient = True)
+        self.expectNone(client1)
+        self.expectNone(client2)
+
+        self.server.flush()
+        client1.close()
+        client2.close()
+
     def test_delete(self):
         self.server.flush()
         client = self.connect()
@@ -32,6 +32,9 @@ class TestConfigClientAgent(ConfigTest):
                   client:
                       relocate: true
                       add_interest: enabled
+                      compression:
+                          type: zlib
+                          threshold: 256
 
                 - type: clientagent
                   bind: 127.0.0.1:57135
@@ -146,6 +149,24 @@ class TestConfigClientAgent(ConfigTest):
             """
         self.assertEquals(self.checkConfig(config), 'Invalid')
 
+    def test_ca_compression_type(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+
+            roles:
+                - type: clientagent
+                  bind: 127.0.0.1:57128
+                  version: "Sword Art Online v5.1"
+                  client:
+                      compression:
+                          type: zstd
+                  channels:
+                      min: 3100
+                      max: 3999
+            """
+        self.assertEquals(self.checkConfig(config), 'Invalid')
+
     def test_ca_bind_address(self):
         config = """\
             messagedirector:
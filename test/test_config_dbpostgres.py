@@ -37,6 +37,7 @@ class TestConfigDBPostgres(ConfigTest):
                     port: 57023
                     username: astron
                     database: astron
+                    sessions: 4
             """ % test_dc
         self.assertEquals(self.checkConfig(config), 'Valid')
 
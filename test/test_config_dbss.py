@@ -115,5 +115,47 @@ class TestConfigDBSS(ConfigTest):
             """
         self.assertEquals(self.checkConfig(config), 'Invalid')
 
+    def test_dbss_cache(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+
+            general:
+                dc_files:
+                    - %r
+
+            roles:
+                - type: dbss
+                  database: 1200
+                  ranges:
+                      - min: 9000
+                        max: 9999
+                  cache:
+                      max_size: 16777216
+                      stats_interval: 60
+                  write_behind:
+                      interval: 5
+            """ % test_dc
+        self.assertEquals(self.checkConfig(config), 'Valid')
+
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+
+            general:
+                dc_files:
+                    - %r
+
+            roles:
+                - type: dbss
+                  database: 1200
+                  ranges:
+                      - min: 9000
+                        max: 9999
+                  cache:
+                      max_entries: 1000
+            """ % test_dc
+        self.assertEquals(self.checkConfig(config), 'Invalid')
+
 if __name__ == '__main__':
     unittest.main()
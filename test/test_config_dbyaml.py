@@ -28,12 +28,17 @@ class TestConfigDBYaml(ConfigTest):
                 - type: database
                   control: 75757
                   broadcast: false
+                  workers: 2
                   generate:
                     min: 1000000
                     max: 1000010
                   backend:
                     type: yaml
                     foldername: %r
+                    flush_interval: 100
+                    lease_size: 64
+                    cache:
+                        max_size: 1048576
             """ % (test_dc, self.yamldb_path)
         self.assertEquals(self.checkConfig(config), 'Valid')
 
@@ -194,5 +199,53 @@ class TestConfigDBYaml(ConfigTest):
             """ % (test_dc, self.yamldb_path)
         self.assertEquals(self.checkConfig(config), 'Invalid')
 
+    def test_yamldb_shards(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+
+            general:
+                dc_files:
+                    - %%r
+
+            roles:
+                - type: database
+                  control: 75757
+                  generate:
+                    min: 1000000
+                    max: 1000010
+                  shards:
+                    - type: yaml
+                      foldername: %%r
+                    - type: %s
+                      foldername: %%r
+            """
+        paths = (test_dc, self.yamldb_path + '/0', self.yamldb_path + '/1')
+        self.assertEquals(self.checkConfig(config % 'yaml' % paths), 'Valid')
+        self.assertEquals(self.checkConfig(config % 'yam' % paths), 'Invalid')
+
+        # Shards can't share a folder, including the default one
+        paths = (test_dc, self.yamldb_path + '/0', self.yamldb_path + '/0')
+        self.assertEquals(self.checkConfig(config % 'yaml' % paths), 'Invalid')
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+
+            general:
+                dc_files:
+                    - %r
+
+            roles:
+                - type: database
+                  control: 75757
+                  generate:
+                    min: 1000000
+                    max: 1000010
+                  shards:
+                    - type: yaml
+                    - type: yaml
+            """ % test_dc
+        self.assertEquals(self.checkConfig(config), 'Invalid')
+
 if __name__ == '__main__':
     unittest.main()
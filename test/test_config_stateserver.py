@@ -50,5 +50,37 @@ class TestConfigStateServer(ConfigTest):
             """
         self.assertEquals(self.checkConfig(config), 'Invalid')
 
+    def test_ss_snapshot_good(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+            general:
+                dc_files:
+                    - %r
+            roles:
+                - type: stateserver
+                  control: 100100
+                  snapshot:
+                      file: "stateserver.snapshot"
+                      interval: 300
+            """ % test_dc
+        self.assertEquals(self.checkConfig(config), 'Valid')
+
+    def test_ss_snapshot_invalid_attr(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+            general:
+                dc_files:
+                    - %r
+            roles:
+                - type: stateserver
+                  control: 100100
+                  snapshot:
+                      file: "stateserver.snapshot"
+                      every: 300
+            """ % test_dc
+        self.assertEquals(self.checkConfig(config), 'Invalid')
+
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,377 @@
+#!/usr/bin/env python2
+import unittest, os, struct
+from common.unittests import ProtocolTest
+from common.dbserver import DBServerTestsuite
+from common.astron import *
+from common.astron import DATATYPES
+from common.dcfile import *
+from database.binlog import setup_binlog, teardown_binlog
+
+CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: database
+      control: 75757
+      broadcast: true
+      workers: %d
+      cache:
+        max_size: %d
+      generate:
+        min: 1000000
+        max: 1000010
+      backend:
+        type: binlog
+        filename: %r
+        compaction:
+            garbage: %d
+            min_size: %d
+"""
+
+class TestDatabaseServerBinlog(ProtocolTest, DBServerTestsuite):
+    WORKERS = 0
+    GARBAGE = 50
+    MIN_SIZE = 16777216
+    CACHE_SIZE = 0
+
+    @classmethod
+    def setUpClass(cls):
+        setup_binlog(cls)
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, cls.WORKERS, cls.CACHE_SIZE,
+                                      cls.binlog_file, cls.GARBAGE, cls.MIN_SIZE))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.objects = cls.connectToServer()
+        cls.objects.send(Datagram.create_add_range(DATABASE_PREFIX|1000000,
+                                                   DATABASE_PREFIX|1000010))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.objects.send(Datagram.create_remove_range(DATABASE_PREFIX|1000000,
+                                                      DATABASE_PREFIX|1000010))
+        cls.objects.close()
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_binlog(cls)
+
+class TestDatabaseServerBinlogWorkers(TestDatabaseServerBinlog):
+    WORKERS = 4
+
+class TestDatabaseServerBinlogCompaction(TestDatabaseServerBinlog):
+    # Compact whenever a tenth of the file is garbage, however small it is
+    WORKERS = 4
+    GARBAGE = 10
+    MIN_SIZE = 0
+
+class TestDatabaseServerBinlogCache(TestDatabaseServerBinlog):
+    WORKERS = 4
+    CACHE_SIZE = 1048576
+
+    def create(self, context, marker):
+        # Creates an object whose first record holds marker, so that it can be found.
+        dg = Datagram.create([75757], 40, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(context)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(marker)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([40], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        return dgi.read_doid()
+
+    def corrupt(self, marker):
+        # Breaks the checksum of the record holding marker, so the backend can't read it.
+        with open(self.binlog_file, 'r+b') as f:
+            data = f.read()
+            offset = data.find(struct.pack('<I', marker))
+            self.assertNotEquals(offset, -1)
+            f.seek(offset)
+            f.write(struct.pack('<I', marker ^ 0xffffffff))
+
+    def get_all(self, context, doid):
+        dg = Datagram.create([75757], 40, DBSERVER_OBJECT_GET_ALL)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        return dg
+
+    def set_rdb3(self, doid, value):
+        dg = Datagram.create([75757], 40, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        return dg
+
+    def send_all(self, dgs):
+        # Sends several datagrams at once, so they're handled one straight after another.
+        self.conn.s.send(''.join(struct.pack(DATATYPES['size'], len(dg.get_data())) +
+                                 dg.get_data() for dg in dgs))
+
+    def delete(self, doid):
+        dg = Datagram.create([75757], 40, DBSERVER_OBJECT_DELETE)
+        dg.add_doid(doid)
+        return dg
+
+    def expect_rdb3(self, context, value):
+        dg = Datagram.create([40], 75757, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        self.expect(self.conn, dg)
+
+    def expect_failure(self, context):
+        dg = Datagram.create([40], 75757, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(FAILURE)
+        self.expect(self.conn, dg)
+
+    def test_cache_hit(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(40))
+
+        # The first GetAll is read from the backend, and caches the object...
+        doid = self.create(1, 0x5ca1ab1e)
+        self.conn.send(self.get_all(2, doid))
+        self.expect_rdb3(2, 0x5ca1ab1e)
+
+        # ... so the next is answered without reading the binlog, which is now unreadable.
+        self.corrupt(0x5ca1ab1e)
+        self.conn.send(self.get_all(3, doid))
+        self.expect_rdb3(3, 0x5ca1ab1e)
+
+        # An update is written through to the cached object...
+        self.conn.send(self.set_rdb3(doid, 1234))
+        self.conn.send(self.get_all(4, doid))
+        self.expect_rdb3(4, 1234)
+
+        # ... and a delete forgets it.
+        self.deleteObject(40, doid)
+        self.conn.send(self.get_all(5, doid))
+        self.expect_failure(5)
+
+        self.objects.flush()
+        self.conn.send(Datagram.create_remove_channel(40))
+
+    def test_cache_outdated_read(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(40))
+
+        # A GetAll followed straight away by an update reads the object as it was before...
+        doid = self.create(1, 0xdecade00)
+        self.send_all([self.get_all(2, doid), self.set_rdb3(doid, 1234), self.get_all(3, doid)])
+        self.expect_rdb3(2, 0xdecade00)
+
+        # ... but the update, once made, is what is read afterwards.
+        self.expect_rdb3(3, 1234)
+        self.conn.send(self.get_all(4, doid))
+        self.expect_rdb3(4, 1234)
+
+        # Likewise, the result of a GetAll made just before a delete doesn't outlive the object.
+        self.send_all([self.get_all(5, doid), self.delete(doid)])
+        self.expect_rdb3(5, 1234)
+        self.conn.send(self.get_all(6, doid))
+        self.expect_failure(6)
+
+        self.objects.flush()
+        self.conn.send(Datagram.create_remove_channel(40))
+
+SHARDS_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: database
+      control: 75757
+      broadcast: true
+      workers: 4
+      generate:
+        min: 1000000
+        max: 1000010
+      shards:
+        - type: binlog
+          filename: %r
+        - type: binlog
+          filename: %r
+        - type: binlog
+          filename: %r
+"""
+
+class TestDatabaseServerBinlogShards(TestDatabaseServerBinlog):
+    # The 11 ids are split 3/3/5, so creates must move on to another shard when one is full
+    @classmethod
+    def setUpClass(cls):
+        setup_binlog(cls)
+        shards = [cls.binlog_path + '/shard%d.binlog' % i for i in xrange(3)]
+        cls.daemon = Daemon(SHARDS_CONFIG % tuple([USE_THREADING, test_dc] + shards))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.objects = cls.connectToServer()
+        cls.objects.send(Datagram.create_add_range(DATABASE_PREFIX|1000000,
+                                                   DATABASE_PREFIX|1000010))
+
+class TestBinlogRecovery(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        setup_binlog(cls)
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, 0, 0, cls.binlog_file, 10, 0))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(30))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_binlog(cls)
+
+    @classmethod
+    def crash(cls):
+        # SIGKILL gives the database no chance to tidy up
+        cls.conn.close()
+        cls.daemon.daemon.kill()
+        cls.daemon.daemon.wait()
+        cls.daemon.daemon = None
+        cls.daemon.stop()
+
+    @classmethod
+    def restart(cls):
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(30))
+
+    def create(self, context, rdb):
+        dg = Datagram.create([75757], 30, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(context)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(rdb)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([30], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        return dgi.read_doid()
+
+    def set_rdb(self, doid, rdb):
+        dg = Datagram.create([75757], 30, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(rdb)
+        self.conn.send(dg)
+
+    def expect_rdb(self, context, doid, rdb):
+        dg = Datagram.create([75757], 30, DBSERVER_OBJECT_GET_ALL)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        self.conn.send(dg)
+
+        dg = Datagram.create([30], 75757, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(rdb)
+        self.expect(self.conn, dg)
+
+    def test_recovery(self):
+        # Make one object with enough updates that its records get merged, and one to delete
+        kept = self.create(1, 0)
+        for i in xrange(1, 21):
+            self.set_rdb(kept, i)
+        deleted = self.create(2, 5)
+        dg = Datagram.create([75757], 30, DBSERVER_OBJECT_DELETE)
+        dg.add_doid(deleted)
+        self.conn.send(dg)
+        self.expect_rdb(3, kept, 20)
+
+        # Kill the database as though it died part way through writing a record...
+        self.crash()
+        with open(self.binlog_file, 'ab') as f:
+            f.write('\x40\x00\x00\x00\x12\x34')
+
+        # ... and it should recover everything that was written before.
+        self.restart()
+        self.expect_rdb(4, kept, 20)
+
+        dg = Datagram.create([75757], 30, DBSERVER_OBJECT_GET_ALL)
+        dg.add_uint32(5)
+        dg.add_doid(deleted)
+        self.conn.send(dg)
+
+        dg = Datagram.create([30], 75757, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(5)
+        dg.add_uint8(FAILURE)
+        self.expect(self.conn, dg)
+
+        # The partial record should have been discarded, so new records can follow
+        self.set_rdb(kept, 21)
+        other = self.create(6, 6)
+        self.assertNotEquals(other, kept)
+        self.crash()
+        self.restart()
+        self.expect_rdb(7, kept, 21)
+        self.expect_rdb(8, other, 6)
+
+    def test_corrupt_record(self):
+        first = self.create(1, 1)
+        second = self.create(2, 2)
+        self.set_rdb(first, 3)
+        self.expect_rdb(3, first, 3)
+        self.crash()
+
+        # Damage the first object's record, which is followed by intact ones...
+        with open(self.binlog_file, 'rb') as f:
+            intact = f.read()
+        pos = 12 + 8 + 1 # File header, record header, record type
+        corrupt = intact[:pos] + chr(ord(intact[pos]) ^ 0xff) + intact[pos+1:]
+        with open(self.binlog_file, 'wb') as f:
+            f.write(corrupt)
+
+        # ... which isn't a torn write, so astrond should refuse to start...
+        self.start_failed()
+        with open(self.binlog_file, 'rb') as f:
+            self.assertEquals(f.read(), corrupt)
+
+        # ... and have left the file alone to be repaired.
+        with open(self.binlog_file, 'wb') as f:
+            f.write(intact)
+        self.restart()
+        self.expect_rdb(4, first, 3)
+        self.expect_rdb(5, second, 2)
+
+    def start_failed(self):
+        self.daemon.start()
+        code = self.daemon.daemon.poll()
+        if code is None:
+            self.daemon.daemon.kill()
+            self.daemon.daemon.wait()
+        self.daemon.daemon = None
+        self.daemon.stop()
+        self.assertEquals(code, 1)
+
+if __name__ == '__main__':
+    unittest.main()
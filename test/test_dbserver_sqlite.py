@@ -0,0 +1,186 @@
+#!/usr/bin/env python2
+import unittest, struct, sqlite3
+from common.unittests import ProtocolTest
+from common.dbserver import DBServerTestsuite, CREATE_DOID_OFFSET
+from common.astron import *
+from common.astron import DATATYPES
+from common.dcfile import *
+from database.sqlite import setup_sqlite, teardown_sqlite
+
+CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: database
+      control: 75757
+      broadcast: true
+      workers: %d
+      generate:
+        min: 1000000
+        max: 1000010
+      backend:
+        type: sqlite3
+        database: %r
+        sessions: %d
+        group_commit:
+            window: %d
+"""
+
+class TestDatabaseServerSQLite(ProtocolTest, DBServerTestsuite):
+    WORKERS = 0
+    SESSIONS = 1
+    GROUP_WINDOW = 0
+
+    @classmethod
+    def setUpClass(cls):
+        setup_sqlite(cls)
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, cls.WORKERS,
+                                      cls.sqlite_file, cls.SESSIONS, cls.GROUP_WINDOW))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.objects = cls.connectToServer()
+        cls.objects.send(Datagram.create_add_range(DATABASE_PREFIX|1000000,
+                                                   DATABASE_PREFIX|1000010))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.objects.send(Datagram.create_remove_range(DATABASE_PREFIX|1000000,
+                                                      DATABASE_PREFIX|1000010))
+        cls.objects.close()
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_sqlite(cls)
+
+    def create_rdb3(self, sender, context, value):
+        dg = Datagram.create([75757], sender, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(context)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        dgi.seek(CREATE_DOID_OFFSET)
+        return dgi.read_doid()
+
+    def get_rdb3(self, sender, context, doid):
+        dg = Datagram.create([75757], sender, DBSERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        return dg
+
+    def get_rdb3_resp(self, sender, context, value):
+        dg = Datagram.create([sender], 75757, DBSERVER_OBJECT_GET_FIELD_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        return dg
+
+    def test_concurrent_sessions(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(30))
+
+        doids = [self.create_rdb3(30, i, i) for i in xrange(6)]
+
+        # Read half of the objects while writing the other half, all at once, so that the
+        # operations are spread across the sessions.  A read mustn't leave its session
+        # holding the database, or the writes on the other sessions can't commit.
+        dgs = []
+        for i, doid in enumerate(doids):
+            if i % 2 == 0:
+                dgs.append(self.get_rdb3(30, 10 + i, doid))
+            else:
+                dg = Datagram.create([75757], 30, DBSERVER_OBJECT_SET_FIELD)
+                dg.add_doid(doid)
+                dg.add_uint16(setRDB3)
+                dg.add_uint32(100 + i)
+                dgs.append(dg)
+        self.conn.s.send(''.join(struct.pack(DATATYPES['size'], len(dg.get_data())) +
+                                 dg.get_data() for dg in dgs))
+        self.expectMany(self.conn, [self.get_rdb3_resp(30, 10 + i, i)
+                                    for i in xrange(0, len(doids), 2)])
+
+        # Every write should have gone through
+        for i in xrange(1, len(doids), 2):
+            self.conn.send(self.get_rdb3(30, 20 + i, doids[i]))
+            self.expect(self.conn, self.get_rdb3_resp(30, 20 + i, 100 + i))
+
+        # Cleanup
+        for doid in doids:
+            self.deleteObject(30, doid)
+        self.conn.send(Datagram.create_remove_channel(30))
+
+class TestDatabaseServerSQLiteSessions(TestDatabaseServerSQLite):
+    WORKERS = 4
+    SESSIONS = 4
+
+class TestDatabaseServerSQLiteGroupCommit(TestDatabaseServerSQLite):
+    WORKERS = 4
+    SESSIONS = 2
+    GROUP_WINDOW = 5
+
+    def set_rdb3(self, sender, doid, value):
+        dg = Datagram.create([75757], sender, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        return dg
+
+    def test_group_retry(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(31))
+
+        doids = [self.create_rdb3(31, i, i) for i in xrange(4)]
+
+        # The database refuses one of the values, which fails the whole group's transaction
+        db = sqlite3.connect(self.sqlite_file, isolation_level = None)
+        db.execute("CREATE TRIGGER reject BEFORE UPDATE ON fields_DistributedTestObject3 "
+                   "WHEN NEW.setRDB3 = '(666)' BEGIN SELECT RAISE(ABORT, 'rejected'); END")
+
+        # Hold the database while one write is committed, so that the next writes queue up
+        # behind it and are committed together.
+        db.execute('BEGIN EXCLUSIVE')
+        self.conn.send(self.set_rdb3(31, doids[0], 100))
+        self.objects.flush()
+        dgs = [self.set_rdb3(31, doids[1], 101),
+               self.set_rdb3(31, doids[2], 666),
+               self.set_rdb3(31, doids[3], 103)]
+        self.conn.s.send(''.join(struct.pack(DATATYPES['size'], len(dg.get_data())) +
+                                 dg.get_data() for dg in dgs))
+        self.objects.flush()
+        db.execute('ROLLBACK')
+
+        # The group is retried one write at a time, so only the refused write fails
+        for doid, value in [(doids[0], 100), (doids[1], 101), (doids[3], 103)]:
+            dg = Datagram.create([DATABASE_PREFIX|doid], 31, DBSERVER_OBJECT_SET_FIELD)
+            dg.add_doid(doid)
+            dg.add_uint16(setRDB3)
+            dg.add_uint32(value)
+            self.expect(self.objects, dg)
+        self.expectNone(self.objects)
+        for i, value in enumerate([100, 101, 2, 103]):
+            self.conn.send(self.get_rdb3(31, 10 + i, doids[i]))
+            self.expect(self.conn, self.get_rdb3_resp(31, 10 + i, value))
+
+        # Cleanup
+        db.execute('DROP TRIGGER reject')
+        db.close()
+        for doid in doids:
+            self.deleteObject(31, doid)
+        self.conn.send(Datagram.create_remove_channel(31))
+
+if __name__ == '__main__':
+    unittest.main()
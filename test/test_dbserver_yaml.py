@@ -1,5 +1,5 @@
 #!/usr/bin/env python2
-import unittest, tempfile, shutil
+import unittest, tempfile, shutil, os, time
 from common.unittests import ProtocolTest
 from common.dbserver import DBServerTestsuite
 from common.astron import *
@@ -19,19 +19,28 @@ roles:
     - type: database
       control: 75757
       broadcast: true
+      workers: %d
       generate:
         min: 1000000
         max: 1000010
       backend:
         type: yaml
         foldername: %r
+        flush_interval: %d
+        cache:
+            max_size: %d
 """
 
 class TestDatabaseServerYAML(ProtocolTest, DBServerTestsuite):
+    WORKERS = 0
+    FLUSH_INTERVAL = 0
+    CACHE_SIZE = 0
+
     @classmethod
     def setUpClass(cls):
         setup_yamldb(cls)
-        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, cls.yamldb_path))
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, cls.WORKERS, cls.yamldb_path,
+                                      cls.FLUSH_INTERVAL, cls.CACHE_SIZE))
         cls.daemon.start()
         cls.conn = cls.connectToServer()
         cls.objects = cls.connectToServer()
@@ -47,5 +56,380 @@ class TestDatabaseServerYAML(ProtocolTest, DBServerTestsuite):
         cls.daemon.stop()
         teardown_yamldb(cls)
 
+class TestDatabaseServerYAMLWorkers(TestDatabaseServerYAML):
+    WORKERS = 4
+
+    def test_ordering(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(90))
+
+        doid1 = self.createTypeGetId(90, 1, DistributedTestObject3)
+        doid2 = self.createTypeGetId(90, 2, DistributedTestObject3)
+
+        # Queue up a series of updates to two objects, followed by a read of each
+        for value in xrange(20):
+            for doid in (doid1, doid2):
+                dg = Datagram.create([75757], 90, DBSERVER_OBJECT_SET_FIELD)
+                dg.add_doid(doid)
+                dg.add_uint16(setRDB3)
+                dg.add_uint32(value)
+                self.conn.send(dg)
+        for context, doid in ((3, doid1), (4, doid2)):
+            dg = Datagram.create([75757], 90, DBSERVER_OBJECT_GET_FIELD)
+            dg.add_uint32(context)
+            dg.add_doid(doid)
+            dg.add_uint16(setRDB3)
+            self.conn.send(dg)
+
+        # Each read must see the last update to its object, though the
+        # responses for different objects may arrive in either order
+        expected = []
+        for context in (3, 4):
+            dg = Datagram.create([90], 75757, DBSERVER_OBJECT_GET_FIELD_RESP)
+            dg.add_uint32(context)
+            dg.add_uint8(SUCCESS)
+            dg.add_uint16(setRDB3)
+            dg.add_uint32(19)
+            expected.append(dg)
+        self.expectMany(self.conn, expected)
+
+        # Cleanup
+        self.deleteObject(90, doid1)
+        self.deleteObject(90, doid2)
+        self.conn.send(Datagram.create_remove_channel(90))
+
+class TestDatabaseServerYAMLWriteBehind(TestDatabaseServerYAMLWorkers):
+    FLUSH_INTERVAL = 20
+
+class TestDatabaseServerYAMLBoundedCache(TestDatabaseServerYAMLWriteBehind):
+    # Small enough that every object but the last one used is evicted once it's written
+    CACHE_SIZE = 1
+
+    def get_rdb3(self, context, doid):
+        dg = Datagram.create([75757], 93, DBSERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive GetFieldResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([93], 75757, DBSERVER_OBJECT_GET_FIELD_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        self.assertEquals(dgi.read_uint8(), SUCCESS)
+        self.assertEquals(dgi.read_uint16(), setRDB3)
+        return dgi.read_uint32()
+
+    def test_eviction(self):
+        self.objects.flush()
+        self.conn.flush()
+        self.conn.send(Datagram.create_add_channel(93))
+
+        doid1 = self.createTypeGetId(93, 1, DistributedTestObject3)
+        dg = Datagram.create([75757], 93, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(13579)
+        self.conn.send(dg)
+        self.assertEquals(self.get_rdb3(2, doid1), 13579)
+
+        # Once its change is written and another object is used, the first is forgotten...
+        doid2 = self.createTypeGetId(93, 3, DistributedTestObject3)
+        time.sleep(0.2)
+        self.objects.flush()
+
+        # ... so it is read from its file again the next time it is used.
+        filename = os.path.join(self.yamldb_path, '%d.yaml' % doid1)
+        with open(filename) as f:
+            contents = f.read()
+        self.assertIn('13579', contents)
+        with open(filename, 'w') as f:
+            f.write(contents.replace('13579', '24680'))
+        self.assertEquals(self.get_rdb3(4, doid1), 24680)
+
+        # Cleanup
+        self.deleteObject(93, doid1)
+        self.deleteObject(93, doid2)
+        self.conn.send(Datagram.create_remove_channel(93))
+
+class TestYAMLWriteBehindShutdown(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        setup_yamldb(cls)
+        # Long enough that nothing is written until astrond is stopped
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, 0, cls.yamldb_path, 60000, 0))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(91))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_yamldb(cls)
+
+    def test_flush_on_shutdown(self):
+        dg = Datagram.create([75757], 91, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(1) # Context
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1234)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([91], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        dgi.read_uint32() # Context
+        doid = dgi.read_doid()
+
+        dg = Datagram.create([75757], 91, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(5678)
+        self.conn.send(dg)
+
+        # The update should be served from memory...
+        dg = Datagram.create([75757], 91, DBSERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(2) # Context
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        self.conn.send(dg)
+
+        dg = Datagram.create([91], 75757, DBSERVER_OBJECT_GET_FIELD_RESP)
+        dg.add_uint32(2) # Context
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(5678)
+        self.expect(self.conn, dg)
+
+        # ... without having been written yet...
+        filename = os.path.join(self.yamldb_path, '%d.yaml' % doid)
+        self.assertFalse(os.path.exists(filename))
+
+        # ... until astrond is stopped gracefully.
+        self.daemon.daemon.terminate()
+        self.daemon.daemon.wait()
+        self.daemon.daemon = None
+        with open(filename) as f:
+            self.assertIn('5678', f.read())
+        with open(os.path.join(self.yamldb_path, 'info.yaml')) as f:
+            self.assertIn('next', f.read())
+
+class TestYAMLFailedFlush(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        setup_yamldb(cls)
+        # Long enough for the file to be swapped between two flushes
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, 0, cls.yamldb_path, 1000, 1))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(94))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_yamldb(cls)
+
+    def get_rdb3(self, context, doid):
+        dg = Datagram.create([75757], 94, DBSERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive GetFieldResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([94], 75757, DBSERVER_OBJECT_GET_FIELD_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        self.assertEquals(dgi.read_uint8(), SUCCESS)
+        self.assertEquals(dgi.read_uint16(), setRDB3)
+        return dgi.read_uint32()
+
+    def test_failed_flush(self):
+        dg = Datagram.create([75757], 94, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(1) # Context
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(0) # Field count
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([94], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        dgi.read_uint32() # Context
+        doid = dgi.read_doid()
+
+        # Just after the object is first written, it is changed...
+        filename = os.path.join(self.yamldb_path, '%d.yaml' % doid)
+        for i in xrange(30):
+            if os.path.exists(filename):
+                break
+            time.sleep(0.05)
+        dg = Datagram.create([75757], 94, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(13579)
+        self.conn.send(dg)
+        self.assertEquals(self.get_rdb3(2, doid), 13579)
+
+        # ... and its file is replaced by one which can't be read or written
+        os.remove(filename)
+        os.symlink(os.path.join(self.yamldb_path, 'missing', 'object.yaml'), filename)
+
+        # The change can't be written, so the object must stay cached...
+        time.sleep(1.2)
+        self.assertEquals(self.get_rdb3(3, doid), 13579)
+
+        # ... until the next flush can write it.
+        os.remove(filename)
+        time.sleep(1.2)
+        with open(filename) as f:
+            self.assertIn('13579', f.read())
+
+SHARDS_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: database
+      control: 75757
+      generate:
+        min: 1000000
+        max: 1000010
+      shards:
+        - type: yaml
+          foldername: %r
+        - type: yaml
+          foldername: %r
+"""
+
+class TestYAMLShardFailure(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        setup_yamldb(cls)
+        cls.shards = [os.path.join(cls.yamldb_path, 'shard%d' % i) for i in xrange(2)]
+        for shard in cls.shards:
+            os.mkdir(shard)
+        cls.daemon = Daemon(SHARDS_CONFIG % tuple([test_dc] + cls.shards))
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(95))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_yamldb(cls)
+
+    def create(self, context):
+        dg = Datagram.create([75757], 95, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(context)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(0) # Field count
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([95], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        return dgi.read_doid()
+
+    def test_shard_failure(self):
+        # The first shard can't write its objects, though it has ids to give them...
+        shutil.rmtree(self.shards[0], ignore_errors = True)
+        os.symlink(os.path.join(self.yamldb_path, 'missing'), self.shards[0])
+
+        # ... so its create fails, rather than being made in the other shard.
+        self.assertEquals(self.create(1), 0)
+        doid = self.create(2)
+        self.assertTrue(1000005 <= doid <= 1000010, "Object %d isn't in the second shard." % doid)
+        self.assertTrue(os.path.exists(os.path.join(self.shards[1], '%d.yaml' % doid)))
+
+        os.remove(self.shards[0])
+
+class TestYAMLLeaseRecovery(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        setup_yamldb(cls)
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, 0, cls.yamldb_path, 0, 0))
+        cls.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        teardown_yamldb(cls)
+
+    @classmethod
+    def start(cls):
+        cls.daemon.start()
+        cls.conn = cls.connectToServer()
+        cls.conn.send(Datagram.create_add_channel(92))
+
+    @classmethod
+    def stop(cls, signal):
+        cls.conn.close()
+        signal()
+        cls.daemon.daemon.wait()
+        cls.daemon.daemon = None
+        cls.daemon.stop()
+
+    def create(self, context):
+        dg = Datagram.create([75757], 92, DBSERVER_CREATE_OBJECT)
+        dg.add_uint32(context)
+        dg.add_uint16(DistributedTestObject3)
+        dg.add_uint16(0) # Field count
+        self.conn.send(dg)
+
+        dg = self.conn.recv_maybe()
+        self.assertTrue(dg is not None, "Did not receive CreateObjectResp.")
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([92], 75757, DBSERVER_CREATE_OBJECT_RESP))
+        self.assertEquals(dgi.read_uint32(), context)
+        return dgi.read_doid()
+
+    def read_info(self):
+        with open(os.path.join(self.yamldb_path, 'info.yaml')) as f:
+            return f.read()
+
+    def test_lease_recovery(self):
+        first = self.create(1)
+        second = self.create(2)
+        self.assertEquals(second, first + 1)
+
+        # The ids are handed out from a lease which is recorded in info.yaml
+        self.assertIn('lease', self.read_info())
+
+        # Freeing an id rewrites info.yaml, but the next create doesn't
+        dg = Datagram.create([75757], 92, DBSERVER_OBJECT_DELETE)
+        dg.add_doid(second)
+        self.conn.send(dg)
+        self.assertEquals(self.create(3), first + 2)
+        self.assertIn('next: %d' % (first + 2), self.read_info())
+
+        # If astrond dies, the ids of the lease after the last object are handed out again...
+        self.stop(self.daemon.daemon.kill)
+        self.start()
+        self.assertEquals(self.create(4), first + 3)
+
+        # ... and a graceful stop leaves no lease behind.
+        self.stop(self.daemon.daemon.terminate)
+        info = self.read_info()
+        self.assertNotIn('lease', info)
+        self.assertIn('next: %d' % (first + 4), info)
+        self.start()
+        self.assertEquals(self.create(5), first + 4)
+
 if __name__ == '__main__':
     unittest.main()
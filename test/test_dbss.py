@@ -1,5 +1,5 @@
 #!/usr/bin/env python2
-import unittest
+import unittest, time
 from common.unittests import ProtocolTest
 from common.astron import *
 from common.dcfile import *
@@ -21,6 +21,44 @@ roles:
             max: 9999
 """ % (USE_THREADING, test_dc)
 
+CACHE_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: dbss
+      database: 1200
+      ranges:
+          - min: 9000
+            max: 9999
+      cache:
+          max_size: 65536
+""" % (USE_THREADING, test_dc)
+
+WRITE_BEHIND_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: dbss
+      database: 1200
+      ranges:
+          - min: 9000
+            max: 9999
+      write_behind:
+          interval: 1
+""" % (USE_THREADING, test_dc)
+
 CONTEXT_OFFSET = 1 + (CHANNEL_SIZE_BYTES*2) + 2
 
 def appendMeta(datagram, doid=None, parent=None, zone=None, dclass=None):
@@ -148,6 +186,92 @@ class TestDBStateServer(ProtocolTest):
         self.shard.send(Datagram.create_remove_channel(80000<<ZONE_SIZE_BITS|101))
 
     # Tests the messages OBJECT_GET_ALL
+    def test_activate_many(self):
+        self.database.flush()
+        self.shard.flush()
+        self.shard.send(Datagram.create_add_channel(80000<<ZONE_SIZE_BITS|102))
+
+        doid1 = 9031
+        doid2 = 9032
+        doid3 = 9033
+
+        # Activate several objects at once
+        dg = Datagram.create([doid1], 5, DBSS_OBJECT_ACTIVATE_MANY)
+        dg.add_uint16(3) # Object count
+        for doid in (doid1, doid2, doid3):
+            appendMeta(dg, doid, 80000, 102)
+        self.shard.send(dg)
+
+        # Expect them to be retrieved from the database with a single request
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid3, DBSERVER_OBJECT_GET_ALL_MULTI,
+                                            remaining = 6 + 3*DOID_SIZE_BYTES))
+        context = dgi.read_uint32() # Get context
+        self.assertEquals(dgi.read_uint16(), 3) # Object count
+        self.assertEquals(dgi.read_doid(), doid1)
+        self.assertEquals(dgi.read_doid(), doid2)
+        self.assertEquals(dgi.read_doid(), doid3)
+        self.expectNone(self.database)
+
+        # Respond in two parts, with doid2 missing from the database
+        dg = Datagram.create([doid3], 1200, DBSERVER_OBJECT_GET_ALL_MULTI_RESP)
+        dg.add_uint32(context)
+        dg.add_uint16(2) # Object count
+        dg.add_doid(doid1)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1111)
+        dg.add_doid(doid2)
+        dg.add_uint8(FAILURE)
+        self.database.send(dg)
+
+        dg = Datagram.create([80000<<ZONE_SIZE_BITS|102], doid1,
+                             STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED)
+        appendMeta(dg, doid1, 80000, 102, DistributedTestObject5)
+        dg.add_uint32(setRequired1DefaultValue) # setRequired1
+        dg.add_uint32(1111) # setRDB3
+        self.expect(self.shard, dg)
+        self.expectNone(self.shard)
+
+        dg = Datagram.create([doid3], 1200, DBSERVER_OBJECT_GET_ALL_MULTI_RESP)
+        dg.add_uint32(context)
+        dg.add_uint16(1) # Object count
+        dg.add_doid(doid3)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(3333)
+        self.database.send(dg)
+
+        dg = Datagram.create([80000<<ZONE_SIZE_BITS|102], doid3,
+                             STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED)
+        appendMeta(dg, doid3, 80000, 102, DistributedTestObject5)
+        dg.add_uint32(setRequired1DefaultValue) # setRequired1
+        dg.add_uint32(3333) # setRDB3
+        self.expect(self.shard, dg)
+
+        # Activating active objects again is ignored
+        dg = Datagram.create([doid1], 5, DBSS_OBJECT_ACTIVATE_MANY)
+        dg.add_uint16(2) # Object count
+        appendMeta(dg, doid1, 80000, 102)
+        appendMeta(dg, doid3, 80000, 102)
+        self.shard.send(dg)
+        self.expectNone(self.database)
+        self.expectNone(self.shard)
+
+        ### Clean up ###
+        for doid in (doid1, doid3):
+            dg = Datagram.create([doid], 5, STATESERVER_OBJECT_DELETE_RAM)
+            dg.add_doid(doid)
+            self.shard.send(dg)
+        self.shard.flush()
+        self.shard.send(Datagram.create_remove_channel(80000<<ZONE_SIZE_BITS|102))
+
     def test_get_all(self):
         self.database.flush()
         self.shard.flush()
@@ -940,6 +1064,115 @@ class TestDBStateServer(ProtocolTest):
         dg.add_uint32(99922)
         self.expect(self.shard, dg)
 
+    def test_coalesce_reads(self):
+        self.database.flush()
+        self.shard.flush()
+
+        doid1 = 9060
+
+        ### Test for concurrent GetAlls on the same object ###
+        for context in (1, 2):
+            dg = Datagram.create([doid1], 5, STATESERVER_OBJECT_GET_ALL)
+            dg.add_uint32(context)
+            dg.add_doid(doid1)
+            self.shard.send(dg)
+
+        # Expect only one query at the database
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid1, DBSERVER_OBJECT_GET_ALL,
+                                            remaining = 4 + DOID_SIZE_BYTES))
+        context = dgi.read_uint32()
+        self.expectNone(self.database)
+
+        dg = Datagram.create([doid1], 1200, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(4444)
+        self.database.send(dg)
+
+        # Both callers should get the result
+        expected = []
+        for context in (1, 2):
+            dg = Datagram.create([5], doid1, STATESERVER_OBJECT_GET_ALL_RESP)
+            dg.add_uint32(context)
+            appendMeta(dg, doid1, INVALID_DO_ID, INVALID_ZONE, DistributedTestObject5)
+            dg.add_uint32(setRequired1DefaultValue) # setRequired1
+            dg.add_uint32(4444) # setRDB3
+            dg.add_uint8(setRDbD5DefaultValue) # setRDbD5
+            dg.add_uint16(0) # Optional field count
+            expected.append(dg)
+        self.expectMany(self.shard, expected)
+
+        ### Test for concurrent GetFields with the same fields ###
+        for context, fields in ((3, [setRDB3, setDb3]), (4, [setDb3, setRDB3])):
+            dg = Datagram.create([doid1], 5, STATESERVER_OBJECT_GET_FIELDS)
+            dg.add_uint32(context)
+            dg.add_doid(doid1)
+            dg.add_uint16(len(fields))
+            for field in fields:
+                dg.add_uint16(field)
+            self.shard.send(dg)
+
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid1, DBSERVER_OBJECT_GET_FIELDS))
+        context = dgi.read_uint32()
+        self.expectNone(self.database)
+
+        dg = Datagram.create([doid1], 1200, DBSERVER_OBJECT_GET_FIELDS_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(2)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(4444)
+        dg.add_uint16(setDb3)
+        dg.add_string("Shared")
+        self.database.send(dg)
+
+        expected = []
+        for context in (3, 4):
+            dg = Datagram.create([5], doid1, STATESERVER_OBJECT_GET_FIELDS_RESP)
+            dg.add_uint32(context)
+            dg.add_uint8(SUCCESS)
+            dg.add_uint16(2)
+            dg.add_uint16(setRDB3)
+            dg.add_uint32(4444)
+            dg.add_uint16(setDb3)
+            dg.add_string("Shared")
+            expected.append(dg)
+        self.expectMany(self.shard, expected)
+
+        ### Test for GetAll after a SetField, which must not share the earlier query ###
+        dg = Datagram.create([doid1], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(5)
+        dg.add_doid(doid1)
+        self.shard.send(dg)
+
+        dg = Datagram.create([doid1], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(5555)
+        self.shard.send(dg)
+
+        dg = Datagram.create([doid1], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(6)
+        dg.add_doid(doid1)
+        self.shard.send(dg)
+
+        # Expect both GetAlls to be sent to the database, around the update
+        for msgtype in (DBSERVER_OBJECT_GET_ALL, DBSERVER_OBJECT_SET_FIELD,
+                        DBSERVER_OBJECT_GET_ALL):
+            dg = self.database.recv_maybe()
+            self.assertTrue(dg is not None)
+            self.assertTrue(*DatagramIterator(dg).matches_header([1200], doid1, msgtype))
+        self.expectNone(self.database)
+
     def test_get_activated(self):
         self.shard.flush()
         self.database.flush()
@@ -1072,5 +1305,422 @@ class TestDBStateServer(ProtocolTest):
         dg.add_uint8(BOOL_NO)
         self.expect(self.shard, dg)
 
+    def test_activate_conflated(self):
+        self.database.flush()
+        self.shard.flush()
+        self.shard.send(Datagram.create_add_channel(80000<<ZONE_SIZE_BITS|102))
+
+        doid = 9070
+
+        # Activate an object, which waits on the database...
+        dg = Datagram.create([doid], 5, DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS)
+        appendMeta(dg, doid, 80000, 102)
+        self.shard.send(dg)
+
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_GET_ALL,
+                                            remaining = 4 + DOID_SIZE_BYTES))
+        context = dgi.read_uint32()
+
+        # ... while it receives two updates of a conflated field, around another update.
+        for field, value in ((setHealth, 100), (setChat, 'Ouch!'), (setHealth, 90)):
+            dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(doid)
+            dg.add_uint16(field)
+            if field == setChat:
+                dg.add_string(value)
+            else:
+                dg.add_uint16(value)
+            self.shard.send(dg)
+        self.expectNone(self.shard)
+
+        dg = Datagram.create([doid], 1200, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedConflatedObject)
+        dg.add_uint16(0) # Field count
+        self.database.send(dg)
+
+        # Once loaded, only the newer value of the conflated field is applied.
+        dg = Datagram.create([80000<<ZONE_SIZE_BITS|102], doid,
+                             STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED)
+        appendMeta(dg, doid, 80000, 102, DistributedConflatedObject)
+        dg.add_int16(0) # setPosition.x
+        dg.add_int16(0) # setPosition.y
+        self.expect(self.shard, dg)
+
+        dg = Datagram.create([80000<<ZONE_SIZE_BITS|102], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setChat)
+        dg.add_string('Ouch!')
+        self.expect(self.shard, dg)
+
+        dg = Datagram.create([80000<<ZONE_SIZE_BITS|102], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setHealth)
+        dg.add_uint16(90)
+        self.expect(self.shard, dg)
+        self.expectNone(self.shard)
+
+        ### Clean up ###
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(doid)
+        self.shard.send(dg)
+        self.shard.flush()
+        self.shard.send(Datagram.create_remove_channel(80000<<ZONE_SIZE_BITS|102))
+
+class TestDBStateServerCache(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.daemon = Daemon(CACHE_CONFIG)
+        cls.daemon.start()
+
+        cls.shard = cls.connectToServer()
+        cls.shard.send(Datagram.create_set_con_name("Shard"))
+        cls.shard.send(Datagram.create_add_channel(5))
+
+        cls.database = cls.connectToServer()
+        cls.database.send(Datagram.create_set_con_name("Database"))
+        cls.database.send(Datagram.create_add_channel(1200))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.database.send(Datagram.create_remove_channel(1200))
+        cls.database.close()
+        cls.shard.send(Datagram.create_remove_channel(5))
+        cls.shard.close()
+        cls.daemon.stop()
+
+    def getAll(self, context, doid):
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        self.shard.send(dg)
+
+    def expectGetAllQuery(self, doid):
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_GET_ALL,
+                                            remaining = 4 + DOID_SIZE_BYTES))
+        context = dgi.read_uint32()
+        self.assertEquals(dgi.read_doid(), doid)
+        return context
+
+    def sendGetAllResp(self, context, doid, value):
+        dg = Datagram.create([doid], 1200, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(value)
+        self.database.send(dg)
+
+    def expectGetAllResp(self, context, doid, value):
+        dg = Datagram.create([5], doid, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        appendMeta(dg, doid, INVALID_DO_ID, INVALID_ZONE, DistributedTestObject5)
+        dg.add_uint32(setRequired1DefaultValue) # setRequired1
+        dg.add_uint32(value) # setRDB3
+        dg.add_uint8(setRDbD5DefaultValue) # setRDbD5
+        dg.add_uint16(0) # Optional field count
+        self.expect(self.shard, dg)
+
+    def test_get_all_cached(self):
+        self.database.flush()
+        self.shard.flush()
+
+        doid = 9100
+
+        # The first GetAll has to go to the database...
+        self.getAll(1, doid)
+        context = self.expectGetAllQuery(doid)
+        self.sendGetAllResp(context, doid, 1234)
+        self.expectGetAllResp(1, doid, 1234)
+
+        # ... but the next is answered from the cache.
+        self.getAll(2, doid)
+        self.expectGetAllResp(2, doid, 1234)
+        self.expectNone(self.database)
+
+        # So is a GetField for one of its fields.
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(3) # Context
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        self.shard.send(dg)
+
+        dg = Datagram.create([5], doid, STATESERVER_OBJECT_GET_FIELD_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1234)
+        self.expect(self.shard, dg)
+        self.expectNone(self.database)
+
+        # Setting a field through the DBSS invalidates the cached object...
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(5678)
+        self.shard.send(dg)
+
+        dg = Datagram.create([1200], doid, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(5678)
+        self.expect(self.database, dg)
+
+        # ... so the next GetAll goes to the database again.
+        self.getAll(4, doid)
+        context = self.expectGetAllQuery(doid)
+        self.sendGetAllResp(context, doid, 5678)
+        self.expectGetAllResp(4, doid, 5678)
+
+        # Deleting the object from disk must forget it as well.
+        dg = Datagram.create([doid], 5, DBSS_OBJECT_DELETE_DISK)
+        dg.add_doid(doid)
+        self.shard.send(dg)
+
+        dg = Datagram.create([1200], doid, DBSERVER_OBJECT_DELETE)
+        dg.add_doid(doid)
+        self.expect(self.database, dg)
+
+        self.getAll(5, doid)
+        self.expectGetAllQuery(doid)
+
+    def test_db_broadcast(self):
+        self.database.flush()
+        self.shard.flush()
+
+        doid = 9101
+
+        # Cache a single field...
+        for context in (1, 2):
+            dg = Datagram.create([doid], 5, STATESERVER_OBJECT_GET_FIELD)
+            dg.add_uint32(context)
+            dg.add_doid(doid)
+            dg.add_uint16(setDb3)
+            self.shard.send(dg)
+
+            if context == 1:
+                dg = self.database.recv_maybe()
+                self.assertTrue(dg is not None)
+                dgi = DatagramIterator(dg)
+                self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_GET_FIELD))
+                db_context = dgi.read_uint32()
+
+                dg = Datagram.create([doid], 1200, DBSERVER_OBJECT_GET_FIELD_RESP)
+                dg.add_uint32(db_context)
+                dg.add_uint8(SUCCESS)
+                dg.add_uint16(setDb3)
+                dg.add_string("Cached")
+                self.database.send(dg)
+
+            dg = Datagram.create([5], doid, STATESERVER_OBJECT_GET_FIELD_RESP)
+            dg.add_uint32(context)
+            dg.add_uint8(SUCCESS)
+            dg.add_uint16(setDb3)
+            dg.add_string("Cached")
+            self.expect(self.shard, dg)
+        self.expectNone(self.database)
+
+        # ... until the database announces that someone else has changed it.
+        dg = Datagram.create([DATABASE_PREFIX|doid], 1200, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setDb3)
+        dg.add_string("Changed")
+        self.database.send(dg)
+
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_GET_FIELD)
+        dg.add_uint32(3)
+        dg.add_doid(doid)
+        dg.add_uint16(setDb3)
+        self.shard.send(dg)
+
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_GET_FIELD))
+
+    def test_stale_read(self):
+        self.database.flush()
+        self.shard.flush()
+
+        doid = 9102
+
+        # Start a GetAll...
+        self.getAll(1, doid)
+        context = self.expectGetAllQuery(doid)
+
+        # ... change the object while the database is still answering it ...
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(2222)
+        self.shard.send(dg)
+        self.database.flush()
+
+        self.sendGetAllResp(context, doid, 1111)
+        self.expectGetAllResp(1, doid, 1111)
+
+        # ... and the old answer must not have been cached.
+        self.getAll(2, doid)
+        self.expectGetAllQuery(doid)
+
+class TestDBStateServerWriteBehind(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.daemon = Daemon(WRITE_BEHIND_CONFIG)
+        cls.daemon.start()
+
+        cls.shard = cls.connectToServer()
+        cls.shard.send(Datagram.create_set_con_name("Shard"))
+        cls.shard.send(Datagram.create_add_channel(5))
+
+        cls.database = cls.connectToServer()
+        cls.database.send(Datagram.create_set_con_name("Database"))
+        cls.database.send(Datagram.create_add_channel(1200))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.database.send(Datagram.create_remove_channel(1200))
+        cls.database.close()
+        cls.shard.send(Datagram.create_remove_channel(5))
+        cls.shard.close()
+        cls.daemon.stop()
+
+    def activate(self, doid):
+        dg = Datagram.create([doid], 5, DBSS_OBJECT_ACTIVATE_WITH_DEFAULTS)
+        dg.add_doid(doid) # Id
+        dg.add_doid(70000) # Parent
+        dg.add_zone(300) # Zone
+        self.shard.send(dg)
+
+        dg = self.database.recv_maybe()
+        self.assertTrue(dg is not None)
+        dgi = DatagramIterator(dg)
+        self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_GET_ALL,
+                                            remaining = 4 + DOID_SIZE_BYTES))
+        context = dgi.read_uint32()
+
+        dg = Datagram.create([doid], 1200, DBSERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(DistributedTestObject5)
+        dg.add_uint16(1)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(100)
+        self.database.send(dg)
+
+    def test_shutdown(self):
+        self.shard.flush()
+        self.database.flush()
+
+        doid = 9201
+        self.activate(doid)
+
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1234)
+        self.shard.send(dg)
+        time.sleep(0.1)
+
+        # A graceful shutdown should write out the dirty fields before exiting.
+        self.daemon.daemon.terminate()
+        self.daemon.daemon.wait()
+
+        dg = Datagram.create([1200], doid, DBSERVER_OBJECT_SET_FIELDS)
+        dg.add_doid(doid)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(1234)
+        self.expect(self.database, dg)
+
+        # Bring the daemon back for the other tests
+        self.daemon.daemon = None
+        self.tearDownClass()
+        self.setUpClass()
+
+    def test_write_behind(self):
+        self.shard.flush()
+        self.database.flush()
+
+        doid = 9200
+        self.activate(doid)
+
+        # Update the same db fields several times...
+        for value in range(1, 6):
+            dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+            dg.add_doid(doid)
+            dg.add_uint16(setRDB3)
+            dg.add_uint32(value * 1000)
+            self.shard.send(dg)
+
+            dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELDS)
+            dg.add_doid(doid)
+            dg.add_uint16(1) # Field count
+            dg.add_uint16(setFoo)
+            dg.add_uint16(value)
+            self.shard.send(dg)
+
+        # The database should only see the latest values, in a SetFields per flush; the
+        # updates may have straddled a flush, in which case there are two of them.
+        time.sleep(1.5)
+        writes = 0
+        values = {}
+        dg = self.database.recv_maybe()
+        while dg is not None:
+            dgi = DatagramIterator(dg)
+            self.assertTrue(*dgi.matches_header([1200], doid, DBSERVER_OBJECT_SET_FIELDS))
+            self.assertEquals(dgi.read_doid(), doid)
+            for i in range(dgi.read_uint16()):
+                field = dgi.read_uint16()
+                if field == setRDB3:
+                    values[field] = dgi.read_uint32()
+                else:
+                    self.assertEquals(field, setFoo)
+                    values[field] = dgi.read_uint16()
+            writes += 1
+            dg = self.database.recv_maybe()
+        self.assertTrue(1 <= writes <= 2)
+        self.assertEquals(values, {setRDB3: 5000, setFoo: 5})
+
+        # Deactivating the object writes out its fields immediately.
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(6000)
+        self.shard.send(dg)
+
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(doid)
+        self.shard.send(dg)
+
+        dg = Datagram.create([1200], doid, DBSERVER_OBJECT_SET_FIELDS)
+        dg.add_doid(doid)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(6000)
+        self.expect(self.database, dg)
+
+        # Once inactive, updates are written through again.
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(7000)
+        self.shard.send(dg)
+
+        dg = Datagram.create([1200], doid, DBSERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setRDB3)
+        dg.add_uint32(7000)
+        self.expect(self.database, dg)
+        self.expectNone(self.database)
+
 if __name__ == '__main__':
     unittest.main()
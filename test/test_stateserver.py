@@ -1724,22 +1724,33 @@ class TestStateServer(ProtocolTest):
             conn.send(dg)
 
             # 2. Expect object count:
-            expected = []
             dg = Datagram.create([5], doid0, STATESERVER_OBJECT_GET_ZONES_COUNT_RESP)
             dg.add_uint32(0xF337) # Context
             dg.add_doid(len(objects)) # Count of objects
                                       # Note: Using doid because range of object-count matches total doid size
-            expected.append(dg)
+            self.expect(conn, dg)
+
+            # 3. Expect objects, which all live on the same stateserver as the parent,
+            #    so they arrive together from the parent in a bulk entry (in any order):
+            dg = conn.recv_maybe()
+            self.assertTrue(dg is not None, "No bulk interest entry received.")
+            dgi = DatagramIterator(dg)
+            self.assertTrue(*dgi.matches_header([5], doid0, STATESERVER_OBJECT_ENTER_INTEREST_BULK))
+            self.assertEquals(dgi.read_uint32(), 0xF337) # Context
 
-            # 3. Expect objects:
+            entries = []
+            for i in xrange(dgi.read_uint16()):
+                entries.append(dgi.read_string())
+
+            expected = []
             for id, zone in objects:
-                dg = Datagram.create([5], id, STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED)
-                dg.add_uint32(0xF337)
-                appendMeta(dg, id, doid0, zone, DistributedTestObject1)
-                dg.add_uint32(0) # setRequired1
-                expected.append(dg)
+                entry = Datagram()
+                entry.add_uint8(0) # has_other
+                appendMeta(entry, id, doid0, zone, DistributedTestObject1)
+                entry.add_uint32(0) # setRequired1
+                expected.append(entry.get_data())
 
-            self.expectMany(conn, expected)
+            self.assertEquals(sorted(entries), sorted(expected))
 
             # Shouldn't receive messages from any of the other objects
             self.expectNone(conn)
@@ -1753,6 +1764,11 @@ class TestStateServer(ProtocolTest):
         createEmptyDTO1(conn, 5, doid4, doid0, 940)
         createEmptyDTO1(conn, 5, doid5, doid0, 950)
         createEmptyDTO1(conn, 5, doid6, doid1, 860)
+        time.sleep(0.1)
+
+        # All of the children live on the parent's stateserver, so the query
+        # shouldn't be relayed to the children channel (checked by expectNone)
+        conn.send(Datagram.create_add_channel(PARENT_PREFIX|doid0))
 
         # Ask for objects from some of the zones...
         checkObjects([(doid1, 912), (doid2, 912), (doid3, 930)], [912, 930])
@@ -1775,6 +1791,7 @@ class TestStateServer(ProtocolTest):
         appendMeta(dg, parent=doid1, zone=930)
         conn.send(dg)
         checkObjects([(doid1, 912), (doid4, 930)], [912, 930])
+        conn.send(Datagram.create_remove_channel(PARENT_PREFIX|doid0))
 
         ### Cleanup ###
         for doid in (doid0, doid1, doid2, doid3, doid4, doid5, doid6):
@@ -0,0 +1,448 @@
+#!/usr/bin/env python2
+import unittest, time
+from common.unittests import ProtocolTest
+from common.astron import *
+from common.dcfile import *
+
+# The destination stateserver runs on the root MessageDirector...
+ROOT_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: stateserver
+      control: 100100
+""" % (USE_THREADING, test_dc)
+
+# ... while the source stateserver is in a second daemon, connected upstream to the first.
+LEAF_CONFIG = """\
+messagedirector:
+    connect: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: stateserver
+      control: 100101
+      migration_timeout: 1
+""" % (USE_THREADING, test_dc)
+
+class TestStateServerMigration(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.root = Daemon(ROOT_CONFIG)
+        cls.root.start()
+        cls.leaf = Daemon(LEAF_CONFIG)
+        cls.leaf.start()
+
+        cls.conn = ChannelConnection('127.0.0.1', 57123)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        if cls.leaf is not None:
+            cls.leaf.stop()
+        cls.root.stop()
+
+    def createObject(self, control, doid, value):
+        dg = Datagram.create([control], 5, STATESERVER_CREATE_OBJECT_WITH_REQUIRED)
+        dg.add_doid(doid)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(value) # setRequired1
+        self.conn.send(dg)
+        time.sleep(0.2)
+        self.conn.flush()
+
+    def addState(self, dg, migration, doid, value):
+        dg.add_uint32(migration)
+        dg.add_doid(doid)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(value) # setRequired1
+        dg.add_uint16(0) # Ram fields: 0
+        dg.add_channel(0) # AI
+        dg.add_uint8(0) # AI explicitly set
+        dg.add_channel(0) # Owner
+        dg.add_uint8(1) # Has children
+        dg.add_uint32(0) # Child count
+
+    def expectResumed(self, doid, value, context):
+        # The update held back during the migration is handled as soon as it fails...
+        dg = Datagram.create([5000<<ZONE_SIZE_BITS|1500], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(doid)
+        dg.add_uint16(setBR1)
+        dg.add_string('Staying put')
+        self.expect(self.conn, dg)
+
+        # ... and the object answers as usual afterwards.
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], doid, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(context)
+        dg.add_doid(doid)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(value) # setRequired1
+        dg.add_uint16(1) # Other fields: 1
+        dg.add_uint16(setBR1)
+        dg.add_string('Staying put')
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+    def expectDeleted(self, doid):
+        dg = Datagram.create([doid], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(doid)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5000<<ZONE_SIZE_BITS|1500], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(doid)
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+    def test_migrate_lost_target(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+        self.conn.add_channel(5000<<ZONE_SIZE_BITS|1500)
+        self.createObject(100101, 101000012, 4444)
+
+        # Migrate the object to a channel nobody is listening on, then update it.
+        dg = Datagram.create([101000012], 5, STATESERVER_OBJECT_MIGRATE)
+        dg.add_doid(101000012)
+        dg.add_channel(7)
+        dg.add_uint8(0) # Don't include children
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000012], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(101000012)
+        dg.add_uint16(setBR1)
+        dg.add_string('Staying put')
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        # Once the leaf's migration_timeout passes, the object carries on where it is.
+        time.sleep(1.0)
+        self.expectResumed(101000012, 4444, 1)
+
+        # If the target turns up after all, it is told to discard its copy.
+        self.conn.add_channel(101000012)
+        dg = Datagram.create([101000012], 7, STATESERVER_OBJECT_MIGRATE_READY)
+        dg.add_doid(101000012)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000012], 101000012, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000012)
+        dg.add_uint32(1) # Migration
+        self.expect(self.conn, dg)
+        self.expectDeleted(101000012)
+
+        self.conn.clear_channels()
+
+    def test_migrate_rejected(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+        self.conn.add_channel(6)
+        self.conn.add_channel(5000<<ZONE_SIZE_BITS|1500)
+
+        # A target which already has the object refuses to take it...
+        self.createObject(100100, 101000010, 1111)
+        dg = Datagram.create([100100], 6, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 1, 101000010, 2222)
+        self.conn.send(dg)
+
+        dg = Datagram.create([6], 100100, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000010)
+        dg.add_uint32(1) # Migration
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+        dg = Datagram.create([101000010], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(101000010)
+        self.conn.send(dg)
+        self.conn.flush()
+
+        # ... and a source which is refused stays where it is.
+        self.createObject(100101, 101000011, 3333)
+        dg = Datagram.create([101000011], 5, STATESERVER_OBJECT_MIGRATE)
+        dg.add_doid(101000011)
+        dg.add_channel(6)
+        dg.add_uint8(0) # Don't include children
+        self.conn.send(dg)
+
+        dg = Datagram.create([6], 100101, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 1, 101000011, 3333)
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000011], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(101000011)
+        dg.add_uint16(setBR1)
+        dg.add_string('Staying put')
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        dg = Datagram.create([100101], 6, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000011)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+        self.expectResumed(101000011, 3333, 2)
+        self.expectDeleted(101000011)
+
+        # A target which became ready after the source gave up discards its copy.
+        self.conn.add_channel(101000013)
+        dg = Datagram.create([100100], 6, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 1, 101000013, 5555)
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000013], 100100, STATESERVER_OBJECT_MIGRATE_READY)
+        dg.add_doid(101000013)
+        dg.add_uint32(1) # Migration
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000013], 101000013, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000013)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        # Since the copy is gone, the object can be migrated there again.
+        dg = Datagram.create([100100], 6, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 1, 101000013, 5555)
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000013], 100100, STATESERVER_OBJECT_MIGRATE_READY)
+        dg.add_doid(101000013)
+        dg.add_uint32(1) # Migration
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000013], 101000013, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000013)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        self.conn.clear_channels()
+
+    def test_migrate_stale_failure(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+        self.conn.add_channel(6)
+        self.conn.add_channel(5000<<ZONE_SIZE_BITS|1500)
+        self.conn.add_channel(101000014)
+        self.createObject(100101, 101000014, 6666)
+
+        # Fail a first migration...
+        dg = Datagram.create([101000014], 5, STATESERVER_OBJECT_MIGRATE)
+        dg.add_doid(101000014)
+        dg.add_channel(6)
+        dg.add_uint8(0) # Don't include children
+        self.conn.send(dg)
+
+        dg = Datagram.create([6], 100101, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 1, 101000014, 6666)
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([100101], 6, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000014)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        # ... then start a second one.
+        dg = Datagram.create([101000014], 5, STATESERVER_OBJECT_MIGRATE)
+        dg.add_doid(101000014)
+        dg.add_channel(6)
+        dg.add_uint8(0) # Don't include children
+        self.conn.send(dg)
+
+        dg = Datagram.create([6], 100101, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 2, 101000014, 6666)
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000014], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(101000014)
+        dg.add_uint16(setBR1)
+        dg.add_string('Staying put')
+        self.conn.send(dg)
+
+        # The first migration's failure and late ready don't affect the second...
+        dg = Datagram.create([100101], 6, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000014)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+        self.expectNone(self.conn)
+
+        dg = Datagram.create([101000014], 6, STATESERVER_OBJECT_MIGRATE_READY)
+        dg.add_doid(101000014)
+        dg.add_uint32(1) # Migration
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000014], 101000014, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000014)
+        dg.add_uint32(1) # Migration
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+        # ... which only its own failure ends.
+        self.conn.remove_channel(101000014)
+        dg = Datagram.create([100101], 6, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000014)
+        dg.add_uint32(2) # Migration
+        self.conn.send(dg)
+        self.expectResumed(101000014, 6666, 3)
+        self.expectDeleted(101000014)
+
+        # Likewise, a copy migrating in ignores the failure of an earlier migration.
+        self.conn.add_channel(101000015)
+        dg = Datagram.create([100100], 6, STATESERVER_OBJECT_MIGRATE_STATE)
+        self.addState(dg, 3, 101000015, 7777)
+        self.conn.send(dg)
+
+        dg = Datagram.create([101000015], 100100, STATESERVER_OBJECT_MIGRATE_READY)
+        dg.add_doid(101000015)
+        dg.add_uint32(3) # Migration
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000015], 101000015, STATESERVER_OBJECT_MIGRATE_FAILED)
+        dg.add_doid(101000015)
+        dg.add_uint32(2) # Migration
+        self.conn.send(dg)
+        dg = Datagram.create([101000015], 101000015, STATESERVER_OBJECT_MIGRATE_DONE)
+        dg.add_doid(101000015)
+        self.conn.send(dg)
+        self.conn.remove_channel(101000015)
+
+        dg = Datagram.create([101000015], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(4) # Context
+        dg.add_doid(101000015)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 101000015, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(4) # Context
+        dg.add_doid(101000015)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(7777) # setRequired1
+        dg.add_uint16(0) # Other fields: 0
+        self.expect(self.conn, dg)
+        self.expectDeleted(101000015)
+
+        self.conn.clear_channels()
+
+    def test_migrate_subtree(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+        self.conn.add_channel(5000<<ZONE_SIZE_BITS|1500)
+
+        # Create a parent and its child on the leaf's stateserver...
+        dg = Datagram.create([100101], 5, STATESERVER_CREATE_OBJECT_WITH_REQUIRED)
+        dg.add_doid(101000000)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(6789) # setRequired1
+        self.conn.send(dg)
+
+        dg = Datagram.create([100101], 5, STATESERVER_CREATE_OBJECT_WITH_REQUIRED)
+        dg.add_doid(101000001)
+        dg.add_doid(101000000)
+        dg.add_zone(10)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(1234) # setRequired1
+        self.conn.send(dg)
+        time.sleep(0.2)
+        self.conn.flush()
+
+        # ... move the whole subtree over to the root's stateserver ...
+        dg = Datagram.create([101000000], 5, STATESERVER_OBJECT_MIGRATE)
+        dg.add_doid(101000000)
+        dg.add_channel(100100)
+        dg.add_uint8(1) # Include children
+        self.conn.send(dg)
+
+        # ... and update the parent while it is in flight.
+        dg = Datagram.create([101000000], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(101000000)
+        dg.add_uint16(setBR1)
+        dg.add_string('Moving day')
+        self.conn.send(dg)
+
+        # The update should be broadcast exactly once, by whichever side handled it.
+        dg = Datagram.create([5000<<ZONE_SIZE_BITS|1500], 5, STATESERVER_OBJECT_SET_FIELD)
+        dg.add_doid(101000000)
+        dg.add_uint16(setBR1)
+        dg.add_string('Moving day')
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+        # Once the leaf goes away, the objects should still be served by the root.
+        self.leaf.stop()
+        self.__class__.leaf = None
+
+        dg = Datagram.create([101000000], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(1) # Context
+        dg.add_doid(101000000)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 101000000, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(1) # Context
+        dg.add_doid(101000000)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(6789) # setRequired1
+        dg.add_uint16(1) # Other fields: 1
+        dg.add_uint16(setBR1)
+        dg.add_string('Moving day')
+        self.expect(self.conn, dg)
+
+        dg = Datagram.create([101000001], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(2) # Context
+        dg.add_doid(101000001)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 101000001, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(2) # Context
+        dg.add_doid(101000001)
+        dg.add_doid(101000000)
+        dg.add_zone(10)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(1234) # setRequired1
+        dg.add_uint16(0) # Other fields: 0
+        self.expect(self.conn, dg)
+
+        # The parent should have brought along its knowledge of its children.
+        dg = Datagram.create([101000000], 5, STATESERVER_GET_ACTIVE_ZONES)
+        dg.add_uint32(3) # Context
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 101000000, STATESERVER_GET_ACTIVE_ZONES_RESP)
+        dg.add_uint32(3) # Context
+        dg.add_uint16(1) # Zone count
+        dg.add_zone(10)
+        self.expect(self.conn, dg)
+        self.expectNone(self.conn)
+
+        ### Cleanup ###
+        dg = Datagram.create([101000000], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(101000000)
+        self.conn.send(dg)
+        self.conn.clear_channels()
+
+if __name__ == '__main__':
+    unittest.main()
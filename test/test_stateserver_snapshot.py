@@ -0,0 +1,155 @@
+#!/usr/bin/env python2
+import unittest, os, shutil, struct, tempfile, time
+from common.unittests import ProtocolTest
+from common.astron import *
+from common.dcfile import *
+
+CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57123
+    threaded: %s
+
+general:
+    dc_files:
+        - %r
+
+roles:
+    - type: stateserver
+      control: 100100
+      snapshot:
+          file: %r
+"""
+
+class TestStateServerSnapshot(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        cls.tempdir = tempfile.mkdtemp(prefix = 'astron')
+        cls.snapshot = os.path.join(cls.tempdir, 'stateserver.snapshot')
+        cls.daemon = Daemon(CONFIG % (USE_THREADING, test_dc, cls.snapshot))
+        cls.daemon.start()
+        cls.conn = ChannelConnection('127.0.0.1', 57123)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.conn.close()
+        cls.daemon.stop()
+        shutil.rmtree(cls.tempdir)
+
+    @classmethod
+    def restart(cls):
+        # SIGTERM lets the stateserver write out its snapshot before exiting
+        cls.conn.close()
+        cls.daemon.daemon.terminate()
+        cls.daemon.daemon.wait()
+        cls.daemon.daemon = None
+        cls.daemon.stop()
+        cls.daemon.start()
+        cls.conn = ChannelConnection('127.0.0.1', 57123)
+
+    def test_save_on_request(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+
+        dg = Datagram.create([100100], 5, STATESERVER_CREATE_OBJECT_WITH_REQUIRED)
+        dg.add_doid(101000000)
+        dg.add_doid(0)
+        dg.add_zone(0)
+        dg.add_uint16(DistributedTestObject2)
+        self.conn.send(dg)
+
+        # Ask the stateserver to save a snapshot right now...
+        dg = Datagram.create([100100], 5, STATESERVER_SAVE_SNAPSHOT)
+        self.conn.send(dg)
+        time.sleep(0.5)
+
+        # ... which should contain our object.
+        with open(self.snapshot, 'rb') as f:
+            magic, version, _, count = struct.unpack('<4sIIQ', f.read(20))
+        self.assertEquals(magic, 'ASSN')
+        self.assertEquals(version, 1)
+        self.assertEquals(count, 1)
+
+        ### Cleanup ###
+        dg = Datagram.create([101000000], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(101000000)
+        self.conn.send(dg)
+        self.conn.clear_channels()
+
+    def test_restore_on_restart(self):
+        self.conn.flush()
+        self.conn.add_channel(5)
+
+        # Create an object with a RAM field, an AI and an owner...
+        dg = Datagram.create([100100], 5, STATESERVER_CREATE_OBJECT_WITH_REQUIRED_OTHER)
+        dg.add_doid(102000000)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(6789) # setRequired1
+        dg.add_uint16(1) # Other fields: 1
+        dg.add_uint16(setBR1)
+        dg.add_string('I survived a restart!')
+        self.conn.send(dg)
+
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_SET_AI)
+        dg.add_channel(1300)
+        self.conn.send(dg)
+
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_SET_OWNER)
+        dg.add_channel(1400)
+        self.conn.send(dg)
+        time.sleep(0.2)
+
+        # Terminate the daemon and bring it back up again.
+        self.restart()
+        self.conn.add_channel(5)
+
+        # The object should have been restored with all of its fields...
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_GET_ALL)
+        dg.add_uint32(0xF00D) # Context
+        dg.add_doid(102000000)
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 102000000, STATESERVER_OBJECT_GET_ALL_RESP)
+        dg.add_uint32(0xF00D) # Context
+        dg.add_doid(102000000)
+        dg.add_doid(5000)
+        dg.add_zone(1500)
+        dg.add_uint16(DistributedTestObject1)
+        dg.add_uint32(6789) # setRequired1
+        dg.add_uint16(1) # Other fields: 1
+        dg.add_uint16(setBR1)
+        dg.add_string('I survived a restart!')
+        self.expect(self.conn, dg)
+
+        # ... as well as its AI...
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_GET_AI)
+        dg.add_uint32(0xBEEF) # Context
+        self.conn.send(dg)
+
+        dg = Datagram.create([5], 102000000, STATESERVER_OBJECT_GET_AI_RESP)
+        dg.add_uint32(0xBEEF) # Context
+        dg.add_doid(102000000)
+        dg.add_channel(1300)
+        self.expect(self.conn, dg)
+
+        # ... and its owner.
+        self.conn.add_channel(1400)
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_SET_OWNER)
+        dg.add_channel(1500)
+        self.conn.send(dg)
+
+        dg = Datagram.create([1400], 5, STATESERVER_OBJECT_CHANGING_OWNER)
+        dg.add_doid(102000000)
+        dg.add_channel(1500) # New owner
+        dg.add_channel(1400) # Old owner
+        self.expect(self.conn, dg)
+
+        ### Cleanup ###
+        dg = Datagram.create([102000000], 5, STATESERVER_OBJECT_DELETE_RAM)
+        dg.add_doid(102000000)
+        self.conn.send(dg)
+        self.conn.clear_channels()
+
+if __name__ == '__main__':
+    unittest.main()